@@ -0,0 +1,135 @@
+#include "pch.h"
+#include "A2TextScreen.h"
+
+constexpr UINT16 A2TEXT_PAGE1 = 0x400;
+constexpr UINT16 A2TEXT_PAGE2 = 0x800;
+constexpr UINT32 A2TEXT_AUX_BANK = 0x10000;
+
+// Row n is at $400 + (n % 8) * $80 + (n / 8) * $28
+static constexpr std::array<UINT16, A2TEXT_ROWS> MakeRowOffsets()
+{
+	std::array<UINT16, A2TEXT_ROWS> a = {};
+	for (UINT8 row = 0; row < A2TEXT_ROWS; row++)
+		a[row] = static_cast<UINT16>(((row & 0x07) * 0x80) + ((row >> 3) * 0x28));
+	return a;
+}
+static constexpr std::array<UINT16, A2TEXT_ROWS> s_rowOffsets = MakeRowOffsets();
+
+// Closest ASCII to each MouseText glyph ($40-$5F in the alternate character set):
+// apples, pointer, hourglass, checkmarks, running man, arrows, bars, scrollbars, folder...
+static const char s_mouseTextAscii[] = "@@^Xvv**<.v^-<#<>v^-L>##[]|*=+||";
+static_assert(sizeof(s_mouseTextAscii) == 33, "there are 32 MouseText glyphs");
+
+A2TextScreen::A2TextScreen()
+{
+	m_forceUpdate = true;
+	for (auto& r : m_raw)
+		r.fill(0);
+	for (auto& a : m_attributes)
+		a.fill(A2TextAttribute::Normal);
+	BuildCharset();
+}
+
+UINT16 A2TextScreen::GetRowAddress(UINT8 row, bool page2)
+{
+	return (page2 ? A2TEXT_PAGE2 : A2TEXT_PAGE1) + s_rowOffsets[row];
+}
+
+void A2TextScreen::SetMode(const A2TextScreenMode& mode)
+{
+	m_mode = mode;
+	BuildCharset();
+	m_forceUpdate = true;
+}
+
+// The IIe (enhanced) video ROM:
+//	$00-$3F	inverse		@A-Z[\]^_ !"#...?
+//	$40-$7F	flash		same characters. With the alternate set, $40-$5F is MouseText
+//						and $60-$7F is inverse lowercase
+//	$80-$FF	normal		@A-Z... !"#...?  @A-Z...  then lowercase from $E0
+void A2TextScreen::BuildCharset()
+{
+	for (UINT16 b = 0; b < 256; b++)
+	{
+		UINT8 c = b & 0x3F;
+		char ascii = static_cast<char>(c < 0x20 ? c + 0x40 : c);
+		A2TextAttribute attr = A2TextAttribute::Normal;
+		if (b < 0x40)
+			attr = A2TextAttribute::Inverse;
+		else if (b < 0x80)
+		{
+			if (!m_mode.altCharset)
+				attr = A2TextAttribute::Flash;
+			else if (b < 0x60)
+			{
+				attr = A2TextAttribute::MouseText;
+				ascii = s_mouseTextAscii[b - 0x40];
+			}
+			else
+			{
+				attr = A2TextAttribute::Inverse;
+				ascii = static_cast<char>((b & 0x1F) + 0x60);
+			}
+		}
+		else if (b >= 0xE0)
+			ascii = static_cast<char>((b & 0x1F) + 0x60);
+		if (ascii == 0x7F)	// DEL is a checkerboard
+			ascii = '#';
+		m_charset[b] = ascii;
+		m_charsetAttributes[b] = attr;
+	}
+}
+
+UINT32 A2TextScreen::Update(const UINT8* mem, int memsize)
+{
+	UINT32 changed = 0;
+	UINT8 columns = GetColumns();
+	UINT16 pageBase = (m_mode.page2 ? A2TEXT_PAGE2 : A2TEXT_PAGE1);
+	// The whole page has to be there, in both banks for 80 columns
+	INT64 needed = (m_mode.col80 ? A2TEXT_AUX_BANK : 0) + pageBase + 0x400;
+	if ((mem == nullptr) || (memsize < needed))
+		return changed;
+
+	std::array<UINT8, A2TEXT_MAX_COLUMNS> raw;
+	for (UINT8 row = 0; row < A2TEXT_ROWS; row++)
+	{
+		const UINT8* pMain = mem + pageBase + s_rowOffsets[row];
+		const UINT8* pRow = pMain;
+		if (m_mode.col80)
+		{
+			const UINT8* pAux = pMain + A2TEXT_AUX_BANK;
+			for (UINT8 i = 0; i < 40; i++)
+			{
+				raw[i * 2] = pAux[i];
+				raw[i * 2 + 1] = pMain[i];
+			}
+			pRow = raw.data();
+		}
+		if (!m_forceUpdate && (memcmp(pRow, m_raw[row].data(), columns) == 0))
+			continue;
+
+		memcpy(m_raw[row].data(), pRow, columns);
+		std::string& text = m_text[row];
+		text.resize(columns);
+		for (UINT8 i = 0; i < columns; i++)
+		{
+			text[i] = m_charset[pRow[i]];
+			m_attributes[row][i] = m_charsetAttributes[pRow[i]];
+		}
+		changed |= (1u << row);
+	}
+	m_forceUpdate = false;
+	return changed;
+}
+
+std::string A2TextScreen::GetText() const
+{
+	std::string s;
+	s.reserve(A2TEXT_ROWS * (A2TEXT_MAX_COLUMNS + 1));
+	for (UINT8 row = 0; row < A2TEXT_ROWS; row++)
+	{
+		s.append(m_text[row]);
+		s.append(1, '\n');
+	}
+	return s;
+}
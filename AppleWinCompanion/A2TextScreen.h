@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <array>
+
+/// <summary>
+/// A2TextScreen decodes the Apple 2 text screen straight from its memory,
+/// so the game text is available even when AppleWin doesn't send frames (tracking only).
+///
+/// The 24 rows of text page 1 ($400) or page 2 ($800) are interleaved in memory. Their
+/// addresses come from a precomputed table. In 80 columns, the even columns are in the
+/// auxiliary memory and the odd columns in main memory, at the same addresses.
+/// Each screen byte is converted to ASCII through a 256 entry table that also gives its
+/// attribute: normal, inverse, flash, or MouseText with the alternate character set.
+///
+/// Update() only decodes the rows whose bytes changed since the previous call,
+/// and returns a mask of those rows so consumers can process the changed lines only.
+/// </summary>
+
+constexpr UINT8 A2TEXT_ROWS = 24;
+constexpr UINT8 A2TEXT_MAX_COLUMNS = 80;
+constexpr UINT32 A2TEXT_ALL_ROWS = (1u << A2TEXT_ROWS) - 1;
+
+enum class A2TextAttribute : UINT8
+{
+	Normal,
+	Inverse,
+	Flash,
+	MouseText,
+	Count
+};
+
+struct A2TextScreenMode
+{
+	bool col80 = false;
+	bool page2 = false;
+	bool altCharset = false;	// IIe alternate character set: MouseText and inverse lowercase instead of flash
+};
+
+class A2TextScreen
+{
+public:
+	A2TextScreen();
+
+	// Changing the mode forces all rows to be decoded again
+	void SetMode(const A2TextScreenMode& mode);
+	const A2TextScreenMode& GetMode() const { return m_mode; }
+	UINT8 GetColumns() const { return (m_mode.col80 ? 80 : 40); }
+
+	// Returns the mask of the rows (bit n is row n) that changed since the last Update().
+	// mem is the AppleWin memory with the auxiliary bank at 0x10000.
+	UINT32 Update(const UINT8* mem, int memsize);
+
+	const std::string& GetRow(UINT8 row) const { return m_text[row]; }
+	const A2TextAttribute* GetRowAttributes(UINT8 row) const { return m_attributes[row].data(); }
+	// All the rows, separated by '\n'
+	std::string GetText() const;
+
+	// Memory address of the first byte of a text row, in the main or aux bank
+	static UINT16 GetRowAddress(UINT8 row, bool page2);
+
+private:
+	void BuildCharset();
+
+	A2TextScreenMode m_mode;
+	bool m_forceUpdate;
+	std::array<char, 256> m_charset;
+	std::array<A2TextAttribute, 256> m_charsetAttributes;
+	std::array<std::array<UINT8, A2TEXT_MAX_COLUMNS>, A2TEXT_ROWS> m_raw;
+	std::array<std::array<A2TextAttribute, A2TEXT_MAX_COLUMNS>, A2TEXT_ROWS> m_attributes;
+	std::array<std::string, A2TEXT_ROWS> m_text;
+};
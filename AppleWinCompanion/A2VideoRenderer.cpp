@@ -0,0 +1,284 @@
+#include "pch.h"
+#include "A2VideoRenderer.h"
+#include <emmintrin.h>
+
+constexpr UINT32 A2VIDEO_AUX_BANK = 0x10000;
+constexpr UINT16 A2VIDEO_HGR_PAGE1 = 0x2000;
+constexpr UINT16 A2VIDEO_HGR_PAGE2 = 0x4000;
+constexpr UINT16 A2VIDEO_HGR_PAGE_SIZE = 0x2000;
+constexpr UINT16 A2VIDEO_TEXT_PAGE_SIZE = 0x400;
+constexpr UINT32 A2VIDEO_SCANLINES = 192;
+constexpr UINT32 A2VIDEO_BLACK = 0xFF000000;
+
+// The 16 LoRes/DHGR colors, 0xAARRGGBB
+static const UINT32 s_palette[16] = {
+	0xFF000000,	// black
+	0xFFE31E60,	// magenta
+	0xFF604EBD,	// dark blue
+	0xFFFF44FD,	// purple
+	0xFF00A360,	// dark green
+	0xFF9C9C9C,	// grey
+	0xFF14CFFD,	// medium blue
+	0xFFD0C3FF,	// light blue
+	0xFF607203,	// brown
+	0xFFFF6A3C,	// orange
+	0xFF9C9C9C,	// grey
+	0xFFFFA0D0,	// pink
+	0xFF14F53C,	// light green
+	0xFFD0DD8D,	// yellow
+	0xFF72FFD0,	// aqua
+	0xFFFFFFFF,	// white
+};
+constexpr UINT32 A2VIDEO_WHITE = 0xFFFFFFFF;
+constexpr UINT32 A2VIDEO_VIOLET = 0xFFFF44FD;
+constexpr UINT32 A2VIDEO_GREEN = 0xFF14F53C;
+constexpr UINT32 A2VIDEO_BLUE = 0xFF14CFFD;
+constexpr UINT32 A2VIDEO_ORANGE = 0xFFFF6A3C;
+
+// HGR scanline y is at $2000 + (y % 8) * $400 + ((y / 8) % 8) * $80 + (y / 64) * $28
+static constexpr std::array<UINT16, A2VIDEO_SCANLINES> MakeHGRLineOffsets()
+{
+	std::array<UINT16, A2VIDEO_SCANLINES> a = {};
+	for (UINT32 y = 0; y < A2VIDEO_SCANLINES; y++)
+		a[y] = static_cast<UINT16>(((y & 0x07) * 0x400) + (((y >> 3) & 0x07) * 0x80) + ((y >> 6) * 0x28));
+	return a;
+}
+static constexpr std::array<UINT16, A2VIDEO_SCANLINES> s_hgrLineOffsets = MakeHGRLineOffsets();
+
+// Byte -> its 7 pixels in display order (bit 0 first). 8 bytes so they can be copied as one UINT64.
+static std::array<UINT64, 256> s_bytePixels;
+// HGR pixel color, indexed by (left << 4) | (pixel << 3) | (right << 2) | (odd column << 1) | high bit
+static std::array<UINT32, 32> s_hgrColors;
+
+static void BuildTables()
+{
+	static bool built = false;
+	if (built)
+		return;
+	for (UINT32 b = 0; b < 256; b++)
+	{
+		UINT64 px = 0;
+		for (UINT32 i = 0; i < 7; i++)
+			px |= static_cast<UINT64>((b >> i) & 1) << (i * 8);
+		s_bytePixels[b] = px;
+	}
+	for (UINT32 idx = 0; idx < 32; idx++)
+	{
+		bool left = (idx >> 4) & 1;
+		bool on = (idx >> 3) & 1;
+		bool right = (idx >> 2) & 1;
+		bool odd = (idx >> 1) & 1;
+		bool hi = idx & 1;
+		UINT32 c = A2VIDEO_BLACK;
+		if (on && (left || right))
+			c = A2VIDEO_WHITE;
+		else if (on || (left && right))
+		{
+			// A lone black pixel between two pixels takes their color, which is of the other parity
+			bool colorOdd = (on ? odd : !odd);
+			if (hi)
+				c = (colorOdd ? A2VIDEO_ORANGE : A2VIDEO_BLUE);
+			else
+				c = (colorOdd ? A2VIDEO_GREEN : A2VIDEO_VIOLET);
+		}
+		s_hgrColors[idx] = c;
+	}
+	built = true;
+}
+
+// Writes n copies of the color, n being a multiple of 2
+static inline void FillPixels(UINT32* out, UINT32 color, UINT32 n)
+{
+	__m128i c = _mm_set1_epi32(static_cast<int>(color));
+	UINT32 i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), c);
+	for (; i < n; i++)
+		out[i] = color;
+}
+
+A2VideoRenderer::A2VideoRenderer()
+{
+	BuildTables();
+	m_forceRender = true;
+	m_frame.assign(A2VIDEO_WIDTH * A2VIDEO_HEIGHT, A2VIDEO_BLACK);
+}
+
+void A2VideoRenderer::SetMode(const A2VideoMode& mode)
+{
+	if (mode == m_mode)
+		return;
+	m_mode = mode;
+	A2TextScreenMode tm;
+	tm.col80 = (mode.type == A2VideoModeType::Text80) || (mode.type == A2VideoModeType::DLoRes) || (mode.type == A2VideoModeType::DHGR);
+	tm.page2 = mode.page2;
+	tm.altCharset = mode.altCharset;
+	m_textScreen.SetMode(tm);
+	m_forceRender = true;
+}
+
+UINT32 A2VideoRenderer::GetTextRowsMask() const
+{
+	switch (m_mode.type)
+	{
+	case A2VideoModeType::Text:
+	case A2VideoModeType::Text80:
+		return A2TEXT_ALL_ROWS;
+	default:
+		return (m_mode.mixed ? A2VIDEO_MIXED_TEXT_ROWS : 0);
+	}
+}
+
+bool A2VideoRenderer::Render(const UINT8* mem, int memsize)
+{
+	bool isHires = (m_mode.type == A2VideoModeType::HGR) || (m_mode.type == A2VideoModeType::DHGR);
+	bool hasAux = (m_mode.type == A2VideoModeType::Text80) || (m_mode.type == A2VideoModeType::DLoRes) || (m_mode.type == A2VideoModeType::DHGR);
+	UINT32 pageBase, pageSize;
+	if (isHires)
+	{
+		pageBase = (m_mode.page2 ? A2VIDEO_HGR_PAGE2 : A2VIDEO_HGR_PAGE1);
+		pageSize = A2VIDEO_HGR_PAGE_SIZE;
+	}
+	else
+	{
+		pageBase = A2TextScreen::GetRowAddress(0, m_mode.page2);
+		pageSize = A2VIDEO_TEXT_PAGE_SIZE;
+	}
+	if ((mem == nullptr) || (static_cast<INT64>(memsize) < (hasAux ? A2VIDEO_AUX_BANK : 0) + pageBase + pageSize))
+		return false;
+
+	// Mixed mode text is always on the text page
+	UINT32 textRows = GetTextRowsMask();
+	bool textChanged = (textRows != 0) && (m_textScreen.Update(mem, memsize) & textRows);
+
+	// Nothing to do if the video page didn't change
+	size_t checkSize = pageSize * (hasAux ? 2 : 1);
+	bool changed = m_forceRender || (m_previousVideoMemory.size() != checkSize)
+		|| (memcmp(m_previousVideoMemory.data(), mem + pageBase, pageSize) != 0)
+		|| (hasAux && (memcmp(m_previousVideoMemory.data() + pageSize, mem + A2VIDEO_AUX_BANK + pageBase, pageSize) != 0));
+	if (!changed)
+		return textChanged;
+	m_previousVideoMemory.resize(checkSize);
+	memcpy(m_previousVideoMemory.data(), mem + pageBase, pageSize);
+	if (hasAux)
+		memcpy(m_previousVideoMemory.data() + pageSize, mem + A2VIDEO_AUX_BANK + pageBase, pageSize);
+	m_forceRender = false;
+
+	UINT32 graphicsLines = (m_mode.mixed ? 160 : A2VIDEO_SCANLINES);
+	switch (m_mode.type)
+	{
+	case A2VideoModeType::HGR:
+		for (UINT32 y = 0; y < graphicsLines; y++)
+		{
+			RenderHGRLine(mem + pageBase + s_hgrLineOffsets[y], ScreenLine(y));
+			DoubleLine(y);
+		}
+		break;
+	case A2VideoModeType::DHGR:
+		for (UINT32 y = 0; y < graphicsLines; y++)
+		{
+			const UINT8* line = mem + pageBase + s_hgrLineOffsets[y];
+			RenderDHGRLine(line, line + A2VIDEO_AUX_BANK, ScreenLine(y));
+			DoubleLine(y);
+		}
+		break;
+	case A2VideoModeType::LoRes:
+	case A2VideoModeType::DLoRes:
+		for (UINT8 row = 0; row < (graphicsLines / 8); row++)
+		{
+			const UINT8* rowMain = mem + A2TextScreen::GetRowAddress(row, m_mode.page2);
+			RenderLoResRow(rowMain, (hasAux ? rowMain + A2VIDEO_AUX_BANK : nullptr), row * 8);
+		}
+		break;
+	default:
+		graphicsLines = 0;
+		break;
+	}
+	// The text rows are drawn by the caller over a black background
+	ClearScreenLines(graphicsLines, A2VIDEO_SCANLINES);
+	return true;
+}
+
+void A2VideoRenderer::RenderHGRLine(const UINT8* line, UINT32* out)
+{
+	// 280 pixels with a black pixel on each side, and the high bit of each pixel's byte
+	alignas(16) UINT8 px[280 + 2 + 8];
+	alignas(16) UINT8 hi[280];
+	px[0] = 0;
+	for (UINT32 col = 0; col < 40; col++)
+	{
+		UINT8 b = line[col];
+		memcpy(px + 1 + col * 7, &s_bytePixels[b], sizeof(UINT64));
+		memset(hi + col * 7, b >> 7, 7);
+	}
+	px[281] = 0;
+
+	for (UINT32 x = 0; x < 280; x += 2)
+	{
+		UINT32 c0 = s_hgrColors[(px[x] << 4) | (px[x + 1] << 3) | (px[x + 2] << 2) | hi[x]];
+		UINT32 c1 = s_hgrColors[(px[x + 1] << 4) | (px[x + 2] << 3) | (px[x + 3] << 2) | 2 | hi[x + 1]];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 2),
+			_mm_set_epi32(static_cast<int>(c1), static_cast<int>(c1), static_cast<int>(c0), static_cast<int>(c0)));
+	}
+}
+
+void A2VideoRenderer::RenderDHGRLine(const UINT8* lineMain, const UINT8* lineAux, UINT32* out)
+{
+	// 560 bits, aux byte then main byte for each column
+	alignas(16) UINT8 px[560 + 8];
+	for (UINT32 col = 0; col < 40; col++)
+	{
+		memcpy(px + col * 14, &s_bytePixels[lineAux[col]], sizeof(UINT64));
+		memcpy(px + col * 14 + 7, &s_bytePixels[lineMain[col]], sizeof(UINT64));
+	}
+	// Every 4 pixels is one of the 16 colors, the first pixel being the lowest bit
+	for (UINT32 x = 0; x < 560; x += 4)
+	{
+		UINT32 c = s_palette[px[x] | (px[x + 1] << 1) | (px[x + 2] << 2) | (px[x + 3] << 3)];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_set1_epi32(static_cast<int>(c)));
+	}
+}
+
+// A LoRes row is 2 blocks high: the low nibble is the top block and the high nibble the bottom one.
+// Each block is 4 scanlines high and 7 pixels wide (14 in LoRes, 7 in DLoRes with aux first).
+void A2VideoRenderer::RenderLoResRow(const UINT8* rowMain, const UINT8* rowAux, UINT32 firstLine)
+{
+	for (UINT32 half = 0; half < 2; half++)
+	{
+		UINT32 y = firstLine + half * 4;
+		UINT32* out = ScreenLine(y);
+		UINT32 shift = half * 4;
+		for (UINT32 col = 0; col < 40; col++)
+		{
+			UINT8 c = (rowMain[col] >> shift) & 0x0F;
+			if (rowAux == nullptr)
+			{
+				FillPixels(out + col * 14, s_palette[c], 14);
+				continue;
+			}
+			// DLoRes aux colors are shifted by one bit
+			UINT8 ca = (rowAux[col] >> shift) & 0x0F;
+			ca = ((ca << 1) | (ca >> 3)) & 0x0F;
+			FillPixels(out + col * 14, s_palette[ca], 7);
+			FillPixels(out + col * 14 + 7, s_palette[c], 7);
+		}
+		// Copy that line to the other 7 lines of the block
+		for (UINT32 i = 1; i < 8; i++)
+			memcpy(out + (i * A2VIDEO_WIDTH), out, A2VIDEO_SCREEN_WIDTH * sizeof(UINT32));
+	}
+}
+
+void A2VideoRenderer::DoubleLine(UINT32 scanline)
+{
+	UINT32* out = ScreenLine(scanline);
+	memcpy(out + A2VIDEO_WIDTH, out, A2VIDEO_SCREEN_WIDTH * sizeof(UINT32));
+}
+
+void A2VideoRenderer::ClearScreenLines(UINT32 firstScanline, UINT32 lastScanline)
+{
+	for (UINT32 y = firstScanline; y < lastScanline; y++)
+	{
+		FillPixels(ScreenLine(y), A2VIDEO_BLACK, A2VIDEO_SCREEN_WIDTH);
+		DoubleLine(y);
+	}
+}
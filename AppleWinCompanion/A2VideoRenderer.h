@@ -0,0 +1,91 @@
+#pragma once
+#include <vector>
+#include <array>
+#include "A2TextScreen.h"
+
+/// <summary>
+/// A2VideoRenderer builds the Apple 2 video frame on the CPU, straight from its memory.
+/// It is used when AppleWin runs with GameLink in tracking only mode (FLAG_NO_FRAME): the 8K-16K
+/// of video memory we already have mapped is decoded instead of receiving a full RGBA frame.
+///
+/// The frame has the same size and borders as the AppleWin frame (600x420 with a 560x384 screen),
+/// top-down, in 0xAARRGGBB. Each Apple 2 scanline is 2 lines, each HGR pixel 2 pixels.
+///		- HGR uses the NTSC artifact colors, with white for adjacent pixels and color fringing
+///		  filling single black pixels between colored ones. Pixels are looked up in a 32 entry
+///		  table indexed by the pixel, its neighbors, its column parity and its byte's high bit.
+///		- DHGR reads the aux and main bytes interleaved, and maps every 4 bits to one of the 16 colors.
+///		- LoRes and DLoRes draw the 16 color blocks. DLoRes aux colors are rotated.
+///		- Text is not rasterized here (there's no character ROM in memory). The text rows are decoded
+///		  by an A2TextScreen and the caller draws them with the Apple 2 font.
+/// Bytes are expanded to pixels through lookup tables, and pixel runs are written with SSE2.
+/// The video mode soft switches are not in memory, so the mode comes from the profile.
+/// </summary>
+
+constexpr UINT32 A2VIDEO_WIDTH = 600;
+constexpr UINT32 A2VIDEO_HEIGHT = 420;
+constexpr UINT32 A2VIDEO_BORDER_X = 20;
+constexpr UINT32 A2VIDEO_BORDER_Y = 18;
+constexpr UINT32 A2VIDEO_SCREEN_WIDTH = 560;
+constexpr UINT32 A2VIDEO_SCREEN_HEIGHT = 384;
+constexpr UINT32 A2VIDEO_TEXT_ROW_HEIGHT = 16;
+constexpr UINT32 A2VIDEO_MIXED_TEXT_ROWS = 0x00F00000;	// rows 20-23
+
+enum class A2VideoModeType : UINT8
+{
+	Text,
+	Text80,
+	LoRes,
+	DLoRes,
+	HGR,
+	DHGR,
+	Count
+};
+
+struct A2VideoMode
+{
+	A2VideoModeType type = A2VideoModeType::HGR;
+	bool page2 = false;
+	bool mixed = false;			// 4 lines of text at the bottom of graphics modes
+	bool altCharset = false;
+	bool operator==(const A2VideoMode& o) const
+	{
+		return (type == o.type) && (page2 == o.page2) && (mixed == o.mixed) && (altCharset == o.altCharset);
+	}
+	bool operator!=(const A2VideoMode& o) const { return !(*this == o); }
+};
+
+class A2VideoRenderer
+{
+public:
+	A2VideoRenderer();
+
+	void SetMode(const A2VideoMode& mode);
+	const A2VideoMode& GetMode() const { return m_mode; }
+	// Forces the next Render() to redraw even if the video memory didn't change
+	void Invalidate() { m_forceRender = true; }
+
+	// Renders the frame if the video memory changed since the last call. Returns true if it did.
+	// mem is the AppleWin memory with the auxiliary bank at 0x10000.
+	bool Render(const UINT8* mem, int memsize);
+
+	UINT32* GetFrameBuffer() { return m_frame.data(); }
+	UINT32 GetFrameBufferLength() const { return static_cast<UINT32>(m_frame.size() * sizeof(UINT32)); }
+
+	// Text rows (bit n is row n) that the caller must draw over the frame
+	UINT32 GetTextRowsMask() const;
+	const A2TextScreen& GetTextScreen() const { return m_textScreen; }
+
+private:
+	void RenderHGRLine(const UINT8* line, UINT32* out);
+	void RenderDHGRLine(const UINT8* lineMain, const UINT8* lineAux, UINT32* out);
+	void RenderLoResRow(const UINT8* rowMain, const UINT8* rowAux, UINT32 firstLine);
+	UINT32* ScreenLine(UINT32 scanline) { return m_frame.data() + ((A2VIDEO_BORDER_Y + scanline * 2) * A2VIDEO_WIDTH) + A2VIDEO_BORDER_X; }
+	void DoubleLine(UINT32 scanline);
+	void ClearScreenLines(UINT32 firstScanline, UINT32 lastScanline);
+
+	A2VideoMode m_mode;
+	bool m_forceRender;
+	std::vector<UINT32> m_frame;
+	std::vector<UINT8> m_previousVideoMemory;	// main then aux video page, to detect changes
+	A2TextScreen m_textScreen;
+};
@@ -0,0 +1,176 @@
+#include "pch.h"
+#include "AWSaveState.h"
+#include <fstream>
+#include <emmintrin.h>
+
+constexpr size_t AWSAVESTATE_CHUNK_SIZE = 256 * 1024;
+static const char s_keyMain[] = "Main Memory:";
+static const char s_keyAux[] = "Auxiliary Memory Bank00:";
+
+// Converts 16 hex digits to their value (0-15) and checks them.
+// Digits are '0'-'9', or 'a'-'f' once lowercased by setting bit 5.
+static inline bool HexNibbles(__m128i c, __m128i& nibbles)
+{
+	const __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	const __m128i isDigit = _mm_andnot_si128(
+		_mm_or_si128(_mm_cmplt_epi8(c, _mm_set1_epi8('0')), _mm_cmpgt_epi8(c, _mm_set1_epi8('9'))),
+		_mm_set1_epi8(-1));
+	const __m128i isLetter = _mm_andnot_si128(
+		_mm_or_si128(_mm_cmplt_epi8(lower, _mm_set1_epi8('a')), _mm_cmpgt_epi8(lower, _mm_set1_epi8('f'))),
+		_mm_set1_epi8(-1));
+	if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF)
+		return false;
+	const __m128i digits = _mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0')));
+	const __m128i letters = _mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)));
+	nibbles = _mm_or_si128(digits, letters);
+	return true;
+}
+
+static inline int HexNibble(char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	c |= 0x20;
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	return -1;
+}
+
+bool AWSaveState::DecodeHex(const char* src, size_t count, UINT8* dst)
+{
+	size_t i = 0;
+	// 32 digits make 16 bytes. In each 16-bit lane the high nibble is in the low byte.
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i n0, n1;
+		if (!HexNibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2)), n0)
+			|| !HexNibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2 + 16)), n1))
+			return false;
+		const __m128i lowByte = _mm_set1_epi16(0x00FF);
+		n0 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n0, lowByte), 4), _mm_srli_epi16(n0, 8));
+		n1 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n1, lowByte), 4), _mm_srli_epi16(n1, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(n0, n1));
+	}
+	for (; i < count; i++)
+	{
+		int hi = HexNibble(src[i * 2]);
+		int lo = HexNibble(src[i * 2 + 1]);
+		if ((hi < 0) || (lo < 0))
+			return false;
+		dst[i] = static_cast<UINT8>((hi << 4) | lo);
+	}
+	return true;
+}
+
+bool AWSaveState::IsSaveStateFile(const std::filesystem::path& path)
+{
+	std::string ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+	return (ext == ".yaml");
+}
+
+// Parses one "addr: hexbytes" line of a memory section into its bank
+static bool DecodeMemoryLine(const char* p, const char* end, UINT8* bank)
+{
+	UINT32 addr = 0;
+	const char* start = p;
+	int nibble;
+	while ((p < end) && ((nibble = HexNibble(*p)) >= 0))
+	{
+		addr = (addr << 4) | static_cast<UINT32>(nibble);
+		p++;
+	}
+	if ((p == start) || (p - start > 5) || (p + 1 >= end) || (p[0] != ':') || (p[1] != ' '))
+		return false;
+	p += 2;
+	size_t digits = static_cast<size_t>(end - p);
+	if (digits & 1)
+		return false;
+	if (addr + digits / 2 > AWSAVESTATE_BANK_SIZE)
+		return false;
+	return AWSaveState::DecodeHex(p, digits / 2, bank + addr);
+}
+
+bool AWSaveState::LoadMemory(const std::filesystem::path& path, std::vector<UINT8>& mem, std::string& error)
+{
+	std::ifstream f(path, std::ios::binary);
+	if (!f)
+	{
+		error = "can't open the file";
+		return false;
+	}
+	mem.assign(AWSAVESTATE_MEMORY_SIZE, 0);
+
+	UINT8* bank = nullptr;			// bank of the memory section we're in, if any
+	size_t sectionIndent = 0;
+	bool hasMain = false;
+	UINT32 lineNumber = 0;
+	std::vector<char> chunk(AWSAVESTATE_CHUNK_SIZE);
+	std::string carry;				// line split across 2 chunks
+
+	auto processLine = [&](const char* p, const char* end) -> bool {
+		lineNumber++;
+		while ((end > p) && ((end[-1] == '\r') || (end[-1] == ' ')))
+			end--;
+		const char* text = p;
+		while ((text < end) && (*text == ' '))
+			text++;
+		if (text == end)
+			return true;
+		size_t indent = static_cast<size_t>(text - p);
+		size_t len = static_cast<size_t>(end - text);
+		if (bank != nullptr)
+		{
+			if (indent > sectionIndent)
+				return DecodeMemoryLine(text, end, bank);
+			bank = nullptr;		// the next key closes the section
+		}
+		if ((len == sizeof(s_keyMain) - 1) && (memcmp(text, s_keyMain, len) == 0))
+		{
+			bank = mem.data();
+			hasMain = true;
+		}
+		else if ((len == sizeof(s_keyAux) - 1) && (memcmp(text, s_keyAux, len) == 0))
+			bank = mem.data() + AWSAVESTATE_BANK_SIZE;
+		sectionIndent = indent;
+		return true;
+	};
+
+	while (f)
+	{
+		f.read(chunk.data(), chunk.size());
+		const char* p = chunk.data();
+		const char* end = p + f.gcount();
+		const char* eol;
+		while ((eol = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)))) != nullptr)
+		{
+			bool ok;
+			if (carry.empty())
+				ok = processLine(p, eol);
+			else
+			{
+				carry.append(p, eol);
+				ok = processLine(carry.data(), carry.data() + carry.size());
+				carry.clear();
+			}
+			if (!ok)
+			{
+				error = "invalid memory line " + std::to_string(lineNumber);
+				return false;
+			}
+			p = eol + 1;
+		}
+		carry.append(p, end);
+	}
+	if (!carry.empty() && !processLine(carry.data(), carry.data() + carry.size()))
+	{
+		error = "invalid memory line " + std::to_string(lineNumber);
+		return false;
+	}
+	if (!hasMain)
+	{
+		error = "no main memory in the save state";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <filesystem>
+
+/// <summary>
+/// AWSaveState extracts the Apple 2 memory from an AppleWin save state (.aws.yaml),
+/// into the same layout as the GameLink mapping: main memory, then the aux bank at 0x10000.
+/// The result can be given to the profile evaluation instead of the live memory.
+///
+/// AppleWin writes each memory bank as lines of "addr: hexbytes" under the "Main Memory"
+/// and "Auxiliary Memory Bank00" keys. The file is streamed in chunks and scanned line
+/// by line, only looking at those two sections: no YAML document is built.
+/// The hex is decoded 16 bytes at a time with SSE2.
+/// </summary>
+
+constexpr UINT32 AWSAVESTATE_BANK_SIZE = 0x10000;
+constexpr UINT32 AWSAVESTATE_MEMORY_SIZE = 2 * AWSAVESTATE_BANK_SIZE;
+
+namespace AWSaveState
+{
+	// Fills mem with the main and aux banks. Missing aux memory (II+, no 80 col card) is left zeroed.
+	// Returns false if the file can't be read, has no main memory, or has invalid memory lines.
+	bool LoadMemory(const std::filesystem::path& path, std::vector<UINT8>& mem, std::string& error);
+
+	// Decodes 2 * count hex digits (upper or lower case) into count bytes. Returns false on a non hex digit.
+	bool DecodeHex(const char* src, size_t count, UINT8* dst);
+
+	// Save states are recognized by their extension (.aws.yaml, or any .yaml)
+	bool IsSaveStateFile(const std::filesystem::path& path);
+}
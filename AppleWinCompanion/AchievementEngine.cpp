@@ -0,0 +1,547 @@
+#include "pch.h"
+#include "AchievementEngine.h"
+#include "Tracer.h"
+#include <fstream>
+#include <map>
+#include <ctime>
+
+using namespace std;
+
+// Operands are kind << 30 | index until the end of the compilation
+enum : UINT32
+{
+	OPERAND_CURRENT = 0,
+	OPERAND_DELTA = 1,
+	OPERAND_PRIOR = 2,
+	OPERAND_CONSTANT = 3,
+	OPERAND_KIND_SHIFT = 30,
+	OPERAND_INDEX_MASK = (1u << OPERAND_KIND_SHIFT) - 1,
+};
+
+static const map<char, AchievementSize> s_sizes = {
+	{ 'M', AchievementSize::Bit0 }, { 'N', AchievementSize::Bit1 }, { 'O', AchievementSize::Bit2 },
+	{ 'P', AchievementSize::Bit3 }, { 'Q', AchievementSize::Bit4 }, { 'R', AchievementSize::Bit5 },
+	{ 'S', AchievementSize::Bit6 }, { 'T', AchievementSize::Bit7 },
+	{ 'L', AchievementSize::Low4 }, { 'U', AchievementSize::High4 },
+	{ 'H', AchievementSize::Bits8 }, { ' ', AchievementSize::Bits16 },
+	{ 'W', AchievementSize::Bits24 }, { 'X', AchievementSize::Bits32 },
+};
+
+// Comparison operators, longest first, and the comparison results that make them true
+static const pair<const char*, UINT8> s_operators[] = {
+	{ "==", 2 }, { "!=", 5 }, { "<=", 3 }, { ">=", 6 }, { "=", 2 }, { "<", 1 }, { ">", 4 },
+};
+
+static UINT32 ReadMemRef(const AchievementMemRef& ref, const UINT8* mem, int memsize)
+{
+	UINT32 length = 1;
+	if (ref.size == AchievementSize::Bits16)
+		length = 2;
+	else if (ref.size == AchievementSize::Bits24)
+		length = 3;
+	else if (ref.size == AchievementSize::Bits32)
+		length = 4;
+	if (static_cast<UINT64>(ref.address) + length > static_cast<UINT64>(memsize))
+		return 0;
+	UINT32 value = 0;
+	for (UINT32 i = 0; i < length; i++)
+		value |= static_cast<UINT32>(mem[ref.address + i]) << (8 * i);
+	if (ref.size <= AchievementSize::Bit7)
+		return (value >> static_cast<UINT32>(ref.size)) & 1;
+	if (ref.size == AchievementSize::Low4)
+		return value & 0x0F;
+	if (ref.size == AchievementSize::High4)
+		return value >> 4;
+	return value;
+}
+
+// Compares the operands and counts the hit. Returns whether the condition is met.
+static inline bool TestCondition(const AchievementCondition& c, const UINT32* values, UINT32& hits)
+{
+	UINT32 l = values[c.left];
+	UINT32 r = values[c.right];
+	UINT32 cmp = static_cast<UINT32>(l < r) | (static_cast<UINT32>(l == r) << 1) | (static_cast<UINT32>(l > r) << 2);
+	bool result = (cmp & c.compareMask) != 0;
+	hits += static_cast<UINT32>(result & (hits < c.requiredHits));
+	return (c.requiredHits == 0) ? result : (hits >= c.requiredHits);
+}
+
+AchievementEngine::AchievementEngine()
+{
+	m_unlockedCount = 0;
+	m_lastUnlocked = -1;
+	m_started = false;
+	m_seq = 0;
+	m_savePending = false;
+	m_stopping = false;
+}
+
+AchievementEngine::~AchievementEngine()
+{
+	Clear();
+}
+
+void AchievementEngine::Clear()
+{
+	// Let the writer finish saving first
+	if (m_writer.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_cv.notify_all();
+		m_writer.join();
+	}
+	m_achievements.clear();
+	m_groups.clear();
+	m_conditions.clear();
+	m_hits.clear();
+	m_memRefs.clear();
+	m_values.clear();
+	m_constants.clear();
+	m_unlockedCount = 0;
+	m_lastUnlocked = -1;
+	m_started = false;
+	m_seq = 0;
+	m_savePath.clear();
+	m_saveData.clear();
+	m_savePending = false;
+}
+
+#pragma region Compilation
+
+bool AchievementEngine::Compile(const nlohmann::json& profile, std::string& error)
+{
+	Clear();
+	if (!profile.contains("achievements"))
+		return true;
+	try
+	{
+		for (auto& aj : profile["achievements"])
+		{
+			Achievement a;
+			a.id = aj.value("id", static_cast<UINT32>(m_achievements.size() + 1));
+			a.title = aj.at("title").get<string>();
+			a.description = aj.value("description", "");
+			a.firstGroup = static_cast<UINT32>(m_groups.size());
+			if (!ParseMemAddr(aj.at("memaddr").get<string>(), error))
+			{
+				error = "achievement " + a.title + ": " + error;
+				Clear();
+				return false;
+			}
+			a.groupCount = static_cast<UINT32>(m_groups.size()) - a.firstGroup;
+			m_achievements.push_back(a);
+		}
+	}
+	catch (exception& e)
+	{
+		error = e.what();
+		Clear();
+		return false;
+	}
+	if (m_achievements.empty())
+		return true;
+
+	// Turn the operands into indices in the value table
+	UINT32 n = static_cast<UINT32>(m_memRefs.size());
+	for (auto& c : m_conditions)
+	{
+		for (UINT32* operand : { &c.left, &c.right })
+			*operand = (*operand >> OPERAND_KIND_SHIFT) * n + (*operand & OPERAND_INDEX_MASK);
+	}
+	m_values.assign(3 * static_cast<size_t>(n), 0);
+	m_values.insert(m_values.end(), m_constants.begin(), m_constants.end());
+	m_hits.assign(m_conditions.size(), 0);
+
+	m_savePath = filesystem::current_path() / ACHIEVEMENTS_DIRECTORY
+		/ (profile.at("meta").at("name").get<string>() + ".json");
+	LoadUnlocked();
+	m_stopping = false;
+	m_writer = std::thread(&AchievementEngine::WriterThread, this);
+	return true;
+}
+
+bool AchievementEngine::ParseMemAddr(const std::string& memaddr, std::string& error)
+{
+	size_t groupStart = 0;
+	for (;;)
+	{
+		// S starts an alternate group, except in 0xS (bit 6)
+		size_t groupEnd = memaddr.find('S', groupStart);
+		while ((groupEnd != string::npos) && (groupEnd >= 2) && (memaddr[groupEnd - 2] == '0')
+			&& ((memaddr[groupEnd - 1] == 'x') || (memaddr[groupEnd - 1] == 'X')))
+			groupEnd = memaddr.find('S', groupEnd + 1);
+		string group = memaddr.substr(groupStart, groupEnd - groupStart);
+		AchievementGroup g;
+		g.firstCondition = static_cast<UINT32>(m_conditions.size());
+		size_t condStart = 0;
+		while (condStart <= group.size())
+		{
+			size_t condEnd = group.find('_', condStart);
+			if (condEnd == string::npos)
+				condEnd = group.size();
+			string cond = group.substr(condStart, condEnd - condStart);
+			if (cond.empty())
+			{
+				// Only an empty core group is allowed, when everything is in the alternates
+				if (!group.empty() || (groupStart != 0))
+				{
+					error = "empty condition";
+					return false;
+				}
+			}
+			else if (!ParseCondition(cond, error))
+				return false;
+			condStart = condEnd + 1;
+		}
+		g.conditionCount = static_cast<UINT32>(m_conditions.size()) - g.firstCondition;
+		for (UINT32 i = 0; i < g.conditionCount; i++)
+			g.hasPauseIf |= (m_conditions[g.firstCondition + i].flag == AchievementFlag::PauseIf);
+		m_groups.push_back(g);
+		if (groupEnd == string::npos)
+			return true;
+		groupStart = groupEnd + 1;
+	}
+}
+
+bool AchievementEngine::ParseCondition(const std::string& text, std::string& error)
+{
+	AchievementCondition c;
+	size_t pos = 0;
+	if ((text.size() > 2) && (text[1] == ':'))
+	{
+		char flag = static_cast<char>(toupper(text[0]));
+		if (flag == 'R')
+			c.flag = AchievementFlag::ResetIf;
+		else if (flag == 'P')
+			c.flag = AchievementFlag::PauseIf;
+		else
+		{
+			error = string("unsupported flag ") + text[0] + ": in " + text;
+			return false;
+		}
+		pos = 2;
+	}
+	if (!ParseOperand(text, pos, c.left, error))
+		return false;
+	for (auto& [op, mask] : s_operators)
+	{
+		size_t len = strlen(op);
+		if (text.compare(pos, len, op) == 0)
+		{
+			c.compareMask = mask;
+			pos += len;
+			break;
+		}
+	}
+	if (c.compareMask == 0)
+	{
+		error = "expected a comparison in " + text;
+		return false;
+	}
+	if (!ParseOperand(text, pos, c.right, error))
+		return false;
+	if ((pos < text.size()) && (text[pos] == '.'))
+	{
+		size_t end = text.find('.', pos + 1);
+		if ((end == string::npos) || (end == pos + 1) || (end != text.size() - 1))
+		{
+			error = "invalid hit count in " + text;
+			return false;
+		}
+		c.requiredHits = static_cast<UINT32>(stoul(text.substr(pos + 1, end - pos - 1)));
+		pos = end + 1;
+	}
+	if (pos != text.size())
+	{
+		error = "unexpected '" + text.substr(pos) + "' in " + text;
+		return false;
+	}
+	m_conditions.push_back(c);
+	return true;
+}
+
+bool AchievementEngine::ParseOperand(const std::string& text, size_t& pos, UINT32& operand, std::string& error)
+{
+	auto isPrefix = [&](size_t at) {
+		return (at + 1 < text.size()) && (text[at] == '0') && ((text[at + 1] == 'x') || (text[at + 1] == 'X'));
+	};
+	UINT32 kind = OPERAND_CURRENT;
+	if ((pos < text.size()) && ((text[pos] == 'd') || (text[pos] == 'p')) && isPrefix(pos + 1))
+		kind = (text[pos++] == 'd') ? OPERAND_DELTA : OPERAND_PRIOR;
+
+	if (isPrefix(pos))
+	{
+		pos += 2;
+		AchievementMemRef ref;
+		ref.size = AchievementSize::Bits16;
+		if (pos < text.size())
+		{
+			auto it = s_sizes.find(static_cast<char>(toupper(text[pos])));
+			if (it != s_sizes.end())
+			{
+				ref.size = it->second;
+				pos++;
+			}
+		}
+		size_t digits = 0;
+		while ((pos + digits < text.size()) && isxdigit(static_cast<unsigned char>(text[pos + digits])) && (digits < 8))
+			digits++;
+		if (digits == 0)
+		{
+			error = "expected an address in " + text;
+			return false;
+		}
+		ref.address = static_cast<UINT32>(stoul(text.substr(pos, digits), nullptr, 16));
+		pos += digits;
+		UINT32 index = 0;
+		while ((index < m_memRefs.size())
+			&& ((m_memRefs[index].address != ref.address) || (m_memRefs[index].size != ref.size)))
+			index++;
+		if (index == m_memRefs.size())
+			m_memRefs.push_back(ref);
+		operand = (kind << OPERAND_KIND_SHIFT) | index;
+		return true;
+	}
+	if (kind != OPERAND_CURRENT)
+	{
+		error = "expected an address after d or p in " + text;
+		return false;
+	}
+
+	bool hex = (pos < text.size()) && ((text[pos] == 'h') || (text[pos] == 'H'));
+	if (hex)
+		pos++;
+	size_t digits = 0;
+	while ((pos + digits < text.size())
+		&& (hex ? isxdigit(static_cast<unsigned char>(text[pos + digits])) : isdigit(static_cast<unsigned char>(text[pos + digits]))))
+		digits++;
+	if ((digits == 0) || (digits > (hex ? 8u : 10u)))
+	{
+		error = "expected a value in " + text;
+		return false;
+	}
+	operand = (OPERAND_CONSTANT << OPERAND_KIND_SHIFT) | static_cast<UINT32>(m_constants.size());
+	m_constants.push_back(static_cast<UINT32>(stoull(text.substr(pos, digits), nullptr, hex ? 16 : 10)));
+	pos += digits;
+	return true;
+}
+
+#pragma endregion
+
+#pragma region Evaluation
+
+void AchievementEngine::ReadMemRefs(const UINT8* mem, int memsize)
+{
+	size_t n = m_memRefs.size();
+	UINT32* current = m_values.data();
+	UINT32* delta = current + n;
+	UINT32* prior = delta + n;
+	for (size_t i = 0; i < n; i++)
+	{
+		UINT32 value = ReadMemRef(m_memRefs[i], mem, memsize);
+		if (!m_started)
+		{
+			current[i] = delta[i] = prior[i] = value;
+			continue;
+		}
+		delta[i] = current[i];
+		prior[i] = (value != current[i]) ? current[i] : prior[i];
+		current[i] = value;
+	}
+}
+
+void AchievementEngine::ResetHits(const Achievement& a)
+{
+	const AchievementGroup& first = m_groups[a.firstGroup];
+	const AchievementGroup& last = m_groups[a.firstGroup + a.groupCount - 1];
+	std::fill(m_hits.begin() + first.firstCondition, m_hits.begin() + last.firstCondition + last.conditionCount, 0);
+}
+
+UINT32 AchievementEngine::Update(UINT16 seq, const UINT8* mem, int memsize)
+{
+	if (m_achievements.empty() || (mem == nullptr))
+		return 0;
+	if (m_started && (seq == m_seq))
+		return 0;
+	ReadMemRefs(mem, memsize);
+	m_started = true;
+	m_seq = seq;
+
+	const UINT32* values = m_values.data();
+	UINT32 unlocked = 0;
+	for (auto& a : m_achievements)
+	{
+		if (a.unlocked)
+			continue;
+		bool reset = false;
+		bool core = false;
+		bool alt = false;
+		for (UINT32 g = 0; g < a.groupCount; g++)
+		{
+			const AchievementGroup& group = m_groups[a.firstGroup + g];
+			const AchievementCondition* conditions = &m_conditions[group.firstCondition];
+			UINT32* hits = &m_hits[group.firstCondition];
+			bool paused = false;
+			if (group.hasPauseIf)
+			{
+				for (UINT32 i = 0; i < group.conditionCount; i++)
+				{
+					if (conditions[i].flag == AchievementFlag::PauseIf)
+						paused |= TestCondition(conditions[i], values, hits[i]);
+				}
+			}
+			bool groupTrue = !paused;
+			if (!paused)
+			{
+				for (UINT32 i = 0; i < group.conditionCount; i++)
+				{
+					const AchievementCondition& c = conditions[i];
+					if (c.flag == AchievementFlag::PauseIf)
+						continue;
+					bool met = TestCondition(c, values, hits[i]);
+					if (c.flag == AchievementFlag::ResetIf)
+						reset |= met;
+					else
+						groupTrue &= met;
+				}
+			}
+			if (g == 0)
+				core = groupTrue;
+			else
+				alt |= groupTrue;
+		}
+		bool trigger = !reset && core && ((a.groupCount == 1) || alt);
+		if (reset)
+			ResetHits(a);
+		if (!a.primed)
+		{
+			// Already true, wait until it is false once
+			if (trigger)
+				ResetHits(a);
+			else
+				a.primed = true;
+			continue;
+		}
+		if (!trigger)
+			continue;
+
+		a.unlocked = true;
+		char timebuf[30];
+		time_t now = time(nullptr);
+		tm local;
+		localtime_s(&local, &now);
+		strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &local);
+		a.unlockTime = timebuf;
+		m_unlockedCount++;
+		m_lastUnlocked = static_cast<int>(&a - m_achievements.data());
+		unlocked++;
+	}
+	if (unlocked > 0)
+		SaveUnlocked();
+	return unlocked;
+}
+
+#pragma endregion
+
+#pragma region Persistence
+
+// The file lists the unlocked achievements:
+//		{ "unlocked": [ { "id": 1, "title": "Rich", "time": "2021-06-01 20:14:05" } ] }
+void AchievementEngine::LoadUnlocked()
+{
+	std::ifstream file(m_savePath);
+	if (!file)
+		return;
+	try
+	{
+		nlohmann::json j;
+		file >> j;
+		for (auto& uj : j.at("unlocked"))
+		{
+			UINT32 id = uj.at("id");
+			for (auto& a : m_achievements)
+			{
+				if ((a.id != id) || a.unlocked)
+					continue;
+				a.unlocked = true;
+				a.unlockTime = uj.value("time", "");
+				m_unlockedCount++;
+				// The times sort as strings
+				if ((m_lastUnlocked < 0) || (a.unlockTime >= m_achievements[m_lastUnlocked].unlockTime))
+					m_lastUnlocked = static_cast<int>(&a - m_achievements.data());
+			}
+		}
+	}
+	catch (exception& e)
+	{
+		char buf[500];
+		snprintf(buf, 500, "Error reading unlocked achievements %s: %s\n", m_savePath.string().c_str(), e.what());
+		OutputDebugStringA(buf);
+	}
+}
+
+std::string AchievementEngine::GetText() const
+{
+	if (m_achievements.empty())
+		return "";
+	std::string text = std::to_string(m_unlockedCount) + "/" + std::to_string(m_achievements.size());
+	if (m_lastUnlocked >= 0)
+		text += "  " + m_achievements[m_lastUnlocked].title;
+	return text;
+}
+
+void AchievementEngine::SaveUnlocked()
+{
+	nlohmann::json j;
+	j["unlocked"] = nlohmann::json::array();
+	for (auto& a : m_achievements)
+	{
+		if (a.unlocked)
+			j["unlocked"].push_back({ { "id", a.id }, { "title", a.title }, { "time", a.unlockTime } });
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_saveData = j.dump(2);
+		m_savePending = true;
+	}
+	m_cv.notify_one();
+}
+
+void AchievementEngine::WriterThread()
+{
+	Tracer::SetThreadName("Achievements");
+	for (;;)
+	{
+		string data;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this] { return m_stopping || m_savePending; });
+			if (!m_savePending)
+				return;
+			data.swap(m_saveData);
+			m_savePending = false;
+		}
+		TraceScope trace("Save achievements");
+		// Write a temporary file and replace the old one, so a crash can't leave half a file
+		std::error_code ec;
+		filesystem::create_directories(m_savePath.parent_path(), ec);
+		filesystem::path tmpPath = m_savePath;
+		tmpPath += ".tmp";
+		{
+			std::ofstream file(tmpPath, std::ios::trunc);
+			file << data;
+		}
+		filesystem::rename(tmpPath, m_savePath, ec);
+		if (ec)
+		{
+			char buf[500];
+			snprintf(buf, 500, "Error saving unlocked achievements %s: %s\n", m_savePath.string().c_str(), ec.message().c_str());
+			OutputDebugStringA(buf);
+		}
+	}
+}
+
+#pragma endregion
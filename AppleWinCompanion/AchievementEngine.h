@@ -0,0 +1,145 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <filesystem>
+#include "nlohmann/json.hpp"
+
+/// <summary>
+/// AchievementEngine runs the achievements of a profile, written like RetroAchievements conditions:
+///		"achievements": [
+///			{ "id": 1, "title": "Rich", "description": "Have 1000 gold", "memaddr": "0x 1165A>=1000_d0x 1165A<1000" }
+///		]
+/// memaddr is a list of conditions separated by _, in a core group optionally followed by
+/// alternate groups, each starting with S. The achievement unlocks on the frame the core group
+/// and at least one alternate group (if there are any) are true.
+///
+/// A condition is [flag:]operand[op operand][.hits.] where
+///		flag is R: (reset if) or P: (pause if)
+///		operand is 0xH1234 (8-bit), 0x 1234 or 0x1234 (16-bit), 0xW (24-bit), 0xX (32-bit),
+///			0xM to 0xT (bit 0 to 7), 0xL and 0xU (low and high nibble), all little-endian,
+///			prefixed with d for its value on the previous frame or p for its value before it last changed.
+///			Or a number, decimal or h followed by hex.
+///		op is one of = != < <= > >=
+///		hits is how many frames the condition must have been true, not necessarily in a row.
+/// A true reset if condition clears the hits of the achievement. A true pause if condition stops
+/// its group from being evaluated, freezing its hits.
+/// An achievement must be false once before it can unlock, so it doesn't unlock when loading a game
+/// where it is already true.
+///
+/// Everything is compiled into flat arrays. Each memory operand is read once per frame into a value
+/// table that also holds its delta and prior values and the constants, so evaluating a condition is two
+/// lookups and a compare against a mask, and hit counting is branchless.
+///
+/// The unlocked achievements are saved to Achievements\[profile name].json by a writer thread.
+/// </summary>
+
+constexpr char ACHIEVEMENTS_DIRECTORY[] = "Achievements";
+
+enum class AchievementSize : UINT8
+{
+	Bit0 = 0, Bit1, Bit2, Bit3, Bit4, Bit5, Bit6, Bit7,
+	Low4,
+	High4,
+	Bits8,
+	Bits16,
+	Bits24,
+	Bits32,
+};
+
+enum class AchievementFlag : UINT8
+{
+	None,
+	ResetIf,
+	PauseIf,
+};
+
+struct AchievementMemRef
+{
+	UINT32 address = 0;
+	AchievementSize size = AchievementSize::Bits8;
+};
+
+struct AchievementCondition
+{
+	UINT32 left = 0;		// index in the value table
+	UINT32 right = 0;
+	UINT8 compareMask = 0;	// bits of the comparisons that make it true: 1 less, 2 equal, 4 greater
+	AchievementFlag flag = AchievementFlag::None;
+	UINT32 requiredHits = 0;
+};
+
+struct AchievementGroup
+{
+	UINT32 firstCondition = 0;
+	UINT32 conditionCount = 0;
+	bool hasPauseIf = false;
+};
+
+struct Achievement
+{
+	UINT32 id = 0;
+	std::string title;
+	std::string description;
+	UINT32 firstGroup = 0;	// the core group, followed by the alternate groups
+	UINT32 groupCount = 0;
+	bool unlocked = false;
+	bool primed = false;	// was false once
+	std::string unlockTime;
+};
+
+class AchievementEngine
+{
+public:
+	AchievementEngine();
+	~AchievementEngine();
+
+	// Compiles the achievements of the profile and loads which ones are unlocked.
+	// Returns false and leaves the engine empty on error.
+	bool Compile(const nlohmann::json& profile, std::string& error);
+	void Clear();
+
+	// Evaluates all the locked achievements. Calls with the same seq are ignored.
+	// Returns the number of achievements unlocked by this frame.
+	UINT32 Update(UINT16 seq, const UINT8* mem, int memsize);
+
+	const std::vector<Achievement>& GetAchievements() const { return m_achievements; }
+	UINT32 GetUnlockedCount() const { return m_unlockedCount; }
+	// The count unlocked and the title of the last unlock, for Achievements blocks: "3/10  Rich"
+	std::string GetText() const;
+
+private:
+	bool ParseMemAddr(const std::string& memaddr, std::string& error);
+	bool ParseCondition(const std::string& text, std::string& error);
+	bool ParseOperand(const std::string& text, size_t& pos, UINT32& operand, std::string& error);
+	void ReadMemRefs(const UINT8* mem, int memsize);
+	void ResetHits(const Achievement& a);
+	void LoadUnlocked();
+	void SaveUnlocked();
+	void WriterThread();
+
+	std::vector<Achievement> m_achievements;
+	std::vector<AchievementGroup> m_groups;
+	std::vector<AchievementCondition> m_conditions;
+	std::vector<UINT32> m_hits;					// per condition
+	std::vector<AchievementMemRef> m_memRefs;
+	// The operands: current, delta and prior value of every memref, then the constants.
+	// Operands are encoded while compiling as kind << 30 | index and turned into value indices at the end.
+	std::vector<UINT32> m_values;
+	std::vector<UINT32> m_constants;
+	UINT32 m_unlockedCount;
+	int m_lastUnlocked;						// index in m_achievements, -1 if none
+	bool m_started;
+	UINT16 m_seq;
+	std::filesystem::path m_savePath;
+
+	// Writer thread, which saves the latest m_saveData
+	std::string m_saveData;
+	bool m_savePending;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stopping;
+	std::thread m_writer;
+};
@@ -0,0 +1,1092 @@
+#include "pch.h"
+#include "CompiledProfile.h"
+
+using namespace std;
+
+static const string PROFILE_FORMAT_PLACEHOLDER("{}");
+static const char* PROFILE_LOOKUP_DEFAULT = "-";	// Default value when unknown lookup is "-"
+
+static const std::map<string, VarType> s_varTypes = {
+	{ "ascii", VarType::Ascii },
+	{ "ascii_high", VarType::AsciiHigh },
+	{ "int_bigendian", VarType::IntBigEndian },
+	{ "int_littleendian", VarType::IntLittleEndian },
+	{ "int_bigendian_literal", VarType::IntBigEndianLiteral },
+	{ "int_littleendian_literal", VarType::IntLittleEndianLiteral },
+	{ "lookup", VarType::Lookup },
+};
+
+void CompiledProfile::LogCompileError(const string& msg)
+{
+	m_compileErrors += msg + "\n";
+}
+
+// Addresses, offsets and strides are hex strings in the profiles ("0x1164B")
+// but we also accept plain json integers
+static INT64 ParseAddress(const nlohmann::json& j)
+{
+	if (j.is_string())
+		return std::stoll(j.get<std::string>(), nullptr, 0);
+	return j.get<INT64>();
+}
+
+CompiledProfile::CompiledProfile()
+{
+	usesTextScreen = false;
+	splitStartExprId = PROFILE_NO_EXPR;
+	splitResetExprId = PROFILE_NO_EXPR;
+	m_source = nullptr;
+	m_exprRecord = nullptr;
+	m_historyStarted = false;
+	m_historySeq = 0;
+	m_historyUpdates = 0;
+}
+
+void CompiledProfile::Clear()
+{
+	name.clear();
+	sidebars.clear();
+	blocks.clear();
+	vars.clear();
+	fields.clear();
+	lookups.clear();
+	pointers.clear();
+	expressions.clear();
+	histories.clear();
+	historyValues.clear();
+	triggers.clear();
+	splitStartExprId = PROFILE_NO_EXPR;
+	splitResetExprId = PROFILE_NO_EXPR;
+	splits.clear();
+	published.clear();
+	textScreen.SetMode(A2TextScreenMode());
+	usesTextScreen = false;
+	videoMode = A2VideoMode();
+	m_records.clear();
+	m_arrays.clear();
+	m_lookupIds.clear();
+	m_pointerIds.clear();
+	m_exprIds.clear();
+	m_resolvedPointers.clear();
+	m_source = nullptr;
+	m_exprRecord = nullptr;
+	m_historyStarted = false;
+	m_historySeq = 0;
+}
+
+bool CompiledProfile::Compile(const nlohmann::json& profile, std::string& error)
+{
+	m_compileErrors.clear();
+	bool compiled = CompileProfile(profile);
+	error = std::move(m_compileErrors);
+	m_compileErrors.clear();
+	return compiled;
+}
+
+bool CompiledProfile::CompileProfile(const nlohmann::json& profile)
+{
+	Clear();
+	m_source = &profile;
+	try
+	{
+		name = profile.at("meta").at("name").get<string>();
+		// How the game uses the text screen, for screen text vars:
+		//		"text_screen": { "columns": 80, "page": 1, "alt_charset": true }
+		if (profile.contains("text_screen"))
+		{
+			auto& tj = profile["text_screen"];
+			A2TextScreenMode mode;
+			mode.col80 = (tj.value("columns", 40) == 80);
+			mode.page2 = (tj.value("page", 1) == 2);
+			mode.altCharset = tj.value("alt_charset", false);
+			textScreen.SetMode(mode);
+		}
+		// The video mode of the game, since the soft switches aren't in memory:
+		//		"video": { "mode": "dhgr", "page": 1, "mixed": false, "alt_charset": false }
+		// mode is one of text, text80, lores, dlores, hgr, dhgr
+		if (profile.contains("video"))
+		{
+			static const std::map<string, A2VideoModeType> videoModes = {
+				{ "text", A2VideoModeType::Text }, { "text80", A2VideoModeType::Text80 },
+				{ "lores", A2VideoModeType::LoRes }, { "dlores", A2VideoModeType::DLoRes },
+				{ "hgr", A2VideoModeType::HGR }, { "dhgr", A2VideoModeType::DHGR },
+			};
+			auto& vj = profile["video"];
+			auto it = videoModes.find(vj.value("mode", "hgr"));
+			if (it == videoModes.end())
+			{
+				LogCompileError("unknown video mode " + vj.value("mode", ""));
+				Clear();
+				return false;
+			}
+			videoMode.type = it->second;
+			videoMode.page2 = (vj.value("page", 1) == 2);
+			videoMode.mixed = vj.value("mixed", false);
+			videoMode.altCharset = vj.value("alt_charset", false);
+		}
+		if (!CompileRecords(profile) || !CompileArrays(profile))
+		{
+			Clear();
+			return false;
+		}
+
+		for (auto& sj : profile.at("sidebars"))
+		{
+			if (!sj.contains("blocks") || sj["blocks"].empty())
+				continue;
+
+			CompiledSidebar cs;
+			if (sj.value("type", "") == "Bottom")
+			{
+				cs.type = SidebarTypes::Bottom;
+				if (sj.contains("height"))
+					cs.size = sj["height"];
+			}
+			else
+			{
+				cs.type = SidebarTypes::Right;
+				if (sj.contains("width"))
+					cs.size = sj["width"];
+			}
+			cs.firstBlock = static_cast<UINT16>(blocks.size());
+			UINT8 sidebarId = static_cast<UINT8>(sidebars.size());
+
+			for (auto& bj : sj["blocks"])
+			{
+				if (bj.value("type", "") == "Repeat")
+				{
+					// Expand the nested blocks once per array row
+					auto arrayName = bj.at("array").get<string>();
+					auto it = m_arrays.find(arrayName);
+					if (it == m_arrays.end())
+					{
+						LogCompileError("unknown array " + arrayName);
+						Clear();
+						return false;
+					}
+					// The visibility of the Repeat applies to all the blocks of the row
+					string rowVisible = bj.value("visible", "");
+					for (UINT16 row = 0; row < it->second.count; row++)
+					{
+						for (auto& nbj : bj.at("blocks"))
+						{
+							if (!CompileBlock(nbj, sidebarId, &it->second, row, rowVisible))
+							{
+								Clear();
+								return false;
+							}
+						}
+					}
+				}
+				else if (!CompileBlock(bj, sidebarId, nullptr, 0, ""))
+				{
+					Clear();
+					return false;
+				}
+			}
+			size_t numBlocks = blocks.size() - cs.firstBlock;
+			if (numBlocks > SIDEBAR_MAX_BLOCKS)
+			{
+				char buf[200];
+				snprintf(buf, 200, "sidebar %d has %zu blocks, only %d will be shown",
+					sidebarId, numBlocks, SIDEBAR_MAX_BLOCKS);
+				LogCompileError(buf);
+				blocks.resize(cs.firstBlock + SIDEBAR_MAX_BLOCKS);
+				numBlocks = SIDEBAR_MAX_BLOCKS;
+			}
+			cs.blockCount = static_cast<UINT8>(numBlocks);
+			for (UINT8 k = 0; k < cs.blockCount; k++)
+				blocks[cs.firstBlock + k].blockId = k;
+			sidebars.push_back(cs);
+		}
+		if (!CompileTriggers(profile) || !CompileSplits(profile) || !CompilePublished(profile))
+		{
+			Clear();
+			return false;
+		}
+	}
+	catch (exception& e)
+	{
+		LogCompileError(e.what());
+		Clear();
+		return false;
+	}
+	// The json is only needed while compiling
+	m_source = nullptr;
+	m_resolvedPointers.assign(pointers.size(), PROFILE_UNRESOLVED);
+	if (!histories.empty())
+		historyValues.assign(histories.back().first + histories.back().capacity, 0);
+	return true;
+}
+
+// Records are named field tables:
+/*
+	"records": {
+		"character": {
+			"fields": {
+				"name": { "offset": "0x4B", "length": 15, "type": "ascii_high" },
+				"level": { "offset": "0x01", "length": 1, "type": "int_bigendian" },
+				"hp_pct": { "expr": "hp * 100 / max(maxhp, 1)" }
+			}
+		}
+	}
+*/
+// Expression fields are compiled once all the fields of the record are known,
+// and can only use the plain fields.
+bool CompiledProfile::CompileRecords(const nlohmann::json& profile)
+{
+	if (!profile.contains("records"))
+		return true;
+	for (auto& [recName, rj] : profile["records"].items())
+	{
+		RecordDef rec;
+		rec.firstField = static_cast<UINT16>(fields.size());
+		for (auto& [fieldName, fj] : rj.at("fields").items())
+		{
+			FieldDef field;
+			if (fj.contains("expr"))
+				field.type = VarType::Expression;
+			else if (!CompileField(fj, "offset", true, field))
+			{
+				LogCompileError("invalid field " + recName + "." + fieldName);
+				return false;
+			}
+			fields.push_back(field);
+			rec.fieldNames.push_back(fieldName);
+		}
+		rec.fieldCount = static_cast<UINT16>(rec.fieldNames.size());
+		m_records[recName] = rec;
+
+		for (UINT16 i = 0; i < rec.fieldCount; i++)
+		{
+			FieldDef& field = fields[rec.firstField + i];
+			if (field.type != VarType::Expression)
+				continue;
+			field.exprId = GetExpressionId(rj["fields"][rec.fieldNames[i]]["expr"].get<string>(), recName);
+			if (field.exprId == PROFILE_NO_EXPR)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Arrays instantiate a record count times, each row stride bytes apart:
+/*
+	"arrays": {
+		"party": { "record": "character", "base": "0x11600", "stride": "0x80", "count": 6 }
+	}
+*/
+// The base can also be read from a pointer, in which case "base" is an optional offset added to it:
+/*
+		"active": { "record": "character", "pointer": "0x3A", "bank": 1, "stride": "0x80", "count": 1 }
+*/
+bool CompiledProfile::CompileArrays(const nlohmann::json& profile)
+{
+	if (!profile.contains("arrays"))
+		return true;
+	for (auto& [arrName, aj] : profile["arrays"].items())
+	{
+		ArrayDef arr;
+		arr.record = aj.at("record").get<string>();
+		if (m_records.find(arr.record) == m_records.end())
+		{
+			LogCompileError("array " + arrName + " uses unknown record " + arr.record);
+			return false;
+		}
+		if (aj.contains("pointer"))
+		{
+			arr.pointerId = GetPointerId(aj);
+			arr.base = aj.contains("base") ? static_cast<UINT32>(ParseAddress(aj["base"])) : 0;
+		}
+		else
+		{
+			arr.base = static_cast<UINT32>(ParseAddress(aj.at("base")));
+		}
+		arr.stride = static_cast<UINT32>(ParseAddress(aj.at("stride")));
+		int count = aj.at("count");
+		if ((count <= 0) || (count > PROFILE_MAX_ARRAY_COUNT))
+		{
+			LogCompileError("array " + arrName + " has an invalid count");
+			return false;
+		}
+		arr.count = static_cast<UINT16>(count);
+		m_arrays[arrName] = arr;
+	}
+	return true;
+}
+
+// Triggers run an action when their condition becomes true:
+/*
+	"triggers": [
+		{ "name": "Low HP", "condition": "party[0].hp * 5 < party[0].maxhp", "debounce": 2,
+			"action": { "type": "beep", "frequency": 440, "duration": 300 } },
+		{ "name": "Boss", "condition": "byte(0x7A12) & 0x80", "mode": "level", "interval": 600,
+			"action": { "type": "log", "file": "boss.log", "message": "The boss is awake" } },
+		{ "name": "Game over", "condition": "byte(0x7A00) == 0",
+			"action": { "type": "replay" } }
+	]
+*/
+bool CompiledProfile::CompileTriggers(const nlohmann::json& profile)
+{
+	if (!profile.contains("triggers"))
+		return true;
+	static const std::map<string, TriggerActionType> actionTypes = {
+		{ "beep", TriggerActionType::Beep }, { "log", TriggerActionType::Log },
+		{ "screenshot", TriggerActionType::Screenshot }, { "replay", TriggerActionType::Replay },
+	};
+	for (auto& tj : profile["triggers"])
+	{
+		CompiledTrigger trigger;
+		trigger.name = tj.at("name").get<string>();
+		trigger.conditionExprId = GetConditionId(tj.at("condition").get<string>(), "trigger " + trigger.name);
+		if (trigger.conditionExprId == PROFILE_NO_EXPR)
+			return false;
+		string mode = tj.value("mode", "edge");
+		if ((mode != "edge") && (mode != "level"))
+		{
+			LogCompileError("trigger " + trigger.name + " has an unknown mode " + mode);
+			return false;
+		}
+		trigger.mode = (mode == "level" ? TriggerMode::Level : TriggerMode::Edge);
+		trigger.debounce = std::max(tj.value("debounce", 1), 1);
+		trigger.interval = std::max(tj.value("interval", 60), 1);
+
+		auto& aj = tj.at("action");
+		auto it = actionTypes.find(aj.value("type", ""));
+		if (it == actionTypes.end())
+		{
+			LogCompileError("trigger " + trigger.name + " has an unknown action " + aj.value("type", ""));
+			return false;
+		}
+		trigger.action = it->second;
+		trigger.frequency = aj.value("frequency", trigger.frequency);
+		trigger.duration = aj.value("duration", trigger.duration);
+		trigger.file = aj.value("file", "triggers.log");
+		trigger.message = aj.value("message", trigger.name);
+		string source = aj.value("source", "window");
+		if ((source != "window") && (source != "video"))
+		{
+			LogCompileError("trigger " + trigger.name + " has an unknown screenshot source " + source);
+			return false;
+		}
+		trigger.videoOnly = (source == "video");
+		triggers.push_back(trigger);
+	}
+	return true;
+}
+
+// The splits of the speedrun timer. The run starts when "start" becomes true, and each segment
+// ends when its condition becomes true. "reset" is optional:
+/*
+	"splits": {
+		"start": "byte(0x7000) == 1",
+		"reset": "byte(0x7000) == 0",
+		"segments": [
+			{ "name": "Dungeon 1", "condition": "byte(0x7012) == 1" },
+			{ "name": "Dungeon 2", "condition": "byte(0x7012) == 2" }
+		]
+	}
+*/
+bool CompiledProfile::CompileSplits(const nlohmann::json& profile)
+{
+	if (!profile.contains("splits"))
+		return true;
+	auto& sj = profile["splits"];
+	splitStartExprId = GetConditionId(sj.at("start").get<string>(), "splits start");
+	if (splitStartExprId == PROFILE_NO_EXPR)
+		return false;
+	if (sj.contains("reset"))
+	{
+		splitResetExprId = GetConditionId(sj["reset"].get<string>(), "splits reset");
+		if (splitResetExprId == PROFILE_NO_EXPR)
+			return false;
+	}
+	for (auto& segj : sj.at("segments"))
+	{
+		CompiledSplit split;
+		split.name = segj.at("name").get<string>();
+		split.conditionExprId = GetConditionId(segj.at("condition").get<string>(), "split " + split.name);
+		if (split.conditionExprId == PROFILE_NO_EXPR)
+			return false;
+		splits.push_back(split);
+	}
+	if (splits.empty())
+	{
+		LogCompileError("splits without segments");
+		return false;
+	}
+	return true;
+}
+
+// Values that other programs can subscribe to by name. Strings are fine:
+//		"publish": { "hp": "party[0].hp", "gold": "word(0x1165A)" }
+bool CompiledProfile::CompilePublished(const nlohmann::json& profile)
+{
+	if (!profile.contains("publish"))
+		return true;
+	for (auto& [valueName, vj] : profile["publish"].items())
+	{
+		CompiledPublished value;
+		value.name = valueName;
+		value.exprId = GetExpressionId(vj.get<string>(), "");
+		if (value.exprId == PROFILE_NO_EXPR)
+			return false;
+		value.isString = expressions[value.exprId].IsString();
+		published.push_back(value);
+	}
+	return true;
+}
+
+// A condition outside of any record, which must not be a string
+UINT16 CompiledProfile::GetConditionId(const std::string& source, const std::string& owner)
+{
+	UINT16 id = GetExpressionId(source, "");
+	if ((id != PROFILE_NO_EXPR) && expressions[id].IsString())
+	{
+		LogCompileError(owner + " has a string condition: " + source);
+		return PROFILE_NO_EXPR;
+	}
+	return id;
+}
+
+// A block can be hidden with a "visible" expression, which is evaluated every frame:
+//		{ "type": "Content", "template": "{}", "visible": "level > 0", "vars": [ ... ] }
+// A Graph block shows its text followed by a sparkline of the history of its first history var:
+//		{ "type": "Graph", "template": "HP {}", "vars": [ { "memstart": "0x1165A", ..., "history": 600 } ] }
+// A Timer block shows its text followed by the split timer:
+//		{ "type": "Timer", "template": "Run " }
+// An Achievements block shows its text followed by the count of achievements unlocked and the last one:
+//		{ "type": "Achievements", "template": "Achievements " }
+bool CompiledProfile::CompileBlock(const nlohmann::json& bj, UINT8 sidebarId, const ArrayDef* row, UINT16 rowIndex,
+	const std::string& parentVisible)
+{
+	CompiledBlock cb;
+	cb.sidebarId = sidebarId;
+	string type = bj.value("type", "Content");
+	if (type == "Header")
+	{
+		cb.type = BlockType::Header;
+		cb.fontId = FontDescriptors::A2FontBold;
+		DirectX::XMStoreFloat4(&cb.color, DirectX::Colors::CadetBlue);
+	}
+	else if (type == "Empty")
+	{
+		cb.type = BlockType::Empty;
+		cb.fontId = FontDescriptors::A2FontRegular;
+		DirectX::XMStoreFloat4(&cb.color, DirectX::Colors::Black);
+	}
+	else if (type == "Graph")
+	{
+		cb.type = BlockType::Graph;
+		cb.fontId = FontDescriptors::A2FontRegular;
+		DirectX::XMStoreFloat4(&cb.color, DirectX::Colors::LimeGreen);
+	}
+	else if (type == "Timer")
+	{
+		cb.type = BlockType::Timer;
+		cb.fontId = FontDescriptors::A2FontBold;
+		DirectX::XMStoreFloat4(&cb.color, DirectX::Colors::Gold);
+	}
+	else if (type == "Achievements")
+	{
+		cb.type = BlockType::Achievements;
+		cb.fontId = FontDescriptors::A2FontBold;
+		DirectX::XMStoreFloat4(&cb.color, DirectX::Colors::Orange);
+	}
+	else // default to "Content"
+	{
+		cb.type = BlockType::Content;
+		cb.fontId = FontDescriptors::A2FontRegular;
+		DirectX::XMStoreFloat4(&cb.color, DirectX::Colors::GhostWhite);
+	}
+	// overrides
+	if (bj.contains("color"))
+	{
+		cb.color = DirectX::XMFLOAT4(bj["color"][0].get<float>(), bj["color"][1].get<float>(),
+			bj["color"][2].get<float>(), bj["color"][3].get<float>());
+	}
+
+	string tmpl = bj.value("template", "");
+	size_t numVars = bj.contains("vars") ? bj["vars"].size() : 0;
+
+	// Split the template once so formatting is a straight concatenation.
+	// Vars without a matching placeholder are dropped.
+	size_t start = 0;
+	size_t pos;
+	cb.firstVar = static_cast<UINT16>(vars.size());
+	while ((cb.varCount < numVars) && ((pos = tmpl.find(PROFILE_FORMAT_PLACEHOLDER, start)) != string::npos))
+	{
+		if (!CompileVar(bj["vars"][cb.varCount], row, rowIndex))
+			return false;
+		cb.templateParts.push_back(tmpl.substr(start, pos - start));
+		start = pos + PROFILE_FORMAT_PLACEHOLDER.length();
+		cb.varCount++;
+	}
+	cb.templateParts.push_back(tmpl.substr(start));
+
+	if (cb.type == BlockType::Graph)
+	{
+		for (UINT16 i = 0; (i < cb.varCount) && (cb.historyId == PROFILE_NO_HISTORY); i++)
+			cb.historyId = vars[cb.firstVar + i].historyId;
+		if (cb.historyId == PROFILE_NO_HISTORY)
+		{
+			LogCompileError("Graph block without a history var in its template: " + tmpl);
+			return false;
+		}
+	}
+
+	string visible = bj.value("visible", "");
+	if (!parentVisible.empty())
+		visible = (visible.empty() ? parentVisible : "(" + parentVisible + ") && (" + visible + ")");
+	if (!visible.empty())
+	{
+		cb.visibleExprId = GetExpressionId(visible, (row ? row->record : ""));
+		if (cb.visibleExprId == PROFILE_NO_EXPR)
+			return false;
+		if (expressions[cb.visibleExprId].IsString())
+		{
+			LogCompileError("visible must be a condition, not a string: " + visible);
+			return false;
+		}
+		if (row != nullptr)
+		{
+			cb.rowBase = row->base + (rowIndex * row->stride);
+			cb.rowPointerId = row->pointerId;
+		}
+	}
+
+	blocks.push_back(cb);
+	return true;
+}
+
+// A var is either a plain memory location:
+//		{ "memstart": "0x1165A", "length": 16, "type": "ascii_high" }
+// or a field of a record row. Inside a "Repeat" block the row is implicit:
+//		{ "field": "name" }
+// Elsewhere the array and index must be given:
+//		{ "array": "party", "index": 2, "field": "name" }
+// or an indirect var, whose address is the 16-bit pointer value + offset, in the given 64K bank:
+//		{ "pointer": "0x3A", "offset": "0x05", "bank": 1, "length": 1, "type": "int_bigendian" }
+// or a computed var, which inside a "Repeat" block can use the fields of the row by name:
+//		{ "expr": "gold * 100 + silver" }
+// or a line of the text screen. column and length are optional, the default is the whole row:
+//		{ "screen_row": 22, "column": 0, "length": 40 }
+// Any numeric var can also keep its last N values (at most PROFILE_MAX_HISTORY) for Graph blocks:
+//		{ "memstart": "0x1165A", "length": 1, "type": "int_bigendian", "history": 600 }
+bool CompiledProfile::CompileVar(const nlohmann::json& vj, const ArrayDef* row, UINT16 rowIndex)
+{
+	CompiledVar cv;
+	if (vj.contains("screen_row"))
+	{
+		int screenRow = vj["screen_row"];
+		int column = vj.value("column", 0);
+		int length = vj.value("length", A2TEXT_MAX_COLUMNS);
+		if ((screenRow < 0) || (screenRow >= A2TEXT_ROWS) || (column < 0) || (column >= A2TEXT_MAX_COLUMNS) || (length <= 0))
+		{
+			LogCompileError("invalid screen text var " + vj.dump());
+			return false;
+		}
+		FieldDef field;
+		field.type = VarType::ScreenText;
+		field.offset = (screenRow * A2TEXT_MAX_COLUMNS) + column;
+		field.length = static_cast<UINT16>(std::min(length, A2TEXT_MAX_COLUMNS - column));
+		cv.fieldId = static_cast<UINT16>(fields.size());
+		fields.push_back(field);
+		usesTextScreen = true;
+	}
+	else if (vj.contains("expr"))
+	{
+		FieldDef field;
+		field.type = VarType::Expression;
+		field.exprId = GetExpressionId(vj["expr"].get<string>(), (row ? row->record : ""));
+		if (field.exprId == PROFILE_NO_EXPR)
+			return false;
+		if (row != nullptr)
+		{
+			cv.base = row->base + (rowIndex * row->stride);
+			cv.pointerId = row->pointerId;
+		}
+		cv.fieldId = static_cast<UINT16>(fields.size());
+		fields.push_back(field);
+	}
+	else if (vj.contains("field"))
+	{
+		if (vj.contains("array"))
+		{
+			auto it = m_arrays.find(vj["array"].get<string>());
+			if (it == m_arrays.end())
+			{
+				LogCompileError("unknown array " + vj["array"].get<string>());
+				return false;
+			}
+			row = &it->second;
+			rowIndex = vj.value("index", 0);
+			if (rowIndex >= row->count)
+			{
+				LogCompileError("index out of range for array " + vj["array"].get<string>());
+				return false;
+			}
+		}
+		if (row == nullptr)
+		{
+			LogCompileError("field var outside of an array: " + vj.dump());
+			return false;
+		}
+		const RecordDef& rec = m_records.at(row->record);
+		string fieldName = vj["field"].get<string>();
+		auto fit = std::find(rec.fieldNames.begin(), rec.fieldNames.end(), fieldName);
+		if (fit == rec.fieldNames.end())
+		{
+			LogCompileError("unknown field " + row->record + "." + fieldName);
+			return false;
+		}
+		cv.fieldId = rec.firstField + static_cast<UINT16>(fit - rec.fieldNames.begin());
+		cv.base = row->base + (rowIndex * row->stride);
+		cv.pointerId = row->pointerId;
+	}
+	else
+	{
+		FieldDef field;
+		bool isIndirect = vj.contains("pointer");
+		if (isIndirect)
+			cv.pointerId = GetPointerId(vj);
+		if (!CompileField(vj, (isIndirect ? "offset" : "memstart"), !isIndirect, field))
+		{
+			// Keep the same leniency as before: an invalid var shows as an empty string
+			LogCompileError("invalid var " + vj.dump());
+		}
+		cv.fieldId = static_cast<UINT16>(fields.size());
+		fields.push_back(field);
+	}
+	if (vj.contains("history"))
+	{
+		int capacity = vj["history"];
+		const FieldDef& f = fields[cv.fieldId];
+		bool isNumeric = (f.type == VarType::IntBigEndian) || (f.type == VarType::IntLittleEndian)
+			|| (f.type == VarType::IntBigEndianLiteral) || (f.type == VarType::IntLittleEndianLiteral)
+			|| ((f.type == VarType::Expression) && !expressions[f.exprId].IsString());
+		if (!isNumeric || (capacity <= 0) || (capacity > static_cast<int>(PROFILE_MAX_HISTORY)))
+		{
+			LogCompileError("invalid history var " + vj.dump());
+			return false;
+		}
+		VarHistory h;
+		h.varId = static_cast<UINT16>(vars.size());
+		h.first = histories.empty() ? 0 : histories.back().first + histories.back().capacity;
+		h.capacity = static_cast<UINT32>(capacity);
+		cv.historyId = static_cast<UINT16>(histories.size());
+		histories.push_back(h);
+	}
+	vars.push_back(cv);
+	return true;
+}
+
+bool CompiledProfile::CompileField(const nlohmann::json& fj, const char* offsetKey, bool offsetRequired, FieldDef& field)
+{
+	if ((offsetRequired && (fj.count(offsetKey) != 1)) || (fj.count("length") != 1) || (fj.count("type") != 1))
+		return false;
+	auto it = s_varTypes.find(fj["type"].get<string>());
+	if (it == s_varTypes.end())
+		return false;
+	int length = fj["length"];
+	if ((length <= 0) || (length > UINT16_MAX))
+		return false;
+
+	field.offset = (fj.contains(offsetKey) ? static_cast<INT32>(ParseAddress(fj[offsetKey])) : 0);
+	field.length = static_cast<UINT16>(length);
+	field.type = it->second;
+	if (field.type == VarType::Lookup)
+	{
+		if (!fj.contains("lookup"))
+			return false;
+		field.lookupId = GetLookupId(fj["lookup"].get<string>());
+		if (field.lookupId == PROFILE_NO_LOOKUP)
+			return false;
+	}
+	return true;
+}
+
+// Resolve a lookup path like "/tables/spells" into a 256 entry table
+UINT16 CompiledProfile::GetLookupId(const std::string& path)
+{
+	auto it = m_lookupIds.find(path);
+	if (it != m_lookupIds.end())
+		return it->second;
+
+	LookupTable table;
+	try
+	{
+		char buf[5000];
+		for (UINT16 x = 0; x < PROFILE_LOOKUP_SIZE; x++)
+		{
+			snprintf(buf, 5000, "%s/0x%02x", path.c_str(), x);
+			nlohmann::json::json_pointer jp(buf);
+			table[x] = m_source->value(jp, PROFILE_LOOKUP_DEFAULT);
+		}
+	}
+	catch (exception& e)
+	{
+		LogCompileError("lookup " + path + ": " + e.what());
+		return PROFILE_NO_LOOKUP;
+	}
+	UINT16 id = static_cast<UINT16>(lookups.size());
+	lookups.push_back(std::move(table));
+	m_lookupIds[path] = id;
+	return id;
+}
+
+// Pointers are shared by every var and array that uses the same location and bank
+UINT16 CompiledProfile::GetPointerId(const nlohmann::json& j)
+{
+	PointerDef pd;
+	pd.address = static_cast<UINT32>(ParseAddress(j.at("pointer")));
+	pd.bank = j.value("bank", 0);
+	UINT64 key = (static_cast<UINT64>(pd.address) << 32) | pd.bank;
+	auto it = m_pointerIds.find(key);
+	if (it != m_pointerIds.end())
+		return it->second;
+	UINT16 id = static_cast<UINT16>(pointers.size());
+	pointers.push_back(pd);
+	m_pointerIds[key] = id;
+	return id;
+}
+
+// Expressions are shared by every var using the same source in the same record context
+UINT16 CompiledProfile::GetExpressionId(const std::string& source, const std::string& recordName)
+{
+	string key = recordName + "\n" + source;
+	auto it = m_exprIds.find(key);
+	if (it != m_exprIds.end())
+		return it->second;
+
+	m_exprRecord = (recordName.empty() ? nullptr : &m_records.at(recordName));
+	ProfileExpression expr;
+	string error;
+	bool ok = expr.Compile(source, this, error);
+	m_exprRecord = nullptr;
+	if (!ok)
+	{
+		LogCompileError("expression \"" + source + "\": " + error);
+		return PROFILE_NO_EXPR;
+	}
+	UINT16 id = static_cast<UINT16>(expressions.size());
+	expressions.push_back(std::move(expr));
+	m_exprIds[key] = id;
+	return id;
+}
+
+bool CompiledProfile::ResolveField(const std::string& arrayName, int index, const std::string& fieldName, ExprMemRef& ref)
+{
+	const RecordDef* rec = m_exprRecord;
+	const ArrayDef* arr = nullptr;
+	if (!arrayName.empty())
+	{
+		auto it = m_arrays.find(arrayName);
+		if ((it == m_arrays.end()) || (index < 0) || (index >= it->second.count))
+			return false;
+		arr = &it->second;
+		rec = &m_records.at(arr->record);
+	}
+	if (rec == nullptr)
+		return false;
+	auto fit = std::find(rec->fieldNames.begin(), rec->fieldNames.end(), fieldName);
+	if (fit == rec->fieldNames.end())
+		return false;
+	const FieldDef& f = fields[rec->firstField + (fit - rec->fieldNames.begin())];
+
+	switch (f.type)
+	{
+	case VarType::IntBigEndian:
+		ref.read = ExprRead::LowFirst;
+		break;
+	case VarType::IntLittleEndian:
+		ref.read = ExprRead::HighFirst;
+		break;
+	case VarType::IntBigEndianLiteral:
+		ref.read = ExprRead::LiteralLowFirst;
+		break;
+	case VarType::IntLittleEndianLiteral:
+		ref.read = ExprRead::LiteralHighFirst;
+		break;
+	case VarType::Lookup:
+		ref.lookupId = f.lookupId;
+		break;
+	default:
+		// Strings and other expressions can't be used in expressions
+		return false;
+	}
+	ref.length = f.length;
+	if (arr == nullptr)
+	{
+		ref.mode = ExprAddrMode::Row;
+		ref.offset = f.offset;
+	}
+	else
+	{
+		ref.mode = (arr->pointerId == PROFILE_NO_POINTER ? ExprAddrMode::Absolute : ExprAddrMode::Pointer);
+		ref.pointerId = arr->pointerId;
+		ref.offset = static_cast<INT32>(arr->base + (index * arr->stride)) + f.offset;
+	}
+	return true;
+}
+
+// Tables are named like in the profile's "tables", or by their full path
+UINT16 CompiledProfile::ResolveLookup(const std::string& table)
+{
+	UINT16 id = GetLookupId(table[0] == '/' ? table : "/tables/" + table);
+	return (id == PROFILE_NO_LOOKUP ? EXPRESSION_NO_LOOKUP : id);
+}
+
+void CompiledProfile::ResolvePointers(const UINT8* mem, int memsize)
+{
+	ResolvePointers(mem, memsize, m_resolvedPointers);
+}
+
+void CompiledProfile::ResolvePointers(const UINT8* mem, int memsize, std::vector<INT64>& resolved) const
+{
+	resolved.resize(pointers.size());
+	for (size_t i = 0; i < pointers.size(); i++)
+	{
+		const PointerDef& pd = pointers[i];
+		resolved[i] = PROFILE_UNRESOLVED;
+		if ((mem == nullptr) || (static_cast<INT64>(pd.address) + 2 > memsize))
+			continue;
+		INT64 target = (static_cast<INT64>(pd.bank) << 16) | mem[pd.address] | (mem[pd.address + 1] << 8);
+		if (target < memsize)
+			resolved[i] = target;
+	}
+}
+
+std::string CompiledProfile::SerializeVariable(const CompiledVar& var, const UINT8* mem, int memsize) const
+{
+	string s = "";
+	if (mem == nullptr)
+		return s;
+	const FieldDef& f = fields[var.fieldId];
+	if (f.type == VarType::ScreenText)
+	{
+		const string& line = textScreen.GetRow(static_cast<UINT8>(f.offset / A2TEXT_MAX_COLUMNS));
+		size_t column = f.offset % A2TEXT_MAX_COLUMNS;
+		if (column < line.size())
+			s = line.substr(column, f.length);
+		return s;
+	}
+	INT64 addr = static_cast<INT64>(var.base) + f.offset;
+	if (var.pointerId != PROFILE_NO_POINTER)
+	{
+		INT64 target = m_resolvedPointers[var.pointerId];
+		if (target == PROFILE_UNRESOLVED)
+			return s;
+		addr += target;
+	}
+	if (f.type == VarType::Expression)
+	{
+		// addr is the row base
+		ExprContext ctx;
+		ctx.mem = mem;
+		ctx.memsize = memsize;
+		ctx.rowBase = addr;
+		ctx.pointers = m_resolvedPointers.data();
+		ctx.lookups = lookups.data();
+		expressions[f.exprId].Evaluate(ctx, s);
+		return s;
+	}
+	if ((f.length == 0) || (addr < 0) || (addr + f.length > memsize))
+		return s;
+	const UINT8* p = mem + addr;
+
+	switch (f.type)
+	{
+	case VarType::Ascii:
+		for (size_t i = 0; i < f.length; i++)
+		{
+			if (p[i] == '\0')
+				break;
+			s.append(1, p[i]);
+		}
+		break;
+	case VarType::AsciiHigh:
+		// ASCII-high is basically ASCII shifted by 0x80
+		for (size_t i = 0; i < f.length; i++)
+		{
+			if (p[i] == '\0')
+				break;
+			s.append(1, (char)(p[i] - 0x80));
+		}
+		break;
+	case VarType::IntBigEndian:
+	{
+		UINT64 x = 0;
+		for (int i = std::min<int>(f.length, 8) - 1; i >= 0; i--)
+			x = (x << 8) | p[i];
+		s = to_string(x);
+		break;
+	}
+	case VarType::IntLittleEndian:
+	{
+		UINT64 x = 0;
+		for (int i = 0; i < std::min<int>(f.length, 8); i++)
+			x = (x << 8) | p[i];
+		s = to_string(x);
+		break;
+	}
+	case VarType::IntBigEndianLiteral:
+	{
+		char cbuf[3];
+		for (int i = 0; i < f.length; i++)
+		{
+			snprintf(cbuf, 3, "%.2x", p[i]);
+			s.insert(0, cbuf);
+		}
+		break;
+	}
+	case VarType::IntLittleEndianLiteral:
+	{
+		// int literal is like what is used in the Ultima games.
+		// Garriott stored ints as literals inside memory, so for example
+		// a hex 0x4523 is in fact the number 4523
+		char cbuf[3];
+		for (int i = 0; i < f.length; i++)
+		{
+			snprintf(cbuf, 3, "%.2x", p[i]);
+			s.append(cbuf);
+		}
+		break;
+	}
+	case VarType::Lookup:
+		s = lookups[f.lookupId][*p];
+		break;
+	default:
+		break;
+	}
+	return s;
+}
+
+std::string CompiledProfile::FormatBlockText(const CompiledBlock& block, const UINT8* mem, int memsize) const
+{
+	string txt = block.templateParts[0];
+	for (UINT16 i = 0; i < block.varCount; i++)
+	{
+		txt.append(SerializeVariable(vars[block.firstVar + i], mem, memsize));
+		txt.append(block.templateParts[i + 1]);
+	}
+	return txt;
+}
+
+// Blocks without a condition are always visible. A condition that can't be evaluated
+// (memory not available or pointer not resolved) hides the block.
+bool CompiledProfile::IsBlockVisible(const CompiledBlock& block, const UINT8* mem, int memsize) const
+{
+	if (block.visibleExprId == PROFILE_NO_EXPR)
+		return true;
+	ExprContext ctx;
+	ctx.mem = mem;
+	ctx.memsize = memsize;
+	ctx.rowBase = block.rowBase;
+	if (block.rowPointerId != PROFILE_NO_POINTER)
+	{
+		if (m_resolvedPointers[block.rowPointerId] == PROFILE_UNRESOLVED)
+			return false;
+		ctx.rowBase += m_resolvedPointers[block.rowPointerId];
+	}
+	ctx.pointers = m_resolvedPointers.data();
+	ctx.lookups = lookups.data();
+	INT32 result;
+	return expressions[block.visibleExprId].EvaluateInt(ctx, result) && (result != 0);
+}
+
+bool CompiledProfile::IsConditionTrue(UINT16 exprId, const UINT8* mem, int memsize) const
+{
+	return IsConditionTrue(exprId, mem, memsize, m_resolvedPointers.data());
+}
+
+bool CompiledProfile::IsConditionTrue(UINT16 exprId, const UINT8* mem, int memsize, const INT64* resolved) const
+{
+	ExprContext ctx;
+	ctx.mem = mem;
+	ctx.memsize = memsize;
+	ctx.pointers = resolved;
+	ctx.lookups = lookups.data();
+	INT32 result;
+	return expressions[exprId].EvaluateInt(ctx, result) && (result != 0);
+}
+
+bool CompiledProfile::EvaluatePublished(const CompiledPublished& value, const UINT8* mem, int memsize,
+	std::string& out) const
+{
+	ExprContext ctx;
+	ctx.mem = mem;
+	ctx.memsize = memsize;
+	ctx.pointers = m_resolvedPointers.data();
+	ctx.lookups = lookups.data();
+	return expressions[value.exprId].Evaluate(ctx, out);
+}
+
+bool CompiledProfile::EvaluatePublished(const CompiledPublished& value, const UINT8* mem, int memsize,
+	INT32& out) const
+{
+	ExprContext ctx;
+	ctx.mem = mem;
+	ctx.memsize = memsize;
+	ctx.pointers = m_resolvedPointers.data();
+	ctx.lookups = lookups.data();
+	return expressions[value.exprId].EvaluateInt(ctx, out);
+}
+
+void CompiledProfile::UpdateTextScreen(const UINT8* mem, int memsize)
+{
+	if (usesTextScreen)
+		textScreen.Update(mem, memsize);
+}
+
+// The values go through SerializeVariable() so that they are exactly what the blocks show.
+// Literal (BCD) vars read as their decimal digits. A value that can't be read isn't pushed.
+void CompiledProfile::UpdateHistories(UINT16 seq, const UINT8* mem, int memsize)
+{
+	if (histories.empty() || (mem == nullptr))
+		return;
+	if (m_historyStarted && (seq == m_historySeq))
+		return;
+	m_historyStarted = true;
+	m_historySeq = seq;
+	m_historyUpdates++;
+	for (auto& h : histories)
+	{
+		string s = SerializeVariable(vars[h.varId], mem, memsize);
+		if (s.empty())
+			continue;
+		historyValues[h.first + h.head] = static_cast<INT32>(strtoll(s.c_str(), nullptr, 10));
+		h.head = (h.head + 1 == h.capacity) ? 0 : h.head + 1;
+		if (h.count < h.capacity)
+			h.count++;
+	}
+}
+
+// Each column covers count / columns consecutive values. Drawing is then bounded by the width
+// of the graph whatever the history length, and spikes shorter than a column still show.
+UINT32 CompiledProfile::GetHistoryColumns(UINT16 historyId, UINT32 columns, INT32* colMin, INT32* colMax) const
+{
+	if (historyId >= histories.size())
+		return 0;
+	const VarHistory& h = histories[historyId];
+	const INT32* values = historyValues.data() + h.first;
+	UINT32 n = std::min(columns, h.count);
+	UINT32 pos = (h.head + h.capacity - h.count) % h.capacity;	// oldest value
+	UINT32 k = 0;
+	for (UINT32 c = 0; c < n; c++)
+	{
+		UINT32 end = static_cast<UINT32>((static_cast<UINT64>(c + 1) * h.count) / n);
+		INT32 lo = values[pos];
+		INT32 hi = lo;
+		for (; k < end; k++)
+		{
+			lo = std::min(lo, values[pos]);
+			hi = std::max(hi, values[pos]);
+			if (++pos == h.capacity)
+				pos = 0;
+		}
+		colMin[c] = lo;
+		colMax[c] = hi;
+	}
+	return n;
+}
@@ -0,0 +1,280 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include "Sidebar.h"
+#include "ProfileExpression.h"
+#include "A2TextScreen.h"
+#include "A2VideoRenderer.h"
+#include "nlohmann/json.hpp"
+
+/// <summary>
+/// CompiledProfile is the flattened, evaluation-ready form of a json profile.
+/// The json is walked once when the profile is activated, and every frame afterwards
+/// only touches the flat tables below instead of the json document.
+///
+/// Records and arrays let a profile describe repeating structures (party members,
+/// inventory slots...) once:
+///   - A record is a table of fields (offset, length, type) relative to a base address.
+///   - An array is a record instantiated count times at base + (i * stride).
+/// Every row of an array points to the same field table and only stores its own base.
+///
+/// Indirect vars and arrays follow a 16-bit pointer in RAM instead of using a fixed address.
+/// Each distinct pointer is dereferenced once per frame by ResolvePointers(), and all
+/// the vars going through it reuse the cached result.
+///
+/// Computed vars and record fields hold an expression instead of a memory location,
+/// which is compiled once into bytecode (see ProfileExpression). An expression in a record
+/// reads its sibling fields relative to the row, so it is shared by all the rows.
+///
+/// Blocks can have a "visible" expression. Hidden blocks are not formatted at all.
+///
+/// Screen text vars show a line of the Apple 2 text screen, decoded by textScreen.
+///
+/// Numeric vars flagged with "history" keep their last values in a ring buffer, pushed once per
+/// GameLink frame by UpdateHistories(). The ring buffers of all the vars share historyValues,
+/// which is allocated once when compiling, so the memory is bounded by the profile.
+/// Graph blocks draw the history of their var as a sparkline next to their text.
+///
+/// Triggers pair a condition expression with an action (see TriggerEngine, which evaluates them).
+/// Splits are the start, reset and segment conditions of the speedrun timer (see SplitTimer),
+/// shown by Timer blocks.
+///
+/// Published values are named expressions that other programs can subscribe to (see ValueServer).
+/// </summary>
+
+constexpr UINT16 PROFILE_MAX_ARRAY_COUNT = 256;
+constexpr UINT16 PROFILE_LOOKUP_SIZE = 256;
+constexpr UINT16 PROFILE_NO_LOOKUP = UINT16_MAX;
+constexpr UINT16 PROFILE_NO_POINTER = UINT16_MAX;
+constexpr UINT16 PROFILE_NO_EXPR = UINT16_MAX;
+constexpr UINT16 PROFILE_NO_HISTORY = UINT16_MAX;
+constexpr UINT32 PROFILE_MAX_HISTORY = 3600;	// a minute at 60 Hz
+constexpr INT64 PROFILE_UNRESOLVED = -1;
+
+enum class VarType : UINT8
+{
+	Ascii,
+	AsciiHigh,
+	IntBigEndian,
+	IntLittleEndian,
+	IntBigEndianLiteral,
+	IntLittleEndianLiteral,
+	Lookup,
+	Expression,
+	ScreenText,		// offset is row * A2TEXT_MAX_COLUMNS + column
+	Count
+};
+
+// One entry of a field table. Plain vars get their own entry with the
+// offset being the absolute memstart. Record fields are shared by all rows.
+struct FieldDef
+{
+	INT32 offset = 0;
+	UINT16 length = 0;
+	VarType type = VarType::Count;
+	UINT16 lookupId = PROFILE_NO_LOOKUP;	// index in CompiledProfile::lookups
+	UINT16 exprId = PROFILE_NO_EXPR;		// index in CompiledProfile::expressions
+};
+
+// A little-endian 16-bit pointer in RAM. What it points to is placed in the given 64K bank.
+struct PointerDef
+{
+	UINT32 address = 0;
+	UINT32 bank = 0;
+};
+
+struct CompiledVar
+{
+	UINT32 base = 0;		// row base address, 0 for plain vars
+	UINT16 fieldId = 0;		// index in CompiledProfile::fields
+	UINT16 pointerId = PROFILE_NO_POINTER;	// index in CompiledProfile::pointers, added to base
+	UINT16 historyId = PROFILE_NO_HISTORY;	// index in CompiledProfile::histories
+};
+
+// Ring buffer of the last values of a var, stored in CompiledProfile::historyValues
+struct VarHistory
+{
+	UINT16 varId = 0;		// index in CompiledProfile::vars
+	UINT32 first = 0;		// index in CompiledProfile::historyValues
+	UINT32 capacity = 0;
+	UINT32 head = 0;		// where the next value goes
+	UINT32 count = 0;
+};
+
+struct CompiledBlock
+{
+	UINT8 sidebarId = 0;
+	UINT8 blockId = 0;
+	BlockType type = BlockType::Empty;
+	FontDescriptors fontId = FontDescriptors::A2FontRegular;
+	DirectX::XMFLOAT4 color = { 1.f, 1.f, 1.f, 1.f };
+	// The template split around its placeholders, so there is always varCount + 1 parts
+	std::vector<std::string> templateParts;
+	UINT16 firstVar = 0;	// index in CompiledProfile::vars
+	UINT16 varCount = 0;
+	// Visibility condition, evaluated against the row when the block is in a Repeat
+	UINT16 visibleExprId = PROFILE_NO_EXPR;	// index in CompiledProfile::expressions
+	UINT32 rowBase = 0;
+	UINT16 rowPointerId = PROFILE_NO_POINTER;
+	UINT16 historyId = PROFILE_NO_HISTORY;	// Graph blocks: the history of their first var that has one
+};
+
+enum class TriggerMode : UINT8
+{
+	Edge,		// the action runs once each time the condition becomes true
+	Level,		// the action runs every interval frames while the condition is true
+};
+
+enum class TriggerActionType : UINT8
+{
+	Beep,
+	Log,
+	Screenshot,
+	Replay,
+	Count
+};
+
+struct CompiledTrigger
+{
+	std::string name;
+	UINT16 conditionExprId = PROFILE_NO_EXPR;	// index in CompiledProfile::expressions
+	TriggerMode mode = TriggerMode::Edge;
+	UINT32 debounce = 1;		// frames the condition must stay true before the action runs
+	UINT32 interval = 60;		// level triggers: frames between two runs of the action
+	TriggerActionType action = TriggerActionType::Beep;
+	UINT32 frequency = 880;		// beep, Hz
+	UINT32 duration = 150;		// beep, ms
+	std::string file;			// log
+	std::string message;		// log
+	bool videoOnly = false;		// screenshot, of the GameLink frame instead of the window
+};
+
+struct CompiledSplit
+{
+	std::string name;
+	UINT16 conditionExprId = PROFILE_NO_EXPR;	// index in CompiledProfile::expressions
+};
+
+struct CompiledPublished
+{
+	std::string name;
+	UINT16 exprId = PROFILE_NO_EXPR;	// index in CompiledProfile::expressions
+	bool isString = false;
+};
+
+struct CompiledSidebar
+{
+	SidebarTypes type = SidebarTypes::Right;
+	UINT16 size = 0;
+	UINT16 firstBlock = 0;	// index in CompiledProfile::blocks
+	UINT8 blockCount = 0;
+};
+
+// Lookup tables (LookupTable) are resolved for all 256 possible byte values at compile time
+
+class CompiledProfile : private IExpressionSymbols
+{
+public:
+	CompiledProfile();
+
+	// Flattens the json profile. Returns false and leaves the profile empty on error.
+	// error gets the messages of the compilation, one per line, including the warnings of a
+	// successful compilation.
+	bool Compile(const nlohmann::json& profile, std::string& error);
+	void Clear();
+
+	// Evaluation against an Apple 2 memory image (the GameLink RAM mapping or a dump).
+	// ResolvePointers() must be called once per frame before formatting any block.
+	void ResolvePointers(const UINT8* mem, int memsize);
+	std::string SerializeVariable(const CompiledVar& var, const UINT8* mem, int memsize) const;
+	std::string FormatBlockText(const CompiledBlock& block, const UINT8* mem, int memsize) const;
+	bool IsBlockVisible(const CompiledBlock& block, const UINT8* mem, int memsize) const;
+	// Evaluates a trigger or split condition
+	bool IsConditionTrue(UINT16 exprId, const UINT8* mem, int memsize) const;
+	// The same for another thread than the render loop, with its own cache of resolved pointers
+	void ResolvePointers(const UINT8* mem, int memsize, std::vector<INT64>& resolved) const;
+	bool IsConditionTrue(UINT16 exprId, const UINT8* mem, int memsize, const INT64* resolved) const;
+	// Evaluates a published value, numbers in decimal
+	bool EvaluatePublished(const CompiledPublished& value, const UINT8* mem, int memsize, std::string& out) const;
+	// Evaluates a published number, false for strings
+	bool EvaluatePublished(const CompiledPublished& value, const UINT8* mem, int memsize, INT32& out) const;
+	// Decodes the changed rows of the text screen, if the profile shows any. Once per frame.
+	void UpdateTextScreen(const UINT8* mem, int memsize);
+	// Pushes the value of every history var. Only once per GameLink frame sequence, after ResolvePointers().
+	void UpdateHistories(UINT16 seq, const UINT8* mem, int memsize);
+	// Decimates a history to at most columns min/max pairs, oldest first. Returns the number of columns filled,
+	// which is less than columns when the history doesn't have enough values yet.
+	UINT32 GetHistoryColumns(UINT16 historyId, UINT32 columns, INT32* colMin, INT32* colMax) const;
+	// Number of times values were pushed to the histories, to know when the graphs moved
+	UINT32 GetHistoryUpdates() const { return m_historyUpdates; }
+
+	std::string name;
+	std::vector<CompiledSidebar> sidebars;
+	std::vector<CompiledBlock> blocks;
+	std::vector<CompiledVar> vars;
+	std::vector<FieldDef> fields;
+	std::vector<LookupTable> lookups;
+	std::vector<PointerDef> pointers;
+	std::vector<ProfileExpression> expressions;
+	std::vector<VarHistory> histories;
+	std::vector<INT32> historyValues;
+	std::vector<CompiledTrigger> triggers;
+	UINT16 splitStartExprId;
+	UINT16 splitResetExprId;
+	std::vector<CompiledSplit> splits;
+	std::vector<CompiledPublished> published;
+	A2TextScreen textScreen;
+	bool usesTextScreen;
+	A2VideoMode videoMode;		// used to render the frame from memory when AppleWin doesn't send it
+
+private:
+	struct RecordDef
+	{
+		UINT16 firstField = 0;
+		UINT16 fieldCount = 0;
+		std::vector<std::string> fieldNames;
+	};
+	struct ArrayDef
+	{
+		std::string record;
+		UINT32 base = 0;
+		UINT32 stride = 0;
+		UINT16 count = 0;
+		UINT16 pointerId = PROFILE_NO_POINTER;
+	};
+
+	bool CompileProfile(const nlohmann::json& profile);
+	void LogCompileError(const std::string& msg);
+	bool CompileRecords(const nlohmann::json& profile);
+	bool CompileArrays(const nlohmann::json& profile);
+	bool CompileTriggers(const nlohmann::json& profile);
+	bool CompileSplits(const nlohmann::json& profile);
+	bool CompilePublished(const nlohmann::json& profile);
+	UINT16 GetConditionId(const std::string& source, const std::string& owner);
+	bool CompileBlock(const nlohmann::json& bj, UINT8 sidebarId, const ArrayDef* row, UINT16 rowIndex,
+		const std::string& parentVisible);
+	bool CompileVar(const nlohmann::json& vj, const ArrayDef* row, UINT16 rowIndex);
+	bool CompileField(const nlohmann::json& fj, const char* offsetKey, bool offsetRequired, FieldDef& field);
+	UINT16 GetLookupId(const std::string& path);
+	UINT16 GetPointerId(const nlohmann::json& j);
+	UINT16 GetExpressionId(const std::string& source, const std::string& recordName);
+
+	// IExpressionSymbols
+	bool ResolveField(const std::string& arrayName, int index, const std::string& fieldName, ExprMemRef& ref) override;
+	UINT16 ResolveLookup(const std::string& table) override;
+
+	const nlohmann::json* m_source;
+	std::string m_compileErrors;
+	std::map<std::string, RecordDef> m_records;
+	std::map<std::string, ArrayDef> m_arrays;
+	std::map<std::string, UINT16> m_lookupIds;
+	std::map<UINT64, UINT16> m_pointerIds;
+	std::map<std::string, UINT16> m_exprIds;
+	const RecordDef* m_exprRecord;			// record whose fields an expression can use by name
+	std::vector<INT64> m_resolvedPointers;	// per frame cache, one entry per pointer
+	bool m_historyStarted;					// m_historySeq is valid
+	UINT16 m_historySeq;					// frame sequence of the last values pushed to the histories
+	UINT32 m_historyUpdates;
+};
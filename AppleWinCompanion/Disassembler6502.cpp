@@ -0,0 +1,150 @@
+#include "pch.h"
+#include "Disassembler6502.h"
+
+struct OpcodeInfo
+{
+	const char* mnemonic;
+	AddressingMode mode;
+	bool cmos;		// only on the 65C02
+};
+
+using M = AddressingMode;
+
+static const OpcodeInfo s_opcodes[256] = {
+	// $00
+	{ "BRK", M::Implied, false }, { "ORA", M::IndirectX, false }, { "???", M::Implied, false }, { "???", M::Implied, false },
+	{ "TSB", M::ZeroPage, true }, { "ORA", M::ZeroPage, false }, { "ASL", M::ZeroPage, false }, { "???", M::Implied, false },
+	{ "PHP", M::Implied, false }, { "ORA", M::Immediate, false }, { "ASL", M::Accumulator, false }, { "???", M::Implied, false },
+	{ "TSB", M::Absolute, true }, { "ORA", M::Absolute, false }, { "ASL", M::Absolute, false }, { "???", M::Implied, false },
+	// $10
+	{ "BPL", M::Relative, false }, { "ORA", M::IndirectY, false }, { "ORA", M::ZeroPageIndirect, true }, { "???", M::Implied, false },
+	{ "TRB", M::ZeroPage, true }, { "ORA", M::ZeroPageX, false }, { "ASL", M::ZeroPageX, false }, { "???", M::Implied, false },
+	{ "CLC", M::Implied, false }, { "ORA", M::AbsoluteY, false }, { "INC", M::Accumulator, true }, { "???", M::Implied, false },
+	{ "TRB", M::Absolute, true }, { "ORA", M::AbsoluteX, false }, { "ASL", M::AbsoluteX, false }, { "???", M::Implied, false },
+	// $20
+	{ "JSR", M::Absolute, false }, { "AND", M::IndirectX, false }, { "???", M::Implied, false }, { "???", M::Implied, false },
+	{ "BIT", M::ZeroPage, false }, { "AND", M::ZeroPage, false }, { "ROL", M::ZeroPage, false }, { "???", M::Implied, false },
+	{ "PLP", M::Implied, false }, { "AND", M::Immediate, false }, { "ROL", M::Accumulator, false }, { "???", M::Implied, false },
+	{ "BIT", M::Absolute, false }, { "AND", M::Absolute, false }, { "ROL", M::Absolute, false }, { "???", M::Implied, false },
+	// $30
+	{ "BMI", M::Relative, false }, { "AND", M::IndirectY, false }, { "AND", M::ZeroPageIndirect, true }, { "???", M::Implied, false },
+	{ "BIT", M::ZeroPageX, true }, { "AND", M::ZeroPageX, false }, { "ROL", M::ZeroPageX, false }, { "???", M::Implied, false },
+	{ "SEC", M::Implied, false }, { "AND", M::AbsoluteY, false }, { "DEC", M::Accumulator, true }, { "???", M::Implied, false },
+	{ "BIT", M::AbsoluteX, true }, { "AND", M::AbsoluteX, false }, { "ROL", M::AbsoluteX, false }, { "???", M::Implied, false },
+	// $40
+	{ "RTI", M::Implied, false }, { "EOR", M::IndirectX, false }, { "???", M::Implied, false }, { "???", M::Implied, false },
+	{ "???", M::Implied, false }, { "EOR", M::ZeroPage, false }, { "LSR", M::ZeroPage, false }, { "???", M::Implied, false },
+	{ "PHA", M::Implied, false }, { "EOR", M::Immediate, false }, { "LSR", M::Accumulator, false }, { "???", M::Implied, false },
+	{ "JMP", M::Absolute, false }, { "EOR", M::Absolute, false }, { "LSR", M::Absolute, false }, { "???", M::Implied, false },
+	// $50
+	{ "BVC", M::Relative, false }, { "EOR", M::IndirectY, false }, { "EOR", M::ZeroPageIndirect, true }, { "???", M::Implied, false },
+	{ "???", M::Implied, false }, { "EOR", M::ZeroPageX, false }, { "LSR", M::ZeroPageX, false }, { "???", M::Implied, false },
+	{ "CLI", M::Implied, false }, { "EOR", M::AbsoluteY, false }, { "PHY", M::Implied, true }, { "???", M::Implied, false },
+	{ "???", M::Implied, false }, { "EOR", M::AbsoluteX, false }, { "LSR", M::AbsoluteX, false }, { "???", M::Implied, false },
+	// $60
+	{ "RTS", M::Implied, false }, { "ADC", M::IndirectX, false }, { "???", M::Implied, false }, { "???", M::Implied, false },
+	{ "STZ", M::ZeroPage, true }, { "ADC", M::ZeroPage, false }, { "ROR", M::ZeroPage, false }, { "???", M::Implied, false },
+	{ "PLA", M::Implied, false }, { "ADC", M::Immediate, false }, { "ROR", M::Accumulator, false }, { "???", M::Implied, false },
+	{ "JMP", M::Indirect, false }, { "ADC", M::Absolute, false }, { "ROR", M::Absolute, false }, { "???", M::Implied, false },
+	// $70
+	{ "BVS", M::Relative, false }, { "ADC", M::IndirectY, false }, { "ADC", M::ZeroPageIndirect, true }, { "???", M::Implied, false },
+	{ "STZ", M::ZeroPageX, true }, { "ADC", M::ZeroPageX, false }, { "ROR", M::ZeroPageX, false }, { "???", M::Implied, false },
+	{ "SEI", M::Implied, false }, { "ADC", M::AbsoluteY, false }, { "PLY", M::Implied, true }, { "???", M::Implied, false },
+	{ "JMP", M::AbsoluteIndirectX, true }, { "ADC", M::AbsoluteX, false }, { "ROR", M::AbsoluteX, false }, { "???", M::Implied, false },
+	// $80
+	{ "BRA", M::Relative, true }, { "STA", M::IndirectX, false }, { "???", M::Implied, false }, { "???", M::Implied, false },
+	{ "STY", M::ZeroPage, false }, { "STA", M::ZeroPage, false }, { "STX", M::ZeroPage, false }, { "???", M::Implied, false },
+	{ "DEY", M::Implied, false }, { "BIT", M::Immediate, true }, { "TXA", M::Implied, false }, { "???", M::Implied, false },
+	{ "STY", M::Absolute, false }, { "STA", M::Absolute, false }, { "STX", M::Absolute, false }, { "???", M::Implied, false },
+	// $90
+	{ "BCC", M::Relative, false }, { "STA", M::IndirectY, false }, { "STA", M::ZeroPageIndirect, true }, { "???", M::Implied, false },
+	{ "STY", M::ZeroPageX, false }, { "STA", M::ZeroPageX, false }, { "STX", M::ZeroPageY, false }, { "???", M::Implied, false },
+	{ "TYA", M::Implied, false }, { "STA", M::AbsoluteY, false }, { "TXS", M::Implied, false }, { "???", M::Implied, false },
+	{ "STZ", M::Absolute, true }, { "STA", M::AbsoluteX, false }, { "STZ", M::AbsoluteX, true }, { "???", M::Implied, false },
+	// $A0
+	{ "LDY", M::Immediate, false }, { "LDA", M::IndirectX, false }, { "LDX", M::Immediate, false }, { "???", M::Implied, false },
+	{ "LDY", M::ZeroPage, false }, { "LDA", M::ZeroPage, false }, { "LDX", M::ZeroPage, false }, { "???", M::Implied, false },
+	{ "TAY", M::Implied, false }, { "LDA", M::Immediate, false }, { "TAX", M::Implied, false }, { "???", M::Implied, false },
+	{ "LDY", M::Absolute, false }, { "LDA", M::Absolute, false }, { "LDX", M::Absolute, false }, { "???", M::Implied, false },
+	// $B0
+	{ "BCS", M::Relative, false }, { "LDA", M::IndirectY, false }, { "LDA", M::ZeroPageIndirect, true }, { "???", M::Implied, false },
+	{ "LDY", M::ZeroPageX, false }, { "LDA", M::ZeroPageX, false }, { "LDX", M::ZeroPageY, false }, { "???", M::Implied, false },
+	{ "CLV", M::Implied, false }, { "LDA", M::AbsoluteY, false }, { "TSX", M::Implied, false }, { "???", M::Implied, false },
+	{ "LDY", M::AbsoluteX, false }, { "LDA", M::AbsoluteX, false }, { "LDX", M::AbsoluteY, false }, { "???", M::Implied, false },
+	// $C0
+	{ "CPY", M::Immediate, false }, { "CMP", M::IndirectX, false }, { "???", M::Implied, false }, { "???", M::Implied, false },
+	{ "CPY", M::ZeroPage, false }, { "CMP", M::ZeroPage, false }, { "DEC", M::ZeroPage, false }, { "???", M::Implied, false },
+	{ "INY", M::Implied, false }, { "CMP", M::Immediate, false }, { "DEX", M::Implied, false }, { "???", M::Implied, false },
+	{ "CPY", M::Absolute, false }, { "CMP", M::Absolute, false }, { "DEC", M::Absolute, false }, { "???", M::Implied, false },
+	// $D0
+	{ "BNE", M::Relative, false }, { "CMP", M::IndirectY, false }, { "CMP", M::ZeroPageIndirect, true }, { "???", M::Implied, false },
+	{ "???", M::Implied, false }, { "CMP", M::ZeroPageX, false }, { "DEC", M::ZeroPageX, false }, { "???", M::Implied, false },
+	{ "CLD", M::Implied, false }, { "CMP", M::AbsoluteY, false }, { "PHX", M::Implied, true }, { "???", M::Implied, false },
+	{ "???", M::Implied, false }, { "CMP", M::AbsoluteX, false }, { "DEC", M::AbsoluteX, false }, { "???", M::Implied, false },
+	// $E0
+	{ "CPX", M::Immediate, false }, { "SBC", M::IndirectX, false }, { "???", M::Implied, false }, { "???", M::Implied, false },
+	{ "CPX", M::ZeroPage, false }, { "SBC", M::ZeroPage, false }, { "INC", M::ZeroPage, false }, { "???", M::Implied, false },
+	{ "INX", M::Implied, false }, { "SBC", M::Immediate, false }, { "NOP", M::Implied, false }, { "???", M::Implied, false },
+	{ "CPX", M::Absolute, false }, { "SBC", M::Absolute, false }, { "INC", M::Absolute, false }, { "???", M::Implied, false },
+	// $F0
+	{ "BEQ", M::Relative, false }, { "SBC", M::IndirectY, false }, { "SBC", M::ZeroPageIndirect, true }, { "???", M::Implied, false },
+	{ "???", M::Implied, false }, { "SBC", M::ZeroPageX, false }, { "INC", M::ZeroPageX, false }, { "???", M::Implied, false },
+	{ "SED", M::Implied, false }, { "SBC", M::AbsoluteY, false }, { "PLX", M::Implied, true }, { "???", M::Implied, false },
+	{ "???", M::Implied, false }, { "SBC", M::AbsoluteX, false }, { "INC", M::AbsoluteX, false }, { "???", M::Implied, false },
+};
+
+static const UINT8 s_modeLengths[static_cast<int>(AddressingMode::Count)] = {
+	1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2, 3, 2
+};
+
+static const OpcodeInfo s_undocumented = { "???", M::Implied, false };
+
+static const OpcodeInfo& GetInfo(UINT8 opcode, bool cmos)
+{
+	const OpcodeInfo& info = s_opcodes[opcode];
+	if (info.cmos && !cmos)
+		return s_undocumented;
+	return info;
+}
+
+UINT8 Disassembler6502::GetLength(UINT8 opcode, bool cmos)
+{
+	return s_modeLengths[static_cast<int>(GetInfo(opcode, cmos).mode)];
+}
+
+void Disassembler6502::Decode(UINT16 address, const UINT8* bytes, bool cmos, DisasmLine& line)
+{
+	const OpcodeInfo& info = GetInfo(bytes[0], cmos);
+	line.address = address;
+	line.length = s_modeLengths[static_cast<int>(info.mode)];
+	for (UINT8 i = 0; i < 3; i++)
+		line.bytes[i] = (i < line.length) ? bytes[i] : 0;
+
+	UINT8 zp = bytes[1];
+	UINT16 abs = static_cast<UINT16>(bytes[1] | (bytes[2] << 8));
+	char* t = line.text;
+	constexpr size_t n = DISASM_MAX_TEXT_LENGTH;
+	switch (info.mode)
+	{
+	case M::Implied:			snprintf(t, n, "%s", info.mnemonic); break;
+	case M::Accumulator:		snprintf(t, n, "%s A", info.mnemonic); break;
+	case M::Immediate:			snprintf(t, n, "%s #$%02X", info.mnemonic, zp); break;
+	case M::ZeroPage:			snprintf(t, n, "%s $%02X", info.mnemonic, zp); break;
+	case M::ZeroPageX:			snprintf(t, n, "%s $%02X,X", info.mnemonic, zp); break;
+	case M::ZeroPageY:			snprintf(t, n, "%s $%02X,Y", info.mnemonic, zp); break;
+	case M::Absolute:			snprintf(t, n, "%s $%04X", info.mnemonic, abs); break;
+	case M::AbsoluteX:			snprintf(t, n, "%s $%04X,X", info.mnemonic, abs); break;
+	case M::AbsoluteY:			snprintf(t, n, "%s $%04X,Y", info.mnemonic, abs); break;
+	case M::Indirect:			snprintf(t, n, "%s ($%04X)", info.mnemonic, abs); break;
+	case M::IndirectX:			snprintf(t, n, "%s ($%02X,X)", info.mnemonic, zp); break;
+	case M::IndirectY:			snprintf(t, n, "%s ($%02X),Y", info.mnemonic, zp); break;
+	case M::ZeroPageIndirect:	snprintf(t, n, "%s ($%02X)", info.mnemonic, zp); break;
+	case M::AbsoluteIndirectX:	snprintf(t, n, "%s ($%04X,X)", info.mnemonic, abs); break;
+	case M::Relative:
+		// The branch target, from the end of the instruction
+		snprintf(t, n, "%s $%04X", info.mnemonic, static_cast<UINT16>(address + 2 + static_cast<INT8>(zp)));
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/// <summary>
+/// Table driven decoder of the 6502 and 65C02 instructions, for the disassembly view.
+/// The 65C02 is the one of the enhanced Apple //e, without the Rockwell bit instructions.
+/// Opcodes that aren't documented for the chosen CPU decode to a 1 byte "???".
+/// </summary>
+
+enum class AddressingMode : UINT8
+{
+	Implied = 0,
+	Accumulator,
+	Immediate,
+	ZeroPage,
+	ZeroPageX,
+	ZeroPageY,
+	Absolute,
+	AbsoluteX,
+	AbsoluteY,
+	Indirect,
+	IndirectX,
+	IndirectY,
+	ZeroPageIndirect,		// 65C02
+	AbsoluteIndirectX,		// 65C02
+	Relative,
+	Count
+};
+
+constexpr size_t DISASM_MAX_TEXT_LENGTH = 16;
+
+struct DisasmLine
+{
+	UINT16 address = 0;
+	UINT8 length = 1;
+	UINT8 bytes[3] = {};
+	char text[DISASM_MAX_TEXT_LENGTH] = {};	// "LDA ($12),Y"
+};
+
+namespace Disassembler6502
+{
+	// Length in bytes of the instruction
+	UINT8 GetLength(UINT8 opcode, bool cmos);
+	// Decodes the instruction at address. bytes must have 3 readable bytes.
+	void Decode(UINT16 address, const UINT8* bytes, bool cmos, DisasmLine& line);
+}
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "DisassemblyDialog.h"
+#include "DisassemblyView.h"
+#include "GameLink.h"
+#include "resource.h"
+
+constexpr UINT DISASM_REFRESH_TIMER = 1;
+constexpr UINT DISASM_REFRESH_MS = 100;
+
+static HWND s_hDlg = NULL;
+static DisassemblyView s_view;
+
+// Rewrites the lines, only called when they changed
+static void RefreshLines()
+{
+	HWND hList = GetDlgItem(s_hDlg, IDC_DISASM_LINES);
+	SendMessage(hList, WM_SETREDRAW, FALSE, 0);
+	SendMessage(hList, LB_RESETCONTENT, 0, 0);
+	char buf[100];
+	for (const auto& line : s_view.GetLines())
+	{
+		int len = snprintf(buf, sizeof(buf), "%04X  ", line.address);
+		for (UINT8 i = 0; i < 3; i++)
+		{
+			if (i < line.length)
+				len += snprintf(buf + len, sizeof(buf) - len, "%02X ", line.bytes[i]);
+			else
+				len += snprintf(buf + len, sizeof(buf) - len, "   ");
+		}
+		snprintf(buf + len, sizeof(buf) - len, " %s", line.text);
+		SendMessageA(hList, LB_ADDSTRING, 0, reinterpret_cast<LPARAM>(buf));
+	}
+	SendMessage(hList, LB_SETCURSEL, s_view.GetPcIndex(), 0);
+	SendMessage(hList, WM_SETREDRAW, TRUE, 0);
+	InvalidateRect(hList, NULL, TRUE);
+}
+
+static void Update()
+{
+	if (!GameLink::IsActive())
+	{
+		SetDlgItemTextA(s_hDlg, IDC_DISASM_STATUS, "GameLink isn't active, start AppleWin first");
+		return;
+	}
+	UINT16 pc = GameLink::GetProgramCounter();
+	if (!s_view.Update(GameLink::GetFrameSequence(), pc, GameLink::GetMemoryBasePointer(), GameLink::GetMemorySize()))
+		return;
+	char buf[20];
+	snprintf(buf, sizeof(buf), "PC $%04X", pc);
+	SetDlgItemTextA(s_hDlg, IDC_DISASM_STATUS, buf);
+	RefreshLines();
+}
+
+static INT_PTR CALLBACK DisassemblyProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	UNREFERENCED_PARAMETER(lParam);
+	switch (message)
+	{
+	case WM_INITDIALOG:
+		s_hDlg = hDlg;
+		SendDlgItemMessage(hDlg, IDC_DISASM_LINES, WM_SETFONT, reinterpret_cast<WPARAM>(GetStockObject(ANSI_FIXED_FONT)), FALSE);
+		CheckDlgButton(hDlg, IDC_DISASM_CMOS, s_view.IsCmos() ? BST_CHECKED : BST_UNCHECKED);
+		Update();
+		SetTimer(hDlg, DISASM_REFRESH_TIMER, DISASM_REFRESH_MS, NULL);
+		return (INT_PTR)TRUE;
+
+	case WM_TIMER:
+		Update();
+		return (INT_PTR)TRUE;
+
+	case WM_COMMAND:
+		switch (LOWORD(wParam))
+		{
+		case IDC_DISASM_CMOS:
+			s_view.SetCmos(IsDlgButtonChecked(hDlg, IDC_DISASM_CMOS) == BST_CHECKED);
+			Update();
+			return (INT_PTR)TRUE;
+		case IDCANCEL:
+			DestroyWindow(hDlg);
+			return (INT_PTR)TRUE;
+		}
+		break;
+
+	case WM_DESTROY:
+		KillTimer(hDlg, DISASM_REFRESH_TIMER);
+		s_view.Invalidate();
+		s_hDlg = NULL;
+		break;
+	}
+	return (INT_PTR)FALSE;
+}
+
+void DisassemblyDialog::Show(HINSTANCE hInstance, HWND parent)
+{
+	if (s_hDlg == NULL)
+		CreateDialog(hInstance, MAKEINTRESOURCE(IDD_DISASSEMBLY), parent, DisassemblyProc);
+	if (s_hDlg != NULL)
+	{
+		ShowWindow(s_hDlg, SW_SHOW);
+		SetForegroundWindow(s_hDlg);
+	}
+}
+
+bool DisassemblyDialog::HandleMessage(MSG* msg)
+{
+	return (s_hDlg != NULL) && IsDialogMessage(s_hDlg, msg);
+}
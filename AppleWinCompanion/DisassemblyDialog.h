@@ -0,0 +1,14 @@
+#pragma once
+
+/// <summary>
+/// The Disassembly panel: a modeless dialog showing the code around the 6502 PC,
+/// following it live through the GameLink peek channel.
+/// </summary>
+
+namespace DisassemblyDialog
+{
+	// Opens the panel, or brings it to the front if it is already open
+	void Show(HINSTANCE hInstance, HWND parent);
+	// Lets the panel handle its keyboard navigation. Returns true if the message was for the panel.
+	bool HandleMessage(MSG* msg);
+}
@@ -0,0 +1,125 @@
+#include "pch.h"
+#include "DisassemblyView.h"
+
+constexpr UINT32 DISASM_MAX_INSTRUCTION_LENGTH = 3;
+
+DisassemblyView::DisassemblyView()
+{
+	m_pages.resize(256);
+	m_cmos = true;
+	Invalidate();
+}
+
+void DisassemblyView::SetCmos(bool cmos)
+{
+	if (cmos == m_cmos)
+		return;
+	m_cmos = cmos;
+	Invalidate();
+}
+
+void DisassemblyView::Invalidate()
+{
+	for (auto& page : m_pages)
+		page.reset();
+	m_lines.clear();
+	m_pcIndex = 0;
+	m_dirty = true;
+	m_started = false;
+	m_seq = 0;
+	m_pc = 0;
+}
+
+bool DisassemblyView::RefreshPage(UINT8 page, const UINT8* mem)
+{
+	const UINT8* cur = mem + (page << 8);
+	// The 2 operand bytes after the page wrap around to the zero page after $FFFF
+	UINT8 next0 = mem[static_cast<UINT16>((page << 8) + 256)];
+	UINT8 next1 = mem[static_cast<UINT16>((page << 8) + 257)];
+	auto& cached = m_pages[page];
+	if (cached)
+	{
+		if ((memcmp(cached->bytes.data(), cur, 256) == 0) && (cached->bytes[256] == next0) && (cached->bytes[257] == next1))
+			return false;
+	}
+	else
+	{
+		cached = std::make_unique<CachedPage>();
+	}
+	memcpy(cached->bytes.data(), cur, 256);
+	cached->bytes[256] = next0;
+	cached->bytes[257] = next1;
+	cached->decoded.reset();
+	return true;
+}
+
+const DisasmLine& DisassemblyView::GetLine(UINT16 address)
+{
+	CachedPage& page = *m_pages[address >> 8];
+	UINT8 offset = address & 0xFF;
+	if (!page.decoded.test(offset))
+	{
+		Disassembler6502::Decode(address, &page.bytes[offset], m_cmos, page.lines[offset]);
+		page.decoded.set(offset);
+	}
+	return page.lines[offset];
+}
+
+bool DisassemblyView::Update(UINT16 seq, UINT16 pc, const UINT8* mem, size_t size)
+{
+	if ((mem == nullptr) || (size < 0x10000))
+		return false;
+	if (m_started && (seq == m_seq))
+		return false;
+	m_started = true;
+	m_seq = seq;
+
+	// Refresh every page the lines can reach, and only rebuild them if something changed
+	constexpr UINT32 bytesBefore = DISASM_LINES_BEFORE * DISASM_MAX_INSTRUCTION_LENGTH;
+	constexpr UINT32 bytesAfter = (DISASM_LINES_AFTER + 1) * DISASM_MAX_INSTRUCTION_LENGTH;
+	UINT8 firstPage = static_cast<UINT16>(pc - bytesBefore) >> 8;
+	UINT8 pageCount = static_cast<UINT8>((static_cast<UINT16>(pc + bytesAfter) >> 8) - firstPage) + 1;
+	bool changed = m_dirty || (pc != m_pc);
+	for (UINT8 i = 0; i < pageCount; i++)
+	{
+		if (RefreshPage(static_cast<UINT8>(firstPage + i), mem))
+			changed = true;
+	}
+	if (!changed)
+		return false;
+	m_dirty = false;
+	m_pc = pc;
+	m_lines.clear();
+
+	// The lines before the PC are ambiguous. Use the farthest start address whose
+	// instructions end exactly at the PC, it is the most likely to be in sync.
+	for (UINT32 back = bytesBefore; back > 0; back--)
+	{
+		UINT16 address = static_cast<UINT16>(pc - back);
+		UINT32 remaining = back;
+		while (remaining > 0)
+		{
+			const DisasmLine& line = GetLine(address);
+			if (line.length > remaining)
+				break;
+			m_lines.push_back(line);
+			address += line.length;
+			remaining -= line.length;
+		}
+		if (remaining == 0)
+			break;
+		m_lines.clear();
+	}
+	if (m_lines.size() > DISASM_LINES_BEFORE)
+		m_lines.erase(m_lines.begin(), m_lines.end() - DISASM_LINES_BEFORE);
+	m_pcIndex = m_lines.size();
+
+	UINT16 address = pc;
+	for (UINT32 i = 0; i <= DISASM_LINES_AFTER; i++)
+	{
+		const DisasmLine& line = GetLine(address);
+		m_lines.push_back(line);
+		address += line.length;
+	}
+	return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <bitset>
+#include <memory>
+#include "Disassembler6502.h"
+
+/// <summary>
+/// DisassemblyView keeps the disassembly of the main memory around the 6502 PC.
+///
+/// The decoded instructions are cached per 256 byte page, one per starting offset, and decoded
+/// on demand. Each cached page keeps a copy of its bytes and of the 2 bytes after it, which hold
+/// the operands of its last instructions. When the copy differs from the memory the page is
+/// decoded again, so code that modifies itself, or that is loaded over older code, always shows
+/// up as it will run. When the PC and the pages around it didn't change, Update() is only
+/// these compares and nothing is decoded or rebuilt.
+///
+/// The code is read from the main 64K of the GameLink memory. Above $D000 this is the language
+/// card RAM, which is what runs unless the ROM is banked in.
+/// </summary>
+
+constexpr UINT32 DISASM_LINES_BEFORE = 8;
+constexpr UINT32 DISASM_LINES_AFTER = 24;
+
+class DisassemblyView
+{
+public:
+	DisassemblyView();
+
+	// Clears the cache when the CPU changes
+	void SetCmos(bool cmos);
+	bool IsCmos() const { return m_cmos; }
+	// Forgets the cached pages and lines
+	void Invalidate();
+
+	// Updates the lines around the pc. Calls with the same seq are ignored.
+	// Returns true if the lines changed.
+	bool Update(UINT16 seq, UINT16 pc, const UINT8* mem, size_t size);
+
+	const std::vector<DisasmLine>& GetLines() const { return m_lines; }
+	// Index of the line at the PC
+	size_t GetPcIndex() const { return m_pcIndex; }
+
+private:
+	struct CachedPage
+	{
+		std::array<UINT8, 256 + 2> bytes;
+		std::array<DisasmLine, 256> lines;
+		std::bitset<256> decoded;
+	};
+
+	// Returns true if the page changed since it was cached
+	bool RefreshPage(UINT8 page, const UINT8* mem);
+	const DisasmLine& GetLine(UINT16 address);
+
+	std::vector<std::unique_ptr<CachedPage>> m_pages;
+	std::vector<DisasmLine> m_lines;
+	size_t m_pcIndex;
+	bool m_cmos;
+	bool m_dirty;
+	bool m_started;
+	UINT16 m_seq;
+	UINT16 m_pc;
+};
@@ -0,0 +1,554 @@
+#include "pch.h"
+#include "FrameCapture.h"
+#include "SessionRecorder.h"
+#include "Tracer.h"
+#include <wincodec.h>
+#include <ctime>
+
+using Microsoft::WRL::ComPtr;
+
+std::atomic<UINT32> FrameCapture::s_requests = 0;
+
+#pragma region WIC encoding
+
+static bool WicFailed(HRESULT hr, const char* what, std::string& error)
+{
+	if (SUCCEEDED(hr))
+		return false;
+	char buf[100];
+	snprintf(buf, 100, "%s failed (0x%08lx)", what, static_cast<unsigned long>(hr));
+	error = buf;
+	return true;
+}
+
+static bool CreateWicEncoder(const std::filesystem::path& path, const GUID& container,
+	ComPtr<IWICImagingFactory>& factory, ComPtr<IWICStream>& stream, ComPtr<IWICBitmapEncoder>& encoder, std::string& error)
+{
+	if (WicFailed(CoCreateInstance(CLSID_WICImagingFactory2, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory)),
+		"Creating the imaging factory", error))
+		return false;
+	if (WicFailed(factory->CreateStream(&stream), "Creating the stream", error)
+		|| WicFailed(stream->InitializeFromFilename(path.c_str(), GENERIC_WRITE), "Creating the file", error)
+		|| WicFailed(factory->CreateEncoder(container, nullptr, &encoder), "Creating the encoder", error)
+		|| WicFailed(encoder->Initialize(stream.Get(), WICBitmapEncoderNoCache), "Initializing the encoder", error))
+		return false;
+	return true;
+}
+
+bool FrameCapture::WritePng(const std::filesystem::path& path, const UINT8* pixels, UINT32 width, UINT32 height,
+	std::string& error)
+{
+	ComPtr<IWICImagingFactory> factory;
+	ComPtr<IWICStream> stream;
+	ComPtr<IWICBitmapEncoder> encoder;
+	if (!CreateWicEncoder(path, GUID_ContainerFormatPng, factory, stream, encoder, error))
+		return false;
+	ComPtr<IWICBitmapFrameEncode> frame;
+	ComPtr<IPropertyBag2> props;
+	ComPtr<IWICBitmap> bitmap;
+	// The encoder converts from the bitmap format to the frame format
+	WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+	if (WicFailed(encoder->CreateNewFrame(&frame, &props), "Creating the frame", error)
+		|| WicFailed(frame->Initialize(props.Get()), "Initializing the frame", error)
+		|| WicFailed(frame->SetSize(width, height), "Setting the size", error)
+		|| WicFailed(frame->SetPixelFormat(&format), "Setting the pixel format", error)
+		|| WicFailed(factory->CreateBitmapFromMemory(width, height, GUID_WICPixelFormat32bppBGR, width * 4,
+			width * height * 4, const_cast<BYTE*>(pixels), &bitmap), "Creating the bitmap", error)
+		|| WicFailed(frame->WriteSource(bitmap.Get(), nullptr), "Writing the pixels", error)
+		|| WicFailed(frame->Commit(), "Committing the frame", error)
+		|| WicFailed(encoder->Commit(), "Committing the file", error))
+		return false;
+	return true;
+}
+
+// Animated GIF, looping forever. Each frame gets its own palette of the 256 colors WIC picks,
+// which is plenty for Apple 2 video.
+class GifWriter
+{
+public:
+	bool Open(const std::filesystem::path& path, UINT32 width, UINT32 height, std::string& error)
+	{
+		m_width = width;
+		m_height = height;
+		if (!CreateWicEncoder(path, GUID_ContainerFormatGif, m_factory, m_stream, m_encoder, error))
+			return false;
+		ComPtr<IWICMetadataQueryWriter> meta;
+		if (WicFailed(m_encoder->GetMetadataQueryWriter(&meta), "Getting the metadata writer", error))
+			return false;
+		PROPVARIANT v;
+		PropVariantInit(&v);
+		v.vt = VT_UI1 | VT_VECTOR;
+		v.caub.cElems = 11;
+		v.caub.pElems = const_cast<UCHAR*>(reinterpret_cast<const UCHAR*>("NETSCAPE2.0"));
+		if (WicFailed(meta->SetMetadataByName(L"/appext/application", &v), "Setting the application extension", error))
+			return false;
+		UCHAR loop[5] = { 3, 1, 0, 0, 0 };		// loop count 0, forever
+		v.caub.cElems = 5;
+		v.caub.pElems = loop;
+		return !WicFailed(meta->SetMetadataByName(L"/appext/data", &v), "Setting the loop count", error);
+	}
+
+	bool AddFrame(const UINT8* pixels, UINT16 delayCs, std::string& error)
+	{
+		ComPtr<IWICBitmapFrameEncode> frame;
+		ComPtr<IWICBitmap> bitmap;
+		ComPtr<IWICPalette> palette;
+		ComPtr<IWICFormatConverter> converter;
+		ComPtr<IWICMetadataQueryWriter> meta;
+		WICPixelFormatGUID format = GUID_WICPixelFormat8bppIndexed;
+		if (WicFailed(m_encoder->CreateNewFrame(&frame, nullptr), "Creating the frame", error)
+			|| WicFailed(frame->Initialize(nullptr), "Initializing the frame", error)
+			|| WicFailed(frame->SetSize(m_width, m_height), "Setting the size", error)
+			|| WicFailed(frame->SetPixelFormat(&format), "Setting the pixel format", error)
+			|| WicFailed(m_factory->CreateBitmapFromMemory(m_width, m_height, GUID_WICPixelFormat32bppBGR, m_width * 4,
+				m_width * m_height * 4, const_cast<BYTE*>(pixels), &bitmap), "Creating the bitmap", error)
+			|| WicFailed(m_factory->CreatePalette(&palette), "Creating the palette", error)
+			|| WicFailed(palette->InitializeFromBitmap(bitmap.Get(), 256, FALSE), "Computing the palette", error)
+			|| WicFailed(m_factory->CreateFormatConverter(&converter), "Creating the converter", error)
+			|| WicFailed(converter->Initialize(bitmap.Get(), GUID_WICPixelFormat8bppIndexed, WICBitmapDitherTypeNone,
+				palette.Get(), 0., WICBitmapPaletteTypeCustom), "Converting the pixels", error)
+			|| WicFailed(frame->SetPalette(palette.Get()), "Setting the palette", error)
+			|| WicFailed(frame->GetMetadataQueryWriter(&meta), "Getting the metadata writer", error))
+			return false;
+		PROPVARIANT v;
+		PropVariantInit(&v);
+		v.vt = VT_UI2;
+		v.uiVal = delayCs;
+		if (WicFailed(meta->SetMetadataByName(L"/grctlext/Delay", &v), "Setting the delay", error)
+			|| WicFailed(frame->WriteSource(converter.Get(), nullptr), "Writing the pixels", error)
+			|| WicFailed(frame->Commit(), "Committing the frame", error))
+			return false;
+		return true;
+	}
+
+	bool Close(std::string& error)
+	{
+		return !WicFailed(m_encoder->Commit(), "Committing the file", error);
+	}
+
+private:
+	UINT32 m_width = 0;
+	UINT32 m_height = 0;
+	ComPtr<IWICImagingFactory> m_factory;
+	ComPtr<IWICStream> m_stream;
+	ComPtr<IWICBitmapEncoder> m_encoder;
+};
+
+#pragma endregion
+
+FrameCapture::FrameCapture()
+{
+	m_running = false;
+	m_fileCount = 0;
+	m_clipPending = false;
+	m_stopping = false;
+	m_replayEnabled = false;
+	m_replayStarted = false;
+	m_replaySeq = 0;
+	m_ringWidth = 0;
+	m_ringHeight = 0;
+	m_ringBytes = 0;
+	m_ringKeyframes = 0;
+	m_sinceKeyframe = 0;
+	m_screenshotsSaved = 0;
+	m_screenshotsDropped = 0;
+	m_clipsSaved = 0;
+	m_clipsDropped = 0;
+	m_failures = 0;
+	m_replayFramesDropped = 0;
+}
+
+FrameCapture::~FrameCapture()
+{
+	Stop();
+}
+
+void FrameCapture::Start(const std::filesystem::path& directory)
+{
+	Stop();
+	m_directory = directory;
+	m_startTime = std::chrono::steady_clock::now();
+	m_pool.clear();
+	m_free.clear();
+	m_replayPool.clear();
+	m_replayFree.clear();
+	for (UINT32 i = 0; i < CAPTURE_BUFFER_COUNT; i++)
+	{
+		m_pool.push_back(std::make_unique<CaptureBuffer>());
+		m_free.push_back(m_pool.back().get());
+	}
+	for (UINT32 i = 0; i < REPLAY_BUFFER_COUNT; i++)
+	{
+		m_replayPool.push_back(std::make_unique<CaptureBuffer>());
+		m_replayFree.push_back(m_replayPool.back().get());
+	}
+	m_stopping = false;
+	for (UINT32 i = 0; i < CAPTURE_THREAD_COUNT; i++)
+		m_encoders.emplace_back(&FrameCapture::EncoderThread, this);
+	m_replayThread = std::thread(&FrameCapture::ReplayThread, this);
+	m_running = true;
+}
+
+void FrameCapture::Stop()
+{
+	if (!m_running)
+		return;
+	m_running = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_cv.notify_all();
+	m_replayCv.notify_one();
+	// The pending screenshots and clip are written first
+	for (auto& t : m_encoders)
+		t.join();
+	m_encoders.clear();
+	m_replayThread.join();
+	m_jobs.clear();
+	m_replayPending.clear();
+	m_clipPending = false;
+}
+
+void FrameCapture::Request(CaptureRequest request)
+{
+	s_requests.fetch_or(static_cast<UINT32>(request));
+}
+
+UINT32 FrameCapture::TakeRequests()
+{
+	if (s_requests.load(std::memory_order_relaxed) == 0)
+		return 0;
+	return s_requests.exchange(0);
+}
+
+UINT32 FrameCapture::GetTimeMs() const
+{
+	return static_cast<UINT32>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - m_startTime).count());
+}
+
+// The one copy of the render thread, which also turns bottom-up frames top-down
+void FrameCapture::CopyPixels(CaptureBuffer& c, const UINT8* pixels, UINT32 width, UINT32 height, INT32 rowPitch)
+{
+	const size_t rowSize = static_cast<size_t>(width) * 4;
+	c.pixels.resize(rowSize * height);
+	c.width = width;
+	c.height = height;
+	if (rowPitch == static_cast<INT32>(rowSize))
+	{
+		memcpy(c.pixels.data(), pixels, c.pixels.size());
+		return;
+	}
+	for (UINT32 y = 0; y < height; y++)
+		memcpy(c.pixels.data() + y * rowSize, pixels + static_cast<ptrdiff_t>(y) * rowPitch, rowSize);
+}
+
+bool FrameCapture::SaveScreenshot(const UINT8* pixels, UINT32 width, UINT32 height, INT32 rowPitch, const char* suffix)
+{
+	if (!m_running || (pixels == nullptr) || (width == 0) || (height == 0))
+		return false;
+	CaptureBuffer* c = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_free.empty())
+		{
+			c = m_free.front();
+			m_free.pop_front();
+		}
+	}
+	if (c == nullptr)
+	{
+		m_screenshotsDropped++;
+		return false;
+	}
+	CopyPixels(*c, pixels, width, height, rowPitch);
+	c->suffix = suffix;
+	c->timeMs = GetTimeMs();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Job job;
+		job.screenshot = c;
+		m_jobs.push_back(std::move(job));
+	}
+	m_cv.notify_one();
+	return true;
+}
+
+void FrameCapture::SetReplayEnabled(bool enabled)
+{
+	m_replayEnabled = enabled;
+	m_replayStarted = false;
+	if (!enabled)
+	{
+		std::lock_guard<std::mutex> lock(m_ringMutex);
+		m_ring.clear();
+		m_ringBytes = 0;
+		m_ringKeyframes = 0;
+		m_ringWidth = 0;
+		m_ringHeight = 0;
+	}
+}
+
+void FrameCapture::AddReplayFrame(UINT16 seq, const UINT8* pixels, UINT32 width, UINT32 height, INT32 rowPitch)
+{
+	if (!m_running || !m_replayEnabled || (pixels == nullptr) || (width == 0) || (height == 0))
+		return;
+	if (m_replayStarted && (seq == m_replaySeq))
+		return;
+	m_replayStarted = true;
+	m_replaySeq = seq;
+	CaptureBuffer* c = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_replayFree.empty())
+		{
+			c = m_replayFree.front();
+			m_replayFree.pop_front();
+		}
+	}
+	if (c == nullptr)
+	{
+		// The next frame is encoded against the last one that made it, the ring stays valid
+		m_replayFramesDropped++;
+		return;
+	}
+	CopyPixels(*c, pixels, width, height, rowPitch);
+	c->timeMs = GetTimeMs();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_replayPending.push_back(c);
+	}
+	m_replayCv.notify_one();
+}
+
+bool FrameCapture::SaveReplay()
+{
+	if (!m_running)
+		return false;
+	Job job;
+	{
+		std::lock_guard<std::mutex> lock(m_ringMutex);
+		// The deltas are shared, the copy is only of their pointers
+		job.clip.assign(m_ring.begin(), m_ring.end());
+		job.width = m_ringWidth;
+		job.height = m_ringHeight;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (job.clip.empty() || m_clipPending)
+		{
+			m_clipsDropped++;
+			return false;
+		}
+		m_clipPending = true;
+		m_jobs.push_back(std::move(job));
+	}
+	m_cv.notify_one();
+	return true;
+}
+
+FrameCaptureStats FrameCapture::GetStats() const
+{
+	FrameCaptureStats stats;
+	stats.screenshotsSaved = m_screenshotsSaved;
+	stats.screenshotsDropped = m_screenshotsDropped;
+	stats.clipsSaved = m_clipsSaved;
+	stats.clipsDropped = m_clipsDropped;
+	stats.failures = m_failures;
+	stats.replayFramesDropped = m_replayFramesDropped;
+	std::lock_guard<std::mutex> lock(m_ringMutex);
+	stats.replayFrames = static_cast<UINT32>(m_ring.size());
+	stats.replayBytes = m_ringBytes;
+	if (!m_ring.empty())
+		stats.replayMs = m_ring.back().timeMs - m_ring.front().timeMs;
+	return stats;
+}
+
+// Captures/YYYYMMDD-HHMMSS-N-suffix.ext, N counting the files of this run
+std::filesystem::path FrameCapture::NextPath(const std::string& suffix, const char* extension)
+{
+	char name[100];
+	time_t now = time(nullptr);
+	tm tmNow;
+	localtime_s(&tmNow, &now);
+	size_t len = strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tmNow);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	snprintf(name + len, sizeof(name) - len, "-%u-%s%s", ++m_fileCount, suffix.c_str(), extension);
+	std::error_code ec;
+	std::filesystem::create_directories(m_directory, ec);
+	return m_directory / name;
+}
+
+void FrameCapture::EncoderThread()
+{
+	Tracer::SetThreadName("Capture encoder");
+	// WIC is COM
+	HRESULT hrCom = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+			if (m_jobs.empty())
+				break;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		TraceScope trace(job.screenshot ? "Encode screenshot" : "Encode replay");
+		std::string error;
+		std::filesystem::path path;
+		bool ok;
+		if (job.screenshot)
+		{
+			path = NextPath(job.screenshot->suffix, ".png");
+			ok = WritePng(path, job.screenshot->pixels.data(), job.screenshot->width, job.screenshot->height, error);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_free.push_back(job.screenshot);
+		}
+		else
+		{
+			path = NextPath("replay", ".gif");
+			ok = WriteClip(job, path, error);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_clipPending = false;
+		}
+		if (ok)
+		{
+			(job.screenshot ? m_screenshotsSaved : m_clipsSaved)++;
+		}
+		else
+		{
+			m_failures++;
+			char buf[500];
+			snprintf(buf, 500, "Capture: couldn't write %s: %s\n", path.string().c_str(), error.c_str());
+			OutputDebugStringA(buf);
+		}
+	}
+	if (SUCCEEDED(hrCom))
+		CoUninitialize();
+}
+
+// Decodes the ring from its first keyframe, and keeps a frame every REPLAY_CLIP_FRAME_MS at most.
+// Each GIF frame lasts until the next one kept, in hundredths of a second.
+bool FrameCapture::WriteClip(const Job& job, const std::filesystem::path& path, std::string& error)
+{
+	std::vector<size_t> kept;
+	for (size_t i = 0; i < job.clip.size(); i++)
+	{
+		if (kept.empty() || (job.clip[i].timeMs - job.clip[kept.back()].timeMs >= REPLAY_CLIP_FRAME_MS))
+			kept.push_back(i);
+	}
+	GifWriter gif;
+	if (!gif.Open(path, job.width, job.height, error))
+		return false;
+	const size_t frameSize = static_cast<size_t>(job.width) * job.height * 4;
+	std::vector<UINT8> frame(frameSize);
+	size_t next = 0;
+	UINT32 endCs = 0;		// when the previous GIF frame ended, rounding carried over
+	for (size_t i = 0; (i < job.clip.size()) && (next < kept.size()); i++)
+	{
+		const ReplayFrame& f = job.clip[i];
+		if (f.key)
+			std::fill_n(reinterpret_cast<UINT32*>(frame.data()), frameSize / 4, REPLAY_KEY_PIXEL);
+		if (!SessionCodec::ApplyDelta(f.delta->data(), f.delta->size(), frame.data(), frameSize))
+		{
+			error = "corrupted replay frame";
+			return false;
+		}
+		if (i != kept[next])
+			continue;
+		next++;
+		UINT32 endMs = (next < kept.size()) ? job.clip[kept[next]].timeMs : f.timeMs + REPLAY_CLIP_FRAME_MS;
+		UINT32 end = (endMs - job.clip[kept[0]].timeMs + 5) / 10;
+		UINT16 delay = static_cast<UINT16>(std::max(2u, end - std::min(end, endCs)));
+		endCs += delay;
+		if (!gif.AddFrame(frame.data(), delay, error))
+			return false;
+	}
+	return gif.Close(error);
+}
+
+void FrameCapture::ReplayThread()
+{
+	Tracer::SetThreadName("Instant replay");
+	for (;;)
+	{
+		CaptureBuffer* c = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_replayCv.wait(lock, [this] { return m_stopping || !m_replayPending.empty(); });
+			if (m_stopping)
+				break;
+			c = m_replayPending.front();
+			m_replayPending.pop_front();
+		}
+		{
+			TraceScope trace("Replay frame");
+			AppendReplayFrame(*c);
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_replayFree.push_back(c);
+	}
+}
+
+void FrameCapture::AppendReplayFrame(CaptureBuffer& c)
+{
+	const size_t frameSize = c.pixels.size();
+	ReplayFrame f;
+	f.timeMs = c.timeMs;
+	{
+		// A new video size (or a restart after being disabled) starts over with a keyframe
+		std::lock_guard<std::mutex> lock(m_ringMutex);
+		f.key = (c.width != m_ringWidth) || (c.height != m_ringHeight) || m_ring.empty()
+			|| (m_sinceKeyframe + 1 >= REPLAY_KEYFRAME_INTERVAL);
+	}
+	if (m_blackFrame.size() != frameSize)
+	{
+		m_blackFrame.resize(frameSize);
+		std::fill_n(reinterpret_cast<UINT32*>(m_blackFrame.data()), frameSize / 4, REPLAY_KEY_PIXEL);
+	}
+
+	// Encode without the lock, SaveReplay() on the render thread only waits for the push
+	auto delta = std::make_shared<std::vector<UINT8>>();
+	SessionCodec::EncodeDelta(c.pixels.data(), f.key ? m_blackFrame.data() : m_prevFrame.data(), frameSize, *delta);
+	delta->shrink_to_fit();
+	m_prevFrame.swap(c.pixels);
+	m_sinceKeyframe = f.key ? 0 : m_sinceKeyframe + 1;
+
+	std::lock_guard<std::mutex> lock(m_ringMutex);
+	if (f.key && ((c.width != m_ringWidth) || (c.height != m_ringHeight)))
+	{
+		m_ring.clear();
+		m_ringBytes = 0;
+		m_ringKeyframes = 0;
+		m_ringWidth = c.width;
+		m_ringHeight = c.height;
+	}
+	else if (!f.key && ((c.width != m_ringWidth) || (c.height != m_ringHeight) || m_ring.empty()
+		|| ((m_ringKeyframes <= 1) && (m_ringBytes + delta->size() > REPLAY_MAX_BYTES))))
+	{
+		// The ring was cleared while encoding, or the delta can't fit before there is a second keyframe
+		// to evict up to. Drop it and make the next frame a keyframe.
+		m_sinceKeyframe = REPLAY_KEYFRAME_INTERVAL;
+		m_replayFramesDropped++;
+		return;
+	}
+	m_ringKeyframes += f.key ? 1 : 0;
+	m_ringBytes += delta->size();
+	f.delta = std::move(delta);
+	m_ring.push_back(std::move(f));
+
+	// Evict the oldest keyframe and its deltas while there is another keyframe to start from
+	while ((m_ringKeyframes > 1) && ((m_ringBytes > REPLAY_MAX_BYTES)
+		|| (m_ring.back().timeMs - m_ring.front().timeMs > REPLAY_SECONDS * 1000)))
+	{
+		do
+		{
+			m_ringBytes -= m_ring.front().delta->size();
+			m_ring.pop_front();
+		} while (!m_ring.front().key);
+		m_ringKeyframes--;
+	}
+}
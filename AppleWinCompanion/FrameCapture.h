@@ -0,0 +1,171 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+
+/// <summary>
+/// FrameCapture saves screenshots to PNG, and the last seconds of video to an animated GIF,
+/// without ever making the render loop wait.
+///
+/// The render loop copies the pixels once into a buffer from a small fixed pool, and the encoding
+/// runs on a pool of encoder threads. When all the buffers are taken the capture is dropped and
+/// counted, the same backpressure as SessionRecorder. Screenshots are either of the composed window
+/// (read back from the GPU by Game) or of the raw GameLink frame.
+///
+/// The instant replay keeps the GameLink frames of the last REPLAY_SECONDS in memory, delta encoded
+/// against the previous frame with SessionCodec by a replay thread, with a keyframe every
+/// REPLAY_KEYFRAME_INTERVAL frames. The oldest keyframe and its deltas are evicted together, so the
+/// ring always starts on a keyframe and never exceeds REPLAY_MAX_BYTES. A delta that doesn't fit while
+/// there is only one keyframe is dropped, and the next frame is a keyframe. SaveReplay() hands a snapshot
+/// of the ring to an encoder thread, which decodes it into a GIF at up to 30 frames per second.
+///
+/// Request() can be called from any thread, like the trigger actions. The render loop picks the
+/// requests up with TakeRequests(), as only it can read the frames.
+/// </summary>
+
+constexpr char CAPTURE_DIRECTORY[] = "Captures";
+constexpr UINT32 CAPTURE_BUFFER_COUNT = 4;			// screenshots waiting to be encoded
+constexpr UINT32 CAPTURE_THREAD_COUNT = 2;
+constexpr UINT32 REPLAY_SECONDS = 15;
+constexpr size_t REPLAY_MAX_BYTES = 48 * 1024 * 1024;
+constexpr UINT32 REPLAY_KEYFRAME_INTERVAL = 120;
+constexpr UINT32 REPLAY_BUFFER_COUNT = 4;			// frames waiting to be delta encoded
+constexpr UINT32 REPLAY_CLIP_FRAME_MS = 33;			// shortest frame of the GIF
+constexpr UINT32 REPLAY_KEY_PIXEL = 0xFF000000;		// keyframes are encoded against black
+
+enum class CaptureRequest : UINT32
+{
+	Window	= 1,		// screenshot of the composed window
+	Video	= 2,		// screenshot of the GameLink frame
+	Replay	= 4,		// GIF of the instant replay
+};
+
+struct FrameCaptureStats
+{
+	UINT32 screenshotsSaved = 0;
+	UINT32 screenshotsDropped = 0;	// no free buffer when they came in
+	UINT32 clipsSaved = 0;
+	UINT32 clipsDropped = 0;		// a clip was already being encoded, or the replay was empty
+	UINT32 failures = 0;			// files that couldn't be written
+	UINT32 replayFrames = 0;
+	UINT32 replayMs = 0;
+	UINT64 replayBytes = 0;
+	UINT32 replayFramesDropped = 0;	// no free buffer, or no room in the ring
+};
+
+class FrameCapture
+{
+public:
+	FrameCapture();
+	~FrameCapture();
+
+	// Starts the threads. The files go to directory, created when the first one is written.
+	void Start(const std::filesystem::path& directory);
+	void Stop();
+
+	// Any thread
+	static void Request(CaptureRequest request);
+	// Render thread, the CaptureRequest flags requested since the last call
+	static UINT32 TakeRequests();
+
+	// Copies the BGRA pixels for an encoder thread. rowPitch is negative for bottom-up frames,
+	// with pixels on the top row. Returns false if the screenshot was dropped.
+	bool SaveScreenshot(const UINT8* pixels, UINT32 width, UINT32 height, INT32 rowPitch, const char* suffix);
+
+	// The ring is emptied when it is disabled
+	void SetReplayEnabled(bool enabled);
+	bool IsReplayEnabled() const { return m_replayEnabled; }
+	// Copies a GameLink frame for the replay thread. Calls with the same seq are ignored.
+	void AddReplayFrame(UINT16 seq, const UINT8* pixels, UINT32 width, UINT32 height, INT32 rowPitch);
+	// Queues the GIF of the replay. Returns false if it was dropped.
+	bool SaveReplay();
+
+	FrameCaptureStats GetStats() const;
+
+	// pixels are top-down BGRA, the alpha is ignored
+	static bool WritePng(const std::filesystem::path& path, const UINT8* pixels, UINT32 width, UINT32 height,
+		std::string& error);
+
+private:
+	struct CaptureBuffer
+	{
+		std::vector<UINT8> pixels;		// top-down, width * 4 bytes per row
+		UINT32 width = 0;
+		UINT32 height = 0;
+		UINT32 timeMs = 0;
+		std::string suffix;
+	};
+	struct ReplayFrame
+	{
+		std::shared_ptr<const std::vector<UINT8>> delta;
+		UINT32 timeMs = 0;
+		bool key = false;
+	};
+	struct Job
+	{
+		CaptureBuffer* screenshot = nullptr;
+		std::vector<ReplayFrame> clip;	// when screenshot is null
+		UINT32 width = 0;
+		UINT32 height = 0;
+	};
+
+	static void CopyPixels(CaptureBuffer& c, const UINT8* pixels, UINT32 width, UINT32 height, INT32 rowPitch);
+	UINT32 GetTimeMs() const;
+	std::filesystem::path NextPath(const std::string& suffix, const char* extension);
+	void EncoderThread();
+	void ReplayThread();
+	void AppendReplayFrame(CaptureBuffer& c);
+	bool WriteClip(const Job& job, const std::filesystem::path& path, std::string& error);
+
+	bool m_running;
+	std::filesystem::path m_directory;
+	std::chrono::steady_clock::time_point m_startTime;
+	UINT32 m_fileCount;
+
+	// Screenshot buffers, owned by m_pool and moving between the free queue and the jobs
+	std::vector<std::unique_ptr<CaptureBuffer>> m_pool;
+	std::deque<CaptureBuffer*> m_free;
+	std::deque<Job> m_jobs;
+	bool m_clipPending;				// only one clip at a time
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stopping;
+	std::vector<std::thread> m_encoders;
+
+	// Replay frames, the same way for the replay thread
+	bool m_replayEnabled;
+	bool m_replayStarted;
+	UINT16 m_replaySeq;
+	std::vector<std::unique_ptr<CaptureBuffer>> m_replayPool;
+	std::deque<CaptureBuffer*> m_replayFree;
+	std::deque<CaptureBuffer*> m_replayPending;
+	std::condition_variable m_replayCv;
+	std::thread m_replayThread;
+
+	// The ring, written by the replay thread and copied by SaveReplay()
+	mutable std::mutex m_ringMutex;
+	std::deque<ReplayFrame> m_ring;
+	UINT32 m_ringWidth;
+	UINT32 m_ringHeight;
+	size_t m_ringBytes;
+	UINT32 m_ringKeyframes;
+	// Replay thread state
+	std::vector<UINT8> m_prevFrame;
+	std::vector<UINT8> m_blackFrame;
+	UINT32 m_sinceKeyframe;
+
+	static std::atomic<UINT32> s_requests;
+	std::atomic<UINT32> m_screenshotsSaved;
+	std::atomic<UINT32> m_screenshotsDropped;
+	std::atomic<UINT32> m_clipsSaved;
+	std::atomic<UINT32> m_clipsDropped;
+	std::atomic<UINT32> m_failures;
+	std::atomic<UINT32> m_replayFramesDropped;
+};
@@ -9,7 +9,19 @@
 #include "Sidebar.h"
 #include "GameLink.h"
 #include "HAUtils.h"
+#include "ProfileExpression.h"
+#include "A2VideoRenderer.h"
+#include "SessionRecorder.h"
+#include "MemoryHeatmap.h"
+#include "ProfilerDialog.h"
+#include "SidebarStream.h"
+#include "FrameCapture.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "LatencyTracker.h"
+#include "resource.h"
 #include <vector>
+#include <ctime>
 
 extern void ExitGame() noexcept;
 
@@ -36,11 +48,51 @@ static Vector2 m_vector2ero = { 0.f, 0.f };
 
 static bool bIsGamelinkPaused = true;
 
+// When AppleWin doesn't send frames (tracking only), they're rendered from its memory
+static A2VideoRenderer m_videoRenderer;
+static bool m_renderFromRam = false;
+
+// Session recording
+static SessionRecorder m_sessionRecorder;
+static bool m_recordSessionVideo = false;
+
+// Memory write heatmap, drawn over the left of the video. Its texture is after the fonts in m_resourceDescriptors.
+static MemoryHeatmap m_heatmap;
+static bool m_showHeatmap = false;
+constexpr int HEATMAP_DESCRIPTOR_INDEX = (int)FontDescriptors::Count;
+
+// Samples the 6502 PC once per frame while it runs, shown in the Profiler panel
+static PcProfiler m_pcProfiler;
+
+// The sidebars alone, rendered offscreen and exported for streaming software.
+// The image of a back buffer is read back and published when that back buffer comes around again.
+static SidebarStream m_sidebarStream;
+static std::unique_ptr<SpriteBatch> m_sidebarSpriteBatch;
+static std::unique_ptr<BasicEffect> m_sidebarLineEffect;
+static std::unique_ptr<DescriptorHeap> m_sidebarRtvHeap;
+
+// Screenshots, and the instant replay of the last seconds of GameLink video
+static FrameCapture m_frameCapture;
+
+// Frame timing HUD, refreshed every second from the metrics
+static MetricsSnapshot m_metricsSnapshot;
+static std::string m_metricsText;
+static UINT64 m_metricsTicks = 0;
+static UINT16 m_metricsLastSeq = 0;
+static LatencyTracker m_latency;
+
+// Event traces, saved on demand or when a frame takes longer than TRACER_SLOW_FRAME_MS
+static bool m_traceSlowFrames = false;
+static UINT64 m_traceSavedTicks = 0;
+
+// Min/max per pixel column of the Graph block being drawn, grown to the widest graph
+static std::vector<INT32> m_graphMin;
+static std::vector<INT32> m_graphMax;
+
 Game::Game() noexcept(false)
 {
     g_textureData = {};
     m_sbM = SidebarManager();
-    m_sbC = SidebarContent();
 
     m_deviceResources = std::make_unique<DX::DeviceResources>();
     m_deviceResources->RegisterDeviceNotify(this);
@@ -48,6 +100,21 @@ Game::Game() noexcept(false)
     // Any time the layouts differ, a recreation of the vertex buffer is triggered
     m_previousLayout = GameLinkLayout::NONE;
     m_currentLayout = GameLinkLayout::NORMAL;
+
+    m_sidebarFootprint = {};
+    m_sidebarTargetBounds = { 0, 0, 0, 0 };
+    for (UINT i = 0; i < SIDEBAR_READBACK_COUNT; i++)
+    {
+        m_sidebarReadbackPending[i] = false;
+        m_sidebarReadbackBounds[i] = { 0, 0, 0, 0 };
+        m_sidebarReadbackSeq[i] = 0;
+    }
+    m_captureWindow = false;
+    for (UINT i = 0; i < CAPTURE_READBACK_COUNT; i++)
+    {
+        m_captureFootprint[i] = {};
+        m_captureReadbackPending[i] = false;
+    }
 }
 
 Game::~Game()
@@ -56,6 +123,9 @@ Game::~Game()
     {
         m_deviceResources->WaitForGpu();
     }
+    m_sessionRecorder.Stop();
+    m_frameCapture.Stop();
+    Tracer::WaitForDump();
     GameLink::Destroy();
 }
 
@@ -96,6 +166,9 @@ void Game::Initialize(HWND window, int width, int height)
     
     m_timer.SetFixedTimeStep(true);
     m_timer.SetTargetElapsedSeconds(1.0 / 30);
+
+    m_frameCapture.Start(std::filesystem::current_path() / CAPTURE_DIRECTORY);
+    Tracer::SetThreadName("Render");
     
 }
 
@@ -121,6 +194,15 @@ D3D12_RESOURCE_DESC Game::ChooseTexture()
         {
             bool shouldRecreateBuffers = false;
             auto fbI = GameLink::GetFrameBufferInfo();
+            m_renderFromRam = GameLink::IsTrackingOnly();
+            if (m_renderFromRam)
+            {
+                fbI.width = A2VIDEO_WIDTH;
+                fbI.height = A2VIDEO_HEIGHT;
+                fbI.frameBuffer = reinterpret_cast<UINT8*>(m_videoRenderer.GetFrameBuffer());
+                fbI.bufferLength = m_videoRenderer.GetFrameBufferLength();
+                m_videoRenderer.Invalidate();
+            }
             if (txtDesc.Width != fbI.width)
             {
 				txtDesc.Width = fbI.width;
@@ -133,7 +215,8 @@ D3D12_RESOURCE_DESC Game::ChooseTexture()
             }
             g_textureData.pData = fbI.frameBuffer;
             g_textureData.SlicePitch = fbI.bufferLength;
-            SetVideoLayout(GameLinkLayout::FLIPPED_Y);
+            // AppleWin frames are bottom-up, ours are top-down
+            SetVideoLayout(m_renderFromRam ? GameLinkLayout::NORMAL : GameLinkLayout::FLIPPED_Y);
 			m_sbM.SetBaseSize(fbI.width, fbI.height);
 #ifdef _DEBUG
             sprintf_s(buf, "GameLink up with Width %d, Height %d\n", fbI.width, fbI.height);
@@ -148,6 +231,7 @@ D3D12_RESOURCE_DESC Game::ChooseTexture()
     // This means it's in a waiting state for a program to be loaded
     if (!GameLink::IsActive() || (txtDesc.Width == 0))
     {
+        m_renderFromRam = false;
         txtDesc.Width = m_bgImageWidth;
         txtDesc.Height = m_bgImageHeight;
         g_textureData.pData = m_bgImage.data();
@@ -192,18 +276,34 @@ void Game::GetBaseSize(__out int& width, __out int& height) noexcept
 // Executes the basic game loop.
 void Game::Tick()
 {
-    m_timer.Tick([&]()
+    UINT64 tickStart = Metrics::GetTicks();
     {
-        Update(m_timer);
-    });
+        MetricScope frameScope(MetricTiming::Frame);
+        TraceScope traceScope("Tick");
+        m_timer.Tick([&]()
+        {
+            Update(m_timer);
+        });
+
+        Render();
+    }
 
-    Render();
+    if (m_traceSlowFrames && (Metrics::TicksToNs(Metrics::GetTicks() - tickStart) > TRACER_SLOW_FRAME_MS * 1000000ull))
+    {
+        // Only the first of a series of slow frames, the trace covers those before
+        if ((m_traceSavedTicks == 0)
+            || (Metrics::TicksToNs(Metrics::GetTicks() - m_traceSavedTicks) > TRACER_SLOW_FRAME_INTERVAL_MS * 1000000ull))
+        {
+            SaveTrace("slow");
+        }
+    }
 }
 
 // Updates the world.
 void Game::Update(DX::StepTimer const& timer)
 {
     PIXBeginEvent(PIX_COLOR_DEFAULT, L"Update");
+    Tracer::Begin("Update");
 
     float elapsedTime = float(timer.GetElapsedSeconds());
 
@@ -224,6 +324,7 @@ void Game::Update(DX::StepTimer const& timer)
 
     elapsedTime;
 
+    Tracer::End();
     PIXEndEvent();
 }
 #pragma endregion
@@ -245,6 +346,8 @@ void Game::Render()
     // Every m_framesDelay see if GameLink is active
     if ((currFrameCount - m_previousFrameCount) > m_framesDelay)
     {
+        MetricScope connectionScope(MetricTiming::ConnectionCheck);
+        TraceScope connectionTrace("Connection check");
 #ifdef _DEBUG
         char buf[500];
 #endif
@@ -309,23 +412,111 @@ void Game::Render()
         OnWindowSizeChanged(rc.right - rc.left, rc.bottom - rc.top);
     }
 
-    m_sbC.UpdateAllSidebarText(&m_sbM);
+    {
+        MetricScope sidebarTextScope(MetricTiming::SidebarText);
+        TraceScope sidebarTextTrace("Sidebar text");
+        m_sbC.UpdateAllSidebarText(&m_sbM);
+    }
+    if (Metrics::IsEnabled())
+    {
+        UpdateMetricsHud();
+    }
+
+    if (m_sessionRecorder.IsRecording() && GameLink::IsActive())
+    {
+        // When rendering from RAM the frame can be rebuilt from the memory, no need to record it
+        auto fbI = GameLink::GetFrameBufferInfo();
+        m_sessionRecorder.Capture(GameLink::GetFrameSequence(), GameLink::GetMemoryBasePointer(),
+            m_renderFromRam ? nullptr : fbI.frameBuffer, fbI.width, fbI.height);
+    }
+
+    if (m_showHeatmap && GameLink::IsActive())
+    {
+        m_heatmap.Update(GameLink::GetFrameSequence(), GameLink::GetMemoryBasePointer(), GameLink::GetMemorySize());
+    }
+
+    if (Metrics::IsEnabled() && GameLink::IsActive())
+    {
+        // The frames AppleWin produced that were never rendered
+        UINT16 seq = GameLink::GetFrameSequence();
+        UINT16 skipped = (UINT16)(seq - m_metricsLastSeq);
+        if ((m_metricsLastSeq != 0) && (skipped > 1) && (skipped < 0x8000))
+        {
+            Metrics::Add(MetricCounter::DroppedSequences, skipped - 1);
+        }
+        if (seq != m_metricsLastSeq)
+        {
+            // The emulator time is also QueryPerformanceCounter(), when it gives one
+            UINT64 producedTicks = 0;
+            if (!GameLink::GetFrameProducedTime(seq, producedTicks))
+                producedTicks = 0;
+            m_latency.FrameSeen(producedTicks);
+        }
+        m_metricsLastSeq = seq;
+    }
+
+    if (m_pcProfiler.IsRunning() && GameLink::IsActive())
+    {
+        m_pcProfiler.Sample(GameLink::GetFrameSequence(), GameLink::GetProgramCounter());
+    }
+
+    // Only upload the video texture when the frame changed
+    bool shouldUploadTexture = true;
+    if (m_renderFromRam && GameLink::IsActive())
+    {
+        m_videoRenderer.SetMode(m_sbC.GetVideoMode());
+        shouldUploadTexture = m_videoRenderer.Render(GameLink::GetMemoryBasePointer(), GameLink::GetMemorySize());
+    }
+
+    UINT32 captureRequests = FrameCapture::TakeRequests();
+    if (GameLink::IsActive())
+    {
+        const UINT8* videoPixels;
+        UINT32 videoWidth, videoHeight;
+        INT32 videoPitch;
+        if (GetVideoFrame(videoPixels, videoWidth, videoHeight, videoPitch))
+        {
+            if (captureRequests & (UINT32)CaptureRequest::Video)
+                m_frameCapture.SaveScreenshot(videoPixels, videoWidth, videoHeight, videoPitch, "video");
+            if (m_frameCapture.IsReplayEnabled())
+                m_frameCapture.AddReplayFrame(GameLink::GetFrameSequence(), videoPixels, videoWidth, videoHeight, videoPitch);
+        }
+    }
+    if (captureRequests & (UINT32)CaptureRequest::Replay)
+        m_frameCapture.SaveReplay();
+    m_captureWindow = (captureRequests & (UINT32)CaptureRequest::Window) != 0;
 
     // Prepare the command list to render a new frame.
     m_deviceResources->Prepare();
+    SaveWindowCapture();
+    RenderSidebarStream(m_deviceResources->GetCommandList());
     Clear();
 
     auto commandList = m_deviceResources->GetCommandList();
     PIXBeginEvent(commandList, PIX_COLOR_DEFAULT, L"Render");
+    Tracer::Begin("Render");
 
     // Add rendering code here.
 
     // Drawing video texture
-    auto barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_texture.Get(), D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
-    commandList->ResourceBarrier(1, &barrier);
-    UpdateSubresources(commandList, m_texture.Get(), g_textureUploadHeap.Get(), 0, 0, 1, &g_textureData);
-    barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_texture.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-    commandList->ResourceBarrier(1, &barrier);
+    {
+        MetricScope uploadScope(MetricTiming::TextureUpload);
+        TraceScope uploadTrace("Texture upload");
+        if (shouldUploadTexture)
+        {
+            Metrics::Add(MetricCounter::BytesUploaded, g_textureData.SlicePitch);
+            m_latency.FrameUploaded(g_textureData.pData, g_textureData.SlicePitch);
+            auto barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_texture.Get(), D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+            commandList->ResourceBarrier(1, &barrier);
+            UpdateSubresources(commandList, m_texture.Get(), g_textureUploadHeap.Get(), 0, 0, 1, &g_textureData);
+            barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_texture.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+            commandList->ResourceBarrier(1, &barrier);
+        }
+        if (m_showHeatmap)
+        {
+            UploadHeatmap(commandList);
+        }
+    }
 
     commandList->SetGraphicsRootSignature(m_rootSignature.Get());
     commandList->SetPipelineState(m_pipelineState.Get());
@@ -348,17 +539,88 @@ void Game::Render()
     ID3D12DescriptorHeap* heaps[] = { m_resourceDescriptors->Heap() };
     commandList->SetDescriptorHeaps(static_cast<UINT>(std::size(heaps)), heaps);
 
-    m_spriteBatch->Begin(commandList);
-   
-    m_lineEffect->Apply(commandList);
+    {
+        MetricScope spriteScope(MetricTiming::SpriteDrawing);
+        TraceScope spriteTrace("Sprite drawing");
+        m_spriteBatch->Begin(commandList);
+
+        if (m_showHeatmap)
+        {
+            // One texel per byte, squeezed into the height of the video
+            RECT heatmapRect = { 0, 0,
+                (LONG)(APPLEWIN_HEIGHT * HEATMAP_WIDTH / HEATMAP_HEIGHT * m_clientFrameScale),
+                (LONG)(APPLEWIN_HEIGHT * m_clientFrameScale) };
+            m_spriteBatch->Draw(m_resourceDescriptors->GetGpuHandle(HEATMAP_DESCRIPTOR_INDEX),
+                XMUINT2(HEATMAP_WIDTH, HEATMAP_HEIGHT), heatmapRect);
+        }
+
+        DrawSidebars(m_spriteBatch.get(), m_lineEffect.get(), m_clientFrameScale);
+
+        if (m_renderFromRam)
+        {
+            DrawVideoText();
+        }
+
+        if (Metrics::IsEnabled())
+        {
+            DrawMetricsHud();
+        }
+
+#ifdef _DEBUG
+        // TEMPORARY
+        // TODO: REMOVE
+        // DISPLAY PC AT TOP LEFT OF WINDOW
+        char pcbuf[5];
+        snprintf(pcbuf, 5, "%.4x", GameLink::GetProgramCounter());
+        m_spriteFonts.at(0)->DrawString(m_spriteBatch.get(), pcbuf,
+            { 10.f, 10.f }, Colors::OrangeRed, 0.f, m_vector2ero, m_clientFrameScale);
+#endif // _DEBUG
+
+        m_spriteBatch->End();
+    }
+    // End drawing text
+
+
+    Tracer::End();
+    PIXEndEvent(commandList);
+
+    // Show the new frame.
+    PIXBeginEvent(PIX_COLOR_DEFAULT, L"Present");
+    MetricScope presentScope(MetricTiming::Present);
+    TraceScope presentTrace("Present");
+    if (m_captureWindow)
+    {
+        m_captureWindow = false;
+        CaptureWindow(commandList);
+        m_deviceResources->Present(D3D12_RESOURCE_STATE_COPY_SOURCE);
+    }
+    else
+    {
+        m_deviceResources->Present();
+    }
+    m_latency.FramePresented();
+    m_graphicsMemory->Commit(m_deviceResources->GetCommandQueue());
+    PIXEndEvent();
+}
+
+// Draws the text, graphs and delimiter lines of the sidebars, between the Begin() and End() of spriteBatch.
+// The sidebar positions are in the base layout, multiplied by scale.
+void Game::DrawSidebars(SpriteBatch* spriteBatch, BasicEffect* lineEffect, float scale)
+{
+    auto commandList = m_deviceResources->GetCommandList();
+    lineEffect->Apply(commandList);
     m_primitiveBatch->Begin(commandList);
     for each (auto sb in m_sbM.sidebars)
     {
         // Draw each block's text
         for each (auto b in sb.blocks)
         {
-            m_spriteFonts.at((int)b->fontId)->DrawString(m_spriteBatch.get(), b->text.c_str(),
-                b->position * m_clientFrameScale, b->color, 0.f, m_vector2ero, m_clientFrameScale);
+            if (!b->visible)
+                continue;
+            m_spriteFonts.at((int)b->fontId)->DrawString(spriteBatch, b->text.c_str(),
+                b->position * scale, b->color, 0.f, m_vector2ero, scale);
+            if (b->type == BlockType::Graph)
+                DrawGraph(sb, *b, scale);
         }
 
         // Now draw a delimiter line for the block
@@ -378,33 +640,11 @@ void Game::Render()
 			break;
         }
         m_primitiveBatch->DrawLine(
-            VertexPositionColor(lstart* m_clientFrameScale, static_cast<XMFLOAT4>(Colors::DimGray)),
-            VertexPositionColor(lend* m_clientFrameScale, static_cast<XMFLOAT4>(Colors::Black))
+            VertexPositionColor(lstart * scale, static_cast<XMFLOAT4>(Colors::DimGray)),
+            VertexPositionColor(lend * scale, static_cast<XMFLOAT4>(Colors::Black))
         );
     }
     m_primitiveBatch->End();
-
-#ifdef _DEBUG
-    // TEMPORARY
-    // TODO: REMOVE
-    // DISPLAY PC AT TOP LEFT OF WINDOW
-    char pcbuf[5];
-    snprintf(pcbuf, 5, "%.2x%.2x", GameLink::GetPeekAt(0), GameLink::GetPeekAt(1));
-    m_spriteFonts.at(0)->DrawString(m_spriteBatch.get(), pcbuf,
-        { 10.f, 10.f }, Colors::OrangeRed, 0.f, m_vector2ero, m_clientFrameScale);
-#endif // _DEBUG
-
-    m_spriteBatch->End();
-    // End drawing text
-
-
-    PIXEndEvent(commandList);
-
-    // Show the new frame.
-    PIXBeginEvent(PIX_COLOR_DEFAULT, L"Present");
-    m_deviceResources->Present();
-    m_graphicsMemory->Commit(m_deviceResources->GetCommandQueue());
-    PIXEndEvent();
 }
 
 // Helper method to clear the back buffers.
@@ -412,6 +652,7 @@ void Game::Clear()
 {
     auto commandList = m_deviceResources->GetCommandList();
     PIXBeginEvent(commandList, PIX_COLOR_DEFAULT, L"Clear");
+    TraceScope trace("Clear");
 
     // Clear the views.
     auto rtvDescriptor = m_deviceResources->GetRenderTargetView();
@@ -433,6 +674,346 @@ void Game::Clear()
 
     PIXEndEvent(commandList);
 }
+// Takes a snapshot of the metrics every second for the HUD
+void Game::UpdateMetricsHud()
+{
+    UINT64 now = Metrics::GetTicks();
+    if ((m_metricsTicks != 0) && (Metrics::TicksToNs(now - m_metricsTicks) < 1000000000ull))
+        return;
+    m_metricsTicks = now;
+    Metrics::Snapshot(m_metricsSnapshot);
+    m_metricsText = (m_metricsSnapshot.seconds > 0.) ? m_metricsSnapshot.ToText() : "Measuring...";
+}
+
+// Draws the frame timings at the top left of the window, with a shadow to stay readable over the video
+void Game::DrawMetricsHud()
+{
+    auto& font = m_spriteFonts.at((int)FontDescriptors::A2FontRegular);
+    // Half the width of an Apple 2 character, to fit the whole table over the video
+    XMFLOAT2 glyphSize;
+    XMStoreFloat2(&glyphSize, font->MeasureString("W"));
+    float scale = ((float)A2VIDEO_SCREEN_WIDTH / 80 / glyphSize.x) * m_clientFrameScale;
+    Vector2 pos = { 10.f * m_clientFrameScale, 30.f * m_clientFrameScale };
+    font->DrawString(m_spriteBatch.get(), m_metricsText.c_str(), pos + Vector2(1.f, 1.f),
+        Colors::Black, 0.f, m_vector2ero, scale);
+    font->DrawString(m_spriteBatch.get(), m_metricsText.c_str(), pos,
+        Colors::LightGreen, 0.f, m_vector2ero, scale);
+}
+
+// Draws the text rows of the frame rendered from memory, using the Apple 2 font
+void Game::DrawVideoText()
+{
+    UINT32 textRows = m_videoRenderer.GetTextRowsMask();
+    if (textRows == 0)
+        return;
+    auto& font = m_spriteFonts.at((int)FontDescriptors::A2FontRegular);
+    const A2TextScreen& ts = m_videoRenderer.GetTextScreen();
+    // Stretch the font glyphs to the Apple 2 character cell
+    float cellWidth = (float)A2VIDEO_SCREEN_WIDTH / ts.GetColumns();
+    XMFLOAT2 glyphSize;
+    XMStoreFloat2(&glyphSize, font->MeasureString("W"));
+    XMFLOAT2 scale = {
+        (cellWidth / glyphSize.x) * m_clientFrameScale,
+        ((float)A2VIDEO_TEXT_ROW_HEIGHT / font->GetLineSpacing()) * m_clientFrameScale };
+    for (UINT8 row = 0; row < A2TEXT_ROWS; row++)
+    {
+        if (!(textRows & (1u << row)))
+            continue;
+        Vector2 pos = { (float)A2VIDEO_BORDER_X, (float)(A2VIDEO_BORDER_Y + row * A2VIDEO_TEXT_ROW_HEIGHT) };
+        font->DrawString(m_spriteBatch.get(), ts.GetRow(row).c_str(), pos * m_clientFrameScale,
+            Colors::White, 0.f, m_vector2ero, scale);
+    }
+}
+
+// Copies the rows of the heatmap that changed to its texture, one copy per run of rows.
+// The rows go through the per-frame upload memory, which is recycled once the GPU is done with it.
+void Game::UploadHeatmap(ID3D12GraphicsCommandList* commandList)
+{
+    bool isCopyDest = false;
+    m_heatmap.ConsumeDirtyRows([&](UINT32 firstRow, UINT32 rowCount)
+    {
+        if (!isCopyDest)
+        {
+            auto barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_heatmapTexture.Get(), D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+            commandList->ResourceBarrier(1, &barrier);
+            isCopyDest = true;
+        }
+        // 1024 bytes per row is already a multiple of D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+        const UINT rowPitch = HEATMAP_WIDTH * sizeof(UINT32);
+        auto upload = m_graphicsMemory->Allocate((size_t)rowPitch * rowCount, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+        memcpy(upload.Memory(), m_heatmap.GetPixels() + ((size_t)firstRow * HEATMAP_WIDTH), (size_t)rowPitch * rowCount);
+        Metrics::Add(MetricCounter::BytesUploaded, (size_t)rowPitch * rowCount);
+        D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {};
+        footprint.Offset = upload.ResourceOffset();
+        footprint.Footprint = CD3DX12_SUBRESOURCE_FOOTPRINT(DXGI_FORMAT_B8G8R8A8_UNORM, HEATMAP_WIDTH, rowCount, 1, rowPitch);
+        CD3DX12_TEXTURE_COPY_LOCATION dst(m_heatmapTexture.Get(), 0);
+        CD3DX12_TEXTURE_COPY_LOCATION src(upload.Resource(), footprint);
+        commandList->CopyTextureRegion(&dst, 0, firstRow, 0, &src, nullptr);
+    });
+    if (isCopyDest)
+    {
+        auto barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_heatmapTexture.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+        commandList->ResourceBarrier(1, &barrier);
+    }
+}
+
+// Publishes the sidebar image this back buffer read back the last time it was used, whose copy is done
+// since the back buffer is ready again. Then renders a new image if the sidebars changed, and reads it back.
+// Runs before Clear(), which sets the back buffer as the render target again.
+void Game::RenderSidebarStream(ID3D12GraphicsCommandList* commandList)
+{
+    UINT frameIndex = m_deviceResources->GetCurrentFrameIndex();
+    if (m_sidebarReadbackPending[frameIndex])
+    {
+        m_sidebarReadbackPending[frameIndex] = false;
+        if (m_sidebarStream.IsRunning())
+        {
+            D3D12_RANGE readRange = { 0, (SIZE_T)(m_sidebarFootprint.Footprint.RowPitch * m_sidebarFootprint.Footprint.Height) };
+            UINT8* pixels = nullptr;
+            if (SUCCEEDED(m_sidebarReadback[frameIndex]->Map(0, &readRange, reinterpret_cast<void**>(&pixels))))
+            {
+                m_sidebarStream.Publish(pixels + m_sidebarFootprint.Offset, m_sidebarFootprint.Footprint.RowPitch,
+                    m_sidebarReadbackBounds[frameIndex], m_sidebarReadbackSeq[frameIndex]);
+                D3D12_RANGE writeRange = { 0, 0 };
+                m_sidebarReadback[frameIndex]->Unmap(0, &writeRange);
+            }
+        }
+    }
+
+    if (!m_sidebarStream.IsRunning())
+        return;
+    if (!m_sidebarStream.NeedsRender(m_sbM.sidebars, m_sbC.GetHistoryUpdates()))
+        return;
+    UINT16 seq = GameLink::IsActive() ? GameLink::GetFrameSequence() : 0;
+    RECT bounds = SidebarStream::GetBounds(m_sbM.sidebars);
+    UINT width = (UINT)(bounds.right - bounds.left);
+    UINT height = (UINT)(bounds.bottom - bounds.top);
+    if ((bounds.right <= bounds.left) || (bounds.bottom <= bounds.top))
+    {
+        // No sidebars, nothing to render
+        m_sidebarStream.Publish(nullptr, 0, bounds, seq);
+        return;
+    }
+    if ((m_sidebarTarget == nullptr)
+        || (width != (UINT)(m_sidebarTargetBounds.right - m_sidebarTargetBounds.left))
+        || (height != (UINT)(m_sidebarTargetBounds.bottom - m_sidebarTargetBounds.top)))
+    {
+        CreateSidebarStreamResources(width, height);
+    }
+    m_sidebarTargetBounds = bounds;
+
+    PIXBeginEvent(commandList, PIX_COLOR_DEFAULT, L"Sidebar stream");
+    TraceScope trace("Sidebar stream");
+    auto barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_sidebarTarget.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+    commandList->ResourceBarrier(1, &barrier);
+
+    auto rtvDescriptor = m_sidebarRtvHeap->GetFirstCpuHandle();
+    commandList->OMSetRenderTargets(1, &rtvDescriptor, FALSE, nullptr);
+    XMVECTORF32 background = { 0.f, 0.f, 0.f, m_sidebarStream.IsTransparent() ? 0.f : 1.f };
+    commandList->ClearRenderTargetView(rtvDescriptor, background, 0, nullptr);
+    D3D12_VIEWPORT viewport = { 0.f, 0.f, (float)width, (float)height, D3D12_MIN_DEPTH, D3D12_MAX_DEPTH };
+    D3D12_RECT scissorRect = { 0, 0, (LONG)width, (LONG)height };
+    commandList->RSSetViewports(1, &viewport);
+    commandList->RSSetScissorRects(1, &scissorRect);
+
+    ID3D12DescriptorHeap* heaps[] = { m_resourceDescriptors->Heap() };
+    commandList->SetDescriptorHeaps(static_cast<UINT>(std::size(heaps)), heaps);
+    // Same coordinates as the window at scale 1, moved to the origin of the image
+    m_sidebarSpriteBatch->SetViewport(viewport);
+    m_sidebarSpriteBatch->Begin(commandList, SpriteSortMode_Deferred,
+        XMMatrixTranslation(-(float)bounds.left, -(float)bounds.top, 0.f));
+    m_sidebarLineEffect->SetProjection(XMMatrixOrthographicOffCenterRH(
+        (float)bounds.left, (float)bounds.right, (float)bounds.bottom, (float)bounds.top, 0, 1));
+    DrawSidebars(m_sidebarSpriteBatch.get(), m_sidebarLineEffect.get(), 1.f);
+    m_sidebarSpriteBatch->End();
+
+    barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_sidebarTarget.Get(), D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    commandList->ResourceBarrier(1, &barrier);
+    CD3DX12_TEXTURE_COPY_LOCATION dst(m_sidebarReadback[frameIndex].Get(), m_sidebarFootprint);
+    CD3DX12_TEXTURE_COPY_LOCATION src(m_sidebarTarget.Get(), 0);
+    commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    m_sidebarReadbackPending[frameIndex] = true;
+    m_sidebarReadbackBounds[frameIndex] = bounds;
+    m_sidebarReadbackSeq[frameIndex] = seq;
+    PIXEndEvent(commandList);
+}
+
+// The current GameLink frame, top-down with a negative rowPitch when it's from AppleWin
+bool Game::GetVideoFrame(const UINT8*& pixels, UINT32& width, UINT32& height, INT32& rowPitch)
+{
+    if (m_renderFromRam)
+    {
+        pixels = reinterpret_cast<const UINT8*>(m_videoRenderer.GetFrameBuffer());
+        width = A2VIDEO_WIDTH;
+        height = A2VIDEO_HEIGHT;
+        rowPitch = (INT32)(width * sizeof(UINT32));
+        return true;
+    }
+    auto fbI = GameLink::GetFrameBufferInfo();
+    if ((fbI.frameBuffer == nullptr) || (fbI.width == 0) || (fbI.height == 0))
+        return false;
+    width = fbI.width;
+    height = fbI.height;
+    // AppleWin frames are bottom-up
+    rowPitch = -(INT32)(width * sizeof(UINT32));
+    pixels = fbI.frameBuffer + (size_t)(height - 1) * width * sizeof(UINT32);
+    return true;
+}
+
+// Copies the back buffer to the readback buffer of this back buffer, before it's presented.
+// The render target is left in the COPY_SOURCE state for Present().
+void Game::CaptureWindow(ID3D12GraphicsCommandList* commandList)
+{
+    UINT frameIndex = m_deviceResources->GetCurrentFrameIndex();
+    auto renderTarget = m_deviceResources->GetRenderTarget();
+    auto device = m_deviceResources->GetD3DDevice();
+    auto targetDesc = renderTarget->GetDesc();
+    UINT64 readbackSize = 0;
+    device->GetCopyableFootprints(&targetDesc, 0, 1, 0, &m_captureFootprint[frameIndex], nullptr, nullptr, &readbackSize);
+    if ((m_captureReadback[frameIndex] == nullptr) || (m_captureReadback[frameIndex]->GetDesc().Width < readbackSize))
+    {
+        // Made once per back buffer, and again when the window grows
+        CD3DX12_HEAP_PROPERTIES heapReadback(D3D12_HEAP_TYPE_READBACK);
+        auto readbackDesc = CD3DX12_RESOURCE_DESC::Buffer(readbackSize);
+        DX::ThrowIfFailed(
+            device->CreateCommittedResource(
+                &heapReadback,
+                D3D12_HEAP_FLAG_NONE,
+                &readbackDesc,
+                D3D12_RESOURCE_STATE_COPY_DEST,
+                nullptr,
+                IID_PPV_ARGS(m_captureReadback[frameIndex].ReleaseAndGetAddressOf())));
+    }
+    auto barrier = CD3DX12_RESOURCE_BARRIER::Transition(renderTarget, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    commandList->ResourceBarrier(1, &barrier);
+    CD3DX12_TEXTURE_COPY_LOCATION dst(m_captureReadback[frameIndex].Get(), m_captureFootprint[frameIndex]);
+    CD3DX12_TEXTURE_COPY_LOCATION src(renderTarget, 0);
+    commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    m_captureReadbackPending[frameIndex] = true;
+}
+
+// Hands the window copied by CaptureWindow() to the encoders once its back buffer comes around again,
+// when the GPU is done with it. The readback buffer is released, screenshots are rare.
+void Game::SaveWindowCapture()
+{
+    UINT frameIndex = m_deviceResources->GetCurrentFrameIndex();
+    if (!m_captureReadbackPending[frameIndex])
+        return;
+    m_captureReadbackPending[frameIndex] = false;
+    auto& footprint = m_captureFootprint[frameIndex];
+    D3D12_RANGE readRange = { 0, (SIZE_T)(footprint.Offset + (UINT64)footprint.Footprint.RowPitch * footprint.Footprint.Height) };
+    UINT8* pixels = nullptr;
+    if (SUCCEEDED(m_captureReadback[frameIndex]->Map(0, &readRange, reinterpret_cast<void**>(&pixels))))
+    {
+        m_frameCapture.SaveScreenshot(pixels + footprint.Offset, footprint.Footprint.Width, footprint.Footprint.Height,
+            (INT32)footprint.Footprint.RowPitch, "window");
+        D3D12_RANGE writeRange = { 0, 0 };
+        m_captureReadback[frameIndex]->Unmap(0, &writeRange);
+    }
+    m_captureReadback[frameIndex].Reset();
+}
+
+// The render target and readback buffers of the sidebar stream, whenever the size of the sidebars changes.
+// The previous ones may still be used by the frames in flight.
+void Game::CreateSidebarStreamResources(UINT width, UINT height)
+{
+    auto device = m_deviceResources->GetD3DDevice();
+    if (m_sidebarTarget)
+    {
+        m_deviceResources->WaitForGpu();
+    }
+    for (UINT i = 0; i < SIDEBAR_READBACK_COUNT; i++)
+    {
+        m_sidebarReadbackPending[i] = false;
+    }
+
+    CD3DX12_HEAP_PROPERTIES heapDefault(D3D12_HEAP_TYPE_DEFAULT);
+    auto targetDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_B8G8R8A8_UNORM, width, height, 1, 1, 1, 0,
+        D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+    DX::ThrowIfFailed(
+        device->CreateCommittedResource(
+            &heapDefault,
+            D3D12_HEAP_FLAG_NONE,
+            &targetDesc,
+            D3D12_RESOURCE_STATE_COPY_SOURCE,
+            nullptr,
+            IID_PPV_ARGS(m_sidebarTarget.ReleaseAndGetAddressOf())));
+    device->CreateRenderTargetView(m_sidebarTarget.Get(), nullptr, m_sidebarRtvHeap->GetFirstCpuHandle());
+
+    UINT64 readbackSize = 0;
+    device->GetCopyableFootprints(&targetDesc, 0, 1, 0, &m_sidebarFootprint, nullptr, nullptr, &readbackSize);
+    CD3DX12_HEAP_PROPERTIES heapReadback(D3D12_HEAP_TYPE_READBACK);
+    auto readbackDesc = CD3DX12_RESOURCE_DESC::Buffer(readbackSize);
+    for (UINT i = 0; i < SIDEBAR_READBACK_COUNT; i++)
+    {
+        DX::ThrowIfFailed(
+            device->CreateCommittedResource(
+                &heapReadback,
+                D3D12_HEAP_FLAG_NONE,
+                &readbackDesc,
+                D3D12_RESOURCE_STATE_COPY_DEST,
+                nullptr,
+                IID_PPV_ARGS(m_sidebarReadback[i].ReleaseAndGetAddressOf())));
+    }
+}
+
+// Draws the sparkline of a Graph block between the end of its text and the right of the sidebar.
+// The newest value is on the right. Each pixel column is a vertical line spanning the min and max
+// of its values, stretched to touch the previous column so the line stays connected.
+void Game::DrawGraph(const Sidebar& sb, const BlockStruct& b, float scale)
+{
+    auto& font = m_spriteFonts.at((int)b.fontId);
+    float left = b.position.x + XMVectorGetX(font->MeasureString(b.text.c_str())) + SIDEBAR_BLOCK_PADDING;
+    float right = sb.position.x + sb.width - (2 * SIDEBAR_OUTSIDE_MARGIN) - SIDEBAR_BLOCK_PADDING;
+    if (right - left < 2.f)
+        return;
+    UINT32 columns = (UINT32)(right - left);
+    if (m_graphMin.size() < columns)
+    {
+        m_graphMin.resize(columns);
+        m_graphMax.resize(columns);
+    }
+    UINT32 n = m_sbC.GetHistoryColumns(b.historyId, columns, m_graphMin.data(), m_graphMax.data());
+    if (n == 0)
+        return;
+
+    INT32 lo = m_graphMin[0];
+    INT32 hi = m_graphMax[0];
+    for (UINT32 c = 1; c < n; c++)
+    {
+        lo = std::min(lo, m_graphMin[c]);
+        hi = std::max(hi, m_graphMax[c]);
+    }
+    if (lo == hi)
+    {
+        // flat line in the middle of the block
+        lo--;
+        hi++;
+    }
+    float top = b.position.y + 1.f;
+    float bottom = b.position.y + sb.blockHeight - 1.f;
+    float yScale = (bottom - top) / ((float)hi - (float)lo);
+    XMFLOAT4 color;
+    XMStoreFloat4(&color, b.color);
+    float x = right - n;
+    for (UINT32 c = 0; c < n; c++, x++)
+    {
+        INT32 vMin = m_graphMin[c];
+        INT32 vMax = m_graphMax[c];
+        if (c > 0)
+        {
+            vMin = std::min(vMin, m_graphMax[c - 1]);
+            vMax = std::max(vMax, m_graphMin[c - 1]);
+        }
+        XMFLOAT3 lstart = XMFLOAT3(x, bottom - ((float)vMax - lo) * yScale, 0);
+        XMFLOAT3 lend = XMFLOAT3(x, bottom - ((float)vMin - lo) * yScale + 1.f, 0);
+        m_primitiveBatch->DrawLine(
+            VertexPositionColor(lstart * scale, color),
+            VertexPositionColor(lend * scale, color)
+        );
+    }
+}
+
 #pragma endregion
 
 #pragma region Message Handlers
@@ -505,6 +1086,209 @@ void Game::MenuDeactivateProfile()
     SetWindowSizeOnChangedProfile();
 }
 
+void Game::MenuBenchmarkExpressions()
+{
+    // 10k profile expression evaluations per frame, for 10 seconds worth of frames
+    ExprBenchmarkResult res = ProfileExpression::RunBenchmark(10000, 600);
+    char buf[500];
+    snprintf(buf, 500, "%u frames of %u expression evaluations\n\n"
+        "Average frame: %.3f ms\nWorst frame: %.3f ms\nPer evaluation: %.1f ns\n",
+        res.frames, res.evalsPerFrame, res.avgFrameMs, res.maxFrameMs, res.nsPerEval);
+    OutputDebugStringA(buf);
+    MessageBoxA(m_window, buf, "Expression Benchmark", MB_OK | MB_ICONINFORMATION);
+}
+
+void Game::MenuToggleRecordSession()
+{
+    char buf[500];
+    if (m_sessionRecorder.IsRecording())
+    {
+        m_sessionRecorder.Stop();
+        SessionRecorderStats stats = m_sessionRecorder.GetStats();
+        snprintf(buf, 500, "Session recorded: %u frames (%u dropped), %.2f MB\n",
+            stats.framesCaptured, stats.framesDropped, stats.bytesWritten / (1024.f * 1024.f));
+        OutputDebugStringA(buf);
+    }
+    else if (GameLink::IsActive())
+    {
+        // Recordings/YYYYMMDD-HHMMSS.awcsession
+        char name[100];
+        time_t now = time(nullptr);
+        tm tmNow;
+        localtime_s(&tmNow, &now);
+        strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tmNow);
+        std::filesystem::path path = std::filesystem::current_path() / "Recordings";
+        std::error_code ec;
+        std::filesystem::create_directories(path, ec);
+        path /= std::string(name) + SESSION_FILE_EXTENSION;
+
+        UINT16 frameWidth = 0;
+        UINT16 frameHeight = 0;
+        if (m_recordSessionVideo && !m_renderFromRam)
+        {
+            auto fbI = GameLink::GetFrameBufferInfo();
+            frameWidth = fbI.width;
+            frameHeight = fbI.height;
+        }
+        if (!m_sessionRecorder.Start(path, GameLink::GetMemorySize(), frameWidth, frameHeight))
+        {
+            snprintf(buf, 500, "Couldn't create %s", path.string().c_str());
+            MessageBoxA(m_window, buf, "Record Session", MB_OK | MB_ICONERROR);
+        }
+    }
+    else
+    {
+        MessageBoxA(m_window, "AppleWin isn't running with GameLink", "Record Session", MB_OK | MB_ICONINFORMATION);
+    }
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_RECORDSESSION,
+        m_sessionRecorder.IsRecording() ? MF_CHECKED : MF_UNCHECKED);
+}
+
+void Game::MenuToggleRecordSessionVideo()
+{
+    // Applies to the next recording
+    m_recordSessionVideo = !m_recordSessionVideo;
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_RECORDSESSIONVIDEO,
+        m_recordSessionVideo ? MF_CHECKED : MF_UNCHECKED);
+}
+
+void Game::MenuToggleMemoryHeatmap()
+{
+    m_showHeatmap = !m_showHeatmap;
+    // Start cold every time, the memory changed since it was last shown
+    m_heatmap.Reset();
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_MEMORYHEATMAP,
+        m_showHeatmap ? MF_CHECKED : MF_UNCHECKED);
+}
+
+void Game::MenuShowProfiler(HINSTANCE hInstance)
+{
+    ProfilerDialog::Show(hInstance, m_window, &m_pcProfiler);
+}
+
+void Game::MenuToggleValueServer()
+{
+    ValueServer* server = m_sbC.GetValueServer();
+    if (server->IsRunning())
+    {
+        server->Stop();
+    }
+    else
+    {
+        std::string error;
+        if (!server->Start(VALUESERVER_DEFAULT_PORT, error))
+        {
+            MessageBoxA(m_window, error.c_str(), "Value Server", MB_OK | MB_ICONERROR);
+        }
+    }
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_VALUESERVER,
+        server->IsRunning() ? MF_CHECKED : MF_UNCHECKED);
+}
+
+void Game::MenuToggleSidebarStream()
+{
+    if (m_sidebarStream.IsRunning())
+    {
+        m_sidebarStream.Stop();
+    }
+    else
+    {
+        std::string error;
+        if (!m_sidebarStream.Start(SIDEBARSTREAM_MMAP_NAME, error))
+        {
+            MessageBoxA(m_window, error.c_str(), "Sidebar Stream", MB_OK | MB_ICONERROR);
+        }
+    }
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_SIDEBARSTREAM,
+        m_sidebarStream.IsRunning() ? MF_CHECKED : MF_UNCHECKED);
+}
+
+void Game::MenuToggleSidebarStreamTransparent()
+{
+    m_sidebarStream.SetTransparent(!m_sidebarStream.IsTransparent());
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_SIDEBARSTREAMTRANSPARENT,
+        m_sidebarStream.IsTransparent() ? MF_CHECKED : MF_UNCHECKED);
+}
+
+void Game::MenuToggleFrameTiming()
+{
+    Metrics::SetEnabled(!Metrics::IsEnabled());
+    m_metricsTicks = 0;
+    m_metricsLastSeq = 0;
+    m_latency.Reset();
+    m_metricsText = "Measuring...";
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_FRAMETIMING,
+        Metrics::IsEnabled() ? MF_CHECKED : MF_UNCHECKED);
+}
+
+// Starts the latency of a key sent to AppleWin, unless it is a repeat
+void Game::OnKeystrokeSent(LPARAM lParam)
+{
+    if (!Metrics::IsEnabled() || !GameLink::IsActive() || (lParam & (1 << 30)))
+        return;
+    m_latency.KeySent();
+}
+
+// Traces/YYYYMMDD-HHMMSS-reason.json
+bool Game::SaveTrace(const char* reason)
+{
+    char name[100];
+    time_t now = time(nullptr);
+    tm tmNow;
+    localtime_s(&tmNow, &now);
+    size_t len = strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tmNow);
+    snprintf(name + len, sizeof(name) - len, "-%s.json", reason);
+    m_traceSavedTicks = Metrics::GetTicks();
+    return Tracer::Dump(std::filesystem::current_path() / TRACER_DIRECTORY / name);
+}
+
+void Game::MenuSaveTrace()
+{
+    if (!SaveTrace("manual"))
+    {
+        MessageBoxA(m_window, "The previous trace is still being saved", "Save Trace", MB_OK | MB_ICONINFORMATION);
+    }
+}
+
+void Game::MenuToggleTraceSlowFrames()
+{
+    m_traceSlowFrames = !m_traceSlowFrames;
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_TRACESLOWFRAMES,
+        m_traceSlowFrames ? MF_CHECKED : MF_UNCHECKED);
+}
+
+void Game::MenuSaveScreenshot()
+{
+    FrameCapture::Request(CaptureRequest::Window);
+}
+
+void Game::MenuSaveScreenshotVideo()
+{
+    if (!GameLink::IsActive())
+    {
+        MessageBoxA(m_window, "AppleWin isn't running with GameLink", "Save Screenshot", MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+    FrameCapture::Request(CaptureRequest::Video);
+}
+
+void Game::MenuToggleInstantReplay()
+{
+    m_frameCapture.SetReplayEnabled(!m_frameCapture.IsReplayEnabled());
+    CheckMenuItem(GetMenu(m_window), ID_TOOLS_INSTANTREPLAY,
+        m_frameCapture.IsReplayEnabled() ? MF_CHECKED : MF_UNCHECKED);
+}
+
+void Game::MenuSaveInstantReplay()
+{
+    if (!m_frameCapture.IsReplayEnabled())
+    {
+        MessageBoxA(m_window, "Turn on Tools > Instant Replay first", "Save Instant Replay", MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+    FrameCapture::Request(CaptureRequest::Replay);
+}
+
 #pragma endregion
 
 #pragma region Direct3D Resources
@@ -518,7 +1302,7 @@ void Game::CreateDeviceDependentResources()
     /// <summary>
     /// Start of Font resource uploading to GPU
     /// </summary>
-    m_resourceDescriptors = std::make_unique<DescriptorHeap>(device, (int)FontDescriptors::Count);
+    m_resourceDescriptors = std::make_unique<DescriptorHeap>(device, (int)FontDescriptors::Count + 1);
 
     ResourceUploadBatch resourceUpload(device);
 
@@ -542,10 +1326,31 @@ void Game::CreateDeviceDependentResources()
     SpriteBatchPipelineStateDescription spd(rtState);
     m_spriteBatch = std::make_unique<SpriteBatch>(device, resourceUpload, spd);
 
+    // The sidebar stream renders to its own target, without depth
+    RenderTargetState sidebarRtState(DXGI_FORMAT_B8G8R8A8_UNORM, DXGI_FORMAT_UNKNOWN);
+    SpriteBatchPipelineStateDescription sidebarSpd(sidebarRtState);
+    m_sidebarSpriteBatch = std::make_unique<SpriteBatch>(device, resourceUpload, sidebarSpd);
+
     auto uploadResourcesFinished = resourceUpload.End(command_queue);
 
     uploadResourcesFinished.wait();
 
+    // The memory heatmap texture. Its content is uploaded by UploadHeatmap().
+    {
+        CD3DX12_HEAP_PROPERTIES heapDefault(D3D12_HEAP_TYPE_DEFAULT);
+        auto heatmapDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_B8G8R8A8_UNORM, HEATMAP_WIDTH, HEATMAP_HEIGHT, 1, 1);
+        DX::ThrowIfFailed(
+            device->CreateCommittedResource(
+                &heapDefault,
+                D3D12_HEAP_FLAG_NONE,
+                &heatmapDesc,
+                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+                nullptr,
+                IID_PPV_ARGS(m_heatmapTexture.ReleaseAndGetAddressOf())));
+        CreateShaderResourceView(device, m_heatmapTexture.Get(), m_resourceDescriptors->GetCpuHandle(HEATMAP_DESCRIPTOR_INDEX));
+        m_heatmap.SetAllDirty();
+    }
+
     //////////////////////////////////////////////////
 
     /// <summary>
@@ -774,6 +1579,21 @@ void Game::CreateDeviceDependentResources()
 
     m_lineEffect->SetProjection(XMMatrixOrthographicOffCenterRH(0, APPLEWIN_WIDTH, APPLEWIN_HEIGHT, 0, 0, 1));
 
+    EffectPipelineStateDescription sidebarEpd(
+        &VertexPositionColor::InputLayout,
+        CommonStates::Opaque,
+        CommonStates::DepthNone,
+        CommonStates::CullNone,
+        sidebarRtState,
+        D3D12_PRIMITIVE_TOPOLOGY_TYPE_LINE);
+
+    m_sidebarLineEffect = std::make_unique<BasicEffect>(device, EffectFlags::VertexColor, sidebarEpd);
+
+    // Its render target and readback buffers are created when the stream renders, at the size of the sidebars
+    m_sidebarRtvHeap = std::make_unique<DescriptorHeap>(device,
+        D3D12_DESCRIPTOR_HEAP_TYPE_RTV, D3D12_DESCRIPTOR_HEAP_FLAG_NONE, 1);
+    m_sidebarStream.Invalidate();
+
     /// <summary>
     /// Finish
     /// </summary>
@@ -887,6 +1707,21 @@ void Game::OnDeviceLost()
         m_spriteFonts.at(i).reset();
     }
     m_texture.Reset();
+    m_heatmapTexture.Reset();
+    m_sidebarTarget.Reset();
+    for (UINT i = 0; i < SIDEBAR_READBACK_COUNT; i++)
+    {
+        m_sidebarReadback[i].Reset();
+        m_sidebarReadbackPending[i] = false;
+    }
+    for (UINT i = 0; i < CAPTURE_READBACK_COUNT; i++)
+    {
+        m_captureReadback[i].Reset();
+        m_captureReadbackPending[i] = false;
+    }
+    m_sidebarRtvHeap.reset();
+    m_sidebarSpriteBatch.reset();
+    m_sidebarLineEffect.reset();
     m_indexBuffer.Reset();
     m_vertexBuffer.Reset();
     m_pipelineState.Reset();
@@ -8,6 +8,9 @@
 #include "StepTimer.h"
 #include "HAUtils.h"
 
+class Sidebar;
+struct BlockStruct;
+
 enum class GameLinkLayout
 {
     NORMAL      = 0,
@@ -49,10 +52,26 @@ public:
     void OnResuming();
     void OnWindowMoved();
     void OnWindowSizeChanged(int width, int height);
+    void OnKeystrokeSent(LPARAM lParam);
 
     // Menu commands
     void MenuActivateProfile();
     void MenuDeactivateProfile();
+    void MenuBenchmarkExpressions();
+    void MenuToggleRecordSession();
+    void MenuToggleRecordSessionVideo();
+    void MenuToggleMemoryHeatmap();
+    void MenuShowProfiler(HINSTANCE hInstance);
+    void MenuToggleValueServer();
+    void MenuToggleSidebarStream();
+    void MenuToggleSidebarStreamTransparent();
+    void MenuToggleFrameTiming();
+    void MenuSaveTrace();
+    void MenuToggleTraceSlowFrames();
+    void MenuSaveScreenshot();
+    void MenuSaveScreenshotVideo();
+    void MenuToggleInstantReplay();
+    void MenuSaveInstantReplay();
 
     // Other methods
     D3D12_RESOURCE_DESC ChooseTexture();
@@ -68,6 +87,18 @@ private:
 
     void Update(DX::StepTimer const& timer);
     void Render();
+    void DrawVideoText();
+    void DrawSidebars(DirectX::SpriteBatch* spriteBatch, DirectX::BasicEffect* lineEffect, float scale);
+    void DrawGraph(const Sidebar& sb, const BlockStruct& b, float scale);
+    void UploadHeatmap(ID3D12GraphicsCommandList* commandList);
+    void RenderSidebarStream(ID3D12GraphicsCommandList* commandList);
+    void CreateSidebarStreamResources(UINT width, UINT height);
+    bool GetVideoFrame(const UINT8*& pixels, UINT32& width, UINT32& height, INT32& rowPitch);
+    void CaptureWindow(ID3D12GraphicsCommandList* commandList);
+    void SaveWindowCapture();
+    void UpdateMetricsHud();
+    void DrawMetricsHud();
+    bool SaveTrace(const char* reason);
 
     void Clear();
 
@@ -122,4 +153,24 @@ private:
     Microsoft::WRL::ComPtr<ID3D12Resource>          m_texture;
     D3D12_VERTEX_BUFFER_VIEW                        m_vertexBufferView;
     D3D12_INDEX_BUFFER_VIEW                         m_indexBufferView;
+
+    // Memory heatmap texture
+    Microsoft::WRL::ComPtr<ID3D12Resource>          m_heatmapTexture;
+
+    // Offscreen render of the sidebars for the sidebar stream, read back once per back buffer
+    static constexpr UINT SIDEBAR_READBACK_COUNT = 3;
+    Microsoft::WRL::ComPtr<ID3D12Resource>          m_sidebarTarget;
+    Microsoft::WRL::ComPtr<ID3D12Resource>          m_sidebarReadback[SIDEBAR_READBACK_COUNT];
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT              m_sidebarFootprint;
+    RECT                                            m_sidebarTargetBounds;
+    bool                                            m_sidebarReadbackPending[SIDEBAR_READBACK_COUNT];
+    RECT                                            m_sidebarReadbackBounds[SIDEBAR_READBACK_COUNT];
+    UINT16                                          m_sidebarReadbackSeq[SIDEBAR_READBACK_COUNT];
+
+    // Window screenshots, read back from the back buffer that was presented
+    static constexpr UINT CAPTURE_READBACK_COUNT = 3;
+    bool                                            m_captureWindow;
+    Microsoft::WRL::ComPtr<ID3D12Resource>          m_captureReadback[CAPTURE_READBACK_COUNT];
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT              m_captureFootprint[CAPTURE_READBACK_COUNT];
+    bool                                            m_captureReadbackPending[CAPTURE_READBACK_COUNT];
 };
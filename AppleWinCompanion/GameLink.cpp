@@ -1,144 +1,11 @@
 #include "pch.h"
 #include "GameLink.h"
-
-//------------------------------------------------------------------------------
-// Local Definitions
-//------------------------------------------------------------------------------
-
-#define SYSTEM_NAME		"AppleWin"
-#define PROTOCOL_VER		4
-#define GAMELINK_MUTEX_NAME		"DWD_GAMELINK_MUTEX_R4"
-#define GAMELINK_MMAP_NAME		"DWD_GAMELINK_MMAP_R4"
+#include "GameLinkProtocol.h"
+#include "Metrics.h"
+#include "Tracer.h"
 
 using namespace GameLink;
 
-//------------------------------------------------------------------------------
-// Shared Memory Structure
-//------------------------------------------------------------------------------
-
-#pragma pack( push, 1 )
-
-	//
-	// sSharedMMapFrame_R1
-	//
-	// Server -> Client Frame. 32-bit RGBA up to MAX_WIDTH x MAX_HEIGHT
-	//
-struct sSharedMMapFrame_R1
-{
-	UINT16 seq;
-	UINT16 width;
-	UINT16 height;
-
-	UINT8 image_fmt; // 0 = no frame; 1 = 32-bit 0xAARRGGBB
-	UINT8 reserved0;
-
-	UINT16 par_x; // pixel aspect ratio
-	UINT16 par_y;
-
-	enum { MAX_WIDTH = 1280 };
-	enum { MAX_HEIGHT = 1024 };
-
-	enum { MAX_PAYLOAD = MAX_WIDTH * MAX_HEIGHT * 4 };
-	UINT8 buffer[MAX_PAYLOAD];
-};
-
-//
-// sSharedMMapInput_R2
-//
-// Client -> Server Input Data
-//
-
-struct sSharedMMapInput_R2
-{
-	float mouse_dx;
-	float mouse_dy;
-	UINT8 ready;
-	UINT8 mouse_btn;
-	UINT keyb_state[8];
-
-	enum { READY_NO = 0 };					// Input not ready
-	enum { READY_GC = 1 };					// Input from GC
-	enum { READY_OTHER = 17 };				// Input from other app
-};
-
-//
-// sSharedMMapPeek_R2
-//
-// Memory reading interface, an obsolete way of requesting RAM address values.
-// This is unnecessary now for reading RAM as the RAM is completely mapped at the end of the SHM
-// However we can use this interface to request processor registers!
-struct sSharedMMapPeek_R2
-{
-	enum { PEEK_SPECIAL_PC_H = UINT_MAX - 1 };	// Set this address to request program counter high byte
-	enum { PEEK_SPECIAL_PC_L = UINT_MAX - 2 };	// Set this address to request program counter low byte
-	enum { PEEK_LIMIT = 16 * 1024 };
-
-	UINT addr_count;
-	UINT addr[PEEK_LIMIT];
-	UINT8 data[PEEK_LIMIT];
-};
-
-//
-// sSharedMMapBuffer_R1
-//
-// General buffer (64Kb)
-//
-struct sSharedMMapBuffer_R1
-{
-	enum { BUFFER_SIZE = (64 * 1024) };
-
-	UINT16 payload;
-	UINT8 data[BUFFER_SIZE];
-};
-
-//
-// sSharedMMapAudio_R1
-//
-// Audio control interface.
-//
-struct sSharedMMapAudio_R1
-{
-	UINT8 master_vol_l;
-	UINT8 master_vol_r;
-};
-
-//
-// sSharedMemoryMap_R4
-//
-// Memory Map (top-level object)
-//
-
-constexpr int FLAG_WANT_KEYB = 1 << 0;
-constexpr int FLAG_WANT_MOUSE = 1 << 1;
-constexpr int FLAG_NO_FRAME = 1 << 2;
-constexpr int FLAG_PAUSED = 1 << 3;
-constexpr int SYSTEM_MAXLEN = 64;
-constexpr int PROGRAM_MAXLEN = 260;
-
-struct sSharedMemoryMap_R4
-{
-	UINT8 version; // = PROTOCOL_VER
-	UINT8 flags;
-	char system[SYSTEM_MAXLEN] = {}; // System name.
-	char program[PROGRAM_MAXLEN] = {}; // Program name. Zero terminated.
-	UINT program_hash[4] = { 0,0,0,0 }; // Program code hash (256-bits)
-
-	sSharedMMapFrame_R1 frame;
-	sSharedMMapInput_R2 input;
-	sSharedMMapPeek_R2 peek;
-	sSharedMMapBuffer_R1 buf_tohost;
-	sSharedMMapBuffer_R1 buf_recv; // a message to us.
-	sSharedMMapAudio_R1 audio;
-
-	// added for protocol v4
-	UINT ram_size;
-
-	sSharedMMapInput_R2 input_other;	// A second app's input channel so it isn't clobbered by GC
-
-};
-
-#pragma pack( pop )
-
 //------------------------------------------------------------------------------
 // Local Data
 //------------------------------------------------------------------------------
@@ -174,6 +41,20 @@ void CloseMutex()
 	}
 }
 
+// With the metrics or the tracer on, first tries without waiting, to count, time and trace the waits for AppleWin
+static DWORD WaitForMutex(DWORD milliseconds)
+{
+	if (!Metrics::IsEnabled() && !Tracer::IsEnabled())
+		return WaitForSingleObject(g_mutex_handle, milliseconds);
+	DWORD result = WaitForSingleObject(g_mutex_handle, 0);
+	if (result != WAIT_TIMEOUT)
+		return result;
+	Metrics::Add(MetricCounter::MutexWaits);
+	MetricScope scope(MetricTiming::MutexWait);
+	TraceScope trace("GameLink mutex wait");
+	return WaitForSingleObject(g_mutex_handle, milliseconds);
+}
+
 //------------------------------------------------------------------------------
 // Methods
 //------------------------------------------------------------------------------
@@ -252,6 +133,12 @@ UINT8 GameLink::GetPeekAt(UINT position)
 	return 0;
 }
 
+UINT16 GameLink::GetProgramCounter()
+{
+	// Peeks 0 and 1 are set up by Init() to return the PC
+	return (static_cast<UINT16>(GetPeekAt(0)) << 8) | GetPeekAt(1);
+}
+
 bool GameLink::IsActive()
 {
 	return (g_p_shared_memory != NULL);
@@ -305,7 +192,7 @@ void GameLink::SetSoundVolume(UINT8 main, UINT8 mockingboard)
 		mockingboard = 0;
 	if (mockingboard > 100)
 		mockingboard = 100;
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
+	DWORD dwWaitResult = WaitForMutex(3000);
 	switch (dwWaitResult)
 	{
 	case WAIT_OBJECT_0:
@@ -328,7 +215,7 @@ void GameLink::SetSoundVolume(UINT8 main, UINT8 mockingboard)
 
 int GameLink::GetSoundVolumeMain()
 {
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
+	DWORD dwWaitResult = WaitForMutex(3000);
 	int ret = 0;
 	switch (dwWaitResult)
 	{
@@ -351,7 +238,7 @@ int GameLink::GetSoundVolumeMain()
 
 int GameLink::GetSoundVolumeMockingboard()
 {
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
+	DWORD dwWaitResult = WaitForMutex(3000);
 	int ret = 0;
 	switch (dwWaitResult)
 	{
@@ -374,7 +261,7 @@ int GameLink::GetSoundVolumeMockingboard()
 
 void GameLink::SendKeystroke(UINT iVK_Code, LPARAM lParam)
 {
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
+	DWORD dwWaitResult = WaitForMutex(3000);
 	switch (dwWaitResult)
 	{
 	case WAIT_OBJECT_0:
@@ -413,7 +300,7 @@ void GameLink::SendKeystroke(UINT iVK_Code, LPARAM lParam)
 sFramebufferInfo GameLink::GetFrameBufferInfo()
 {
 	sFramebufferInfo fbI = sFramebufferInfo();
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 1000);
+	DWORD dwWaitResult = WaitForMutex(1000);
 	switch (dwWaitResult)
 	{
 	case WAIT_ABANDONED:
@@ -454,4 +341,20 @@ UINT16 GameLink::GetFrameSequence()
 	return g_p_shared_memory->frame.seq;
 }
 
+const volatile UINT16* GameLink::GetFrameSequenceAddress()
+{
+	if (g_p_shared_memory)
+		return &g_p_shared_memory->frame.seq;
+	return nullptr;
+}
+
+bool GameLink::GetFrameProducedTime(UINT16 seq, UINT64& ticks)
+{
+	if (!(g_p_shared_memory->flags & FLAG_FRAME_TIME))
+		return false;
+	ticks = g_p_shared_memory->frame.produced_time;
+	// The seq is written after the time, check it again in case the next frame came in between
+	return (g_p_shared_memory->frame.produced_seq == seq) && (g_p_shared_memory->frame.seq == seq);
+}
+
 
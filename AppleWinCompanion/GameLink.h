@@ -34,6 +34,7 @@ namespace GameLink
 	extern int GetMemorySize();
 	extern UINT8* GetMemoryBasePointer();
 	extern UINT8 GetPeekAt(UINT position);
+	extern UINT16 GetProgramCounter();
 	extern bool IsActive();
 	extern bool IsTrackingOnly();
 
@@ -52,5 +53,11 @@ namespace GameLink
 
 	extern sFramebufferInfo GetFrameBufferInfo();
 	extern inline UINT16 GetFrameSequence();
+	// Address of the frame sequence, for threads that poll it. Null when GameLink isn't active.
+	// Destroy() doesn't unmap the view, so the address stays readable after it.
+	extern const volatile UINT16* GetFrameSequenceAddress();
+	// When the emulator produced frame seq, in QueryPerformanceCounter() ticks.
+	// False if the emulator doesn't say, or already moved on to the next frame.
+	extern bool GetFrameProducedTime(UINT16 seq, UINT64& ticks);
 
 }; // namespace GameLink
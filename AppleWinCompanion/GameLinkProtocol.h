@@ -0,0 +1,150 @@
+#pragma once
+
+// The GameLink shared memory layout, as written by AppleWin (and by SessionPlayer when replaying).
+// The emulated RAM follows right after sSharedMemoryMap_R4, ram_size bytes long.
+
+//------------------------------------------------------------------------------
+// Protocol Definitions
+//------------------------------------------------------------------------------
+
+#define SYSTEM_NAME		"AppleWin"
+#define PROTOCOL_VER		4
+#define GAMELINK_MUTEX_NAME		"DWD_GAMELINK_MUTEX_R4"
+#define GAMELINK_MMAP_NAME		"DWD_GAMELINK_MMAP_R4"
+
+//------------------------------------------------------------------------------
+// Shared Memory Structure
+//------------------------------------------------------------------------------
+
+#pragma pack( push, 1 )
+
+	//
+	// sSharedMMapFrame_R1
+	//
+	// Server -> Client Frame. 32-bit RGBA up to MAX_WIDTH x MAX_HEIGHT
+	//
+struct sSharedMMapFrame_R1
+{
+	UINT16 seq;
+	UINT16 width;
+	UINT16 height;
+
+	UINT8 image_fmt; // 0 = no frame; 1 = 32-bit 0xAARRGGBB
+	UINT8 reserved0;
+
+	UINT16 par_x; // pixel aspect ratio
+	UINT16 par_y;
+
+	enum { MAX_WIDTH = 1280 };
+	enum { MAX_HEIGHT = 1024 };
+
+	enum { MAX_PAYLOAD = MAX_WIDTH * MAX_HEIGHT * 4 };
+	enum { FRAME_TIME_SIZE = 16 };
+	UINT8 buffer[MAX_PAYLOAD - FRAME_TIME_SIZE];
+
+	// Optional, valid when the server sets FLAG_FRAME_TIME: the QueryPerformanceCounter() time when
+	// the frame produced_seq was produced, written before seq. It takes the end of the payload,
+	// which no Apple 2 frame reaches, so the layout is the same for servers that don't know it.
+	UINT64 produced_time;
+	UINT16 produced_seq;
+	UINT8 reserved1[6];
+};
+static_assert(sizeof(sSharedMMapFrame_R1) == 12 + sSharedMMapFrame_R1::MAX_PAYLOAD, "GameLink frame layout changed");
+
+//
+// sSharedMMapInput_R2
+//
+// Client -> Server Input Data
+//
+
+struct sSharedMMapInput_R2
+{
+	float mouse_dx;
+	float mouse_dy;
+	UINT8 ready;
+	UINT8 mouse_btn;
+	UINT keyb_state[8];
+
+	enum { READY_NO = 0 };					// Input not ready
+	enum { READY_GC = 1 };					// Input from GC
+	enum { READY_OTHER = 17 };				// Input from other app
+};
+
+//
+// sSharedMMapPeek_R2
+//
+// Memory reading interface, an obsolete way of requesting RAM address values.
+// This is unnecessary now for reading RAM as the RAM is completely mapped at the end of the SHM
+// However we can use this interface to request processor registers!
+struct sSharedMMapPeek_R2
+{
+	enum { PEEK_SPECIAL_PC_H = UINT_MAX - 1 };	// Set this address to request program counter high byte
+	enum { PEEK_SPECIAL_PC_L = UINT_MAX - 2 };	// Set this address to request program counter low byte
+	enum { PEEK_LIMIT = 16 * 1024 };
+
+	UINT addr_count;
+	UINT addr[PEEK_LIMIT];
+	UINT8 data[PEEK_LIMIT];
+};
+
+//
+// sSharedMMapBuffer_R1
+//
+// General buffer (64Kb)
+//
+struct sSharedMMapBuffer_R1
+{
+	enum { BUFFER_SIZE = (64 * 1024) };
+
+	UINT16 payload;
+	UINT8 data[BUFFER_SIZE];
+};
+
+//
+// sSharedMMapAudio_R1
+//
+// Audio control interface.
+//
+struct sSharedMMapAudio_R1
+{
+	UINT8 master_vol_l;
+	UINT8 master_vol_r;
+};
+
+//
+// sSharedMemoryMap_R4
+//
+// Memory Map (top-level object)
+//
+
+constexpr int FLAG_WANT_KEYB = 1 << 0;
+constexpr int FLAG_WANT_MOUSE = 1 << 1;
+constexpr int FLAG_NO_FRAME = 1 << 2;
+constexpr int FLAG_PAUSED = 1 << 3;
+constexpr int FLAG_FRAME_TIME = 1 << 4;		// frame.produced_time is set
+constexpr int SYSTEM_MAXLEN = 64;
+constexpr int PROGRAM_MAXLEN = 260;
+
+struct sSharedMemoryMap_R4
+{
+	UINT8 version; // = PROTOCOL_VER
+	UINT8 flags;
+	char system[SYSTEM_MAXLEN] = {}; // System name.
+	char program[PROGRAM_MAXLEN] = {}; // Program name. Zero terminated.
+	UINT program_hash[4] = { 0,0,0,0 }; // Program code hash (256-bits)
+
+	sSharedMMapFrame_R1 frame;
+	sSharedMMapInput_R2 input;
+	sSharedMMapPeek_R2 peek;
+	sSharedMMapBuffer_R1 buf_tohost;
+	sSharedMMapBuffer_R1 buf_recv; // a message to us.
+	sSharedMMapAudio_R1 audio;
+
+	// added for protocol v4
+	UINT ram_size;
+
+	sSharedMMapInput_R2 input_other;	// A second app's input channel so it isn't clobbered by GC
+
+};
+
+#pragma pack( pop )
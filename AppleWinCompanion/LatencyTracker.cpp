@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "LatencyTracker.h"
+#include "Metrics.h"
+
+void LatencyTracker::Reset()
+{
+	m_seenTicks = 0;
+	m_producedTicks = 0;
+	m_uploadPending = false;
+	m_frameHash = 0;
+	m_frameHashValid = false;
+	m_hashPending = false;
+	m_keyTicks = 0;
+	m_keyHash = 0;
+	m_keyChanged = false;
+}
+
+void LatencyTracker::FrameSeen(UINT64 producedTicks)
+{
+	if (!Metrics::IsEnabled())
+		return;
+	// A frame that was seen but not presented yet is replaced, it is the newer one that will show
+	m_seenTicks = Metrics::GetTicks();
+	// A time after now isn't from the same clock
+	m_producedTicks = (producedTicks <= m_seenTicks) ? producedTicks : 0;
+	m_uploadPending = true;
+	m_hashPending = true;
+}
+
+void LatencyTracker::FrameUploaded(const void* pixels, size_t size)
+{
+	if (!Metrics::IsEnabled())
+		return;
+	if (m_uploadPending)
+	{
+		m_uploadPending = false;
+		Metrics::Record(MetricTiming::SeenToUpload, Metrics::TicksToNs(Metrics::GetTicks() - m_seenTicks));
+	}
+	// The same frame is uploaded again when there's no new one
+	if ((m_hashPending || !m_frameHashValid) && (pixels != nullptr))
+	{
+		m_frameHash = HashPixels(pixels, size);
+		m_frameHashValid = true;
+		m_hashPending = false;
+		if ((m_keyTicks != 0) && !m_keyChanged)
+			m_keyChanged = (m_frameHash != m_keyHash);
+	}
+}
+
+void LatencyTracker::FramePresented()
+{
+	if (!Metrics::IsEnabled())
+		return;
+	UINT64 now = Metrics::GetTicks();
+	if ((m_seenTicks != 0) && !m_uploadPending)
+	{
+		Metrics::Record(MetricTiming::SeenToPresent, Metrics::TicksToNs(now - m_seenTicks));
+		if (m_producedTicks != 0)
+			Metrics::Record(MetricTiming::EmulatorToPresent, Metrics::TicksToNs(now - m_producedTicks));
+		m_seenTicks = 0;
+		m_producedTicks = 0;
+	}
+	if (m_keyTicks != 0)
+	{
+		UINT64 ns = Metrics::TicksToNs(now - m_keyTicks);
+		if (m_keyChanged)
+			Metrics::Record(MetricTiming::KeyToPresent, ns);
+		if (m_keyChanged || (ns > LATENCY_KEY_TIMEOUT_MS * 1000000ull))
+		{
+			m_keyTicks = 0;
+			m_keyChanged = false;
+		}
+	}
+}
+
+void LatencyTracker::KeySent()
+{
+	if (!Metrics::IsEnabled() || (m_keyTicks != 0) || !m_frameHashValid)
+		return;
+	m_keyHash = m_frameHash;
+	m_keyChanged = false;
+	m_keyTicks = Metrics::GetTicks();
+}
+
+// FNV-1a over 8 bytes at a time, a frame is about 1MB and is hashed once per new frame
+UINT64 LatencyTracker::HashPixels(const void* pixels, size_t size)
+{
+	const UINT8* p = static_cast<const UINT8*>(pixels);
+	UINT64 hash = 0xcbf29ce484222325ull;
+	size_t i = 0;
+	for (; i + sizeof(UINT64) <= size; i += sizeof(UINT64))
+	{
+		UINT64 word;
+		memcpy(&word, p + i, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ull;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ p[i]) * 0x100000001b3ull;
+	return hash;
+}
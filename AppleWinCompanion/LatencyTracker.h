@@ -0,0 +1,45 @@
+#pragma once
+
+/// <summary>
+/// LatencyTracker measures how long the frames of AppleWin take to reach the screen, into the
+/// latency timings of Metrics. The render loop tells it when it first sees a new GameLink frame
+/// sequence, when it records the upload of the frame, and when Present() returns. If the emulator
+/// stamps its frames with FLAG_FRAME_TIME, the time from the emulator is measured too.
+///
+/// For a keystroke sent to AppleWin, the latency runs until the first presented frame whose pixels
+/// differ from those on screen when the key went out. Each new frame is hashed as it is uploaded,
+/// from the buffer the upload reads, so a key compares with the hash of the last frame uploaded and
+/// never reads the GameLink memory outside of the render loop. A key that changes nothing is dropped
+/// after LATENCY_KEY_TIMEOUT_MS. The keys sent while another one waits aren't measured.
+///
+/// Everything runs on the UI thread, and does nothing while the metrics are off.
+/// </summary>
+
+constexpr UINT32 LATENCY_KEY_TIMEOUT_MS = 2000;
+
+class LatencyTracker
+{
+public:
+	// producedTicks is the time of the frame from the emulator, 0 if it didn't give one
+	void FrameSeen(UINT64 producedTicks);
+	// pixels is the frame being uploaded, hashed once per frame seen
+	void FrameUploaded(const void* pixels, size_t size);
+	void FramePresented();
+	void KeySent();
+	void Reset();
+
+	static UINT64 HashPixels(const void* pixels, size_t size);
+
+private:
+	UINT64 m_seenTicks = 0;			// of the frame waiting to be presented, 0 if none
+	UINT64 m_producedTicks = 0;
+	bool m_uploadPending = false;
+
+	UINT64 m_frameHash = 0;			// of the last frame uploaded
+	bool m_frameHashValid = false;
+	bool m_hashPending = false;		// a new frame was seen since the last hash
+
+	UINT64 m_keyTicks = 0;			// of the key waiting for a change, 0 if none
+	UINT64 m_keyHash = 0;
+	bool m_keyChanged = false;
+};
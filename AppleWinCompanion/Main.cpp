@@ -9,6 +9,9 @@
 #include "SidebarManager.h"
 #include "SidebarContent.h"
 #include "GameLink.h"
+#include "MemorySearchDialog.h"
+#include "ProfilerDialog.h"
+#include "DisassemblyDialog.h"
 
 using namespace DirectX;
 
@@ -141,8 +144,12 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     {
         if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
         {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
+            if (!MemorySearchDialog::HandleMessage(&msg) && !ProfilerDialog::HandleMessage(&msg)
+                && !DisassemblyDialog::HandleMessage(&msg))
+            {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
         }
         else
         {
@@ -320,8 +327,24 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
     case WM_KEYDOWN:
         GameLink::SendKeystroke((UINT)wParam, lParam);
+        if (game)
+        {
+            game->OnKeystrokeSent(lParam);
+        }
         break;
     case WM_KEYUP:
+        // Windows only sends the key up of PrintScreen
+        if ((wParam == VK_SNAPSHOT) && game)
+        {
+            if ((GetKeyState(VK_CONTROL) < 0) && (GetKeyState(VK_SHIFT) < 0))
+                game->MenuSaveTrace();
+            else if (GetKeyState(VK_CONTROL) < 0)
+                game->MenuSaveInstantReplay();
+            else if (GetKeyState(VK_SHIFT) < 0)
+                game->MenuSaveScreenshotVideo();
+            else
+                game->MenuSaveScreenshot();
+        }
         [[fallthrough]];
     case WM_SYSKEYUP:
         Keyboard::ProcessMessage(message, wParam, lParam);
@@ -411,6 +434,136 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			GameLink::SetVideoModeSDHR();
 			break;
 		}
+        case ID_TOOLS_BENCHMARKEXPRESSIONS:
+        {
+            if (game)
+            {
+                game->MenuBenchmarkExpressions();
+            }
+            break;
+        }
+        case ID_TOOLS_RECORDSESSION:
+        {
+            if (game)
+            {
+                game->MenuToggleRecordSession();
+            }
+            break;
+        }
+        case ID_TOOLS_RECORDSESSIONVIDEO:
+        {
+            if (game)
+            {
+                game->MenuToggleRecordSessionVideo();
+            }
+            break;
+        }
+        case ID_TOOLS_MEMORYSEARCH:
+        {
+            MemorySearchDialog::Show(hInst, hWnd);
+            break;
+        }
+        case ID_TOOLS_MEMORYHEATMAP:
+        {
+            if (game)
+            {
+                game->MenuToggleMemoryHeatmap();
+            }
+            break;
+        }
+        case ID_TOOLS_PROFILER:
+        {
+            if (game)
+            {
+                game->MenuShowProfiler(hInst);
+            }
+            break;
+        }
+        case ID_TOOLS_DISASSEMBLY:
+        {
+            DisassemblyDialog::Show(hInst, hWnd);
+            break;
+        }
+        case ID_TOOLS_VALUESERVER:
+        {
+            if (game)
+            {
+                game->MenuToggleValueServer();
+            }
+            break;
+        }
+        case ID_TOOLS_SIDEBARSTREAM:
+        {
+            if (game)
+            {
+                game->MenuToggleSidebarStream();
+            }
+            break;
+        }
+        case ID_TOOLS_SIDEBARSTREAMTRANSPARENT:
+        {
+            if (game)
+            {
+                game->MenuToggleSidebarStreamTransparent();
+            }
+            break;
+        }
+        case ID_TOOLS_FRAMETIMING:
+        {
+            if (game)
+            {
+                game->MenuToggleFrameTiming();
+            }
+            break;
+        }
+        case ID_TOOLS_SAVETRACE:
+        {
+            if (game)
+            {
+                game->MenuSaveTrace();
+            }
+            break;
+        }
+        case ID_TOOLS_TRACESLOWFRAMES:
+        {
+            if (game)
+            {
+                game->MenuToggleTraceSlowFrames();
+            }
+            break;
+        }
+        case ID_TOOLS_SCREENSHOT:
+        {
+            if (game)
+            {
+                game->MenuSaveScreenshot();
+            }
+            break;
+        }
+        case ID_TOOLS_SCREENSHOTVIDEO:
+        {
+            if (game)
+            {
+                game->MenuSaveScreenshotVideo();
+            }
+            break;
+        }
+        case ID_TOOLS_INSTANTREPLAY:
+        {
+            if (game)
+            {
+                game->MenuToggleInstantReplay();
+            }
+            break;
+        }
+        case ID_TOOLS_SAVEREPLAY:
+        {
+            if (game)
+            {
+                game->MenuSaveInstantReplay();
+            }
+            break;
+        }
         case IDM_ABOUT:
             DialogBox(hInst, MAKEINTRESOURCE(IDD_ABOUTBOX), hWnd, About);
             break;
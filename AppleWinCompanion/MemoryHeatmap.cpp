@@ -0,0 +1,120 @@
+#include "pch.h"
+#include "MemoryHeatmap.h"
+#include <emmintrin.h>
+
+constexpr size_t HEATMAP_MEMORY_SIZE = HEATMAP_WIDTH * HEATMAP_HEIGHT;
+
+// Dark blue for cold bytes so that the memory layout stays visible, then red, yellow and white
+static UINT32 HeatColor(UINT8 heat)
+{
+	UINT32 r, g, b;
+	if (heat < 85)
+	{
+		r = heat * 3;
+		g = 0;
+		b = 48 - (heat * 48 / 85);
+	}
+	else if (heat < 170)
+	{
+		r = 255;
+		g = (heat - 85) * 3;
+		b = 0;
+	}
+	else
+	{
+		r = 255;
+		g = 255;
+		b = (heat - 170) * 3;
+	}
+	return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+static const std::array<UINT32, 256> s_palette = []
+{
+	std::array<UINT32, 256> p;
+	for (UINT32 i = 0; i < 256; i++)
+		p[i] = HeatColor(static_cast<UINT8>(i));
+	return p;
+}();
+
+MemoryHeatmap::MemoryHeatmap()
+{
+	m_heat.assign(HEATMAP_MEMORY_SIZE, 0);
+	m_previous.assign(HEATMAP_MEMORY_SIZE, 0);
+	m_pixels.assign(HEATMAP_MEMORY_SIZE, s_palette[0]);
+	Reset();
+}
+
+void MemoryHeatmap::Reset()
+{
+	std::fill(m_heat.begin(), m_heat.end(), static_cast<UINT8>(0));
+	std::fill(m_pixels.begin(), m_pixels.end(), s_palette[0]);
+	m_hotPages.reset();
+	m_dirtyRows.set();
+	m_started = false;
+	m_seq = 0;
+	m_frames = 0;
+}
+
+void MemoryHeatmap::Update(UINT16 seq, const UINT8* mem, size_t size)
+{
+	if (mem == nullptr)
+		return;
+	size = std::min(size, HEATMAP_MEMORY_SIZE);
+	if (!m_started)
+	{
+		memcpy(m_previous.data(), mem, size);
+		m_started = true;
+		m_seq = seq;
+		return;
+	}
+	if (seq == m_seq)
+		return;
+	m_seq = seq;
+	bool decay = ((++m_frames % HEATMAP_DECAY_INTERVAL) == 0);
+
+	for (UINT32 page = 0; page < size / HEATMAP_WIDTH; page++)
+	{
+		const UINT8* cur = mem + (page * HEATMAP_WIDTH);
+		if (!(decay && m_hotPages.test(page))
+			&& (memcmp(cur, m_previous.data() + (page * HEATMAP_WIDTH), HEATMAP_WIDTH) == 0))
+			continue;
+		UpdatePage(page, cur, decay);
+	}
+}
+
+void MemoryHeatmap::UpdatePage(UINT32 page, const UINT8* cur, bool decay)
+{
+	size_t base = page * HEATMAP_WIDTH;
+	UINT8* prev = m_previous.data() + base;
+	UINT8* heat = m_heat.data() + base;
+	const __m128i hit = _mm_set1_epi8(static_cast<char>(HEATMAP_HIT));
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i low5 = _mm_set1_epi8(0x1F);
+	__m128i hot = _mm_setzero_si128();
+	for (UINT32 i = 0; i < HEATMAP_WIDTH; i += 16)
+	{
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i));
+		__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+		__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(heat + i));
+		if (decay)
+		{
+			// h -= max(h / 8, 1), saturating at 0. There is no byte shift, the bits shifted
+			// in from the neighbouring byte are masked out.
+			__m128i eighth = _mm_and_si128(_mm_srli_epi16(h, 3), low5);
+			h = _mm_subs_epu8(h, _mm_max_epu8(eighth, one));
+		}
+		// The changed bytes are the ones where the compare is all zeros
+		__m128i unchanged = _mm_cmpeq_epi8(c, p);
+		h = _mm_adds_epu8(h, _mm_andnot_si128(unchanged, hit));
+		hot = _mm_or_si128(hot, h);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(heat + i), h);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(prev + i), c);
+	}
+	m_hotPages.set(page, _mm_movemask_epi8(_mm_cmpeq_epi8(hot, _mm_setzero_si128())) != 0xFFFF);
+
+	UINT32* pixels = m_pixels.data() + base;
+	for (UINT32 i = 0; i < HEATMAP_WIDTH; i++)
+		pixels[i] = s_palette[heat[i]];
+	m_dirtyRows.set(page);
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <vector>
+#include <bitset>
+
+/// <summary>
+/// MemoryHeatmap shows how often each byte of the Apple 2 memory changes.
+/// Every byte has a heat value that goes up by HEATMAP_HIT each frame the byte changed,
+/// and decays exponentially: every HEATMAP_DECAY_INTERVAL frames it loses 1/8th of its value.
+///
+/// The image is HEATMAP_WIDTH x HEATMAP_HEIGHT, one row per 256 byte page: main memory
+/// on the top half, auxiliary memory on the bottom half. Only the pages where a byte changed,
+/// or that are still cooling down, are recomputed and flagged as dirty, so the texture
+/// upload can skip the rest. Quiet pages cost one 256 byte compare per frame.
+/// The compare, the counting and the decay are all done 16 bytes at a time with SSE2.
+/// </summary>
+
+constexpr UINT32 HEATMAP_WIDTH = 256;			// bytes per page
+constexpr UINT32 HEATMAP_HEIGHT = 512;			// pages in 128K
+constexpr UINT8 HEATMAP_HIT = 48;
+constexpr UINT32 HEATMAP_DECAY_INTERVAL = 8;	// frames, for a half-life of about 40 frames
+
+class MemoryHeatmap
+{
+public:
+	MemoryHeatmap();
+
+	// Forgets all the heat. The next Update() only takes the reference snapshot.
+	void Reset();
+	// Accumulates the bytes changed since the previous frame sequence. Calls with the same seq are ignored.
+	void Update(UINT16 seq, const UINT8* mem, size_t size);
+
+	UINT8 GetHeat(UINT32 address) const { return (address < m_heat.size()) ? m_heat[address] : 0; }
+	// B8G8R8A8 pixels, HEATMAP_WIDTH per row
+	const UINT32* GetPixels() const { return m_pixels.data(); }
+	// Flags every row as dirty, when the texture was recreated
+	void SetAllDirty() { m_dirtyRows.set(); }
+
+	// Calls f(firstRow, rowCount) for each run of rows that changed since the last call
+	template <typename F>
+	void ConsumeDirtyRows(F f)
+	{
+		UINT32 row = 0;
+		while (row < HEATMAP_HEIGHT)
+		{
+			if (!m_dirtyRows.test(row))
+			{
+				row++;
+				continue;
+			}
+			UINT32 first = row;
+			while ((row < HEATMAP_HEIGHT) && m_dirtyRows.test(row))
+				row++;
+			f(first, row - first);
+		}
+		m_dirtyRows.reset();
+	}
+
+private:
+	void UpdatePage(UINT32 page, const UINT8* cur, bool decay);
+
+	std::vector<UINT8> m_heat;
+	std::vector<UINT8> m_previous;
+	std::vector<UINT32> m_pixels;
+	std::bitset<HEATMAP_HEIGHT> m_hotPages;		// pages with some heat left
+	std::bitset<HEATMAP_HEIGHT> m_dirtyRows;	// pixels changed since the last ConsumeDirtyRows()
+	bool m_started;
+	UINT16 m_seq;
+	UINT32 m_frames;
+};
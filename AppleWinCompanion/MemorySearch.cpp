@@ -0,0 +1,355 @@
+#include "pch.h"
+#include "MemorySearch.h"
+#include <bitset>
+#include <emmintrin.h>
+
+constexpr size_t MEMSEARCH_BLOCK_SIZE = 64;		// addresses per bitmap word
+
+static const char* s_typeNames[] = { "8-bit", "16-bit", "BCD 8-bit", "BCD 16-bit", "ASCII-high text" };
+static_assert(std::size(s_typeNames) == static_cast<size_t>(MemorySearchType::Count), "a search type has no name");
+
+#pragma region Block masks
+
+// Each mask has bit i set when the predicate holds for byte i of the 64 byte block
+
+static inline UINT64 EqualMask(const UINT8* a, const UINT8* b)
+{
+	UINT64 mask = 0;
+	for (UINT32 i = 0; i < MEMSEARCH_BLOCK_SIZE; i += 16)
+	{
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+		mask |= static_cast<UINT64>(static_cast<UINT16>(_mm_movemask_epi8(eq))) << i;
+	}
+	return mask;
+}
+
+static inline UINT64 EqualValueMask(const UINT8* a, UINT8 value)
+{
+	__m128i v = _mm_set1_epi8(static_cast<char>(value));
+	UINT64 mask = 0;
+	for (UINT32 i = 0; i < MEMSEARCH_BLOCK_SIZE; i += 16)
+	{
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), v);
+		mask |= static_cast<UINT64>(static_cast<UINT16>(_mm_movemask_epi8(eq))) << i;
+	}
+	return mask;
+}
+
+// Unsigned a > b. SSE2 only compares signed bytes, so both sides are offset by 0x80 first.
+static inline UINT64 GreaterMask(const UINT8* a, const UINT8* b)
+{
+	__m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+	UINT64 mask = 0;
+	for (UINT32 i = 0; i < MEMSEARCH_BLOCK_SIZE; i += 16)
+	{
+		__m128i gt = _mm_cmpgt_epi8(
+			_mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), bias),
+			_mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)), bias));
+		mask |= static_cast<UINT64>(static_cast<UINT16>(_mm_movemask_epi8(gt))) << i;
+	}
+	return mask;
+}
+
+#pragma endregion
+
+MemorySearch::MemorySearch()
+{
+	m_type = MemorySearchType::Byte;
+	m_width = 1;
+	m_count = 0;
+}
+
+const char* MemorySearch::GetTypeName(MemorySearchType type)
+{
+	if (type >= MemorySearchType::Count)
+		return "";
+	return s_typeNames[static_cast<size_t>(type)];
+}
+
+void MemorySearch::Clear()
+{
+	m_value.clear();
+	m_candidates.clear();
+	m_snapshot.clear();
+	m_count = 0;
+}
+
+// Numbers are decimal, or hex with a 0x or $ prefix. BCD values are always decimal.
+bool MemorySearch::ParseValue(MemorySearchType type, const std::string& value, std::string& error)
+{
+	m_value.clear();
+	if (type == MemorySearchType::AsciiHigh)
+	{
+		if (value.size() > MEMSEARCH_MAX_TEXT_LENGTH)
+		{
+			error = "the text is longer than " + std::to_string(MEMSEARCH_MAX_TEXT_LENGTH) + " characters";
+			return false;
+		}
+		for (char c : value)
+			m_value.push_back(static_cast<UINT8>(c) | 0x80);
+		return true;
+	}
+	if (value.empty())
+		return true;
+
+	bool isBcd = (type == MemorySearchType::Bcd8) || (type == MemorySearchType::Bcd16);
+	bool isWord = (type == MemorySearchType::Word) || (type == MemorySearchType::Bcd16);
+	UINT64 x = 0;
+	size_t parsed = 0;
+	try
+	{
+		// Decimal, or hex with the Apple 2 $ or a 0x. A leading 0 isn't octal.
+		size_t prefix = 0;
+		if (!isBcd && (value[0] == '$'))
+			prefix = 1;
+		else if (!isBcd && (value.size() > 1) && (value[0] == '0') && ((value[1] == 'x') || (value[1] == 'X')))
+			prefix = 2;
+		x = std::stoull(value.substr(prefix), &parsed, (prefix > 0) ? 16 : 10);
+		parsed += prefix;
+	}
+	catch (std::exception&)
+	{
+		parsed = 0;
+	}
+	UINT64 maxValue = isBcd ? (isWord ? 9999 : 99) : (isWord ? 0xFFFF : 0xFF);
+	if ((parsed != value.size()) || (x > maxValue))
+	{
+		error = "the value must be a number from 0 to " + std::to_string(maxValue);
+		return false;
+	}
+	if (isBcd)
+		x = ((x / 1000) << 12) | (((x / 100) % 10) << 8) | (((x / 10) % 10) << 4) | (x % 10);
+	m_value.push_back(static_cast<UINT8>(x & 0xFF));
+	if (isWord)
+		m_value.push_back(static_cast<UINT8>(x >> 8));
+	return true;
+}
+
+bool MemorySearch::Start(MemorySearchType type, const std::string& value, const UINT8* mem, size_t size, std::string& error)
+{
+	Clear();
+	if ((mem == nullptr) || (size == 0))
+	{
+		error = "no memory to search";
+		return false;
+	}
+	if (!ParseValue(type, value, error))
+		return false;
+	m_type = type;
+	switch (type)
+	{
+	case MemorySearchType::Word:
+	case MemorySearchType::Bcd16:
+		m_width = 2;
+		break;
+	case MemorySearchType::AsciiHigh:
+		if (m_value.empty())
+		{
+			error = "enter the text to search";
+			return false;
+		}
+		m_width = m_value.size();
+		break;
+	default:
+		m_width = 1;
+		break;
+	}
+	if (m_width > size)
+	{
+		error = "the value is larger than the memory";
+		return false;
+	}
+
+	// Every address where the whole value fits is a candidate
+	size_t addrCount = size - m_width + 1;
+	m_candidates.assign((size + MEMSEARCH_BLOCK_SIZE - 1) / MEMSEARCH_BLOCK_SIZE, 0);
+	std::fill_n(m_candidates.begin(), addrCount / MEMSEARCH_BLOCK_SIZE, ~0ull);
+	if (addrCount % MEMSEARCH_BLOCK_SIZE)
+		m_candidates[addrCount / MEMSEARCH_BLOCK_SIZE] = (1ull << (addrCount % MEMSEARCH_BLOCK_SIZE)) - 1;
+	m_snapshot.assign(mem, mem + size);
+	m_count = addrCount;
+	if (m_value.empty())
+		return true;
+	return Narrow(MemorySearchFilter::Equal, value, mem, size, error);
+}
+
+bool MemorySearch::Narrow(MemorySearchFilter filter, const std::string& value, const UINT8* mem, size_t size, std::string& error)
+{
+	if (!IsActive())
+	{
+		error = "start a new search first";
+		return false;
+	}
+	if ((mem == nullptr) || (size != m_snapshot.size()))
+	{
+		error = "the memory size changed, start a new search";
+		return false;
+	}
+	if ((m_type == MemorySearchType::AsciiHigh)
+		&& ((filter == MemorySearchFilter::Increased) || (filter == MemorySearchFilter::Decreased)))
+	{
+		error = "text can only be equal, changed or unchanged";
+		return false;
+	}
+	if (filter == MemorySearchFilter::Equal)
+	{
+		// The width of the candidates can't change, so a text search keeps its length
+		std::vector<UINT8> previous = m_value;
+		if (!ParseValue(m_type, value, error))
+			return false;
+		if (m_value.size() != m_width)
+		{
+			error = m_value.empty() ? "enter the value to compare with" : "the text must keep the same length";
+			m_value = previous;
+			return false;
+		}
+	}
+
+	for (size_t w = 0; w < m_candidates.size(); w++)
+	{
+		UINT64 bits = m_candidates[w];
+		if (bits == 0)
+			continue;
+		size_t offset = w * MEMSEARCH_BLOCK_SIZE;
+		if (offset + MEMSEARCH_BLOCK_SIZE + m_width - 1 <= size)
+		{
+			bits &= MatchBlock(offset, filter, mem);
+		}
+		else
+		{
+			// The end of the memory, byte by byte so nothing is read past it
+			for (UINT32 i = 0; i < MEMSEARCH_BLOCK_SIZE; i++)
+			{
+				if ((bits & (1ull << i)) && !MatchesAt(offset + i, filter, mem))
+					bits &= ~(1ull << i);
+			}
+		}
+		m_candidates[w] = bits;
+	}
+	memcpy(m_snapshot.data(), mem, size);
+	CountCandidates();
+	return true;
+}
+
+// Multi-byte values are matched byte by byte on shifted blocks. For increased and decreased the
+// bytes are folded from the least significant one: a byte decides unless it is equal, then the
+// less significant bytes decide.
+UINT64 MemorySearch::MatchBlock(size_t offset, MemorySearchFilter filter, const UINT8* mem) const
+{
+	const UINT8* cur = mem + offset;
+	const UINT8* prev = m_snapshot.data() + offset;
+	UINT64 mask = ~0ull;
+	switch (filter)
+	{
+	case MemorySearchFilter::Equal:
+		for (size_t k = 0; k < m_width; k++)
+			mask &= EqualValueMask(cur + k, m_value[k]);
+		return mask;
+	case MemorySearchFilter::Changed:
+	case MemorySearchFilter::Unchanged:
+		for (size_t k = 0; k < m_width; k++)
+			mask &= EqualMask(cur + k, prev + k);
+		return (filter == MemorySearchFilter::Unchanged) ? mask : ~mask;
+	case MemorySearchFilter::Increased:
+		mask = GreaterMask(cur, prev);
+		for (size_t k = 1; k < m_width; k++)
+			mask = GreaterMask(cur + k, prev + k) | (EqualMask(cur + k, prev + k) & mask);
+		return mask;
+	case MemorySearchFilter::Decreased:
+		mask = GreaterMask(prev, cur);
+		for (size_t k = 1; k < m_width; k++)
+			mask = GreaterMask(prev + k, cur + k) | (EqualMask(cur + k, prev + k) & mask);
+		return mask;
+	default:
+		return 0;
+	}
+}
+
+bool MemorySearch::MatchesAt(size_t addr, MemorySearchFilter filter, const UINT8* mem) const
+{
+	const UINT8* cur = mem + addr;
+	const UINT8* prev = m_snapshot.data() + addr;
+	switch (filter)
+	{
+	case MemorySearchFilter::Equal:
+		return memcmp(cur, m_value.data(), m_width) == 0;
+	case MemorySearchFilter::Changed:
+		return memcmp(cur, prev, m_width) != 0;
+	case MemorySearchFilter::Unchanged:
+		return memcmp(cur, prev, m_width) == 0;
+	case MemorySearchFilter::Increased:
+	case MemorySearchFilter::Decreased:
+		// From the most significant byte
+		for (size_t k = m_width; k-- > 0;)
+		{
+			if (cur[k] != prev[k])
+				return (filter == MemorySearchFilter::Increased) ? (cur[k] > prev[k]) : (cur[k] < prev[k]);
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+void MemorySearch::CountCandidates()
+{
+	m_count = 0;
+	for (UINT64 bits : m_candidates)
+		m_count += std::bitset<64>(bits).count();
+}
+
+void MemorySearch::GetCandidates(std::vector<UINT32>& addrs, size_t max) const
+{
+	size_t found = 0;
+	for (size_t w = 0; (w < m_candidates.size()) && (found < max); w++)
+	{
+		UINT64 bits = m_candidates[w];
+		for (UINT32 i = 0; (bits != 0) && (found < max); i++, bits >>= 1)
+		{
+			if (bits & 1)
+			{
+				addrs.push_back(static_cast<UINT32>(w * MEMSEARCH_BLOCK_SIZE + i));
+				found++;
+			}
+		}
+	}
+}
+
+std::string MemorySearch::FormatValue(UINT32 addr, const UINT8* mem, size_t size) const
+{
+	if ((mem == nullptr) || (addr + m_width > size))
+		return "";
+	const UINT8* p = mem + addr;
+	char buf[MEMSEARCH_MAX_TEXT_LENGTH + 20];
+	switch (m_type)
+	{
+	case MemorySearchType::Byte:
+		snprintf(buf, sizeof(buf), "%u ($%02X)", p[0], p[0]);
+		break;
+	case MemorySearchType::Word:
+		snprintf(buf, sizeof(buf), "%u ($%04X)", p[0] | (p[1] << 8), p[0] | (p[1] << 8));
+		break;
+	case MemorySearchType::Bcd8:
+		snprintf(buf, sizeof(buf), "%02X", p[0]);
+		break;
+	case MemorySearchType::Bcd16:
+		snprintf(buf, sizeof(buf), "%02X%02X", p[1], p[0]);
+		break;
+	case MemorySearchType::AsciiHigh:
+	{
+		size_t i = 0;
+		for (; i < m_width; i++)
+		{
+			char c = static_cast<char>(p[i] & 0x7F);
+			buf[i] = (c < ' ') ? '.' : c;
+		}
+		buf[i] = '\0';
+		break;
+	}
+	default:
+		buf[0] = '\0';
+		break;
+	}
+	return buf;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <string>
+
+/// <summary>
+/// MemorySearch finds where a game stores a value, the way cheat finders do.
+/// A search starts with every address holding a value (or every address at all when the value
+/// isn't known), then each pass narrows the candidates by comparing the memory with the value,
+/// or with the snapshot taken at the previous pass: changed, unchanged, increased, decreased.
+///
+/// The candidates are a bitmap with one bit per address, and a pass only looks at the 64 byte
+/// blocks that still have candidates. Each block is compared 16 bytes at a time with SSE2 into
+/// a 64-bit mask that is ANDed into the bitmap, so a pass over 128K takes a few microseconds.
+///
+/// 16-bit values are little-endian. BCD values are packed decimal digits, little-endian as well,
+/// which order the same as binary so increased and decreased work on them unchanged.
+/// ASCII-high searches for a string with the high bit set, and only supports equal, changed
+/// and unchanged.
+/// </summary>
+
+constexpr size_t MEMSEARCH_MAX_TEXT_LENGTH = 40;
+
+enum class MemorySearchType : UINT8
+{
+	Byte,
+	Word,
+	Bcd8,
+	Bcd16,
+	AsciiHigh,
+	Count
+};
+
+enum class MemorySearchFilter : UINT8
+{
+	Equal,			// to the value
+	Changed,		// since the previous pass
+	Unchanged,
+	Increased,
+	Decreased,
+	Count
+};
+
+class MemorySearch
+{
+public:
+	MemorySearch();
+
+	// Starts a new search. An empty value keeps every address as a candidate.
+	// Returns false with an error message if the value can't be parsed.
+	bool Start(MemorySearchType type, const std::string& value, const UINT8* mem, size_t size, std::string& error);
+	// Removes the candidates that don't pass the filter, and takes a new snapshot of the memory.
+	// The value is only used by the Equal filter.
+	bool Narrow(MemorySearchFilter filter, const std::string& value, const UINT8* mem, size_t size, std::string& error);
+	void Clear();
+
+	bool IsActive() const { return !m_snapshot.empty(); }
+	MemorySearchType GetType() const { return m_type; }
+	size_t GetCount() const { return m_count; }
+	// Appends the first max candidate addresses to addrs
+	void GetCandidates(std::vector<UINT32>& addrs, size_t max) const;
+	// The value at addr in mem, formatted for the search type
+	std::string FormatValue(UINT32 addr, const UINT8* mem, size_t size) const;
+
+	static const char* GetTypeName(MemorySearchType type);
+
+private:
+	bool ParseValue(MemorySearchType type, const std::string& value, std::string& error);
+	bool MatchesAt(size_t addr, MemorySearchFilter filter, const UINT8* mem) const;
+	UINT64 MatchBlock(size_t offset, MemorySearchFilter filter, const UINT8* mem) const;
+	void CountCandidates();
+
+	MemorySearchType m_type;
+	std::vector<UINT8> m_value;		// bytes to match, in memory order
+	size_t m_width;					// bytes per candidate
+	std::vector<UINT64> m_candidates;
+	std::vector<UINT8> m_snapshot;
+	size_t m_count;
+};
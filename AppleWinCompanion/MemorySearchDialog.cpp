@@ -0,0 +1,185 @@
+#include "pch.h"
+#include "MemorySearchDialog.h"
+#include "MemorySearch.h"
+#include "GameLink.h"
+#include "resource.h"
+#include <chrono>
+
+constexpr size_t MEMSEARCH_MAX_LISTED = 500;
+constexpr UINT MEMSEARCH_REFRESH_TIMER = 1;
+constexpr UINT MEMSEARCH_REFRESH_MS = 250;
+
+static HWND s_hDlg = NULL;
+static MemorySearch s_search;
+static std::vector<UINT32> s_listed;
+
+static void SetStatus(const std::string& text)
+{
+	SetDlgItemTextA(s_hDlg, IDC_SEARCH_STATUS, text.c_str());
+}
+
+// Rewrites the list of candidates with their current values, keeping the scroll position
+static void RefreshResults()
+{
+	HWND hList = GetDlgItem(s_hDlg, IDC_SEARCH_RESULTS);
+	const UINT8* mem = GameLink::IsActive() ? GameLink::GetMemoryBasePointer() : nullptr;
+	size_t memsize = GameLink::IsActive() ? GameLink::GetMemorySize() : 0;
+	LRESULT top = SendMessage(hList, LB_GETTOPINDEX, 0, 0);
+	LRESULT sel = SendMessage(hList, LB_GETCURSEL, 0, 0);
+	SendMessage(hList, WM_SETREDRAW, FALSE, 0);
+	SendMessage(hList, LB_RESETCONTENT, 0, 0);
+	char buf[100];
+	for (UINT32 addr : s_listed)
+	{
+		snprintf(buf, sizeof(buf), "0x%05X   %s", addr, s_search.FormatValue(addr, mem, memsize).c_str());
+		SendMessageA(hList, LB_ADDSTRING, 0, reinterpret_cast<LPARAM>(buf));
+	}
+	SendMessage(hList, LB_SETTOPINDEX, top, 0);
+	if (sel != LB_ERR)
+		SendMessage(hList, LB_SETCURSEL, sel, 0);
+	SendMessage(hList, WM_SETREDRAW, TRUE, 0);
+	InvalidateRect(hList, NULL, TRUE);
+}
+
+// Starts a new search (filter Count) or narrows the current one
+static void RunSearch(MemorySearchFilter filter)
+{
+	if (!GameLink::IsActive())
+	{
+		SetStatus("GameLink isn't active, start AppleWin first");
+		return;
+	}
+	const UINT8* mem = GameLink::GetMemoryBasePointer();
+	size_t memsize = GameLink::GetMemorySize();
+	char value[MEMSEARCH_MAX_TEXT_LENGTH + 1];
+	GetDlgItemTextA(s_hDlg, IDC_SEARCH_VALUE, value, sizeof(value));
+
+	std::string error;
+	bool ok;
+	auto tStart = std::chrono::steady_clock::now();
+	if (filter == MemorySearchFilter::Count)
+	{
+		LRESULT type = SendDlgItemMessage(s_hDlg, IDC_SEARCH_TYPE, CB_GETCURSEL, 0, 0);
+		ok = s_search.Start(static_cast<MemorySearchType>(type), value, mem, memsize, error);
+	}
+	else
+	{
+		ok = s_search.Narrow(filter, value, mem, memsize, error);
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+	if (!ok)
+	{
+		SetStatus("Error: " + error);
+		return;
+	}
+
+	s_listed.clear();
+	s_search.GetCandidates(s_listed, MEMSEARCH_MAX_LISTED);
+	char buf[200];
+	snprintf(buf, sizeof(buf), "%zu candidates (%.3f ms)%s", s_search.GetCount(), ms,
+		(s_search.GetCount() > s_listed.size()) ? ", showing the first ones" : "");
+	SetStatus(buf);
+	RefreshResults();
+}
+
+static void CopySelectedAddress()
+{
+	LRESULT sel = SendDlgItemMessage(s_hDlg, IDC_SEARCH_RESULTS, LB_GETCURSEL, 0, 0);
+	if ((sel == LB_ERR) || (static_cast<size_t>(sel) >= s_listed.size()))
+		return;
+	char buf[20];
+	int len = snprintf(buf, sizeof(buf), "0x%05X", s_listed[sel]);
+	if (!OpenClipboard(s_hDlg))
+		return;
+	EmptyClipboard();
+	HGLOBAL hMem = GlobalAlloc(GMEM_MOVEABLE, len + 1);
+	if (hMem)
+	{
+		memcpy(GlobalLock(hMem), buf, len + 1);
+		GlobalUnlock(hMem);
+		if (SetClipboardData(CF_TEXT, hMem) == NULL)
+			GlobalFree(hMem);
+	}
+	CloseClipboard();
+	SetStatus(std::string("Copied ") + buf);
+}
+
+static INT_PTR CALLBACK MemorySearchProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	UNREFERENCED_PARAMETER(lParam);
+	switch (message)
+	{
+	case WM_INITDIALOG:
+		s_hDlg = hDlg;
+		for (UINT8 t = 0; t < static_cast<UINT8>(MemorySearchType::Count); t++)
+		{
+			SendDlgItemMessageA(hDlg, IDC_SEARCH_TYPE, CB_ADDSTRING, 0,
+				reinterpret_cast<LPARAM>(MemorySearch::GetTypeName(static_cast<MemorySearchType>(t))));
+		}
+		SendDlgItemMessage(hDlg, IDC_SEARCH_TYPE, CB_SETCURSEL, 0, 0);
+		SendDlgItemMessage(hDlg, IDC_SEARCH_VALUE, EM_LIMITTEXT, MEMSEARCH_MAX_TEXT_LENGTH, 0);
+		SetStatus("Enter a value, or leave it empty to search for an unknown value");
+		SetTimer(hDlg, MEMSEARCH_REFRESH_TIMER, MEMSEARCH_REFRESH_MS, NULL);
+		return (INT_PTR)TRUE;
+
+	case WM_TIMER:
+		if (!s_listed.empty())
+			RefreshResults();
+		return (INT_PTR)TRUE;
+
+	case WM_COMMAND:
+		switch (LOWORD(wParam))
+		{
+		case IDC_SEARCH_NEW:
+			RunSearch(MemorySearchFilter::Count);
+			return (INT_PTR)TRUE;
+		case IDC_SEARCH_EQUAL:
+			RunSearch(MemorySearchFilter::Equal);
+			return (INT_PTR)TRUE;
+		case IDC_SEARCH_CHANGED:
+			RunSearch(MemorySearchFilter::Changed);
+			return (INT_PTR)TRUE;
+		case IDC_SEARCH_UNCHANGED:
+			RunSearch(MemorySearchFilter::Unchanged);
+			return (INT_PTR)TRUE;
+		case IDC_SEARCH_INCREASED:
+			RunSearch(MemorySearchFilter::Increased);
+			return (INT_PTR)TRUE;
+		case IDC_SEARCH_DECREASED:
+			RunSearch(MemorySearchFilter::Decreased);
+			return (INT_PTR)TRUE;
+		case IDC_SEARCH_RESULTS:
+			if (HIWORD(wParam) == LBN_DBLCLK)
+				CopySelectedAddress();
+			return (INT_PTR)TRUE;
+		case IDCANCEL:
+			DestroyWindow(hDlg);
+			return (INT_PTR)TRUE;
+		}
+		break;
+
+	case WM_DESTROY:
+		KillTimer(hDlg, MEMSEARCH_REFRESH_TIMER);
+		s_search.Clear();
+		s_listed.clear();
+		s_hDlg = NULL;
+		break;
+	}
+	return (INT_PTR)FALSE;
+}
+
+void MemorySearchDialog::Show(HINSTANCE hInstance, HWND parent)
+{
+	if (s_hDlg == NULL)
+		CreateDialog(hInstance, MAKEINTRESOURCE(IDD_MEMORYSEARCH), parent, MemorySearchProc);
+	if (s_hDlg != NULL)
+	{
+		ShowWindow(s_hDlg, SW_SHOW);
+		SetForegroundWindow(s_hDlg);
+	}
+}
+
+bool MemorySearchDialog::HandleMessage(MSG* msg)
+{
+	return (s_hDlg != NULL) && IsDialogMessage(s_hDlg, msg);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+/// <summary>
+/// The Memory Search panel: a modeless dialog driving a MemorySearch over the GameLink RAM.
+/// The first candidates are listed with their live values, refreshed a few times per second.
+/// Double-clicking a candidate copies its address to the clipboard in the profile format (0x1165A).
+/// </summary>
+
+namespace MemorySearchDialog
+{
+	// Opens the panel, or brings it to the front if it is already open
+	void Show(HINSTANCE hInstance, HWND parent);
+	// Lets the panel handle its keyboard navigation. Returns true if the message was for the panel.
+	bool HandleMessage(MSG* msg);
+}
@@ -0,0 +1,200 @@
+#include "pch.h"
+#include "Metrics.h"
+
+std::atomic<bool> Metrics::s_enabled = false;
+std::atomic<UINT64> Metrics::s_counters[(size_t)MetricCounter::Count] = {};
+Metrics::AtomicHistogram Metrics::s_timings[(size_t)MetricTiming::Count] = {};
+UINT64 Metrics::s_snapshotTicks = 0;
+
+static const char* const COUNTER_NAMES[] = {
+	"Blocks formatted", "Bytes uploaded", "Mutex waits", "Dropped sequences",
+};
+static_assert(std::size(COUNTER_NAMES) == (size_t)MetricCounter::Count);
+
+static const char* const TIMING_NAMES[] = {
+	"Frame", "Connection check", "Sidebar text", "Texture upload", "Sprite drawing", "Present", "Mutex wait",
+	"Seen to upload", "Seen to present", "Emulator to present", "Key to present",
+};
+static_assert(std::size(TIMING_NAMES) == (size_t)MetricTiming::Count);
+
+static UINT64 GetTickFrequency()
+{
+	static const UINT64 frequency = []
+	{
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		return static_cast<UINT64>(f.QuadPart);
+	}();
+	return frequency;
+}
+
+UINT64 Metrics::GetTicks()
+{
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return static_cast<UINT64>(t.QuadPart);
+}
+
+UINT64 Metrics::TicksToNs(UINT64 ticks)
+{
+	// Split to not overflow with the 10MHz counter
+	const UINT64 frequency = GetTickFrequency();
+	return (ticks / frequency) * 1000000000ull + (ticks % frequency) * 1000000000ull / frequency;
+}
+
+void Metrics::SetEnabled(bool enabled)
+{
+	if (enabled && !IsEnabled())
+	{
+		// Start from scratch, what is left is from the last time
+		MetricsSnapshot discard;
+		Snapshot(discard);
+		for (size_t i = (size_t)METRICS_FIRST_LATENCY; i < (size_t)MetricTiming::Count; i++)
+		{
+			AtomicHistogram& h = s_timings[i];
+			for (auto& b : h.buckets)
+				b.store(0, std::memory_order_relaxed);
+			h.count = 0;
+			h.totalNs = 0;
+			h.maxNs = 0;
+		}
+	}
+	s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+#pragma region Histograms
+
+// Values under 16 have their own bucket. Above, each power of two is split in 16 sub-buckets.
+UINT32 Metrics::GetBucket(UINT64 ns)
+{
+	if (ns < METRICS_SUB_BUCKETS)
+		return static_cast<UINT32>(ns);
+	UINT32 exponent = 63;
+	while (!(ns & (1ull << exponent)))
+		exponent--;
+	if (exponent > METRICS_MAX_EXPONENT)
+		return METRICS_BUCKET_COUNT - 1;
+	UINT32 sub = static_cast<UINT32>(ns >> (exponent - METRICS_SUB_BUCKET_BITS)) - METRICS_SUB_BUCKETS;
+	return (exponent - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS + sub;
+}
+
+UINT64 Metrics::GetBucketUpperBound(UINT32 bucket)
+{
+	if (bucket < METRICS_SUB_BUCKETS)
+		return bucket;
+	UINT32 exponent = bucket / METRICS_SUB_BUCKETS + METRICS_SUB_BUCKET_BITS - 1;
+	UINT64 sub = bucket % METRICS_SUB_BUCKETS;
+	return ((METRICS_SUB_BUCKETS + sub + 1) << (exponent - METRICS_SUB_BUCKET_BITS)) - 1;
+}
+
+void Metrics::Record(MetricTiming timing, UINT64 ns)
+{
+	if (!IsEnabled())
+		return;
+	AtomicHistogram& h = s_timings[(size_t)timing];
+	h.buckets[GetBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+	h.count.fetch_add(1, std::memory_order_relaxed);
+	h.totalNs.fetch_add(ns, std::memory_order_relaxed);
+	UINT64 maxNs = h.maxNs.load(std::memory_order_relaxed);
+	while ((ns > maxNs) && !h.maxNs.compare_exchange_weak(maxNs, ns, std::memory_order_relaxed))
+		;
+}
+
+UINT64 MetricHistogram::GetPercentile(double percentile) const
+{
+	if (count == 0)
+		return 0;
+	UINT64 rank = static_cast<UINT64>(percentile / 100. * count + 0.5);
+	rank = std::max<UINT64>(rank, 1);
+	UINT64 seen = 0;
+	for (UINT32 b = 0; b < METRICS_BUCKET_COUNT; b++)
+	{
+		seen += buckets[b];
+		if (seen >= rank)
+			return std::min(Metrics::GetBucketUpperBound(b), maxNs);
+	}
+	return maxNs;
+}
+
+#pragma endregion
+
+void Metrics::Snapshot(MetricsSnapshot& snapshot)
+{
+	UINT64 now = GetTicks();
+	snapshot.seconds = (s_snapshotTicks != 0) ? TicksToNs(now - s_snapshotTicks) / 1e9 : 0.;
+	s_snapshotTicks = now;
+	for (size_t i = 0; i < (size_t)MetricCounter::Count; i++)
+		snapshot.counters[i] = s_counters[i].exchange(0, std::memory_order_relaxed);
+	// A timing recorded during the exchanges can land half in this snapshot and half in the next,
+	// which is fine for a display
+	for (size_t i = 0; i < (size_t)MetricTiming::Count; i++)
+	{
+		AtomicHistogram& h = s_timings[i];
+		MetricHistogram& out = snapshot.timings[i];
+		if (i >= (size_t)METRICS_FIRST_LATENCY)
+		{
+			for (UINT32 b = 0; b < METRICS_BUCKET_COUNT; b++)
+				out.buckets[b] = h.buckets[b].load(std::memory_order_relaxed);
+			out.count = h.count.load(std::memory_order_relaxed);
+			out.totalNs = h.totalNs.load(std::memory_order_relaxed);
+			out.maxNs = h.maxNs.load(std::memory_order_relaxed);
+			continue;
+		}
+		for (UINT32 b = 0; b < METRICS_BUCKET_COUNT; b++)
+			out.buckets[b] = h.buckets[b].exchange(0, std::memory_order_relaxed);
+		out.count = h.count.exchange(0, std::memory_order_relaxed);
+		out.totalNs = h.totalNs.exchange(0, std::memory_order_relaxed);
+		out.maxNs = h.maxNs.exchange(0, std::memory_order_relaxed);
+	}
+}
+
+const char* Metrics::GetName(MetricCounter counter)
+{
+	return COUNTER_NAMES[(size_t)counter];
+}
+
+const char* Metrics::GetName(MetricTiming timing)
+{
+	return TIMING_NAMES[(size_t)timing];
+}
+
+std::string MetricsSnapshot::ToText() const
+{
+	std::string text;
+	char buf[200];
+	snprintf(buf, sizeof(buf), "%-17s %6s %6s %6s %6s  (ms)\n", "", "mean", "p50", "p99", "max");
+	text += buf;
+	for (size_t i = 0; i < (size_t)MetricTiming::Count; i++)
+	{
+		const MetricHistogram& h = timings[i];
+		if (i == (size_t)METRICS_FIRST_LATENCY)
+		{
+			snprintf(buf, sizeof(buf), "%-19s %6s %6s %6s %6s  (count)\n", "Latency since on", "p50", "p90", "p99", "max");
+			text += buf;
+		}
+		if (h.count == 0)
+			continue;
+		if (i >= (size_t)METRICS_FIRST_LATENCY)
+		{
+			snprintf(buf, sizeof(buf), "%-19s %6.2f %6.2f %6.2f %6.2f  (%llu)\n", Metrics::GetName((MetricTiming)i),
+				h.GetPercentile(50) / 1e6, h.GetPercentile(90) / 1e6, h.GetPercentile(99) / 1e6, h.maxNs / 1e6,
+				static_cast<unsigned long long>(h.count));
+			text += buf;
+			continue;
+		}
+		snprintf(buf, sizeof(buf), "%-17s %6.2f %6.2f %6.2f %6.2f\n", Metrics::GetName((MetricTiming)i),
+			h.GetMeanNs() / 1e6, h.GetPercentile(50) / 1e6, h.GetPercentile(99) / 1e6, h.maxNs / 1e6);
+		text += buf;
+	}
+	double perSecond = (seconds > 0.) ? 1. / seconds : 0.;
+	for (size_t i = 0; i < (size_t)MetricCounter::Count; i++)
+	{
+		if ((MetricCounter)i == MetricCounter::BytesUploaded)
+			snprintf(buf, sizeof(buf), "%-17s %8.2f MB/s\n", Metrics::GetName((MetricCounter)i),
+				counters[i] * perSecond / (1024. * 1024.));
+		else
+			snprintf(buf, sizeof(buf), "%-17s %8.1f /s\n", Metrics::GetName((MetricCounter)i), counters[i] * perSecond);
+		text += buf;
+	}
+	return text;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <string>
+
+/// <summary>
+/// Metrics is the registry of the performance counters and timings of the companion,
+/// shown by Tools > Frame Timing over the video.
+///
+/// Counters are totals, and timings go into log-linear histograms in the manner of HdrHistogram:
+/// 16 sub-buckets per power of two of nanoseconds, so any percentile is within 6.25% of the truth,
+/// in a fixed 2.4K per timing that never allocates. Both are relaxed atomics, recorded from any thread.
+///
+/// The latency timings, from LatencyTracker, are kept from SetEnabled(true) on instead of per second:
+/// there are few keystrokes in a second.
+///
+/// Everything is off until SetEnabled(true). Until then a MetricScope or an Add() is one relaxed load
+/// of the enabled flag, and the clock isn't even read. Game takes a Snapshot() every second while the
+/// HUD shows, which moves the histograms and counters of the last second out of the registry.
+/// </summary>
+
+enum class MetricCounter : UINT8
+{
+	BlocksFormatted,		// sidebar blocks whose text was formatted
+	BytesUploaded,			// to the video and heatmap textures
+	MutexWaits,				// GameLink mutex acquisitions that had to wait for AppleWin
+	DroppedSequences,		// GameLink frames that came and went between two renders
+	Count
+};
+
+enum class MetricTiming : UINT8
+{
+	Frame,					// the whole of Game::Tick
+	ConnectionCheck,		// looking for GameLink and choosing the texture
+	SidebarText,			// SidebarContent::UpdateAllSidebarText
+	TextureUpload,
+	SpriteDrawing,
+	Present,
+	MutexWait,				// the waits counted by MutexWaits
+	// Latencies, see LatencyTracker
+	SeenToUpload,			// a new GameLink frame is seen, until its upload is recorded
+	SeenToPresent,			// until Present returns
+	EmulatorToPresent,		// from the time given by the emulator, when it does
+	KeyToPresent,			// a key is sent to AppleWin, until a different frame is presented
+	Count
+};
+constexpr MetricTiming METRICS_FIRST_LATENCY = MetricTiming::SeenToUpload;
+
+constexpr UINT32 METRICS_SUB_BUCKET_BITS = 4;
+constexpr UINT32 METRICS_SUB_BUCKETS = 1 << METRICS_SUB_BUCKET_BITS;
+constexpr UINT32 METRICS_MAX_EXPONENT = 40;			// 2^40 ns, about 18 minutes
+constexpr UINT32 METRICS_BUCKET_COUNT = (METRICS_MAX_EXPONENT - METRICS_SUB_BUCKET_BITS + 2) * METRICS_SUB_BUCKETS;
+
+struct MetricHistogram
+{
+	std::array<UINT32, METRICS_BUCKET_COUNT> buckets = {};
+	UINT64 count = 0;
+	UINT64 totalNs = 0;
+	UINT64 maxNs = 0;
+
+	// The upper bound of the bucket holding the percentile, in nanoseconds. 0 when empty.
+	UINT64 GetPercentile(double percentile) const;
+	double GetMeanNs() const { return (count > 0) ? static_cast<double>(totalNs) / count : 0.; }
+};
+
+struct MetricsSnapshot
+{
+	double seconds = 0.;				// covered by the snapshot
+	std::array<UINT64, (size_t)MetricCounter::Count> counters = {};
+	std::array<MetricHistogram, (size_t)MetricTiming::Count> timings;
+
+	// One line per timing, then the counters per second, for the HUD
+	std::string ToText() const;
+};
+
+class Metrics
+{
+public:
+	static void SetEnabled(bool enabled);
+	static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+	static void Add(MetricCounter counter, UINT64 value = 1)
+	{
+		if (IsEnabled())
+			s_counters[(size_t)counter].fetch_add(value, std::memory_order_relaxed);
+	}
+	static void Record(MetricTiming timing, UINT64 ns);
+
+	// Moves what was recorded since the last snapshot into snapshot, and copies the latencies
+	static void Snapshot(MetricsSnapshot& snapshot);
+
+	static const char* GetName(MetricCounter counter);
+	static const char* GetName(MetricTiming timing);
+
+	static UINT64 GetTicks();
+	static UINT64 TicksToNs(UINT64 ticks);
+	static UINT32 GetBucket(UINT64 ns);
+	static UINT64 GetBucketUpperBound(UINT32 bucket);
+
+private:
+	struct AtomicHistogram
+	{
+		std::array<std::atomic<UINT32>, METRICS_BUCKET_COUNT> buckets;
+		std::atomic<UINT64> count;
+		std::atomic<UINT64> totalNs;
+		std::atomic<UINT64> maxNs;
+	};
+
+	static std::atomic<bool> s_enabled;
+	static std::atomic<UINT64> s_counters[(size_t)MetricCounter::Count];
+	static AtomicHistogram s_timings[(size_t)MetricTiming::Count];
+	static UINT64 s_snapshotTicks;
+};
+
+// Times its lifetime into a histogram, if the metrics were enabled when it started
+class MetricScope
+{
+public:
+	explicit MetricScope(MetricTiming timing)
+		: m_timing(timing), m_start(Metrics::IsEnabled() ? Metrics::GetTicks() : 0) {}
+	~MetricScope()
+	{
+		if (m_start != 0)
+			Metrics::Record(m_timing, Metrics::TicksToNs(Metrics::GetTicks() - m_start));
+	}
+	MetricScope(const MetricScope&) = delete;
+	MetricScope& operator=(const MetricScope&) = delete;
+
+private:
+	MetricTiming m_timing;
+	UINT64 m_start;
+};
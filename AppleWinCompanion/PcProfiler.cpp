@@ -0,0 +1,104 @@
+#include "pch.h"
+#include "PcProfiler.h"
+#include <fstream>
+
+PcProfiler::PcProfiler()
+{
+	m_histogram = std::make_unique<std::atomic<UINT32>[]>(PCPROFILER_ADDRESSES);
+	m_running = false;
+	Reset();
+}
+
+void PcProfiler::Reset()
+{
+	for (UINT32 i = 0; i < PCPROFILER_ADDRESSES; i++)
+		m_histogram[i].store(0, std::memory_order_relaxed);
+	m_sampleCount.store(0, std::memory_order_relaxed);
+	m_started = false;
+	m_seq = 0;
+}
+
+void PcProfiler::Sample(UINT16 seq, UINT16 pc)
+{
+	if (!m_running || (m_started && (seq == m_seq)))
+		return;
+	m_started = true;
+	m_seq = seq;
+	m_histogram[pc].fetch_add(1, std::memory_order_relaxed);
+	m_sampleCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PcProfiler::Aggregate(const SymbolTable* symbols, std::vector<PcProfileEntry>& entries) const
+{
+	entries.clear();
+	char buf[20];
+	UINT32 addr = 0;
+	while (addr < PCPROFILER_ADDRESSES)
+	{
+		PcProfileEntry e;
+		int sym = (symbols != nullptr) ? symbols->Find(static_cast<UINT16>(addr)) : -1;
+		if (sym >= 0)
+		{
+			e.name = symbols->Get(sym).name;
+			e.start = static_cast<UINT16>(addr);
+			e.end = symbols->GetEnd(sym);
+		}
+		else if (symbols != nullptr)
+		{
+			// Outside of any symbol, by page, which never crosses a region
+			e.start = static_cast<UINT16>(addr);
+			e.end = static_cast<UINT16>(std::min<UINT32>(addr | 0xFF, symbols->GetNextAddress(e.start) - 1));
+		}
+		else
+			e.start = e.end = static_cast<UINT16>(addr);
+		for (UINT32 a = e.start; a <= e.end; a++)
+			e.samples += m_histogram[a].load(std::memory_order_relaxed);
+		addr = static_cast<UINT32>(e.end) + 1;
+		if (e.samples == 0)
+			continue;
+		if (e.name.empty())
+		{
+			if (e.start == e.end)
+				snprintf(buf, sizeof(buf), "$%04X", e.start);
+			else
+				snprintf(buf, sizeof(buf), "$%04X-$%04X", e.start, e.end);
+			e.name = buf;
+		}
+		entries.push_back(std::move(e));
+	}
+	std::sort(entries.begin(), entries.end(),
+		[](const PcProfileEntry& a, const PcProfileEntry& b) { return a.samples > b.samples; });
+}
+
+// Each line is the stack, outermost first and separated by semicolons, then the sample count:
+//		Nox Archaist;RAM;DRAWMAP 1234
+bool PcProfiler::ExportFolded(const std::filesystem::path& path, const std::string& program, const SymbolTable* symbols,
+	std::string& error) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file)
+	{
+		error = "can't create " + path.string();
+		return false;
+	}
+	// Semicolons split the frames, and the last space splits the count
+	auto frame = [](std::string s)
+	{
+		std::replace(s.begin(), s.end(), ';', '_');
+		std::replace(s.begin(), s.end(), ' ', '_');
+		return s;
+	};
+	std::string root = frame(program.empty() ? "AppleWin" : program);
+	std::vector<PcProfileEntry> entries;
+	Aggregate(symbols, entries);
+	for (auto& e : entries)
+	{
+		file << root << ';' << SymbolTable::GetRegionName(e.start) << ';' << frame(e.name) << ' ' << e.samples << '\n';
+	}
+	if (!file)
+	{
+		error = "can't write " + path.string();
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include "SymbolTable.h"
+
+/// <summary>
+/// PcProfiler is a sampling profiler of the program running in AppleWin.
+/// AppleWin writes the 6502 program counter to the GameLink peek channel every frame, and each new
+/// frame sequence adds one sample to a histogram of the 64K addresses.
+///
+/// Sample() runs in the render loop and only bumps a relaxed atomic counter, it never locks or
+/// allocates. The histogram is read without locking either: an aggregation can miss the samples
+/// added while it runs, which doesn't matter for a profile.
+///
+/// Aggregate() groups the samples by symbol when a symbol table is given, with the addresses
+/// outside of any symbol grouped by page, or else by address. ExportFolded() writes the same
+/// groups in the folded stacks format of flame graph tools, under the program and memory region.
+/// The peek channel has no stack pointer, so the stacks stop at the routine.
+/// </summary>
+
+constexpr UINT32 PCPROFILER_ADDRESSES = 0x10000;
+
+struct PcProfileEntry
+{
+	std::string name;
+	UINT16 start = 0;
+	UINT16 end = 0;
+	UINT64 samples = 0;
+};
+
+class PcProfiler
+{
+public:
+	PcProfiler();
+
+	void SetRunning(bool running) { m_running = running; }
+	bool IsRunning() const { return m_running; }
+	// Adds a sample for the frame sequence if it wasn't sampled yet
+	void Sample(UINT16 seq, UINT16 pc);
+	void Reset();
+	UINT64 GetSampleCount() const { return m_sampleCount.load(std::memory_order_relaxed); }
+
+	// Fills entries, sorted by decreasing samples. symbols can be null.
+	void Aggregate(const SymbolTable* symbols, std::vector<PcProfileEntry>& entries) const;
+	bool ExportFolded(const std::filesystem::path& path, const std::string& program, const SymbolTable* symbols,
+		std::string& error) const;
+
+private:
+	std::unique_ptr<std::atomic<UINT32>[]> m_histogram;
+	std::atomic<UINT64> m_sampleCount;
+	bool m_running;
+	bool m_started;
+	UINT16 m_seq;
+};
@@ -0,0 +1,883 @@
+#include "pch.h"
+#include "ProfileExpression.h"
+#include <chrono>
+
+using namespace std;
+
+// Bytecode. Immediates follow their opcode in the code stream.
+enum ExprOp : INT32
+{
+	OP_END,
+	OP_PUSH,		// imm: value
+	OP_PUSH_STR,	// imm: index in m_strings
+	OP_READ,		// imm: index in m_refs
+	OP_READ_BYTE,	// pops the address
+	OP_READ_WORD,	// pops the address
+	OP_LOOKUP,		// imm: lookup id. Pops the byte, pushes the string
+	OP_NEG,
+	OP_NOT,
+	OP_LNOT,
+	OP_BOOL,
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_AND,
+	OP_OR,
+	OP_XOR,
+	OP_SHL,
+	OP_SHR,
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_SEQ,			// string ==
+	OP_SNE,			// string !=
+	OP_MIN,
+	OP_MAX,
+	OP_JZ,			// imm: target. Pops the condition
+	OP_JMP,			// imm: target
+};
+
+// Binary operators by precedence level, lowest first. Level 0 and 1 are the short-circuit logical ops.
+struct BinaryOpDef
+{
+	const char* token;
+	INT32 op;
+};
+static const vector<vector<BinaryOpDef>> s_binaryLevels = {
+	{ { "||", OP_OR } },
+	{ { "&&", OP_AND } },
+	{ { "|", OP_OR } },
+	{ { "^", OP_XOR } },
+	{ { "&", OP_AND } },
+	{ { "==", OP_EQ }, { "!=", OP_NE } },
+	{ { "<", OP_LT }, { "<=", OP_LE }, { ">", OP_GT }, { ">=", OP_GE } },
+	{ { "<<", OP_SHL }, { ">>", OP_SHR } },
+	{ { "+", OP_ADD }, { "-", OP_SUB } },
+	{ { "*", OP_MUL }, { "/", OP_DIV }, { "%", OP_MOD } },
+};
+static const size_t EXPR_LEVEL_LOGICAL_OR = 0;
+static const size_t EXPR_LEVEL_LOGICAL_AND = 1;
+
+static const char* s_twoCharPuncts[] = { "==", "!=", "<=", ">=", "<<", ">>", "&&", "||" };
+
+static const string s_emptyString;
+
+static inline INT32 ReadInt(const UINT8* p, UINT16 length, ExprRead read)
+{
+	UINT32 x = 0;
+	int n = min<int>(length, 4);
+	switch (read)
+	{
+	case ExprRead::LowFirst:
+		for (int i = n - 1; i >= 0; i--)
+			x = (x << 8) | p[i];
+		break;
+	case ExprRead::HighFirst:
+		for (int i = 0; i < n; i++)
+			x = (x << 8) | p[i];
+		break;
+	case ExprRead::LiteralLowFirst:
+		// 0x23 0x45 is the number 4523
+		for (int i = length - 1; i >= 0; i--)
+			x = (x * 100) + ((p[i] >> 4) * 10) + (p[i] & 0x0F);
+		break;
+	case ExprRead::LiteralHighFirst:
+		for (int i = 0; i < length; i++)
+			x = (x * 100) + ((p[i] >> 4) * 10) + (p[i] & 0x0F);
+		break;
+	}
+	return static_cast<INT32>(x);
+}
+
+ProfileExpression::ProfileExpression()
+{
+	m_isString = false;
+	m_hasComputedReads = false;
+	m_pos = 0;
+	m_tokType = TokType::End;
+	m_tokNum = 0;
+	m_symbols = nullptr;
+	m_foldBarrier = 0;
+	m_depth = 0;
+	m_maxDepth = 0;
+	m_code.push_back(OP_PUSH);
+	m_code.push_back(0);
+	m_code.push_back(OP_END);
+}
+
+#pragma region Evaluation
+
+bool ProfileExpression::Run(const ExprContext& ctx, Slot& result) const
+{
+	Slot stack[EXPRESSION_MAX_STACK];
+	int sp = -1;
+	bool valid = true;
+	const INT32* code = m_code.data();
+	size_t pc = 0;
+
+	for (;;)
+	{
+		switch (code[pc++])
+		{
+		case OP_END:
+			result = stack[sp];
+			return valid;
+		case OP_PUSH:
+			stack[++sp].i = code[pc++];
+			break;
+		case OP_PUSH_STR:
+			stack[++sp].s = &m_strings[code[pc++]];
+			break;
+		case OP_READ:
+		{
+			const ExprMemRef& r = m_refs[code[pc++]];
+			INT64 addr = r.offset;
+			if (r.mode == ExprAddrMode::Row)
+				addr += ctx.rowBase;
+			else if (r.mode == ExprAddrMode::Pointer)
+				addr = ((ctx.pointers == nullptr) || (ctx.pointers[r.pointerId] < 0)) ? -1 : addr + ctx.pointers[r.pointerId];
+			if ((ctx.mem == nullptr) || (addr < 0) || (addr + r.length > ctx.memsize))
+			{
+				valid = false;
+				if (r.lookupId != EXPRESSION_NO_LOOKUP)
+					stack[++sp].s = &s_emptyString;
+				else
+					stack[++sp].i = 0;
+			}
+			else if (r.lookupId != EXPRESSION_NO_LOOKUP)
+				stack[++sp].s = &ctx.lookups[r.lookupId][ctx.mem[addr]];
+			else
+				stack[++sp].i = ReadInt(ctx.mem + addr, r.length, r.read);
+			break;
+		}
+		case OP_READ_BYTE:
+		case OP_READ_WORD:
+		{
+			INT64 addr = stack[sp].i;
+			int len = (code[pc - 1] == OP_READ_BYTE ? 1 : 2);
+			if ((ctx.mem == nullptr) || (addr < 0) || (addr + len > ctx.memsize))
+			{
+				valid = false;
+				stack[sp].i = 0;
+			}
+			else
+				stack[sp].i = (len == 1 ? ctx.mem[addr] : ctx.mem[addr] | (ctx.mem[addr + 1] << 8));
+			break;
+		}
+		case OP_LOOKUP:
+			stack[sp].s = &ctx.lookups[code[pc++]][stack[sp].i & 0xFF];
+			break;
+		case OP_NEG:
+			stack[sp].i = static_cast<INT32>(0u - static_cast<UINT32>(stack[sp].i));
+			break;
+		case OP_NOT:
+			stack[sp].i = ~stack[sp].i;
+			break;
+		case OP_LNOT:
+			stack[sp].i = !stack[sp].i;
+			break;
+		case OP_BOOL:
+			stack[sp].i = !!stack[sp].i;
+			break;
+		case OP_ADD:
+			sp--;
+			stack[sp].i = static_cast<INT32>(static_cast<UINT32>(stack[sp].i) + static_cast<UINT32>(stack[sp + 1].i));
+			break;
+		case OP_SUB:
+			sp--;
+			stack[sp].i = static_cast<INT32>(static_cast<UINT32>(stack[sp].i) - static_cast<UINT32>(stack[sp + 1].i));
+			break;
+		case OP_MUL:
+			sp--;
+			stack[sp].i = static_cast<INT32>(static_cast<UINT32>(stack[sp].i) * static_cast<UINT32>(stack[sp + 1].i));
+			break;
+		case OP_DIV:
+			// Division by 0 gives 0, it's what's least surprising in a sidebar
+			sp--;
+			stack[sp].i = (stack[sp + 1].i == 0 ? 0 : static_cast<INT32>(static_cast<INT64>(stack[sp].i) / stack[sp + 1].i));
+			break;
+		case OP_MOD:
+			sp--;
+			stack[sp].i = (stack[sp + 1].i == 0 ? 0 : static_cast<INT32>(static_cast<INT64>(stack[sp].i) % stack[sp + 1].i));
+			break;
+		case OP_AND:
+			sp--;
+			stack[sp].i &= stack[sp + 1].i;
+			break;
+		case OP_OR:
+			sp--;
+			stack[sp].i |= stack[sp + 1].i;
+			break;
+		case OP_XOR:
+			sp--;
+			stack[sp].i ^= stack[sp + 1].i;
+			break;
+		case OP_SHL:
+			sp--;
+			stack[sp].i = static_cast<INT32>(static_cast<UINT32>(stack[sp].i) << (stack[sp + 1].i & 31));
+			break;
+		case OP_SHR:
+			sp--;
+			stack[sp].i = static_cast<INT32>(static_cast<UINT32>(stack[sp].i) >> (stack[sp + 1].i & 31));
+			break;
+		case OP_EQ:
+			sp--;
+			stack[sp].i = (stack[sp].i == stack[sp + 1].i);
+			break;
+		case OP_NE:
+			sp--;
+			stack[sp].i = (stack[sp].i != stack[sp + 1].i);
+			break;
+		case OP_LT:
+			sp--;
+			stack[sp].i = (stack[sp].i < stack[sp + 1].i);
+			break;
+		case OP_LE:
+			sp--;
+			stack[sp].i = (stack[sp].i <= stack[sp + 1].i);
+			break;
+		case OP_GT:
+			sp--;
+			stack[sp].i = (stack[sp].i > stack[sp + 1].i);
+			break;
+		case OP_GE:
+			sp--;
+			stack[sp].i = (stack[sp].i >= stack[sp + 1].i);
+			break;
+		case OP_SEQ:
+			sp--;
+			stack[sp].i = (*stack[sp].s == *stack[sp + 1].s);
+			break;
+		case OP_SNE:
+			sp--;
+			stack[sp].i = (*stack[sp].s != *stack[sp + 1].s);
+			break;
+		case OP_MIN:
+			sp--;
+			stack[sp].i = min(stack[sp].i, stack[sp + 1].i);
+			break;
+		case OP_MAX:
+			sp--;
+			stack[sp].i = max(stack[sp].i, stack[sp + 1].i);
+			break;
+		case OP_JZ:
+			if (stack[sp--].i == 0)
+				pc = code[pc];
+			else
+				pc++;
+			break;
+		case OP_JMP:
+			pc = code[pc];
+			break;
+		default:
+			// Can't happen with compiled code
+			result.i = 0;
+			return false;
+		}
+	}
+}
+
+bool ProfileExpression::Evaluate(const ExprContext& ctx, std::string& out) const
+{
+	Slot result;
+	bool valid = Run(ctx, result);
+	if (!valid)
+		out.clear();
+	else if (m_isString)
+		out = *result.s;
+	else
+		out = to_string(result.i);
+	return valid;
+}
+
+bool ProfileExpression::EvaluateInt(const ExprContext& ctx, INT32& out) const
+{
+	Slot result;
+	bool valid = Run(ctx, result);
+	out = ((valid && !m_isString) ? result.i : 0);
+	return valid && !m_isString;
+}
+
+bool ProfileExpression::GetFixedReads(std::vector<std::pair<UINT32, UINT16>>& reads) const
+{
+	bool allFixed = !m_hasComputedReads;
+	for (auto& r : m_refs)
+	{
+		if ((r.mode == ExprAddrMode::Absolute) && (r.offset >= 0))
+			reads.emplace_back(static_cast<UINT32>(r.offset), r.length);
+		else
+			allFixed = false;
+	}
+	return allFixed;
+}
+
+#pragma endregion
+
+#pragma region Compilation
+
+bool ProfileExpression::Compile(const std::string& source, IExpressionSymbols* symbols, std::string& error)
+{
+	m_code.clear();
+	m_refs.clear();
+	m_strings.clear();
+	m_instrStarts.clear();
+	m_hasComputedReads = false;
+	m_src = source;
+	m_pos = 0;
+	m_symbols = symbols;
+	m_error.clear();
+	m_foldBarrier = 0;
+	m_depth = 0;
+	m_maxDepth = 0;
+
+	NextToken();
+	ValType t = ParseTernary();
+	if ((t != ValType::Error) && (m_tokType != TokType::End))
+		t = Fail("unexpected '" + m_tok + "'");
+	if ((t != ValType::Error) && !m_error.empty())
+		t = ValType::Error;		// from the tokenizer
+	if ((t != ValType::Error) && (m_maxDepth > EXPRESSION_MAX_STACK))
+		t = Fail("expression is too complex");
+	m_src.clear();
+	m_instrStarts.clear();
+	m_symbols = nullptr;
+
+	if (t == ValType::Error)
+	{
+		error = m_error;
+		// Leave a valid expression that evaluates to 0
+		m_code.assign({ OP_PUSH, 0, OP_END });
+		m_refs.clear();
+		m_strings.clear();
+		m_isString = false;
+		m_hasComputedReads = false;
+		return false;
+	}
+	m_code.push_back(OP_END);
+	m_isString = (t == ValType::Str);
+	return true;
+}
+
+ProfileExpression::ValType ProfileExpression::Fail(const std::string& msg)
+{
+	if (m_error.empty())
+	{
+		char buf[50];
+		snprintf(buf, 50, " at position %zu", m_pos);
+		m_error = msg + buf;
+	}
+	return ValType::Error;
+}
+
+void ProfileExpression::NextToken()
+{
+	while ((m_pos < m_src.size()) && isspace(static_cast<unsigned char>(m_src[m_pos])))
+		m_pos++;
+	m_tok.clear();
+	if (m_pos >= m_src.size())
+	{
+		m_tokType = TokType::End;
+		return;
+	}
+	char c = m_src[m_pos];
+	if (isdigit(static_cast<unsigned char>(c)) || ((c == '$') && (m_pos + 1 < m_src.size()) && isxdigit(static_cast<unsigned char>(m_src[m_pos + 1]))))
+	{
+		// Decimal, 0x hex or the Apple 2 $ hex
+		size_t literalStart = m_pos;
+		int base = 10;
+		if (c == '$')
+		{
+			base = 16;
+			m_pos++;
+		}
+		else if ((c == '0') && (m_pos + 1 < m_src.size()) && ((m_src[m_pos + 1] == 'x') || (m_src[m_pos + 1] == 'X')))
+		{
+			base = 16;
+			m_pos += 2;
+		}
+		size_t start = m_pos;
+		while ((m_pos < m_src.size()) && ((base == 16) ? isxdigit(static_cast<unsigned char>(m_src[m_pos]))
+			: isdigit(static_cast<unsigned char>(m_src[m_pos]))))
+			m_pos++;
+		size_t end = m_pos;
+		// Letters or digits stuck to the number, as in 1f or 12ab, aren't a separate token
+		while ((m_pos < m_src.size()) && (isalnum(static_cast<unsigned char>(m_src[m_pos])) || (m_src[m_pos] == '_')))
+			m_pos++;
+		if ((end == start) || (m_pos != end))
+		{
+			m_tok = m_src.substr(literalStart, m_pos - literalStart);
+			Fail("invalid number '" + m_tok + "'");
+			m_tokType = TokType::Punct;		// will fail to parse
+			return;
+		}
+		m_tok = m_src.substr(start, end - start);
+		m_tokType = TokType::Number;
+		m_tokNum = strtoll(m_tok.c_str(), nullptr, base);
+		return;
+	}
+	if ((c == '\'') || (c == '"'))
+	{
+		size_t end = m_src.find(c, m_pos + 1);
+		if (end == string::npos)
+		{
+			m_tok = m_src.substr(m_pos);
+			m_tokType = TokType::Punct;		// will fail to parse
+			m_pos = m_src.size();
+			return;
+		}
+		m_tok = m_src.substr(m_pos + 1, end - m_pos - 1);
+		m_tokType = TokType::String;
+		m_pos = end + 1;
+		return;
+	}
+	if (isalpha(static_cast<unsigned char>(c)) || (c == '_'))
+	{
+		size_t start = m_pos;
+		while ((m_pos < m_src.size()) && (isalnum(static_cast<unsigned char>(m_src[m_pos])) || (m_src[m_pos] == '_')))
+			m_pos++;
+		m_tok = m_src.substr(start, m_pos - start);
+		m_tokType = TokType::Ident;
+		return;
+	}
+	m_tokType = TokType::Punct;
+	for (const char* p : s_twoCharPuncts)
+	{
+		if (m_src.compare(m_pos, 2, p) == 0)
+		{
+			m_tok = p;
+			m_pos += 2;
+			return;
+		}
+	}
+	m_tok = string(1, c);
+	m_pos++;
+}
+
+bool ProfileExpression::Accept(const char* punct)
+{
+	if ((m_tokType != TokType::Punct) || (m_tok != punct))
+		return false;
+	NextToken();
+	return true;
+}
+
+bool ProfileExpression::Expect(const char* punct)
+{
+	if (Accept(punct))
+		return true;
+	Fail(string("expected '") + punct + "'");
+	return false;
+}
+
+ProfileExpression::ValType ProfileExpression::ParseTernary()
+{
+	ValType cond = ParseBinary(0);
+	if ((cond == ValType::Error) || !Accept("?"))
+		return cond;
+	if (cond != ValType::Int)
+		return Fail("condition must be a number");
+	size_t jElse = EmitJump(OP_JZ);
+	ValType tThen = ParseTernary();
+	if ((tThen == ValType::Error) || !Expect(":"))
+		return ValType::Error;
+	size_t jEnd = EmitJump(OP_JMP);
+	PlaceLabel(jElse);
+	Push(-1);	// only one of the branches runs
+	ValType tElse = ParseTernary();
+	if (tElse == ValType::Error)
+		return tElse;
+	if (tThen != tElse)
+		return Fail("both sides of ?: must be of the same type");
+	PlaceLabel(jEnd);
+	return tThen;
+}
+
+ProfileExpression::ValType ProfileExpression::ParseBinary(int level)
+{
+	if (level >= static_cast<int>(s_binaryLevels.size()))
+		return ParseUnary();
+	ValType lhs = ParseBinary(level + 1);
+	while (lhs != ValType::Error)
+	{
+		if (m_tokType != TokType::Punct)
+			break;
+		const BinaryOpDef* def = nullptr;
+		for (auto& d : s_binaryLevels[level])
+		{
+			if (m_tok == d.token)
+				def = &d;
+		}
+		if (def == nullptr)
+			break;
+		NextToken();
+
+		if (level == EXPR_LEVEL_LOGICAL_AND)
+		{
+			// a && b  ->  a JZ(false) b BOOL JMP(end) false: PUSH 0 end:
+			if (lhs != ValType::Int)
+				return Fail("&& needs numbers");
+			size_t jFalse = EmitJump(OP_JZ);
+			if (ParseBinary(level + 1) != ValType::Int)
+				return Fail("&& needs numbers");
+			Emit(OP_BOOL);
+			size_t jEnd = EmitJump(OP_JMP);
+			PlaceLabel(jFalse);
+			Push(-1);
+			Emit(OP_PUSH, 0);
+			Push(1);
+			PlaceLabel(jEnd);
+			continue;
+		}
+		if (level == EXPR_LEVEL_LOGICAL_OR)
+		{
+			// a || b  ->  a JZ(rhs) PUSH 1 JMP(end) rhs: b BOOL end:
+			if (lhs != ValType::Int)
+				return Fail("|| needs numbers");
+			size_t jRhs = EmitJump(OP_JZ);
+			Emit(OP_PUSH, 1);
+			Push(1);
+			size_t jEnd = EmitJump(OP_JMP);
+			PlaceLabel(jRhs);
+			Push(-1);
+			if (ParseBinary(level + 1) != ValType::Int)
+				return Fail("|| needs numbers");
+			Emit(OP_BOOL);
+			PlaceLabel(jEnd);
+			continue;
+		}
+
+		ValType rhs = ParseBinary(level + 1);
+		if (rhs == ValType::Error)
+			return rhs;
+		if ((lhs == ValType::Str) && (rhs == ValType::Str) && ((def->op == OP_EQ) || (def->op == OP_NE)))
+		{
+			Emit(def->op == OP_EQ ? OP_SEQ : OP_SNE);
+			Push(-1);
+		}
+		else if ((lhs != ValType::Int) || (rhs != ValType::Int))
+			return Fail(string("'") + def->token + "' needs numbers");
+		else
+			EmitBinary(def->op);
+		lhs = ValType::Int;
+	}
+	return lhs;
+}
+
+ProfileExpression::ValType ProfileExpression::ParseUnary()
+{
+	INT32 op = -1;
+	if (Accept("-"))
+		op = OP_NEG;
+	else if (Accept("~"))
+		op = OP_NOT;
+	else if (Accept("!"))
+		op = OP_LNOT;
+	else if (Accept("+"))
+		return ParseUnary();
+	if (op < 0)
+		return ParsePrimary();
+
+	ValType t = ParseUnary();
+	if (t == ValType::Error)
+		return t;
+	if (t != ValType::Int)
+		return Fail("unary operator needs a number");
+	INT32 v;
+	if (LastIsConst(0, v))
+	{
+		// fold
+		m_code.resize(m_instrStarts.back());
+		m_instrStarts.pop_back();
+		v = (op == OP_NEG ? static_cast<INT32>(0u - static_cast<UINT32>(v)) : (op == OP_NOT ? ~v : !v));
+		Emit(OP_PUSH, v);
+	}
+	else
+		Emit(op);
+	return ValType::Int;
+}
+
+ProfileExpression::ValType ProfileExpression::ParsePrimary()
+{
+	switch (m_tokType)
+	{
+	case TokType::Number:
+		Emit(OP_PUSH, static_cast<INT32>(m_tokNum));
+		Push(1);
+		NextToken();
+		return ValType::Int;
+	case TokType::String:
+		Emit(OP_PUSH_STR, static_cast<INT32>(m_strings.size()));
+		Push(1);
+		m_strings.push_back(m_tok);
+		NextToken();
+		return ValType::Str;
+	case TokType::Punct:
+		if (Accept("("))
+		{
+			ValType t = ParseTernary();
+			if ((t == ValType::Error) || !Expect(")"))
+				return ValType::Error;
+			return t;
+		}
+		return Fail("unexpected '" + m_tok + "'");
+	case TokType::End:
+		return Fail("unexpected end of expression");
+	default:
+		break;
+	}
+
+	// Identifier: function, array[index].field or field of the current row
+	string name = m_tok;
+	NextToken();
+	if (Accept("("))
+	{
+		if ((name == "byte") || (name == "word"))
+		{
+			if (ParseTernary() != ValType::Int || !Expect(")"))
+				return Fail(name + "() needs an address");
+			INT32 addr;
+			if (LastIsConst(0, addr))
+			{
+				// Static address: turn it into a direct read
+				m_code.resize(m_instrStarts.back());
+				m_instrStarts.pop_back();
+				ExprMemRef ref;
+				ref.offset = addr;
+				ref.length = (name == "byte" ? 1 : 2);
+				Emit(OP_READ, static_cast<INT32>(m_refs.size()));
+				m_refs.push_back(ref);
+			}
+			else
+			{
+				Emit(name == "byte" ? OP_READ_BYTE : OP_READ_WORD);
+				m_hasComputedReads = true;
+			}
+			return ValType::Int;
+		}
+		if ((name == "min") || (name == "max"))
+		{
+			if ((ParseTernary() != ValType::Int) || !Expect(",") || (ParseTernary() != ValType::Int) || !Expect(")"))
+				return Fail(name + "() needs two numbers");
+			EmitBinary(name == "min" ? OP_MIN : OP_MAX);
+			return ValType::Int;
+		}
+		if (name == "lookup")
+		{
+			if (m_tokType != TokType::String)
+				return Fail("lookup() needs a table name");
+			string table = m_tok;
+			NextToken();
+			if (!Expect(",") || (ParseTernary() != ValType::Int) || !Expect(")"))
+				return Fail("lookup() needs a table name and a number");
+			UINT16 lookupId = m_symbols ? m_symbols->ResolveLookup(table) : EXPRESSION_NO_LOOKUP;
+			if (lookupId == EXPRESSION_NO_LOOKUP)
+				return Fail("unknown table " + table);
+			Emit(OP_LOOKUP, lookupId);
+			return ValType::Str;
+		}
+		return Fail("unknown function " + name);
+	}
+	if (Accept("["))
+	{
+		if ((m_tokType != TokType::Number) || (m_tokNum < 0))
+			return Fail("array index must be a number");
+		int index = static_cast<int>(m_tokNum);
+		NextToken();
+		if (!Expect("]") || !Expect("."))
+			return ValType::Error;
+		if (m_tokType != TokType::Ident)
+			return Fail("expected a field name");
+		string field = m_tok;
+		NextToken();
+		return ParseField(name, index, field);
+	}
+	return ParseField("", 0, name);
+}
+
+ProfileExpression::ValType ProfileExpression::ParseField(const std::string& arrayName, int index, const std::string& fieldName)
+{
+	ExprMemRef ref;
+	if ((m_symbols == nullptr) || !m_symbols->ResolveField(arrayName, index, fieldName, ref))
+		return Fail("unknown field " + (arrayName.empty() ? fieldName : arrayName + "[" + to_string(index) + "]." + fieldName));
+	Emit(OP_READ, static_cast<INT32>(m_refs.size()));
+	Push(1);
+	m_refs.push_back(ref);
+	return (ref.lookupId != EXPRESSION_NO_LOOKUP ? ValType::Str : ValType::Int);
+}
+
+void ProfileExpression::Push(int n)
+{
+	m_depth += n;
+	m_maxDepth = max(m_maxDepth, m_depth);
+}
+
+void ProfileExpression::Emit(INT32 op)
+{
+	m_instrStarts.push_back(m_code.size());
+	m_code.push_back(op);
+}
+
+void ProfileExpression::Emit(INT32 op, INT32 imm)
+{
+	Emit(op);
+	m_code.push_back(imm);
+}
+
+bool ProfileExpression::LastIsConst(size_t back, INT32& value) const
+{
+	if (m_instrStarts.size() <= back)
+		return false;
+	size_t start = m_instrStarts[m_instrStarts.size() - 1 - back];
+	// Never fold across a jump target
+	if ((start < m_foldBarrier) || (m_code[start] != OP_PUSH))
+		return false;
+	value = m_code[start + 1];
+	return true;
+}
+
+// Emits a binary op, or folds it into a constant when both operands are constants
+void ProfileExpression::EmitBinary(INT32 op)
+{
+	INT32 a, b;
+	if (LastIsConst(1, a) && LastIsConst(0, b))
+	{
+		// Run the op itself so folding can't disagree with the interpreter
+		ProfileExpression folder;
+		folder.m_code = { OP_PUSH, a, OP_PUSH, b, op, OP_END };
+		Slot r;
+		folder.Run(ExprContext(), r);
+		m_code.resize(m_instrStarts[m_instrStarts.size() - 2]);
+		m_instrStarts.resize(m_instrStarts.size() - 2);
+		Emit(OP_PUSH, r.i);
+	}
+	else
+		Emit(op);
+	Push(-1);
+}
+
+size_t ProfileExpression::EmitJump(INT32 op)
+{
+	Emit(op, 0);
+	if (op == OP_JZ)
+		Push(-1);
+	return m_code.size() - 1;
+}
+
+void ProfileExpression::PlaceLabel(size_t jumpImmPos)
+{
+	m_code[jumpImmPos] = static_cast<INT32>(m_code.size());
+	m_foldBarrier = m_code.size();
+}
+
+#pragma endregion
+
+#pragma region Benchmark
+
+// A fake "character" record at 0x1000, with lookups, for the benchmark
+class BenchmarkSymbols : public IExpressionSymbols
+{
+public:
+	bool ResolveField(const std::string& arrayName, int index, const std::string& fieldName, ExprMemRef& ref) override
+	{
+		static const map<string, pair<INT32, UINT16>> fields = {
+			{ "hp", { 0x00, 2 } }, { "maxhp", { 0x02, 2 } }, { "gold", { 0x04, 2 } },
+			{ "silver", { 0x06, 1 } }, { "flags", { 0x07, 1 } }, { "food", { 0x08, 2 } },
+		};
+		auto it = fields.find(fieldName);
+		if (it == fields.end())
+			return false;
+		ref.length = it->second.second;
+		if (arrayName.empty())
+		{
+			ref.mode = ExprAddrMode::Row;
+			ref.offset = it->second.first;
+		}
+		else
+			ref.offset = 0x1000 + (index * 0x20) + it->second.first;
+		ref.read = (fieldName == "food" ? ExprRead::LiteralHighFirst : ExprRead::LowFirst);
+		return true;
+	}
+	UINT16 ResolveLookup(const std::string& table) override
+	{
+		return (table == "spells" ? 0 : EXPRESSION_NO_LOOKUP);
+	}
+};
+
+ExprBenchmarkResult ProfileExpression::RunBenchmark(UINT32 evalsPerFrame, UINT32 frames)
+{
+	static const char* sources[] = {
+		"hp * 100 / max(maxhp, 1)",
+		"gold * 100 + silver",
+		"flags & 0x40 ? 'Poisoned' : (flags & 0x20 ? 'Asleep' : 'Good')",
+		"lookup('spells', byte($7033))",
+		"party[2].hp < party[2].maxhp / 4 && !(flags & 1)",
+		"food / 100",
+		"(word(0x7000 + silver) >> 4) ^ 0x55",
+	};
+	ExprBenchmarkResult res;
+	res.frames = frames;
+	res.evalsPerFrame = evalsPerFrame;
+
+	BenchmarkSymbols symbols;
+	vector<ProfileExpression> exprs;
+	for (const char* src : sources)
+	{
+		ProfileExpression e;
+		string error;
+		if (e.Compile(src, &symbols, error))
+			exprs.push_back(std::move(e));
+	}
+	if (exprs.empty() || (frames == 0))
+		return res;
+
+	vector<UINT8> mem(0x20000);
+	for (size_t i = 0; i < mem.size(); i++)
+		mem[i] = static_cast<UINT8>((i * 7) ^ (i >> 8));
+	vector<LookupTable> lookups(1);
+	for (size_t i = 0; i < lookups[0].size(); i++)
+		lookups[0][i] = "Spell " + to_string(i);
+
+	ExprContext ctx;
+	ctx.mem = mem.data();
+	ctx.memsize = static_cast<int>(mem.size());
+	ctx.lookups = lookups.data();
+
+	string out;
+	out.reserve(64);
+	double totalMs = 0.0;
+	for (UINT32 f = 0; f < frames; f++)
+	{
+		// Something changes every frame, as it would in the game
+		mem[0x1000 + (f & 0x1F)] = static_cast<UINT8>(f);
+		auto t0 = chrono::high_resolution_clock::now();
+		for (UINT32 i = 0; i < evalsPerFrame; i++)
+		{
+			const ProfileExpression& e = exprs[i % exprs.size()];
+			ctx.rowBase = 0x1000 + ((i & 3) * 0x20);
+			if (e.IsString())
+			{
+				e.Evaluate(ctx, out);
+				res.checksum += out.size();
+			}
+			else
+			{
+				INT32 v;
+				e.EvaluateInt(ctx, v);
+				res.checksum += v;
+			}
+		}
+		double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - t0).count();
+		totalMs += ms;
+		res.maxFrameMs = max(res.maxFrameMs, ms);
+	}
+	res.avgFrameMs = totalMs / frames;
+	res.nsPerEval = (evalsPerFrame > 0 ? (res.avgFrameMs * 1000000.0) / evalsPerFrame : 0.0);
+	return res;
+}
+
+#pragma endregion
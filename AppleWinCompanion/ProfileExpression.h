@@ -0,0 +1,150 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+
+/// <summary>
+/// A ProfileExpression computes a value from the Apple 2 memory, for example
+///		"hp * 100 / maxhp"
+///		"gold * 100 + silver"
+///		"flags & 0x40 ? 'Poisoned' : ''"
+///		"lookup('spells', byte($7033))"
+/// It is parsed once when the profile is compiled into a compact stack bytecode.
+/// Evaluation is a single interpreter loop over a fixed size stack that never allocates.
+///
+/// Supported: decimal, 0x and $ hex numbers, 'strings' or "strings", the C operators
+/// (arithmetic, bitwise, comparison, logical and ?:), byte(addr), word(addr), min(a,b), max(a,b),
+/// lookup('table', value), record fields of the current row by name, and array[index].field.
+/// Values are 32-bit signed ints or strings. The type of each subexpression is checked at compile time.
+/// </summary>
+
+constexpr UINT8 EXPRESSION_MAX_STACK = 32;
+constexpr UINT16 EXPRESSION_NO_LOOKUP = UINT16_MAX;
+
+typedef std::array<std::string, 256> LookupTable;
+
+enum class ExprAddrMode : UINT8
+{
+	Absolute,	// offset is the address
+	Row,		// offset is relative to the row base given at evaluation
+	Pointer,	// offset is relative to a resolved pointer
+};
+
+// Byte order and encoding of an int in memory, matching the profile var types
+enum class ExprRead : UINT8
+{
+	LowFirst,			// int_bigendian
+	HighFirst,			// int_littleendian
+	LiteralLowFirst,	// int_bigendian_literal
+	LiteralHighFirst,	// int_littleendian_literal
+};
+
+struct ExprMemRef
+{
+	ExprAddrMode mode = ExprAddrMode::Absolute;
+	INT32 offset = 0;
+	UINT16 pointerId = 0;
+	UINT16 length = 1;
+	ExprRead read = ExprRead::LowFirst;
+	UINT16 lookupId = EXPRESSION_NO_LOOKUP;		// set for lookup fields, which are strings
+};
+
+// Implemented by whoever compiles expressions, to resolve the names they use
+class IExpressionSymbols
+{
+public:
+	// arrayName is empty for a field of the current row
+	virtual bool ResolveField(const std::string& arrayName, int index, const std::string& fieldName, ExprMemRef& ref) = 0;
+	virtual UINT16 ResolveLookup(const std::string& table) = 0;
+
+protected:
+	~IExpressionSymbols() = default;
+};
+
+struct ExprContext
+{
+	const UINT8* mem = nullptr;
+	int memsize = 0;
+	INT64 rowBase = 0;
+	const INT64* pointers = nullptr;		// resolved pointers, negative when unresolved
+	const LookupTable* lookups = nullptr;
+};
+
+struct ExprBenchmarkResult
+{
+	UINT32 frames = 0;
+	UINT32 evalsPerFrame = 0;
+	double avgFrameMs = 0.0;
+	double maxFrameMs = 0.0;
+	double nsPerEval = 0.0;
+	INT64 checksum = 0;		// so the evaluations can't be optimized away
+};
+
+class ProfileExpression
+{
+public:
+	ProfileExpression();
+
+	bool Compile(const std::string& source, IExpressionSymbols* symbols, std::string& error);
+	bool IsString() const { return m_isString; }
+
+	// Both return false if the expression read outside of the memory or through an unresolved pointer
+	bool Evaluate(const ExprContext& ctx, std::string& out) const;
+	bool EvaluateInt(const ExprContext& ctx, INT32& out) const;
+
+	// Adds the memory ranges read at fixed addresses, as (address, length). Returns false if the expression
+	// also reads addresses only known when evaluating: row fields, pointers or byte() of a computed address.
+	bool GetFixedReads(std::vector<std::pair<UINT32, UINT16>>& reads) const;
+
+	// Runs evalsPerFrame evaluations of a mix of typical expressions, for the given number of frames
+	static ExprBenchmarkResult RunBenchmark(UINT32 evalsPerFrame, UINT32 frames);
+
+private:
+	union Slot
+	{
+		INT32 i;
+		const std::string* s;
+	};
+	bool Run(const ExprContext& ctx, Slot& result) const;
+
+	// Parser. Each level emits its bytecode and returns the type of what it left on the stack.
+	enum class TokType { End, Number, String, Ident, Punct };
+	enum class ValType { Int, Str, Error };
+	void NextToken();
+	bool Accept(const char* punct);
+	bool Expect(const char* punct);
+	ValType ParseTernary();
+	ValType ParseBinary(int level);
+	ValType ParseUnary();
+	ValType ParsePrimary();
+	ValType ParseField(const std::string& arrayName, int index, const std::string& fieldName);
+	ValType Fail(const std::string& msg);
+
+	// Emitter
+	void Emit(INT32 op);
+	void Emit(INT32 op, INT32 imm);
+	void EmitBinary(INT32 op);
+	size_t EmitJump(INT32 op);
+	void PlaceLabel(size_t jumpImmPos);
+	bool LastIsConst(size_t back, INT32& value) const;
+	void Push(int n);
+
+	std::vector<INT32> m_code;
+	std::vector<ExprMemRef> m_refs;
+	std::vector<std::string> m_strings;
+	bool m_isString;
+	bool m_hasComputedReads;	// byte() or word() of a computed address
+
+	// compile-time only state
+	std::string m_src;
+	size_t m_pos;
+	TokType m_tokType;
+	std::string m_tok;
+	INT64 m_tokNum;
+	IExpressionSymbols* m_symbols;
+	std::string m_error;
+	std::vector<size_t> m_instrStarts;
+	size_t m_foldBarrier;
+	int m_depth;
+	int m_maxDepth;
+};
@@ -0,0 +1,195 @@
+#include "pch.h"
+#include "ProfilerDialog.h"
+#include "GameLink.h"
+#include "resource.h"
+#include <shobjidl.h>
+
+constexpr size_t PROFILER_MAX_LISTED = 50;
+constexpr UINT PROFILER_REFRESH_TIMER = 1;
+constexpr UINT PROFILER_REFRESH_MS = 500;
+
+static HWND s_hDlg = NULL;
+static PcProfiler* s_profiler = nullptr;
+static SymbolTable s_symbols;
+static std::string s_symbolsName;
+static std::vector<PcProfileEntry> s_entries;
+
+static void SetStatus(const std::string& text)
+{
+	SetDlgItemTextA(s_hDlg, IDC_PROFILER_STATUS, text.c_str());
+}
+
+static void RefreshResults()
+{
+	const SymbolTable* symbols = s_symbols.IsEmpty() ? nullptr : &s_symbols;
+	s_profiler->Aggregate(symbols, s_entries);
+	UINT64 total = s_profiler->GetSampleCount();
+
+	HWND hList = GetDlgItem(s_hDlg, IDC_PROFILER_RESULTS);
+	LRESULT top = SendMessage(hList, LB_GETTOPINDEX, 0, 0);
+	SendMessage(hList, WM_SETREDRAW, FALSE, 0);
+	SendMessage(hList, LB_RESETCONTENT, 0, 0);
+	char buf[200];
+	for (size_t i = 0; (i < s_entries.size()) && (i < PROFILER_MAX_LISTED); i++)
+	{
+		const auto& e = s_entries[i];
+		snprintf(buf, sizeof(buf), "%5.1f%%\t%llu\t$%04X\t%s",
+			100.0 * e.samples / total, static_cast<unsigned long long>(e.samples), e.start, e.name.c_str());
+		SendMessageA(hList, LB_ADDSTRING, 0, reinterpret_cast<LPARAM>(buf));
+	}
+	SendMessage(hList, LB_SETTOPINDEX, top, 0);
+	SendMessage(hList, WM_SETREDRAW, TRUE, 0);
+	InvalidateRect(hList, NULL, TRUE);
+
+	snprintf(buf, sizeof(buf), "%s, %llu samples%s%s",
+		s_profiler->IsRunning() ? "Sampling" : "Stopped", static_cast<unsigned long long>(total),
+		s_symbolsName.empty() ? "" : ", symbols from ", s_symbolsName.c_str());
+	SetStatus(buf);
+}
+
+// Asks for a file to open or to save. Returns false if the user cancelled.
+static bool PickFile(bool save, std::filesystem::path& path)
+{
+	bool picked = false;
+	HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+	if (SUCCEEDED(hr))
+	{
+		IFileDialog* pFileDialog;
+		hr = CoCreateInstance(save ? CLSID_FileSaveDialog : CLSID_FileOpenDialog, NULL, CLSCTX_ALL,
+			save ? IID_IFileSaveDialog : IID_IFileOpenDialog, reinterpret_cast<void**>(&pFileDialog));
+		if (SUCCEEDED(hr))
+		{
+			if (save)
+			{
+				pFileDialog->SetFileName(L"profile.folded");
+				pFileDialog->SetDefaultExtension(L"folded");
+			}
+			hr = pFileDialog->Show(s_hDlg);
+			if (SUCCEEDED(hr))
+			{
+				IShellItem* pItem;
+				hr = pFileDialog->GetResult(&pItem);
+				if (SUCCEEDED(hr))
+				{
+					PWSTR pszFilePath;
+					hr = pItem->GetDisplayName(SIGDN_FILESYSPATH, &pszFilePath);
+					if (SUCCEEDED(hr))
+					{
+						path = pszFilePath;
+						picked = true;
+						CoTaskMemFree(pszFilePath);
+					}
+					pItem->Release();
+				}
+			}
+			pFileDialog->Release();
+		}
+		CoUninitialize();
+	}
+	return picked;
+}
+
+static void LoadSymbols()
+{
+	std::filesystem::path path;
+	if (!PickFile(false, path))
+		return;
+	std::string error;
+	if (!s_symbols.Load(path, error))
+	{
+		s_symbolsName.clear();
+		SetStatus("Error: " + error);
+		return;
+	}
+	s_symbolsName = path.filename().string();
+	RefreshResults();
+}
+
+static void ExportFolded()
+{
+	std::filesystem::path path;
+	if (!PickFile(true, path))
+		return;
+	std::string program = GameLink::IsActive() ? GameLink::GetEmulatedProgramName() : "";
+	std::string error;
+	if (!s_profiler->ExportFolded(path, program, s_symbols.IsEmpty() ? nullptr : &s_symbols, error))
+	{
+		SetStatus("Error: " + error);
+		return;
+	}
+	SetStatus("Exported to " + path.filename().string());
+}
+
+static INT_PTR CALLBACK ProfilerProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	UNREFERENCED_PARAMETER(lParam);
+	switch (message)
+	{
+	case WM_INITDIALOG:
+	{
+		s_hDlg = hDlg;
+		// Percentage, samples, address, name
+		INT tabs[] = { 30, 70, 100 };
+		SendDlgItemMessage(hDlg, IDC_PROFILER_RESULTS, LB_SETTABSTOPS, ARRAYSIZE(tabs), reinterpret_cast<LPARAM>(tabs));
+		CheckDlgButton(hDlg, IDC_PROFILER_RUN, s_profiler->IsRunning() ? BST_CHECKED : BST_UNCHECKED);
+		RefreshResults();
+		SetTimer(hDlg, PROFILER_REFRESH_TIMER, PROFILER_REFRESH_MS, NULL);
+		return (INT_PTR)TRUE;
+	}
+
+	case WM_TIMER:
+		if (s_profiler->IsRunning())
+			RefreshResults();
+		return (INT_PTR)TRUE;
+
+	case WM_COMMAND:
+		switch (LOWORD(wParam))
+		{
+		case IDC_PROFILER_RUN:
+			s_profiler->SetRunning(IsDlgButtonChecked(hDlg, IDC_PROFILER_RUN) == BST_CHECKED);
+			RefreshResults();
+			return (INT_PTR)TRUE;
+		case IDC_PROFILER_RESET:
+			s_profiler->Reset();
+			RefreshResults();
+			return (INT_PTR)TRUE;
+		case IDC_PROFILER_SYMBOLS:
+			LoadSymbols();
+			return (INT_PTR)TRUE;
+		case IDC_PROFILER_EXPORT:
+			ExportFolded();
+			return (INT_PTR)TRUE;
+		case IDCANCEL:
+			DestroyWindow(hDlg);
+			return (INT_PTR)TRUE;
+		}
+		break;
+
+	case WM_DESTROY:
+		// The profiler keeps sampling with the panel closed
+		KillTimer(hDlg, PROFILER_REFRESH_TIMER);
+		s_entries.clear();
+		s_hDlg = NULL;
+		break;
+	}
+	return (INT_PTR)FALSE;
+}
+
+void ProfilerDialog::Show(HINSTANCE hInstance, HWND parent, PcProfiler* profiler)
+{
+	if (profiler == nullptr)
+		return;
+	s_profiler = profiler;
+	if (s_hDlg == NULL)
+		CreateDialog(hInstance, MAKEINTRESOURCE(IDD_PROFILER), parent, ProfilerProc);
+	if (s_hDlg != NULL)
+	{
+		ShowWindow(s_hDlg, SW_SHOW);
+		SetForegroundWindow(s_hDlg);
+	}
+}
+
+bool ProfilerDialog::HandleMessage(MSG* msg)
+{
+	return (s_hDlg != NULL) && IsDialogMessage(s_hDlg, msg);
+}
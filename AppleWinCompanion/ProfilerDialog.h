@@ -0,0 +1,16 @@
+#pragma once
+#include "PcProfiler.h"
+
+/// <summary>
+/// The Profiler panel: a modeless dialog to start and stop a PcProfiler, load the symbols of the
+/// running program and export the profile for flame graph tools.
+/// The routines taking the most samples are listed, refreshed twice per second.
+/// </summary>
+
+namespace ProfilerDialog
+{
+	// Opens the panel on the profiler, or brings it to the front if it is already open
+	void Show(HINSTANCE hInstance, HWND parent, PcProfiler* profiler);
+	// Lets the panel handle its keyboard navigation. Returns true if the message was for the panel.
+	bool HandleMessage(MSG* msg);
+}
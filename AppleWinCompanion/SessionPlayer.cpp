@@ -0,0 +1,339 @@
+#include "pch.h"
+#include "SessionPlayer.h"
+#include "GameLinkProtocol.h"
+#include <thread>
+
+#pragma region SessionReader
+
+SessionReader::SessionReader()
+{
+	m_header = {};
+	m_next = 0;
+	m_frameValid = false;
+	m_frameNumber = 0;
+	m_timeMs = 0;
+	m_seq = 0;
+}
+
+bool SessionReader::Open(const std::filesystem::path& path, std::string& error)
+{
+	Close();
+	m_file.open(path, std::ios::binary | std::ios::ate);
+	if (!m_file)
+	{
+		error = "can't open the file";
+		return false;
+	}
+	UINT64 fileSize = static_cast<UINT64>(m_file.tellg());
+	m_file.seekg(0);
+	if (!m_file.read(reinterpret_cast<char*>(&m_header), sizeof(m_header))
+		|| (memcmp(m_header.magic, SESSION_MAGIC, sizeof(SESSION_MAGIC)) != 0))
+	{
+		error = "not a session file";
+		return false;
+	}
+	if (m_header.version != SESSION_VERSION)
+	{
+		error = "unsupported session version " + std::to_string(m_header.version);
+		return false;
+	}
+	if (!ReadIndex(fileSize) && !RebuildIndex(fileSize))
+	{
+		error = "corrupt session file";
+		return false;
+	}
+	for (size_t i = 0; i < m_index.size(); i++)
+	{
+		if (m_index[i].type == SessionChunkType::MemoryKey)
+			m_keyframes.push_back(i);
+	}
+	if (m_keyframes.empty())
+	{
+		error = "the session is empty";
+		return false;
+	}
+	m_mem.assign(m_header.memSize, 0);
+	m_frame.assign(static_cast<size_t>(m_header.frameWidth) * m_header.frameHeight * sizeof(UINT32), 0);
+	m_next = m_keyframes[0];
+	return true;
+}
+
+void SessionReader::Close()
+{
+	if (m_file.is_open())
+		m_file.close();
+	m_file.clear();
+	m_header = {};
+	m_index.clear();
+	m_keyframes.clear();
+	m_next = 0;
+	m_frameValid = false;
+	m_frameNumber = 0;
+	m_timeMs = 0;
+	m_seq = 0;
+}
+
+bool SessionReader::ReadIndex(UINT64 fileSize)
+{
+	SessionFileFooter footer;
+	if (fileSize < sizeof(SessionFileHeader) + sizeof(footer))
+		return false;
+	m_file.seekg(static_cast<std::streamoff>(fileSize - sizeof(footer)));
+	if (!m_file.read(reinterpret_cast<char*>(&footer), sizeof(footer))
+		|| (memcmp(footer.magic, SESSION_INDEX_MAGIC, sizeof(footer.magic)) != 0)
+		|| (footer.indexOffset + static_cast<UINT64>(footer.indexCount) * sizeof(SessionIndexEntry) + sizeof(footer) != fileSize))
+	{
+		m_file.clear();
+		return false;
+	}
+	m_index.resize(footer.indexCount);
+	m_file.seekg(static_cast<std::streamoff>(footer.indexOffset));
+	if (!m_file.read(reinterpret_cast<char*>(m_index.data()), m_index.size() * sizeof(SessionIndexEntry)))
+	{
+		m_file.clear();
+		m_index.clear();
+		return false;
+	}
+	return true;
+}
+
+// Walks the chunks from the start. A truncated last chunk is ignored.
+bool SessionReader::RebuildIndex(UINT64 fileSize)
+{
+	m_index.clear();
+	UINT64 offset = sizeof(SessionFileHeader);
+	SessionChunkHeader ch;
+	while (offset + sizeof(ch) <= fileSize)
+	{
+		m_file.seekg(static_cast<std::streamoff>(offset));
+		if (!m_file.read(reinterpret_cast<char*>(&ch), sizeof(ch)) || (ch.type >= SessionChunkType::Count)
+			|| (offset + sizeof(ch) + ch.size > fileSize))
+			break;
+		SessionIndexEntry ie = {};
+		ie.offset = offset;
+		ie.frame = ch.frame;
+		ie.type = ch.type;
+		m_index.push_back(ie);
+		offset += sizeof(ch) + ch.size;
+	}
+	m_file.clear();
+	return !m_index.empty();
+}
+
+UINT32 SessionReader::GetFirstFrame() const
+{
+	return m_keyframes.empty() ? 0 : m_index[m_keyframes.front()].frame;
+}
+
+UINT32 SessionReader::GetLastFrame() const
+{
+	return m_index.empty() ? 0 : m_index.back().frame;
+}
+
+bool SessionReader::ApplyChunk(const SessionIndexEntry& entry)
+{
+	SessionChunkHeader ch;
+	m_file.seekg(static_cast<std::streamoff>(entry.offset));
+	if (!m_file.read(reinterpret_cast<char*>(&ch), sizeof(ch)))
+		return false;
+	m_payload.resize(ch.size);
+	if (!m_file.read(reinterpret_cast<char*>(m_payload.data()), ch.size))
+		return false;
+
+	std::vector<UINT8>* buf = &m_mem;
+	switch (ch.type)
+	{
+	case SessionChunkType::MemoryKey:
+		std::fill(m_mem.begin(), m_mem.end(), static_cast<UINT8>(0));
+		break;
+	case SessionChunkType::MemoryDelta:
+		break;
+	case SessionChunkType::FrameKey:
+		buf = &m_frame;
+		std::fill_n(reinterpret_cast<UINT32*>(m_frame.data()), m_frame.size() / sizeof(UINT32), SESSION_FRAME_KEY_PIXEL);
+		m_frameValid = true;
+		break;
+	case SessionChunkType::FrameDelta:
+		buf = &m_frame;
+		break;
+	default:
+		return false;
+	}
+	if (!SessionCodec::ApplyDelta(m_payload.data(), m_payload.size(), buf->data(), buf->size()))
+		return false;
+	m_frameNumber = ch.frame;
+	m_timeMs = ch.timeMs;
+	m_seq = ch.seq;
+	return true;
+}
+
+bool SessionReader::NextFrame()
+{
+	if (m_next >= m_index.size())
+		return false;
+	UINT32 frame = m_index[m_next].frame;
+	while ((m_next < m_index.size()) && (m_index[m_next].frame == frame))
+	{
+		if (!ApplyChunk(m_index[m_next]))
+		{
+			m_file.clear();
+			m_next = m_index.size();
+			return false;
+		}
+		m_next++;
+	}
+	return true;
+}
+
+bool SessionReader::Seek(UINT32 frame)
+{
+	if (m_keyframes.empty())
+		return false;
+	// Last keyframe at or before the frame
+	auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), frame,
+		[this](UINT32 f, size_t pos) { return f < m_index[pos].frame; });
+	if (it != m_keyframes.begin())
+		--it;
+	m_next = *it;
+	m_frameValid = false;
+	if (!NextFrame())
+		return false;
+	while ((m_next < m_index.size()) && (m_index[m_next].frame <= frame))
+	{
+		if (!NextFrame())
+			return false;
+	}
+	return true;
+}
+
+#pragma endregion
+
+#pragma region SessionPlayer
+
+SessionPlayer::SessionPlayer()
+{
+	m_mutex = NULL;
+	m_mapping = NULL;
+	m_shm = nullptr;
+	m_seq = 0;
+	m_stopping = false;
+}
+
+SessionPlayer::~SessionPlayer()
+{
+	Close();
+}
+
+bool SessionPlayer::Open(const std::filesystem::path& path, std::string& error)
+{
+	Close();
+	if (!m_reader.Open(path, error))
+		return false;
+	const SessionFileHeader& h = m_reader.GetHeader();
+	if (static_cast<UINT64>(h.frameWidth) * h.frameHeight * sizeof(UINT32) > sizeof(sSharedMMapFrame_R1::buffer))
+	{
+		error = "the session frames are larger than GameLink allows";
+		return false;
+	}
+
+	DWORD mapSize = static_cast<DWORD>(sizeof(sSharedMemoryMap_R4) + h.memSize);
+	m_mutex = CreateMutexA(NULL, FALSE, GAMELINK_MUTEX_NAME);
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, mapSize, GAMELINK_MMAP_NAME);
+	if ((m_mutex == NULL) || (m_mapping == NULL) || (GetLastError() == ERROR_ALREADY_EXISTS))
+	{
+		error = "couldn't create the GameLink shared memory. Is AppleWin running?";
+		Close();
+		return false;
+	}
+	m_shm = reinterpret_cast<sSharedMemoryMap_R4*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if (m_shm == nullptr)
+	{
+		error = "couldn't map the GameLink shared memory";
+		Close();
+		return false;
+	}
+
+	// The view of a new mapping is zeroed
+	m_shm->version = PROTOCOL_VER;
+	m_shm->flags = FLAG_FRAME_TIME | (m_reader.HasVideo() ? 0 : FLAG_NO_FRAME);
+	snprintf(m_shm->system, SYSTEM_MAXLEN, "%s", SYSTEM_NAME);
+	snprintf(m_shm->program, PROGRAM_MAXLEN, "%s", path.filename().string().c_str());
+	m_shm->ram_size = h.memSize;
+	m_shm->frame.width = h.frameWidth;
+	m_shm->frame.height = h.frameHeight;
+	m_shm->frame.image_fmt = m_reader.HasVideo() ? 1 : 0;
+	m_shm->frame.par_x = 1;
+	m_shm->frame.par_y = 1;
+	return true;
+}
+
+void SessionPlayer::Close()
+{
+	if (m_shm)
+		UnmapViewOfFile(m_shm);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_mutex)
+		CloseHandle(m_mutex);
+	m_shm = nullptr;
+	m_mapping = NULL;
+	m_mutex = NULL;
+	m_reader.Close();
+}
+
+void SessionPlayer::Publish()
+{
+	if (m_shm == nullptr)
+		return;
+	// The sequence always moves forward, even when looping or seeking back,
+	// so GameLink readers see a new frame every time.
+	m_seq++;
+	WaitForSingleObject(m_mutex, 1000);
+	const std::vector<UINT8>& mem = m_reader.GetMemory();
+	memcpy(reinterpret_cast<UINT8*>(m_shm + 1), mem.data(), mem.size());
+	if (m_reader.IsFrameValid())
+	{
+		const std::vector<UINT8>& frame = m_reader.GetFrame();
+		memcpy(m_shm->frame.buffer, frame.data(), frame.size());
+	}
+	// For the latency of the companion, from the time the frame is ready
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	m_shm->frame.produced_time = static_cast<UINT64>(now.QuadPart);
+	m_shm->frame.produced_seq = m_seq;
+	m_shm->frame.seq = m_seq;
+	ReleaseMutex(m_mutex);
+}
+
+SessionPlayerStats SessionPlayer::Play(double speed, bool loop)
+{
+	SessionPlayerStats stats;
+	m_stopping = false;
+	auto tStart = std::chrono::steady_clock::now();
+	auto tSegment = tStart;
+	UINT32 segmentStartMs = m_reader.GetTimeMs();
+	while (!m_stopping)
+	{
+		if (!m_reader.NextFrame())
+		{
+			if (!loop || !m_reader.Rewind())
+				break;
+			tSegment = std::chrono::steady_clock::now();
+			segmentStartMs = m_reader.GetTimeMs();
+		}
+		if (speed > 0.)
+		{
+			// Recorded time since the segment start, scaled
+			auto due = tSegment + std::chrono::microseconds(
+				static_cast<INT64>((m_reader.GetTimeMs() - segmentStartMs) * 1000. / speed));
+			std::this_thread::sleep_until(due);
+		}
+		Publish();
+		stats.framesPlayed++;
+	}
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	stats.fps = stats.framesPlayed / std::max(stats.seconds, 0.001);
+	return stats;
+}
+
+#pragma endregion
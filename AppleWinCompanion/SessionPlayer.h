@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <filesystem>
+#include "SessionRecorder.h"
+
+struct sSharedMemoryMap_R4;
+
+/// <summary>
+/// SessionReader decodes a session file written by SessionRecorder, frame by frame.
+/// The chunk index comes from the end of the file, or is rebuilt by walking the chunks when the
+/// recording wasn't stopped cleanly. Seeking starts decoding at the closest memory keyframe
+/// at or before the requested frame, so it never decodes more than a keyframe interval.
+///
+/// SessionPlayer is a stand-in for AppleWin: it creates the GameLink shared memory and publishes
+/// the decoded memory and frames into it with the same layout, so the companion (or anything
+/// reading GameLink) runs unchanged against a recording. Sessions without video are published
+/// as tracking only (FLAG_NO_FRAME), and the companion renders the frame from memory.
+/// It plays in real time, at a multiple of real time, or as fast as possible (speed 0).
+/// </summary>
+
+class SessionReader
+{
+public:
+	SessionReader();
+
+	bool Open(const std::filesystem::path& path, std::string& error);
+	void Close();
+
+	const SessionFileHeader& GetHeader() const { return m_header; }
+	bool HasVideo() const { return m_header.frameWidth > 0; }
+	UINT32 GetFirstFrame() const;
+	UINT32 GetLastFrame() const;
+
+	// Decodes the next frame. Returns false at the end of the session or on a corrupt chunk.
+	bool NextFrame();
+	// Decodes up to the given frame, or the last recorded one before it. Returns false on error.
+	bool Seek(UINT32 frame);
+	// Seeks back to the first frame
+	bool Rewind() { return Seek(GetFirstFrame()); }
+
+	const std::vector<UINT8>& GetMemory() const { return m_mem; }
+	const std::vector<UINT8>& GetFrame() const { return m_frame; }
+	// False until a video keyframe was decoded after opening or seeking
+	bool IsFrameValid() const { return m_frameValid; }
+	UINT32 GetFrameNumber() const { return m_frameNumber; }
+	UINT32 GetTimeMs() const { return m_timeMs; }
+	UINT16 GetSeq() const { return m_seq; }
+
+private:
+	bool ReadIndex(UINT64 fileSize);
+	bool RebuildIndex(UINT64 fileSize);
+	bool ApplyChunk(const SessionIndexEntry& entry);
+
+	std::ifstream m_file;
+	SessionFileHeader m_header;
+	std::vector<SessionIndexEntry> m_index;
+	std::vector<size_t> m_keyframes;		// positions in m_index of the memory keyframes
+	size_t m_next;							// position in m_index of the next frame's first chunk
+	std::vector<UINT8> m_payload;
+	std::vector<UINT8> m_mem;
+	std::vector<UINT8> m_frame;
+	bool m_frameValid;
+	UINT32 m_frameNumber;
+	UINT32 m_timeMs;
+	UINT16 m_seq;
+};
+
+struct SessionPlayerStats
+{
+	UINT32 framesPlayed = 0;
+	double seconds = 0.;
+	double fps = 0.;
+};
+
+class SessionPlayer
+{
+public:
+	SessionPlayer();
+	~SessionPlayer();
+
+	// Opens the session and creates the GameLink shared memory for it
+	bool Open(const std::filesystem::path& path, std::string& error);
+	void Close();
+	SessionReader& GetReader() { return m_reader; }
+
+	// Publishes the frames after the current position until the end of the session, or Stop().
+	// speed is a multiple of real time, 0 to play as fast as possible.
+	SessionPlayerStats Play(double speed, bool loop);
+	void Stop() { m_stopping = true; }
+
+	// Writes the reader's current memory and frame into the shared memory
+	void Publish();
+
+private:
+	SessionReader m_reader;
+	HANDLE m_mutex;
+	HANDLE m_mapping;
+	sSharedMemoryMap_R4* m_shm;
+	UINT16 m_seq;
+	std::atomic<bool> m_stopping;
+};
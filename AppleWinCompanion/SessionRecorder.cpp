@@ -0,0 +1,308 @@
+#include "pch.h"
+#include "SessionRecorder.h"
+#include "Tracer.h"
+#include <emmintrin.h>
+
+constexpr size_t SESSION_FILE_BUFFER_SIZE = 1024 * 1024;
+constexpr size_t SESSION_MIN_UNCHANGED_RUN = 4;
+
+#pragma region SessionCodec
+
+static inline void PutVarint(std::vector<UINT8>& out, size_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back(static_cast<UINT8>(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back(static_cast<UINT8>(v));
+}
+
+static inline bool GetVarint(const UINT8*& p, const UINT8* end, size_t& v)
+{
+	v = 0;
+	for (UINT32 shift = 0; (p < end) && (shift < 35); shift += 7)
+	{
+		UINT8 b = *p++;
+		v |= static_cast<size_t>(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+void SessionCodec::EncodeDelta(const UINT8* cur, const UINT8* prev, size_t size, std::vector<UINT8>& out)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		// Skip the unchanged bytes, 16 at a time while possible
+		size_t start = i;
+		while ((i + 16 <= size) && (_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i)))) == 0xFFFF))
+			i += 16;
+		while ((i < size) && (cur[i] == prev[i]))
+			i++;
+		if (i == size)
+			break;
+		// The changed bytes run until SESSION_MIN_UNCHANGED_RUN unchanged bytes in a row
+		size_t changedStart = i;
+		size_t changedEnd = i;
+		while ((i < size) && (i - changedEnd < SESSION_MIN_UNCHANGED_RUN))
+		{
+			if (cur[i] != prev[i])
+				changedEnd = i + 1;
+			i++;
+		}
+		PutVarint(out, changedStart - start);
+		PutVarint(out, changedEnd - changedStart);
+		for (size_t k = changedStart; k < changedEnd; k++)
+			out.push_back(cur[k] ^ prev[k]);
+		i = changedEnd;
+	}
+}
+
+bool SessionCodec::ApplyDelta(const UINT8* in, size_t inSize, UINT8* buf, size_t size)
+{
+	const UINT8* p = in;
+	const UINT8* end = in + inSize;
+	size_t pos = 0;
+	while (p < end)
+	{
+		size_t unchanged, changed;
+		if (!GetVarint(p, end, unchanged) || !GetVarint(p, end, changed))
+			return false;
+		if ((unchanged > size - pos) || (changed > size - pos - unchanged)
+			|| (changed > static_cast<size_t>(end - p)))
+			return false;
+		pos += unchanged;
+		for (size_t k = 0; k < changed; k++)
+			buf[pos + k] ^= p[k];
+		pos += changed;
+		p += changed;
+	}
+	return true;
+}
+
+#pragma endregion
+
+SessionRecorder::SessionRecorder()
+{
+	m_recording = false;
+	m_header = {};
+	m_frameSize = 0;
+	m_lastSeq = 0;
+	m_frameNumber = 0;
+	m_stopping = false;
+	m_fileOffset = 0;
+	m_framesWritten = 0;
+	m_frameKeyPending = true;
+	m_framesCaptured = 0;
+	m_framesDropped = 0;
+	m_bytesWritten = 0;
+}
+
+SessionRecorder::~SessionRecorder()
+{
+	Stop();
+}
+
+bool SessionRecorder::Start(const std::filesystem::path& path, UINT32 memSize, UINT16 frameWidth, UINT16 frameHeight)
+{
+	Stop();
+	m_fileBuffer.resize(SESSION_FILE_BUFFER_SIZE);
+	m_file.rdbuf()->pubsetbuf(m_fileBuffer.data(), m_fileBuffer.size());
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_file)
+	{
+		char buf[500];
+		snprintf(buf, 500, "Couldn't create the session file %s\n", path.string().c_str());
+		OutputDebugStringA(buf);
+		return false;
+	}
+
+	memcpy(m_header.magic, SESSION_MAGIC, sizeof(m_header.magic));
+	m_header.version = SESSION_VERSION;
+	m_header.memSize = memSize;
+	m_header.frameWidth = frameWidth;
+	m_header.frameHeight = frameHeight;
+	m_header.keyframeInterval = SESSION_KEYFRAME_INTERVAL;
+	m_frameSize = static_cast<UINT32>(frameWidth) * frameHeight * sizeof(UINT32);
+	m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+	m_fileOffset = sizeof(m_header);
+
+	m_pool.clear();
+	m_free.clear();
+	m_pending.clear();
+	for (UINT32 i = 0; i < SESSION_BUFFER_COUNT; i++)
+	{
+		auto c = std::make_unique<CaptureBuffer>();
+		c->mem.resize(memSize);
+		c->frame.resize(m_frameSize);
+		m_free.push_back(c.get());
+		m_pool.push_back(std::move(c));
+	}
+	m_prevMem.assign(memSize, 0);
+	m_prevFrame.assign(m_frameSize, 0);
+	m_zeros.assign(memSize, 0);
+	m_blackFrame.resize(m_frameSize);
+	std::fill_n(reinterpret_cast<UINT32*>(m_blackFrame.data()), m_frameSize / sizeof(UINT32), SESSION_FRAME_KEY_PIXEL);
+	m_encoded.reserve(memSize);
+	m_index.clear();
+	m_framesWritten = 0;
+	m_frameKeyPending = true;
+	m_frameNumber = 0;
+	m_framesCaptured = 0;
+	m_framesDropped = 0;
+	m_bytesWritten = sizeof(m_header);
+	m_startTime = std::chrono::steady_clock::now();
+
+	m_stopping = false;
+	m_writer = std::thread(&SessionRecorder::WriterThread, this);
+	m_recording = true;
+	return true;
+}
+
+void SessionRecorder::Stop()
+{
+	if (!m_recording)
+		return;
+	m_recording = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_cv.notify_one();
+	m_writer.join();		// the pending captures are written first
+
+	SessionFileFooter footer = {};
+	footer.indexOffset = m_fileOffset;
+	footer.indexCount = static_cast<UINT32>(m_index.size());
+	memcpy(footer.magic, SESSION_INDEX_MAGIC, sizeof(footer.magic));
+	m_file.write(reinterpret_cast<const char*>(m_index.data()), m_index.size() * sizeof(SessionIndexEntry));
+	m_file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+	m_bytesWritten += m_index.size() * sizeof(SessionIndexEntry) + sizeof(footer);
+	m_file.close();
+	m_pool.clear();
+	m_free.clear();
+}
+
+SessionRecorderStats SessionRecorder::GetStats() const
+{
+	SessionRecorderStats stats;
+	stats.framesCaptured = m_framesCaptured;
+	stats.framesDropped = m_framesDropped;
+	stats.bytesWritten = m_bytesWritten;
+	stats.seconds = static_cast<UINT32>(std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::steady_clock::now() - m_startTime).count());
+	return stats;
+}
+
+void SessionRecorder::Capture(UINT16 seq, const UINT8* mem, const UINT8* frameBuffer, UINT16 frameWidth, UINT16 frameHeight)
+{
+	if (!m_recording || (mem == nullptr))
+		return;
+	if (m_framesCaptured + m_framesDropped > 0)
+	{
+		if (seq == m_lastSeq)
+			return;
+		m_frameNumber += static_cast<UINT16>(seq - m_lastSeq);	// the sequence wraps around
+	}
+	m_lastSeq = seq;
+
+	CaptureBuffer* c;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_free.empty())
+		{
+			m_framesDropped++;
+			return;
+		}
+		c = m_free.front();
+		m_free.pop_front();
+	}
+	memcpy(c->mem.data(), mem, c->mem.size());
+	c->hasFrame = (frameBuffer != nullptr) && (m_frameSize > 0)
+		&& (frameWidth == m_header.frameWidth) && (frameHeight == m_header.frameHeight);
+	if (c->hasFrame)
+		memcpy(c->frame.data(), frameBuffer, m_frameSize);
+	c->frameNumber = m_frameNumber;
+	c->seq = seq;
+	c->timeMs = static_cast<UINT32>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - m_startTime).count());
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.push_back(c);
+	}
+	m_framesCaptured++;
+	m_cv.notify_one();
+}
+
+void SessionRecorder::WriterThread()
+{
+	Tracer::SetThreadName("Session recorder");
+	while (true)
+	{
+		CaptureBuffer* c;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this] { return m_stopping || !m_pending.empty(); });
+			if (m_pending.empty())
+				return;
+			c = m_pending.front();
+			m_pending.pop_front();
+		}
+		{
+			TraceScope trace("Write session frame");
+			WriteCapture(*c);
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_free.push_back(c);
+		}
+	}
+}
+
+void SessionRecorder::WriteCapture(CaptureBuffer& c)
+{
+	bool isKey = ((m_framesWritten % SESSION_KEYFRAME_INTERVAL) == 0);
+	m_encoded.clear();
+	SessionCodec::EncodeDelta(c.mem.data(), isKey ? m_zeros.data() : m_prevMem.data(), c.mem.size(), m_encoded);
+	WriteChunk(c, isKey ? SessionChunkType::MemoryKey : SessionChunkType::MemoryDelta);
+	m_prevMem.swap(c.mem);		// the capture buffer is overwritten by the next capture anyway
+
+	if (isKey)
+		m_frameKeyPending = true;	// keep the video seekable at the same frames as the memory
+	if (c.hasFrame)
+	{
+		m_encoded.clear();
+		SessionCodec::EncodeDelta(c.frame.data(), m_frameKeyPending ? m_blackFrame.data() : m_prevFrame.data(),
+			c.frame.size(), m_encoded);
+		WriteChunk(c, m_frameKeyPending ? SessionChunkType::FrameKey : SessionChunkType::FrameDelta);
+		m_prevFrame.swap(c.frame);
+		m_frameKeyPending = false;
+	}
+	m_framesWritten++;
+}
+
+void SessionRecorder::WriteChunk(const CaptureBuffer& c, SessionChunkType type)
+{
+	SessionChunkHeader ch = {};
+	ch.frame = c.frameNumber;
+	ch.timeMs = c.timeMs;
+	ch.size = static_cast<UINT32>(m_encoded.size());
+	ch.seq = c.seq;
+	ch.type = type;
+
+	SessionIndexEntry ie = {};
+	ie.offset = m_fileOffset;
+	ie.frame = c.frameNumber;
+	ie.type = type;
+	m_index.push_back(ie);
+
+	m_file.write(reinterpret_cast<const char*>(&ch), sizeof(ch));
+	m_file.write(reinterpret_cast<const char*>(m_encoded.data()), m_encoded.size());
+	m_fileOffset += sizeof(ch) + m_encoded.size();
+	m_bytesWritten += sizeof(ch) + m_encoded.size();
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <fstream>
+#include <chrono>
+#include <filesystem>
+
+/// <summary>
+/// SessionRecorder captures the Apple 2 memory, and optionally the video frame, of every
+/// GameLink frame sequence into an append-only session file that can be replayed later.
+///
+/// Capture() is called from the render loop and only copies the memory (and frame) into a buffer
+/// from a small fixed pool, then hands it to the writer thread. If the writer falls behind and no
+/// buffer is free, the frame is dropped and counted: the render loop never waits on the disk.
+///
+/// The writer thread XORs each capture with the previous one so that unchanged bytes become zeros,
+/// and encodes the zero runs (see SessionCodec). Games change a few hundred bytes of memory per frame,
+/// which makes a frame a few hundred bytes on disk. Every SESSION_KEYFRAME_INTERVAL frames the capture
+/// is encoded against zeros instead, so a player can seek without decoding from the start.
+/// Video keyframes are encoded against a black frame (SESSION_FRAME_KEY_PIXEL), as most of the
+/// Apple 2 screen is black and the alpha byte is never 0.
+///
+/// File layout, little-endian:
+///		SessionFileHeader
+///		one chunk per stream per frame: SessionChunkHeader, then the encoded delta
+///		the index of all the chunks (SessionIndexEntry), written when the recording stops
+///		SessionFileFooter
+/// A file without footer (the app was killed) is still valid, the index is rebuilt by walking the chunks.
+/// </summary>
+
+constexpr char SESSION_MAGIC[8] = { 'A', 'W', 'C', 'S', 'E', 'S', 'S', '1' };
+constexpr char SESSION_INDEX_MAGIC[4] = { 'A', 'W', 'C', 'I' };
+constexpr UINT32 SESSION_VERSION = 1;
+constexpr UINT32 SESSION_KEYFRAME_INTERVAL = 300;		// 5 seconds at 60 Hz
+constexpr UINT32 SESSION_BUFFER_COUNT = 8;
+constexpr char SESSION_FILE_EXTENSION[] = ".awcsession";
+constexpr UINT32 SESSION_FRAME_KEY_PIXEL = 0xFF000000;	// opaque black
+
+enum class SessionChunkType : UINT8
+{
+	MemoryKey,
+	MemoryDelta,
+	FrameKey,
+	FrameDelta,
+	Count
+};
+
+struct SessionFileHeader
+{
+	char magic[8];
+	UINT32 version;
+	UINT32 memSize;
+	UINT16 frameWidth;		// 0 when the session has no video
+	UINT16 frameHeight;
+	UINT32 keyframeInterval;
+};
+
+struct SessionChunkHeader
+{
+	UINT32 frame;			// frames since the start of the session, from the GameLink sequence
+	UINT32 timeMs;			// capture time since the start of the session
+	UINT32 size;			// of the encoded payload that follows
+	UINT16 seq;				// GameLink frame sequence
+	SessionChunkType type;
+	UINT8 reserved;
+};
+
+struct SessionIndexEntry
+{
+	UINT64 offset;			// of the SessionChunkHeader
+	UINT32 frame;
+	SessionChunkType type;
+	UINT8 reserved[3];
+};
+
+struct SessionFileFooter
+{
+	UINT64 indexOffset;
+	UINT32 indexCount;
+	char magic[4];
+};
+
+static_assert(sizeof(SessionFileHeader) == 24, "session file header must not be padded");
+static_assert(sizeof(SessionChunkHeader) == 16, "session chunk header must not be padded");
+static_assert(sizeof(SessionIndexEntry) == 16, "session index entry must not be padded");
+static_assert(sizeof(SessionFileFooter) == 16, "session file footer must not be padded");
+
+// Delta encoding of a buffer against its previous version:
+// a sequence of [unchanged byte count][changed byte count][XOR of the changed bytes],
+// with the counts as LEB128 varints. Trailing unchanged bytes are implicit.
+// Short unchanged runs (less than 4 bytes) are kept inside the changed bytes.
+namespace SessionCodec
+{
+	// Appends the encoding of cur against prev to out
+	void EncodeDelta(const UINT8* cur, const UINT8* prev, size_t size, std::vector<UINT8>& out);
+	// XORs an encoded delta into buf. Returns false if the delta is malformed or overflows buf.
+	bool ApplyDelta(const UINT8* in, size_t inSize, UINT8* buf, size_t size);
+}
+
+struct SessionRecorderStats
+{
+	UINT32 framesCaptured = 0;
+	UINT32 framesDropped = 0;		// no free buffer when they came in
+	UINT64 bytesWritten = 0;
+	UINT32 seconds = 0;
+};
+
+class SessionRecorder
+{
+public:
+	SessionRecorder();
+	~SessionRecorder();
+
+	// frameWidth and frameHeight are 0 to only record the memory
+	bool Start(const std::filesystem::path& path, UINT32 memSize, UINT16 frameWidth, UINT16 frameHeight);
+	void Stop();
+	bool IsRecording() const { return m_recording; }
+
+	// Copies the memory and frame for the writer thread. Calls with an already captured seq are ignored.
+	// The frame is not recorded for this sequence if frameBuffer is null or its size isn't the session's.
+	void Capture(UINT16 seq, const UINT8* mem, const UINT8* frameBuffer, UINT16 frameWidth, UINT16 frameHeight);
+
+	SessionRecorderStats GetStats() const;
+
+private:
+	struct CaptureBuffer
+	{
+		std::vector<UINT8> mem;
+		std::vector<UINT8> frame;
+		bool hasFrame = false;
+		UINT32 frameNumber = 0;
+		UINT32 timeMs = 0;
+		UINT16 seq = 0;
+	};
+
+	void WriterThread();
+	void WriteCapture(CaptureBuffer& c);
+	void WriteChunk(const CaptureBuffer& c, SessionChunkType type);
+
+	bool m_recording;
+	SessionFileHeader m_header;
+	UINT32 m_frameSize;
+	UINT16 m_lastSeq;
+	UINT32 m_frameNumber;
+	std::chrono::steady_clock::time_point m_startTime;
+
+	// Buffers, owned by m_pool and moving between the free and pending queues
+	std::vector<std::unique_ptr<CaptureBuffer>> m_pool;
+	std::deque<CaptureBuffer*> m_free;
+	std::deque<CaptureBuffer*> m_pending;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stopping;
+	std::thread m_writer;
+
+	// Writer thread state
+	std::ofstream m_file;
+	std::vector<char> m_fileBuffer;
+	UINT64 m_fileOffset;
+	std::vector<SessionIndexEntry> m_index;
+	std::vector<UINT8> m_prevMem;
+	std::vector<UINT8> m_prevFrame;
+	std::vector<UINT8> m_zeros;
+	std::vector<UINT8> m_blackFrame;
+	std::vector<UINT8> m_encoded;
+	UINT32 m_framesWritten;
+	bool m_frameKeyPending;		// the next frame must be a keyframe
+
+	std::atomic<UINT32> m_framesCaptured;
+	std::atomic<UINT32> m_framesDropped;
+	std::atomic<UINT64> m_bytesWritten;
+};
@@ -0,0 +1,410 @@
+#include "pch.h"
+#include "SharedValues.h"
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+static UINT32 MappingSize()
+{
+	return static_cast<UINT32>(sizeof(SharedValuesHeader) + SHAREDVALUES_MAX_VALUES * sizeof(SharedValueEntry)
+		+ SHAREDVALUES_ARENA_SIZE);
+}
+
+SharedValues::SharedValues()
+{
+	m_mapping = NULL;
+	m_header = nullptr;
+	m_entries = nullptr;
+	m_arena = nullptr;
+	m_valuesArenaStart = 0;
+	m_profile = nullptr;
+	m_stringChanged = false;
+	m_started = false;
+	m_seq = 0;
+}
+
+SharedValues::~SharedValues()
+{
+	Close();
+}
+
+bool SharedValues::Create(const char* name, std::string& error)
+{
+	if (m_header != nullptr)
+		return true;
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, MappingSize(), name);
+	if ((m_mapping == NULL) || (GetLastError() == ERROR_ALREADY_EXISTS))
+	{
+		error = "couldn't create the shared memory. Is another companion running?";
+		Close();
+		return false;
+	}
+	m_header = reinterpret_cast<SharedValuesHeader*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if (m_header == nullptr)
+	{
+		error = "couldn't map the shared memory";
+		Close();
+		return false;
+	}
+	// The view of a new mapping is zeroed
+	memcpy(m_header->magic, SHAREDVALUES_MAGIC, sizeof(m_header->magic));
+	m_header->version = SHAREDVALUES_VERSION;
+	m_header->size = MappingSize();
+	m_header->entriesOffset = sizeof(SharedValuesHeader);
+	m_header->maxValues = SHAREDVALUES_MAX_VALUES;
+	m_header->arenaOffset = m_header->entriesOffset + SHAREDVALUES_MAX_VALUES * sizeof(SharedValueEntry);
+	m_header->arenaSize = SHAREDVALUES_ARENA_SIZE;
+	m_entries = reinterpret_cast<SharedValueEntry*>(reinterpret_cast<UINT8*>(m_header) + m_header->entriesOffset);
+	m_arena = reinterpret_cast<char*>(m_header) + m_header->arenaOffset;
+	WriteSchema("", {});
+	return true;
+}
+
+void SharedValues::Close()
+{
+	if (m_header)
+		UnmapViewOfFile(m_header);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	m_header = nullptr;
+	m_entries = nullptr;
+	m_arena = nullptr;
+	m_mapping = NULL;
+}
+
+void SharedValues::Load(const CompiledProfile* profile)
+{
+	m_profile = ((profile != nullptr) && !profile->published.empty()) ? profile : nullptr;
+	m_started = false;
+	// The mapping is created the first time a profile publishes values, and stays afterwards
+	if ((m_header == nullptr) && (m_profile != nullptr))
+	{
+		std::string error;
+		if (!Create(SHAREDVALUES_MMAP_NAME, error))
+		{
+			char buf[500];
+			snprintf(buf, 500, "Shared values: %s\n", error.c_str());
+			OutputDebugStringA(buf);
+		}
+	}
+	if (m_header == nullptr)
+		return;
+	std::vector<std::string> names;
+	if (m_profile != nullptr)
+	{
+		for (auto& value : m_profile->published)
+			names.push_back(value.name);
+	}
+	WriteSchema((m_profile != nullptr) ? m_profile->name : "", names);
+}
+
+void SharedValues::Update(UINT16 seq, const UINT8* mem, int memsize)
+{
+	if ((m_header == nullptr) || (m_profile == nullptr) || (mem == nullptr))
+		return;
+	if (m_started && (seq == m_seq))
+		return;
+	bool first = !m_started;
+	m_started = true;
+	m_seq = seq;
+
+	std::string s;
+	for (size_t i = 0; i < m_types.size(); i++)
+	{
+		const CompiledPublished& value = m_profile->published[i];
+		SharedValueType type = SharedValueType::Invalid;
+		INT32 n = 0;
+		if (value.isString)
+		{
+			if (m_profile->EvaluatePublished(value, mem, memsize, s))
+				type = SharedValueType::String;
+			if ((type == SharedValueType::String) && (first || (m_types[i] != type) || (s != m_strings[i])))
+			{
+				m_strings[i] = s;
+				m_stringChanged = true;
+				m_changed[i] = 1;
+			}
+		}
+		else if (m_profile->EvaluatePublished(value, mem, memsize, n))
+			type = SharedValueType::Int;
+		if (first || (type != m_types[i]) || (n != m_ints[i]))
+			m_changed[i] = 1;
+		m_types[i] = type;
+		m_ints[i] = n;
+	}
+	WriteValues(seq);
+}
+
+void SharedValues::WriteSchema(const std::string& profileName, const std::vector<std::string>& names)
+{
+	size_t count = std::min<size_t>(names.size(), SHAREDVALUES_MAX_VALUES);
+	if (count < names.size())
+		OutputDebugStringA("Shared values: too many values, the last ones aren't shared\n");
+	m_types.assign(count, SharedValueType::Invalid);
+	m_ints.assign(count, 0);
+	m_strings.assign(count, std::string());
+	m_changed.assign(count, 0);
+	m_stringChanged = false;
+
+	InterlockedIncrement(&m_header->seq);
+	UINT32 used = 0;
+	UINT32 length;
+	m_header->profileNameOffset = AppendString(profileName, used, length);
+	for (size_t i = 0; i < count; i++)
+	{
+		SharedValueEntry& e = m_entries[i];
+		e.nameOffset = AppendString(names[i], used, length);
+		e.nameLength = static_cast<UINT16>(length);
+		e.type = SharedValueType::Invalid;
+		e.intValue = 0;
+		e.stringOffset = 0;
+		e.stringLength = 0;
+		e.changed = 0;
+	}
+	m_valuesArenaStart = used;
+	m_header->arenaUsed = used;
+	m_header->valueCount = static_cast<UINT32>(count);
+	m_header->schema++;
+	m_header->updates = 0;
+	InterlockedIncrement(&m_header->seq);
+}
+
+void SharedValues::WriteValues(UINT32 frameSeq)
+{
+	bool any = (std::find(m_changed.begin(), m_changed.end(), 1) != m_changed.end());
+	InterlockedIncrement(&m_header->seq);
+	if (any)
+		m_header->updates++;
+	// The string values are packed after the names, so they are all written again when one changes
+	if (m_stringChanged)
+	{
+		UINT32 used = m_valuesArenaStart;
+		for (size_t i = 0; i < m_types.size(); i++)
+		{
+			if (m_types[i] == SharedValueType::String)
+				m_entries[i].stringOffset = AppendString(m_strings[i], used, m_entries[i].stringLength);
+		}
+		m_header->arenaUsed = used;
+		m_stringChanged = false;
+	}
+	for (size_t i = 0; i < m_types.size(); i++)
+	{
+		if (!m_changed[i])
+			continue;
+		m_changed[i] = 0;
+		SharedValueEntry& e = m_entries[i];
+		e.type = m_types[i];
+		e.intValue = m_ints[i];
+		if (e.type != SharedValueType::String)
+		{
+			e.stringOffset = 0;
+			e.stringLength = 0;
+		}
+		e.changed = m_header->updates;
+	}
+	m_header->frameSeq = frameSeq;
+	InterlockedIncrement(&m_header->seq);
+}
+
+// Strings that don't fit in the arena are truncated
+UINT32 SharedValues::AppendString(const std::string& s, UINT32& used, UINT32& length)
+{
+	UINT32 room = SHAREDVALUES_ARENA_SIZE - used;
+	if (room == 0)
+	{
+		length = 0;
+		return m_header->arenaOffset + SHAREDVALUES_ARENA_SIZE - 1;
+	}
+	length = static_cast<UINT32>(std::min<size_t>(s.size(), room - 1));
+	UINT32 offset = m_header->arenaOffset + used;
+	memcpy(m_arena + used, s.data(), length);
+	m_arena[used + length] = '\0';
+	used += length + 1;
+	return offset;
+}
+
+SharedValuesBenchmarkResult SharedValues::RunBenchmark(UINT32 values, UINT32 milliseconds)
+{
+	SharedValuesBenchmarkResult res;
+	SharedValues writer;
+	std::string error;
+	if (!writer.Create(nullptr, error))
+		return res;
+	std::vector<std::string> names;
+	for (UINT32 i = 0; i < values; i++)
+		names.push_back("value" + std::to_string(i));
+	writer.WriteSchema("Benchmark", names);
+	res.values = static_cast<UINT32>(writer.m_types.size());
+
+	std::atomic<bool> stop = false;
+	UINT64 reads = 0;
+	UINT64 retries = 0;
+	std::thread reader([&]
+		{
+			SharedValuesReader r;
+			r.Attach(writer.GetBase());
+			SharedValuesSnapshot snapshot;
+			UINT32 n;
+			while (!stop)
+			{
+				if (r.Read(snapshot, 1000, &n))
+					reads++;
+				retries += n;
+			}
+		});
+
+	// One value in four is a string, and they all change every frame
+	auto tStart = std::chrono::steady_clock::now();
+	auto tEnd = tStart + std::chrono::milliseconds(milliseconds);
+	UINT32 frame = 0;
+	while (std::chrono::steady_clock::now() < tEnd)
+	{
+		for (UINT32 k = 0; k < 64; k++, frame++)
+		{
+			for (size_t i = 0; i < writer.m_types.size(); i++)
+			{
+				if ((i & 3) == 3)
+				{
+					writer.m_types[i] = SharedValueType::String;
+					writer.m_strings[i] = "Value " + std::to_string(frame + i);
+					writer.m_stringChanged = true;
+				}
+				else
+				{
+					writer.m_types[i] = SharedValueType::Int;
+					writer.m_ints[i] = static_cast<INT32>(frame + i);
+				}
+				writer.m_changed[i] = 1;
+			}
+			writer.WriteValues(frame);
+		}
+	}
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	stop = true;
+	reader.join();
+
+	res.writes = frame;
+	res.reads = reads;
+	res.retries = retries;
+	res.nsPerWrite = res.seconds * 1e9 / std::max<UINT64>(res.writes, 1);
+	res.nsPerRead = res.seconds * 1e9 / std::max<UINT64>(res.reads, 1);
+	return res;
+}
+
+#pragma region SharedValuesReader
+
+SharedValuesReader::SharedValuesReader()
+{
+	m_mapping = NULL;
+	m_header = nullptr;
+}
+
+SharedValuesReader::~SharedValuesReader()
+{
+	Close();
+}
+
+bool SharedValuesReader::Open(std::string& error)
+{
+	Close();
+	m_mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, SHAREDVALUES_MMAP_NAME);
+	if (m_mapping == NULL)
+	{
+		error = "the companion isn't publishing values";
+		return false;
+	}
+	m_header = reinterpret_cast<const SharedValuesHeader*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if ((m_header == nullptr) || (memcmp(m_header->magic, SHAREDVALUES_MAGIC, sizeof(SHAREDVALUES_MAGIC)) != 0)
+		|| (m_header->version != SHAREDVALUES_VERSION))
+	{
+		error = "unknown shared memory layout";
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void SharedValuesReader::Attach(const void* base)
+{
+	Close();
+	m_header = reinterpret_cast<const SharedValuesHeader*>(base);
+}
+
+void SharedValuesReader::Close()
+{
+	if (m_mapping)
+	{
+		if (m_header)
+			UnmapViewOfFile(m_header);
+		CloseHandle(m_mapping);
+	}
+	m_mapping = NULL;
+	m_header = nullptr;
+}
+
+bool SharedValuesReader::Read(SharedValuesSnapshot& snapshot, UINT32 maxRetries, UINT32* retries)
+{
+	if (retries)
+		*retries = 0;
+	if (m_header == nullptr)
+		return false;
+	const UINT8* base = reinterpret_cast<const UINT8*>(m_header);
+	// The layout never changes, only the seqlocked fields
+	UINT32 entriesOffset = m_header->entriesOffset;
+	UINT32 arenaOffset = m_header->arenaOffset;
+	UINT32 maxValues = m_header->maxValues;
+	UINT32 arenaSize = m_header->arenaSize;
+	SharedValuesHeader h;
+	for (UINT32 attempt = 0; attempt <= maxRetries; attempt++)
+	{
+		if (retries)
+			*retries = attempt;
+		LONG seq = m_header->seq;
+		if (seq & 1)
+		{
+			YieldProcessor();
+			continue;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		memcpy(&h, m_header, sizeof(h));
+		UINT32 count = std::min(h.valueCount, maxValues);
+		UINT32 arenaUsed = std::min(h.arenaUsed, arenaSize);
+		size_t entriesBytes = count * sizeof(SharedValueEntry);
+		m_copy.resize(entriesBytes + arenaUsed + 1);
+		memcpy(m_copy.data(), base + entriesOffset, entriesBytes);
+		memcpy(m_copy.data() + entriesBytes, base + arenaOffset, arenaUsed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_header->seq != seq)
+			continue;
+
+		// Consistent copy, decode it. Offsets outside of the used arena read as empty strings.
+		m_copy.back() = '\0';
+		const SharedValueEntry* entries = reinterpret_cast<const SharedValueEntry*>(m_copy.data());
+		const char* arena = reinterpret_cast<const char*>(m_copy.data() + entriesBytes);
+		auto str = [&](UINT32 offset, UINT32 length)
+		{
+			if ((offset < arenaOffset) || (offset - arenaOffset + static_cast<UINT64>(length) > arenaUsed))
+				return std::string();
+			return std::string(arena + (offset - arenaOffset), length);
+		};
+		snapshot.schema = h.schema;
+		snapshot.frameSeq = h.frameSeq;
+		snapshot.updates = h.updates;
+		snapshot.profileName = ((h.profileNameOffset >= arenaOffset) && (h.profileNameOffset - arenaOffset < arenaUsed))
+			? std::string(arena + (h.profileNameOffset - arenaOffset)) : std::string();
+		snapshot.values.resize(count);
+		for (UINT32 i = 0; i < count; i++)
+		{
+			SharedValue& v = snapshot.values[i];
+			v.name = str(entries[i].nameOffset, entries[i].nameLength);
+			v.type = entries[i].type;
+			v.intValue = entries[i].intValue;
+			v.stringValue = (v.type == SharedValueType::String) ? str(entries[i].stringOffset, entries[i].stringLength) : "";
+			v.changed = entries[i].changed;
+		}
+		return true;
+	}
+	return false;
+}
+
+#pragma endregion
@@ -0,0 +1,163 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "CompiledProfile.h"
+
+/// <summary>
+/// SharedValues republishes the published values of the profile into a named shared memory,
+/// so that programs on the same machine (OBS plugins, trackers) read them without any system call.
+///
+/// The mapping starts with a SharedValuesHeader, followed by a table of SharedValueEntry and
+/// a string arena. The arena holds the profile name, then the value names, then the string values.
+/// Numbers are stored in the entries. Every offset in the header and the entries is from the start
+/// of the mapping, and the strings in the arena are null terminated.
+///
+/// The header and the table are protected by a seqlock: the companion increments seq before and
+/// after writing, so seq is odd while a write is in progress. A reader copies what it needs between
+/// two reads of seq, and tries again if they differ or are odd. Readers never block the companion,
+/// and can poll at any rate. schema changes when the names change, with the profile.
+///
+/// The companion writes once per GameLink frame, and only touches the entries that changed.
+/// SharedValuesReader is the reference reader, which the CLI uses.
+/// </summary>
+
+constexpr const char* SHAREDVALUES_MMAP_NAME = "AppleWinCompanionValues";
+constexpr char SHAREDVALUES_MAGIC[8] = { 'A', 'W', 'C', 'V', 'A', 'L', 'S', '\0' };
+constexpr UINT32 SHAREDVALUES_VERSION = 1;
+constexpr UINT32 SHAREDVALUES_MAX_VALUES = 256;
+constexpr UINT32 SHAREDVALUES_ARENA_SIZE = 64 * 1024;
+
+enum class SharedValueType : UINT8
+{
+	Invalid,		// couldn't be read this frame
+	Int,
+	String,
+};
+
+#pragma pack(push, 4)
+struct SharedValuesHeader
+{
+	char magic[8];				// SHAREDVALUES_MAGIC
+	UINT32 version;				// SHAREDVALUES_VERSION
+	UINT32 size;				// of the whole mapping
+	UINT32 entriesOffset;
+	UINT32 maxValues;
+	UINT32 arenaOffset;
+	UINT32 arenaSize;
+	volatile LONG seq;			// seqlock, odd while the companion writes
+	UINT32 schema;				// changes with the names
+	UINT32 valueCount;
+	UINT32 frameSeq;			// GameLink frame sequence of the values
+	UINT32 updates;				// frames where a value changed
+	UINT32 profileNameOffset;
+	UINT32 arenaUsed;			// bytes of the arena in use, from arenaOffset
+	UINT32 reserved[3];
+};
+
+struct SharedValueEntry
+{
+	UINT32 nameOffset;
+	UINT16 nameLength;
+	SharedValueType type;
+	UINT8 reserved;
+	INT32 intValue;
+	UINT32 stringOffset;		// string values
+	UINT32 stringLength;
+	UINT32 changed;				// updates when the value last changed
+};
+#pragma pack(pop)
+
+struct SharedValue
+{
+	std::string name;
+	SharedValueType type = SharedValueType::Invalid;
+	INT32 intValue = 0;
+	std::string stringValue;
+	UINT32 changed = 0;
+};
+
+struct SharedValuesSnapshot
+{
+	UINT32 schema = 0;
+	UINT32 frameSeq = 0;
+	UINT32 updates = 0;
+	std::string profileName;
+	std::vector<SharedValue> values;
+};
+
+struct SharedValuesBenchmarkResult
+{
+	UINT32 values = 0;
+	double seconds = 0.;
+	UINT64 writes = 0;
+	UINT64 reads = 0;
+	UINT64 retries = 0;			// reads that overlapped a write and started over
+	double nsPerWrite = 0.;
+	double nsPerRead = 0.;
+};
+
+class SharedValues
+{
+public:
+	SharedValues();
+	~SharedValues();
+
+	// Creates the mapping if needed. name can be null for a private mapping (benchmark).
+	bool Create(const char* name, std::string& error);
+	void Close();
+	const void* GetBase() const { return m_header; }
+
+	// Uses the published values of the profile, which must outlive this or the next Load().
+	// Writes the new names, and invalidates the values until the next Update().
+	void Load(const CompiledProfile* profile);
+
+	// Evaluates the values and writes the ones that changed. Calls with the same seq are ignored.
+	// The profile pointers must be resolved for this frame.
+	void Update(UINT16 seq, const UINT8* mem, int memsize);
+
+	// A writer and a reader thread going as fast as they can over a private mapping
+	static SharedValuesBenchmarkResult RunBenchmark(UINT32 values, UINT32 milliseconds);
+
+private:
+	void WriteSchema(const std::string& profileName, const std::vector<std::string>& names);
+	void WriteValues(UINT32 frameSeq);
+	UINT32 AppendString(const std::string& s, UINT32& used, UINT32& length);
+
+	HANDLE m_mapping;
+	SharedValuesHeader* m_header;
+	SharedValueEntry* m_entries;
+	char* m_arena;
+	UINT32 m_valuesArenaStart;	// after the names
+
+	const CompiledProfile* m_profile;
+	std::vector<SharedValueType> m_types;
+	std::vector<INT32> m_ints;
+	std::vector<std::string> m_strings;
+	std::vector<UINT8> m_changed;
+	bool m_stringChanged;
+	bool m_started;
+	UINT16 m_seq;
+};
+
+class SharedValuesReader
+{
+public:
+	SharedValuesReader();
+	~SharedValuesReader();
+
+	// Opens the companion's mapping, which exists once a profile published values
+	bool Open(std::string& error);
+	// Reads a mapping in this process instead
+	void Attach(const void* base);
+	void Close();
+	bool IsOpen() const { return m_header != nullptr; }
+
+	// Copies a consistent snapshot of the values. Returns false if the companion
+	// was writing for all the retries. retries, if given, gets the number of retries.
+	bool Read(SharedValuesSnapshot& snapshot, UINT32 maxRetries = 1000, UINT32* retries = nullptr);
+
+private:
+	HANDLE m_mapping;
+	const SharedValuesHeader* m_header;
+	std::vector<UINT8> m_copy;
+};
@@ -13,18 +13,38 @@ Sidebar::Sidebar(UINT8 _id, SidebarTypes _type, int _width, int _height, UINT8 _
 	position.x		= _position.x + SIDEBAR_OUTSIDE_MARGIN;
 	position.y		= _position.y + SIDEBAR_OUTSIDE_MARGIN;
 
-	// Determine each block's origin point. They all flow downwards from the sidebar's origin
-	int blockHeight = ((height - (2 * SIDEBAR_OUTSIDE_MARGIN)) / maxBlocks) - (2 * SIDEBAR_BLOCK_PADDING);
-	float hoffset = position.y + SIDEBAR_OUTSIDE_MARGIN;	// starting height offset
+	blockHeight = ((height - (2 * SIDEBAR_OUTSIDE_MARGIN)) / maxBlocks) - (2 * SIDEBAR_BLOCK_PADDING);
 	for (UINT8 i = 0; i < maxBlocks; i++)
 	{
 		auto b = std::make_shared <BlockStruct>();
 		b->position.x = position.x + SIDEBAR_BLOCK_PADDING;
+		blocks.push_back(b);
+		m_visibleMask.set(i);
+	}
+	Layout();
+}
+
+// Determine each visible block's origin point. They all flow downwards from the sidebar's origin
+void Sidebar::Layout()
+{
+	float hoffset = position.y + SIDEBAR_OUTSIDE_MARGIN;	// starting height offset
+	for (UINT8 i = 0; i < maxBlocks; i++)
+	{
+		if (!m_visibleMask.test(i))
+			continue;
 		hoffset += SIDEBAR_BLOCK_PADDING;
-		b->position.y = hoffset;
+		blocks[i]->position.y = hoffset;
 		hoffset += blockHeight + SIDEBAR_BLOCK_PADDING;
-		blocks.push_back(b);
 	}
+	m_layoutMask = m_visibleMask;
+}
+
+bool Sidebar::UpdateLayout()
+{
+	if (m_layoutMask == m_visibleMask)
+		return false;
+	Layout();
+	return true;
 }
 
 void Sidebar::Clear()
@@ -44,6 +64,9 @@ SidebarError Sidebar::SetBlock(BlockStruct bS, UINT8 _id)
 		b->color = bS.color;
 		b->fontId = bS.fontId;
 		b->text = bS.text;
+		b->visible = bS.visible;
+		b->historyId = bS.historyId;
+		m_visibleMask.set(_id, bS.visible);
 	}
 	catch (std::out_of_range const& exc)
 	{
@@ -73,3 +96,17 @@ SidebarError Sidebar::SetBlockText(std::string str, UINT8 _id)
 
 	return SidebarError::ERR_NONE;
 }
+
+SidebarError Sidebar::SetBlockVisible(bool visible, UINT8 _id)
+{
+	if (_id >= blocks.size())
+	{
+		char buf[300];
+		sprintf_s(buf, "Block %d doesn't exist\n", _id);
+		OutputDebugStringA(buf);
+		return SidebarError::ERR_OUT_OF_RANGE;
+	}
+	blocks[_id]->visible = visible;
+	m_visibleMask.set(_id, visible);
+	return SidebarError::ERR_NONE;
+}
@@ -3,6 +3,7 @@
 #include <DirectXMath.h>
 #include <DirectXColors.h>
 #include <vector>
+#include <bitset>
 
 #pragma warning( disable:4324 )
 // C4324: structure was padded due to alignment specifier
@@ -24,6 +25,9 @@ enum class BlockType
 	Header,
 	Content,
 	Empty,
+	Graph,		// text followed by a sparkline of a var's history
+	Timer,		// text followed by the split timer
+	Achievements,	// text followed by the achievements unlocked and the last one
 	Count
 };
 
@@ -33,6 +37,8 @@ enum class BlockType
 /// It is given an origin point, and calculates each block's origin point, and manages the textual
 /// data of each block. A block height is the sidebar height / number of blocks.
 /// The sidebar is assigned width, height and number of blocks by the Sidebar Manager.
+/// Hidden blocks are neither drawn nor take space: the visible blocks flow up to fill the gap.
+/// The layout is only recomputed when a block's visibility changed.
 /// </summary>
 
 enum class FontDescriptors
@@ -54,6 +60,8 @@ struct BlockStruct
 	DirectX::XMVECTOR color = DirectX::Colors::GhostWhite;
 	FontDescriptors fontId = FontDescriptors::A2FontRegular;
 	std::string text = "";
+	bool visible = true;
+	UINT16 historyId = UINT16_MAX;	// Graph blocks: the var history to draw, see CompiledProfile
 };
 
 enum class SidebarTypes
@@ -71,6 +79,7 @@ public:
 	int width;
 	int height;
 	UINT8 maxBlocks;
+	int blockHeight;
 	DirectX::XMFLOAT2 position;
 	std::vector< std::shared_ptr<BlockStruct> > blocks;
 
@@ -82,5 +91,18 @@ public:
 	SidebarError SetBlock(BlockStruct bS, UINT8 id);
 
 	SidebarError SetBlockText(std::string str, UINT8 id);
+
+	// The other blocks reflow on the next UpdateLayout()
+	SidebarError SetBlockVisible(bool visible, UINT8 id);
+
+	// Recalculates the block positions if any visibility changed since the last layout.
+	// Returns true if the blocks moved.
+	bool UpdateLayout();
+
+private:
+	void Layout();
+
+	std::bitset<SIDEBAR_MAX_BLOCKS> m_visibleMask;
+	std::bitset<SIDEBAR_MAX_BLOCKS> m_layoutMask;	// visibility at the last layout
 };
 
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "SidebarContent.h"
 #include "GameLink.h"
+#include "Metrics.h"
 #include <shobjidl.h> 
 #include <DirectXPackedVector.h>
 #include <DirectXMath.h>
@@ -12,8 +13,6 @@ using namespace DirectX::PackedVector;
 using namespace std;
 namespace fs = std::filesystem;
 
-static string SIDEBAR_FORMAT_PLACEHOLDER("{}");
-
 static UINT8* pmem;
 static int memsize;
 
@@ -67,71 +66,56 @@ bool SidebarContent::setActiveProfile(SidebarManager* sbM, std::string* name)
     //OutputDebugStringA(j["sidebars"].dump().c_str());
 
     sbM->DeleteAllSidebars();
-    string title = "";
-    UINT8 numSidebars = (UINT8)m_activeProfile["sidebars"].size();
-    for (UINT8 i = 0; i < numSidebars; i++)
+    // The trigger worker uses the compiled profile
+    m_triggers.Clear();
+    m_splitTimer.Clear();
+    m_valueServer.Load(nullptr);
+    m_sharedValues.Load(nullptr);
+    std::string error;
+    bool compiled = m_compiledProfile.Compile(m_activeProfile, error);
+    if (!error.empty())
     {
-        nlohmann::json sj = m_activeProfile["sidebars"][i];
-        UINT8 numBlocks = static_cast<UINT8>(sj["blocks"].size());
-        if (numBlocks == 0)
-        {
-            continue;
-        }
+        OutputDebugStringA(("Error compiling profile " + *name + ":\n" + error).c_str());
+    }
+    if (!compiled)
+    {
+        char buf[500];
+        snprintf(buf, 500, "Profile %s couldn't be compiled\n", name->c_str());
+        OutputDebugStringA(buf);
+        return false;
+    }
+    if (!m_achievements.Compile(m_activeProfile, error))
+    {
+        char buf[500];
+        snprintf(buf, 500, "Profile %s achievements couldn't be compiled: %s\n", name->c_str(), error.c_str());
+        OutputDebugStringA(buf);
+        m_compiledProfile.Clear();
+        return false;
+    }
 
-        SidebarTypes st = SidebarTypes::Right;  // default
-        UINT16 sSize = 0;
-        if (sj["type"] == "Bottom")
-        {
-            st = SidebarTypes::Bottom;
-        }
-        switch (st)
+    for (auto& cs : m_compiledProfile.sidebars)
+    {
+        UINT8 sbId;
+        if (sbM->CreateSidebar(cs.type, cs.blockCount, cs.size, &sbId) != SidebarError::ERR_NONE)
         {
-        case SidebarTypes::Right:
-            if (sj.contains("width"))
-                sSize = sj["width"];
-            break;
-        case SidebarTypes::Bottom:
-            if (sj.contains("height"))
-                sSize = sj["height"];
-            break;
-        default:
             break;
         }
-        UINT8 sbId;
-        sbM->CreateSidebar(st, numBlocks, sSize, &sbId);
-        for (UINT8 k = 0; k < numBlocks; k++)
+        for (UINT8 k = 0; k < cs.blockCount; k++)
         {
-            nlohmann::json bj = sj["blocks"][k];
-            // OutputDebugStringA((bj.dump() + string("\n")).c_str());
+            const CompiledBlock& cb = m_compiledProfile.blocks[cs.firstBlock + k];
             BlockStruct bS;
-
-            if (bj["type"] == "Header")
-            {
-                bS.color = Colors::CadetBlue;
-                bS.type = BlockType::Header;
-                bS.fontId = FontDescriptors::A2FontBold;
-            }
-            else if (bj["type"] == "Empty")
-            {
-                bS.color = Colors::Black;
-                bS.type = BlockType::Empty;
-                bS.fontId = FontDescriptors::A2FontRegular;
-            }
-            else // default to "Content"
-            {
-                bS.color = Colors::GhostWhite;
-                bS.type = BlockType::Content;
-                bS.fontId = FontDescriptors::A2FontRegular;
-            }
-            // overrides
-            if (bj.contains("color"))
-            {
-                bS.color = XMVectorSet(bj["color"][0], bj["color"][1], bj["color"][2], bj["color"][3]);
-            }
+            bS.type = cb.type;
+            bS.fontId = cb.fontId;
+            bS.color = XMLoadFloat4(&cb.color);
             bS.text = "";
+            bS.historyId = cb.historyId;
             sbM->sidebars[sbId].SetBlock(bS, k);
         }
     }
+    m_triggers.Load(&m_compiledProfile);
+    m_splitTimer.Load(&m_compiledProfile);
+    m_valueServer.Load(&m_compiledProfile);
+    m_sharedValues.Load(&m_compiledProfile);
     return true;
 }
 
@@ -210,6 +194,12 @@ std::string SidebarContent::OpenProfile(std::filesystem::directory_entry entry)
 void SidebarContent::ClearActiveProfile(SidebarManager* sbM)
 {
     m_activeProfile.clear();
+    m_triggers.Clear();
+    m_achievements.Clear();
+    m_splitTimer.Clear();
+    m_valueServer.Load(nullptr);
+    m_sharedValues.Load(nullptr);
+    m_compiledProfile.Clear();
     sbM->DeleteAllSidebars();
 }
 
@@ -230,237 +220,84 @@ nlohmann::json SidebarContent::ParseProfile(fs::path filepath)
     }
 }
 
-// Turn a variable into a string
-// using the following json format:
-/*
-    {
-        "memstart": "0x1165A",
-        "length" : 16,
-        "type" : "ascii_high"
-    }
-*/
-
-std::string SidebarContent::SerializeVariable(nlohmann::json* pvar)
+void SidebarContent::UpdateAllSidebarText(SidebarManager* sbM)
 {
-    if (pmem == NULL)
-        return "";
-
-    nlohmann::json j = *pvar;
-    // initialize variables
-    // OutputDebugStringA((j.dump()+string("\n")).c_str());
-    string s = "";
-    if (j.count("length") != 1)
-        return s;
-    int length = j["length"];
-
-    if (j.count("memstart") != 1)
-        return s;
-    int memoffset = std::stoul(j["memstart"].get<std::string>(), nullptr, 0);
-
-    if (j.count("type") != 1)
-        return s;
-
-    if ((length == 0) || (length > memsize))
-    {
-        return s;
-    }
-
-
-    // now we have the memory offset and length, and we need to parse
-    if (j["type"] == "ascii")
-    {
-        for (size_t i = 0; i < length; i++)
-        {
-            if (*(pmem + memoffset + i) == '\0')
-                return s;
-            s.append(1, (*(pmem + memoffset + i)));
-        }
-        return s;
-    }
-    else if (j["type"] == "ascii_high")
-    {
-        // ASCII-high is basically ASCII shifted by 0x80
-        for (size_t i = 0; i < length; i++)
-        {
-            if (*(pmem + memoffset + i) == '\0')
-                return s;
-            s.append(1, (*(pmem + memoffset + i) - 0x80));
-        }
-        return s;
-    }
-    else if (j["type"] == "int_bigendian")
+    // GameLink may have come up (or gone away) since the last update
+    if (GameLink::IsActive())
     {
-        int x = 0;
-        for (int i = 0; i < length; i++)
-        {
-            x += (*(pmem + memoffset + i)) * (int)pow(0x100, i);
-        }
-        s = to_string(x);
-        return s;
-    }
-    else if (j["type"] == "int_littleendian")
-    {
-        int x = 0;
-        for (int i = 0; i < length; i++)
-        {
-            x += (*(pmem + memoffset + i)) * (int)pow(0x100, (length - i - 1));
-        }
-        s = to_string(x);
-        return s;
+        pmem = GameLink::GetMemoryBasePointer();
+        memsize = GameLink::GetMemorySize();
     }
-    else if (j["type"] == "int_bigendian_literal")
+    else
     {
-        s = "";
-        char cbuf[3];
-        for (int i = 0; i < length; i++)
-        {
-            snprintf(cbuf, 3, "%.2x", *(pmem + memoffset + i));
-            s.insert(0, string(cbuf));
-        }
-        return s;
+        pmem = NULL;
+        memsize = 0;
     }
-    else if (j["type"] == "int_littleendian_literal")
+
+    m_compiledProfile.ResolvePointers(pmem, memsize);
+    m_compiledProfile.UpdateTextScreen(pmem, memsize);
+    // The split timer polls every GameLink frame on its own thread, even those the companion doesn't render
+    m_splitTimer.SetSource((pmem != NULL) ? GameLink::GetFrameSequenceAddress() : nullptr, pmem, memsize);
+    if (pmem != NULL)
     {
-        // int literal is like what is used in the Ultima games.
-        // Garriott stored ints as literals inside memory, so for example
-        // a hex 0x4523 is in fact the number 4523
-        s = "";
-        char cbuf[3];
-        for (int i = 0; i < length; i++)
-        {
-            snprintf(cbuf, 3, "%.2x", *(pmem + memoffset + i));
-            s.append(string(cbuf));
-        }
-        return s;
+        m_compiledProfile.UpdateHistories(GameLink::GetFrameSequence(), pmem, memsize);
+        m_triggers.Update(GameLink::GetFrameSequence(), pmem, memsize);
+        m_achievements.Update(GameLink::GetFrameSequence(), pmem, memsize);
+        m_valueServer.Update(GameLink::GetFrameSequence(), pmem, memsize);
+        m_sharedValues.Update(GameLink::GetFrameSequence(), pmem, memsize);
     }
-    else if (j["type"] == "lookup")
+    for (auto& cb : m_compiledProfile.blocks)
     {
-        try
-        {
-            int x = *(pmem + memoffset);
-            char buf[5000];
-            snprintf(buf, 5000, "%s/0x%02x", j["lookup"].get<std::string>().c_str(), x);
-            nlohmann::json::json_pointer jp(buf);
-            return m_activeProfile.value(jp, "-");  // Default value when unknown lookup is "-"
-        }
-        catch (exception e)
+        if (!UpdateBlock(sbM, cb))
         {
-            std::string es = j.dump().substr(0, 4500);
-            char buf[sizeof(e.what()) + 5000];
-            sprintf_s(buf, "Error parsing lookup: %s\n%s\n", es.c_str(), e.what());
-            OutputDebugStringA(buf);
+            std::cout << "Error updating block: " << (int)cb.blockId << endl;
         }
     }
-    return s;
-}
-
-// This method formats the whole text block using the format string and vars
-// Kind of like sprintf using the following json format:
-/*
-{
-    "type": "Content",
-    "template" : "Left: {} - Right: {}",
-    "vars" : [
-                {
-                    "memstart": "0x1165A",
-                    "length" : 4,
-                    "type" : "ascii_high"
-                },
-                {
-                    "memstart": "0x1165E",
-                    "length" : 4,
-                    "type" : "ascii_high"
-                }
-            ]
-}
-*/
-
-std::string SidebarContent::FormatBlockText(nlohmann::json* pdata)
-{
-// serialize the SHM variables into strings
-// and directly put them in the format string
-    nlohmann::json data = *pdata;
-    string txt = "";
-    if (data.contains("template"))
-    {
-        txt = data["template"].get<string>();
-    }
-    array<string, SIDEBAR_MAX_VARS_IN_BLOCK> sVars;
-    for (size_t i = 0; i < data["vars"].size(); i++)
-    {
-        sVars[i] = SerializeVariable(&(data["vars"][i]));
-        txt.replace(txt.find(SIDEBAR_FORMAT_PLACEHOLDER), SIDEBAR_FORMAT_PLACEHOLDER.length(), sVars[i]);
-    }
-    return txt;
-}
-
-void SidebarContent::UpdateAllSidebarText(SidebarManager* sbM)
-{
-    UINT8 isb = 0;  // sidebar index
-    for (auto sB : m_activeProfile["sidebars"])
+    // Only reflows the sidebars where a block was hidden or shown
+    for (auto& sb : sbM->sidebars)
     {
-        // OutputDebugStringA((sB.dump() + string("\n")).c_str());
-        UINT8 ib = 0;   // block index
-        for (auto& bl : sB["blocks"])
-        {
-            // OutputDebugStringA((bl.dump() + string("\n")).c_str());
-            if (!UpdateBlock(sbM, isb, ib, &bl))
-            {
-                std::cout << "Error updating block: " << ib << endl;
-            }
-            ib++;
-        }
-        isb++;
+        sb.UpdateLayout();
     }
 }
 
 // Update and send for display a block of text
-// using the following json format:
-/*
-{
-    "type": "Content",
-    "template" : "Left: {} - Right: {}",
-    "vars" : [
-                {
-                    "memstart": "0x1165A",
-                    "length" : 4,
-                    "type" : "ascii_high"
-                },
-                {
-                    "memstart": "0x1165E",
-                    "length" : 4,
-                    "type" : "ascii_high"
-                }
-            ]
-}
-*/
+// See CompiledProfile for the json format of blocks and vars
 
-bool SidebarContent::UpdateBlock(SidebarManager* sbM, UINT8 sidebarId, UINT8 blockId, nlohmann::json* pdata)
+bool SidebarContent::UpdateBlock(SidebarManager* sbM, const CompiledBlock& block)
 {
-    nlohmann::json data = *pdata;
-    // OutputDebugStringA((data.dump()+string("\n")).c_str());
-
     try
     {
-        Sidebar sb = sbM->sidebars.at(sidebarId);
-        auto b = sb.blocks.at(blockId);
+        Sidebar& sb = sbM->sidebars.at(block.sidebarId);
+        bool visible = m_compiledProfile.IsBlockVisible(block, pmem, memsize);
+        if (sb.blocks.at(block.blockId)->visible != visible)
+        {
+            sb.SetBlockVisible(visible, block.blockId);
+        }
+        if (!visible)
+        {
+            return true;
+        }
         string s = "";
-        switch (b->type)
+        switch (block.type)
         {
         case BlockType::Empty:
             return true;
             break;
-        case BlockType::Header:
-            s = FormatBlockText(pdata);
+        case BlockType::Timer:
+            s = m_compiledProfile.FormatBlockText(block, pmem, memsize) + m_splitTimer.GetText();
+            break;
+        case BlockType::Achievements:
+            s = m_compiledProfile.FormatBlockText(block, pmem, memsize) + m_achievements.GetText();
             break;
-        default:                    // Content
-            s = FormatBlockText(pdata);
+        default:                    // Header, Content and Graph
+            s = m_compiledProfile.FormatBlockText(block, pmem, memsize);
             break;
         }
 
+        Metrics::Add(MetricCounter::BlocksFormatted);
         // OutputDebugStringA(s.c_str());
         // OutputDebugStringA("\n");
-        if (sb.SetBlockText(s, blockId) == SidebarError::ERR_NONE)
+        if (sb.SetBlockText(s, block.blockId) == SidebarError::ERR_NONE)
         {
             return true;
         }
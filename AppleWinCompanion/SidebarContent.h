@@ -2,10 +2,14 @@
 #include <filesystem>
 #include "SidebarManager.h"
 #include "nlohmann/json.hpp"
+#include "CompiledProfile.h"
+#include "TriggerEngine.h"
+#include "AchievementEngine.h"
+#include "SplitTimer.h"
+#include "ValueServer.h"
+#include "SharedValues.h"
 #include <map>
 
-constexpr UINT8 SIDEBAR_MAX_VARS_IN_BLOCK = 255;
-
 /// <summary>
 /// SidebarContent is responsible for managing the json profiles
 /// and generating the dynamic text from the Apple 2 memory
@@ -21,14 +25,25 @@ public:
 	std::string OpenProfile(std::filesystem::directory_entry entry);
 	void ClearActiveProfile(SidebarManager* sbM);
 	void UpdateAllSidebarText(SidebarManager* sbM);
-	bool UpdateBlock(SidebarManager* sbM, UINT8 sidebarId, UINT8 blockId, nlohmann::json* pdata);
+	bool UpdateBlock(SidebarManager* sbM, const CompiledBlock& block);
+	const A2VideoMode& GetVideoMode() const { return m_compiledProfile.videoMode; }
+	ValueServer* GetValueServer() { return &m_valueServer; }
+	UINT32 GetHistoryColumns(UINT16 historyId, UINT32 columns, INT32* colMin, INT32* colMax) const
+	{
+		return m_compiledProfile.GetHistoryColumns(historyId, columns, colMin, colMax);
+	}
+	UINT32 GetHistoryUpdates() const { return m_compiledProfile.GetHistoryUpdates(); }
 private:
 	void LoadProfilesFromDisk();
 	nlohmann::json ParseProfile(std::filesystem::path filepath);
-	std::string SerializeVariable(nlohmann::json* pvar);
-	std::string FormatBlockText(nlohmann::json* pdata);
 
 	std::map<std::string, nlohmann::json> m_allProfiles;
 	nlohmann::json m_activeProfile;
+	CompiledProfile m_compiledProfile;
+	TriggerEngine m_triggers;
+	AchievementEngine m_achievements;
+	SplitTimer m_splitTimer;
+	ValueServer m_valueServer;
+	SharedValues m_sharedValues;
 };
 
@@ -0,0 +1,258 @@
+#include "pch.h"
+#include "SidebarStream.h"
+#include <atomic>
+
+static UINT32 BufferSize()
+{
+	return SIDEBARSTREAM_MAX_WIDTH * SIDEBARSTREAM_MAX_HEIGHT * 4;
+}
+
+static UINT32 MappingSize()
+{
+	return static_cast<UINT32>(sizeof(SidebarStreamHeader)) + 2 * BufferSize();
+}
+
+#pragma region SidebarStream
+
+SidebarStream::SidebarStream()
+{
+	m_mapping = NULL;
+	m_header = nullptr;
+	m_running = false;
+	m_transparent = false;
+}
+
+SidebarStream::~SidebarStream()
+{
+	Close();
+}
+
+bool SidebarStream::Start(const char* name, std::string& error)
+{
+	if (m_header == nullptr)
+	{
+		m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, MappingSize(), name);
+		if ((m_mapping == NULL) || (GetLastError() == ERROR_ALREADY_EXISTS))
+		{
+			error = "couldn't create the shared memory. Is another companion running?";
+			Close();
+			return false;
+		}
+		m_header = reinterpret_cast<SidebarStreamHeader*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+		if (m_header == nullptr)
+		{
+			error = "couldn't map the shared memory";
+			Close();
+			return false;
+		}
+		// The view of a new mapping is zeroed, which is an empty image for frame 0
+		memcpy(m_header->magic, SIDEBARSTREAM_MAGIC, sizeof(m_header->magic));
+		m_header->version = SIDEBARSTREAM_VERSION;
+		m_header->size = MappingSize();
+		m_header->maxWidth = SIDEBARSTREAM_MAX_WIDTH;
+		m_header->maxHeight = SIDEBARSTREAM_MAX_HEIGHT;
+		m_header->bufferOffset[0] = sizeof(SidebarStreamHeader);
+		m_header->bufferOffset[1] = m_header->bufferOffset[0] + BufferSize();
+		m_header->bufferSize = BufferSize();
+	}
+	m_running = true;
+	Invalidate();
+	return true;
+}
+
+void SidebarStream::Stop()
+{
+	if (!m_running)
+		return;
+	m_running = false;
+	Publish(nullptr, 0, RECT{ 0, 0, 0, 0 }, 0);
+}
+
+void SidebarStream::Close()
+{
+	if (m_header)
+		UnmapViewOfFile(m_header);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	m_header = nullptr;
+	m_mapping = NULL;
+	m_running = false;
+}
+
+void SidebarStream::SetTransparent(bool transparent)
+{
+	if (transparent == m_transparent)
+		return;
+	m_transparent = transparent;
+	Invalidate();
+}
+
+// The signature is everything that changes the look of the sidebars, serialized.
+// Comparing it is much cheaper than rendering and copying the image.
+bool SidebarStream::NeedsRender(const std::vector<Sidebar>& sidebars, UINT32 historyUpdates)
+{
+	m_nextSignature.clear();
+	bool hasGraph = false;
+	for (auto& sb : sidebars)
+	{
+		INT32 layout[4] = { (INT32)sb.position.x, (INT32)sb.position.y, sb.width, sb.height };
+		m_nextSignature.append(reinterpret_cast<const char*>(layout), sizeof(layout));
+		for (auto& b : sb.blocks)
+		{
+			if (!b->visible)
+			{
+				m_nextSignature.push_back('\0');
+				continue;
+			}
+			hasGraph |= (b->type == BlockType::Graph);
+			DirectX::XMFLOAT4 color;
+			DirectX::XMStoreFloat4(&color, b->color);
+			UINT8 style[2] = { (UINT8)b->type, (UINT8)b->fontId };
+			m_nextSignature.push_back('\1');
+			m_nextSignature.append(reinterpret_cast<const char*>(style), sizeof(style));
+			m_nextSignature.append(reinterpret_cast<const char*>(&color), sizeof(color));
+			m_nextSignature.append(reinterpret_cast<const char*>(&b->position), sizeof(b->position));
+			m_nextSignature.append(b->text.c_str(), b->text.size() + 1);
+		}
+	}
+	if (hasGraph)
+		m_nextSignature.append(reinterpret_cast<const char*>(&historyUpdates), sizeof(historyUpdates));
+	if (m_nextSignature == m_signature)
+		return false;
+	m_signature.swap(m_nextSignature);
+	return true;
+}
+
+RECT SidebarStream::GetBounds(const std::vector<Sidebar>& sidebars)
+{
+	RECT r = { 0, 0, 0, 0 };
+	bool first = true;
+	for (auto& sb : sidebars)
+	{
+		// The sidebar position is inside its outside margin
+		LONG left = (LONG)sb.position.x - SIDEBAR_OUTSIDE_MARGIN;
+		LONG top = (LONG)sb.position.y - SIDEBAR_OUTSIDE_MARGIN;
+		RECT s = { left, top, left + sb.width, top + sb.height };
+		if (first)
+			r = s;
+		else
+		{
+			r.left = std::min(r.left, s.left);
+			r.top = std::min(r.top, s.top);
+			r.right = std::max(r.right, s.right);
+			r.bottom = std::max(r.bottom, s.bottom);
+		}
+		first = false;
+	}
+	r.right = std::min(r.right, r.left + (LONG)SIDEBARSTREAM_MAX_WIDTH);
+	r.bottom = std::min(r.bottom, r.top + (LONG)SIDEBARSTREAM_MAX_HEIGHT);
+	return r;
+}
+
+void SidebarStream::Publish(const UINT8* pixels, UINT32 rowPitch, const RECT& bounds, UINT16 frameSeq)
+{
+	if (m_header == nullptr)
+		return;
+	UINT32 frame = static_cast<UINT32>(m_header->frame) + 1;
+	UINT32 buffer = frame & 1;
+	SidebarStreamImage& image = m_header->images[buffer];
+	bool empty = (pixels == nullptr) || (bounds.right <= bounds.left) || (bounds.bottom <= bounds.top);
+	image.width = empty ? 0 : static_cast<UINT32>(bounds.right - bounds.left);
+	image.height = empty ? 0 : static_cast<UINT32>(bounds.bottom - bounds.top);
+	image.stride = image.width * 4;
+	image.flags = static_cast<UINT32>(m_transparent ? SidebarStreamFlags::Transparent : SidebarStreamFlags::None);
+	image.originX = bounds.left;
+	image.originY = bounds.top;
+	image.frameSeq = frameSeq;
+	UINT8* dst = reinterpret_cast<UINT8*>(m_header) + m_header->bufferOffset[buffer];
+	for (UINT32 y = 0; y < image.height; y++)
+		memcpy(dst + (size_t)y * image.stride, pixels + (size_t)y * rowPitch, image.stride);
+	// Makes the image visible before the frame, and is a full barrier
+	InterlockedExchange(&m_header->frame, static_cast<LONG>(frame));
+}
+
+#pragma endregion
+
+#pragma region SidebarStreamReader
+
+SidebarStreamReader::SidebarStreamReader()
+{
+	m_mapping = NULL;
+	m_header = nullptr;
+}
+
+SidebarStreamReader::~SidebarStreamReader()
+{
+	Close();
+}
+
+bool SidebarStreamReader::Open(std::string& error)
+{
+	Close();
+	m_mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, SIDEBARSTREAM_MMAP_NAME);
+	if (m_mapping == NULL)
+	{
+		error = "the companion isn't streaming the sidebars";
+		return false;
+	}
+	m_header = reinterpret_cast<const SidebarStreamHeader*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if ((m_header == nullptr) || (memcmp(m_header->magic, SIDEBARSTREAM_MAGIC, sizeof(SIDEBARSTREAM_MAGIC)) != 0)
+		|| (m_header->version != SIDEBARSTREAM_VERSION))
+	{
+		error = "unknown shared memory layout";
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void SidebarStreamReader::Attach(const void* base)
+{
+	Close();
+	m_header = reinterpret_cast<const SidebarStreamHeader*>(base);
+}
+
+void SidebarStreamReader::Close()
+{
+	if (m_mapping)
+	{
+		if (m_header)
+			UnmapViewOfFile(m_header);
+		CloseHandle(m_mapping);
+	}
+	m_mapping = NULL;
+	m_header = nullptr;
+}
+
+bool SidebarStreamReader::Read(SidebarStreamImage& image, std::vector<UINT8>& pixels, UINT32& frame, UINT32 maxRetries)
+{
+	if (m_header == nullptr)
+		return false;
+	const UINT8* base = reinterpret_cast<const UINT8*>(m_header);
+	UINT32 maxWidth = m_header->maxWidth;
+	UINT32 maxHeight = m_header->maxHeight;
+	for (UINT32 attempt = 0; attempt <= maxRetries; attempt++)
+	{
+		frame = static_cast<UINT32>(m_header->frame);
+		if (frame == 0)
+			return false;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		UINT32 buffer = frame & 1;
+		image = m_header->images[buffer];
+		image.width = std::min(image.width, maxWidth);
+		image.height = std::min(image.height, maxHeight);
+		image.stride = image.width * 4;
+		pixels.resize((size_t)image.stride * image.height);
+		if (!pixels.empty())
+			memcpy(pixels.data(), base + m_header->bufferOffset[buffer], pixels.size());
+		std::atomic_thread_fence(std::memory_order_acquire);
+		// A newer frame only overwrites this buffer after the next one, but both could have
+		// happened during the copy
+		if (static_cast<UINT32>(m_header->frame) == frame)
+			return true;
+		YieldProcessor();
+	}
+	return false;
+}
+
+#pragma endregion
@@ -0,0 +1,132 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "Sidebar.h"
+
+/// <summary>
+/// SidebarStream exports an image of the sidebars alone into a named shared memory, so that
+/// streaming software shows them as their own video source instead of cropping the window.
+///
+/// The image covers the bounding box of the sidebars in the base layout, at scale 1. Where the
+/// sidebars don't reach (the corner next to the video when there are a right and a bottom sidebar)
+/// it has the background. The pixels are BGRA, 8 bits per channel, with premultiplied alpha: with
+/// a transparent background everything but the text and the graphs has an alpha of 0.
+///
+/// The mapping has a SidebarStreamHeader and two image buffers. Image n is written to buffer n & 1,
+/// and frame is set to n once it is complete, so the companion never writes to the buffer of the
+/// current frame. A reader reads frame, copies the buffer and its SidebarStreamImage, and tries again
+/// if frame changed in the meantime. Polling frame alone is enough to know when there is a new image.
+///
+/// While the stream is off the current image is empty, with a width of 0.
+/// Game renders a new image only when NeedsRender() says the sidebars look different, which is when
+/// a text, a color or the layout changed, or when the histories behind the graphs moved.
+/// SidebarStreamReader is the reference reader, which the CLI uses.
+/// </summary>
+
+constexpr const char* SIDEBARSTREAM_MMAP_NAME = "AppleWinCompanionSidebars";
+constexpr char SIDEBARSTREAM_MAGIC[8] = { 'A', 'W', 'C', 'S', 'I', 'D', 'E', '\0' };
+constexpr UINT32 SIDEBARSTREAM_VERSION = 1;
+constexpr UINT32 SIDEBARSTREAM_MAX_WIDTH = 2048;	// larger sidebars are cut
+constexpr UINT32 SIDEBARSTREAM_MAX_HEIGHT = 1536;
+
+enum class SidebarStreamFlags : UINT32
+{
+	None			= 0,
+	Transparent		= 1,	// the background has an alpha of 0
+};
+
+#pragma pack(push, 4)
+struct SidebarStreamImage
+{
+	UINT32 width;				// 0 when there are no sidebars
+	UINT32 height;
+	UINT32 stride;				// bytes per row
+	UINT32 flags;				// SidebarStreamFlags
+	INT32 originX;				// position of the image in the base layout of the window
+	INT32 originY;
+	UINT32 frameSeq;			// GameLink frame sequence when rendered
+	UINT32 reserved;
+};
+
+struct SidebarStreamHeader
+{
+	char magic[8];				// SIDEBARSTREAM_MAGIC
+	UINT32 version;				// SIDEBARSTREAM_VERSION
+	UINT32 size;				// of the whole mapping
+	UINT32 maxWidth;
+	UINT32 maxHeight;
+	UINT32 bufferOffset[2];
+	UINT32 bufferSize;
+	volatile LONG frame;		// the last complete image, in buffer frame & 1. 0 before the first.
+	SidebarStreamImage images[2];
+	UINT32 reserved[4];
+};
+#pragma pack(pop)
+
+class SidebarStream
+{
+public:
+	SidebarStream();
+	~SidebarStream();
+
+	// Creates the mapping the first time. name can be null for a private mapping.
+	// The mapping stays when the stream stops, with an empty image, so that readers can stay open.
+	bool Start(const char* name, std::string& error);
+	void Stop();
+	bool IsRunning() const { return m_running; }
+	const void* GetBase() const { return m_header; }
+
+	void SetTransparent(bool transparent);
+	bool IsTransparent() const { return m_transparent; }
+
+	// Forces the next NeedsRender() to be true
+	void Invalidate() { m_signature.clear(); }
+
+	// True if the sidebars look different from the last time it returned true.
+	// historyUpdates is CompiledProfile::GetHistoryUpdates(), which only matters with graphs.
+	bool NeedsRender(const std::vector<Sidebar>& sidebars, UINT32 historyUpdates);
+
+	// The area of the base layout covered by the sidebars, cut to the maximum size. Empty without sidebars.
+	static RECT GetBounds(const std::vector<Sidebar>& sidebars);
+
+	// Copies an image into the next buffer and makes it the current frame.
+	// pixels can be null when the bounds are empty.
+	void Publish(const UINT8* pixels, UINT32 rowPitch, const RECT& bounds, UINT16 frameSeq);
+
+	UINT32 GetFrame() const { return (m_header != nullptr) ? static_cast<UINT32>(m_header->frame) : 0; }
+
+private:
+	void Close();
+
+	HANDLE m_mapping;
+	SidebarStreamHeader* m_header;
+	bool m_running;
+	bool m_transparent;
+	std::string m_signature;		// of the last image that was rendered
+	std::string m_nextSignature;
+};
+
+class SidebarStreamReader
+{
+public:
+	SidebarStreamReader();
+	~SidebarStreamReader();
+
+	// Opens the companion's mapping, which exists once the stream was started
+	bool Open(std::string& error);
+	// Reads a mapping in this process instead
+	void Attach(const void* base);
+	void Close();
+	bool IsOpen() const { return m_header != nullptr; }
+
+	// The last frame written by the companion, to poll for new images
+	UINT32 GetFrame() const { return (m_header != nullptr) ? static_cast<UINT32>(m_header->frame) : 0; }
+
+	// Copies the current image, rows of width * 4 bytes. Returns false if there is no image yet,
+	// or if the companion wrote new images during all the retries.
+	bool Read(SidebarStreamImage& image, std::vector<UINT8>& pixels, UINT32& frame, UINT32 maxRetries = 100);
+
+private:
+	HANDLE m_mapping;
+	const SidebarStreamHeader* m_header;
+};
@@ -0,0 +1,187 @@
+#include "pch.h"
+#include "SplitTimer.h"
+#include "Tracer.h"
+
+SplitTimer::SplitTimer()
+{
+	m_profile = nullptr;
+	m_stopping = false;
+	m_sourceSeq = nullptr;
+	m_sourceMem = nullptr;
+	m_sourceMemsize = 0;
+	Clear();
+}
+
+SplitTimer::~SplitTimer()
+{
+	Clear();
+}
+
+void SplitTimer::Load(const CompiledProfile* profile)
+{
+	Clear();
+	if ((profile == nullptr) || profile->splits.empty())
+		return;
+	m_profile = profile;
+	m_stopping = false;
+	m_thread = std::thread(&SplitTimer::PollThread, this);
+}
+
+void SplitTimer::Clear()
+{
+	if (m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_cv.notify_all();
+		m_thread.join();
+	}
+	m_profile = nullptr;
+	m_pointers.clear();
+	m_state = SplitTimerState::Idle;
+	m_frames = 0;
+	m_splitFrames.clear();
+	// What is already true when the profile loads isn't an edge
+	m_startWasTrue = true;
+	m_resetWasTrue = true;
+	m_segmentWasTrue = true;
+	m_started = false;
+	m_seq = 0;
+}
+
+void SplitTimer::SetSource(const volatile UINT16* seq, const UINT8* mem, int memsize)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_sourceSeq = seq;
+	m_sourceMem = mem;
+	m_sourceMemsize = memsize;
+}
+
+SplitTimerState SplitTimer::GetState() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_state;
+}
+
+UINT64 SplitTimer::GetFrames() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_frames;
+}
+
+std::vector<UINT64> SplitTimer::GetSplitFrames() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_splitFrames;
+}
+
+void SplitTimer::PollThread()
+{
+	Tracer::SetThreadName("Split timer");
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_cv.wait_for(lock, std::chrono::milliseconds(SPLIT_POLL_MS), [this] { return m_stopping; }))
+	{
+		if ((m_sourceSeq == nullptr) || (m_sourceMem == nullptr))
+			continue;
+		UINT16 seq = *m_sourceSeq;
+		if (m_started && (seq == m_seq))
+			continue;
+		m_profile->ResolvePointers(m_sourceMem, m_sourceMemsize, m_pointers);
+		Update(seq, m_sourceMem, m_sourceMemsize);
+	}
+}
+
+void SplitTimer::Update(UINT16 seq, const UINT8* mem, int memsize)
+{
+	if ((m_profile == nullptr) || (mem == nullptr))
+		return;
+	if (m_started && (seq == m_seq))
+		return;
+	// The sequence wraps, but the companion never skips 65536 frames
+	UINT16 elapsed = m_started ? static_cast<UINT16>(seq - m_seq) : 0;
+	m_started = true;
+	m_seq = seq;
+
+	if (m_state == SplitTimerState::Running)
+		m_frames += elapsed;
+
+	if (m_profile->splitResetExprId != PROFILE_NO_EXPR)
+	{
+		bool reset = m_profile->IsConditionTrue(m_profile->splitResetExprId, mem, memsize, m_pointers.data());
+		bool edge = reset && !m_resetWasTrue;
+		m_resetWasTrue = reset;
+		if (edge && (m_state != SplitTimerState::Idle))
+		{
+			m_state = SplitTimerState::Idle;
+			m_frames = 0;
+			m_splitFrames.clear();
+		}
+	}
+
+	if (m_state == SplitTimerState::Running)
+	{
+		const CompiledSplit& split = m_profile->splits[m_splitFrames.size()];
+		bool done = m_profile->IsConditionTrue(split.conditionExprId, mem, memsize, m_pointers.data());
+		bool edge = done && !m_segmentWasTrue;
+		m_segmentWasTrue = done;
+		if (edge)
+			Split();
+		return;
+	}
+
+	// Idle or finished, the start condition begins a new run
+	bool start = m_profile->IsConditionTrue(m_profile->splitStartExprId, mem, memsize, m_pointers.data());
+	bool edge = start && !m_startWasTrue;
+	m_startWasTrue = start;
+	if (!edge)
+		return;
+	m_state = SplitTimerState::Running;
+	m_frames = 0;
+	m_splitFrames.clear();
+	m_segmentWasTrue = m_profile->IsConditionTrue(m_profile->splits[0].conditionExprId, mem, memsize,
+		m_pointers.data());
+}
+
+void SplitTimer::Split()
+{
+	m_splitFrames.push_back(m_frames);
+	if (m_splitFrames.size() == m_profile->splits.size())
+	{
+		m_state = SplitTimerState::Finished;
+		return;
+	}
+	// The next segment needs its own edge
+	m_segmentWasTrue = true;
+}
+
+std::string SplitTimer::GetText() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_profile == nullptr)
+		return "";
+	switch (m_state)
+	{
+	case SplitTimerState::Idle:
+		return "Ready";
+	case SplitTimerState::Running:
+		return FormatFrames(m_frames) + "  " + m_profile->splits[m_splitFrames.size()].name;
+	case SplitTimerState::Finished:
+		return FormatFrames(m_frames) + "  Done";
+	}
+	return "";
+}
+
+std::string SplitTimer::FormatFrames(UINT64 frames)
+{
+	UINT64 hundredths = static_cast<UINT64>(frames * 100.0 / SPLIT_FRAMES_PER_SECOND);
+	UINT64 seconds = hundredths / 100;
+	char buf[40];
+	if (seconds >= 3600)
+		snprintf(buf, sizeof(buf), "%llu:%02llu:%02llu.%02llu", seconds / 3600, (seconds / 60) % 60, seconds % 60,
+			hundredths % 100);
+	else
+		snprintf(buf, sizeof(buf), "%llu:%02llu.%02llu", seconds / 60, seconds % 60, hundredths % 100);
+	return buf;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "CompiledProfile.h"
+
+/// <summary>
+/// SplitTimer is a speedrun timer driven by the splits of a compiled profile.
+///
+/// The time is counted in emulator frames, from the GameLink frame sequence, and not from the wall
+/// clock. The companion can render less often than AppleWin runs, and Update() adds the number of
+/// sequences elapsed since the previous call, so the skipped frames still count. The frames are
+/// converted with the NTSC Apple 2 frame rate, so a run plays back to the same time at any speed.
+///
+/// The conditions are evaluated by a thread that polls the GameLink frame sequence every
+/// SPLIT_POLL_MS, once per new sequence, and not by the render loop. A split is stamped at the
+/// sequence where its condition became true even when the companion renders less often, is busy,
+/// or sits in a modal loop. It can only be late when AppleWin produces frames faster than the poll.
+/// </summary>
+
+// 1.020484 MHz 6502 clock over the 17030 cycles of an NTSC frame
+constexpr double SPLIT_FRAMES_PER_SECOND = 1020484.5 / 17030.0;
+constexpr UINT32 SPLIT_POLL_MS = 1;
+
+enum class SplitTimerState
+{
+	Idle,		// waiting for the start condition
+	Running,
+	Finished,
+};
+
+class SplitTimer
+{
+public:
+	SplitTimer();
+	~SplitTimer();
+
+	// Uses the splits of the profile, which must outlive the timer or the next Load()/Clear().
+	// Starts the polling thread when the profile has splits.
+	void Load(const CompiledProfile* profile);
+	void Clear();
+
+	// The GameLink memory and frame sequence to poll, or nulls when GameLink isn't active.
+	// From the render loop, whenever GameLink may have come up or gone away.
+	void SetSource(const volatile UINT16* seq, const UINT8* mem, int memsize);
+
+	SplitTimerState GetState() const;
+	UINT64 GetFrames() const;
+	// Frames at the end of each segment done so far
+	std::vector<UINT64> GetSplitFrames() const;
+	// The running time and the next segment, for the sidebar
+	std::string GetText() const;
+
+	// M:SS.hh, or H:MM:SS.hh past an hour
+	static std::string FormatFrames(UINT64 frames);
+
+private:
+	void PollThread();
+	// Counts the frames elapsed since the last call and checks the split conditions.
+	// Calls with the same seq are ignored. With m_mutex held.
+	void Update(UINT16 seq, const UINT8* mem, int memsize);
+	void Split();
+
+	const CompiledProfile* m_profile;
+	std::vector<INT64> m_pointers;		// resolved for the polled sequence
+	SplitTimerState m_state;
+	UINT64 m_frames;
+	std::vector<UINT64> m_splitFrames;
+	bool m_startWasTrue;
+	bool m_resetWasTrue;
+	bool m_segmentWasTrue;		// of the next segment, so that only an edge splits
+	bool m_started;
+	UINT16 m_seq;
+
+	// Everything above is guarded by m_mutex once the thread runs
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stopping;
+	std::thread m_thread;
+	const volatile UINT16* m_sourceSeq;
+	const UINT8* m_sourceMem;
+	int m_sourceMemsize;
+};
@@ -0,0 +1,120 @@
+#include "pch.h"
+#include "SymbolTable.h"
+#include <fstream>
+#include <sstream>
+
+static bool IsHexDigits(const std::string& s)
+{
+	return !s.empty() && (s.size() <= 4) && (s.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos);
+}
+
+// $FDED or 0xFDED, or bare hex digits if allowBare
+static bool ParseSymbolAddress(const std::string& token, bool allowBare, UINT16& address)
+{
+	std::string digits;
+	if ((token.size() > 1) && (token[0] == '$'))
+		digits = token.substr(1);
+	else if ((token.size() > 2) && (token[0] == '0') && ((token[1] == 'x') || (token[1] == 'X')))
+		digits = token.substr(2);
+	else if (allowBare)
+		digits = token;
+	if (!IsHexDigits(digits))
+		return false;
+	address = static_cast<UINT16>(std::stoul(digits, nullptr, 16));
+	return true;
+}
+
+bool SymbolTable::Load(const std::filesystem::path& path, std::string& error)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		error = "can't open " + path.string();
+		return false;
+	}
+	m_symbols.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t comment = std::min(line.find(';'), line.find("//"));
+		if (comment != std::string::npos)
+			line.resize(comment);
+		std::vector<std::string> tokens;
+		std::istringstream ss(line);
+		std::string token;
+		while (ss >> token)
+		{
+			if ((token == "=") || (_stricmp(token.c_str(), "EQU") == 0) || (_stricmp(token.c_str(), ".EQ") == 0))
+				continue;
+			if ((token.size() > 1) && ((token.back() == ':') || (token.back() == '=')))
+				token.pop_back();
+			tokens.push_back(token);
+		}
+		if (tokens.size() < 2)
+			continue;
+
+		// A prefixed address after the name first, as names can be hex digits too (ADD = $1234)
+		Symbol sym;
+		if (ParseSymbolAddress(tokens[1], false, sym.address))
+			sym.name = tokens[0];
+		else if (ParseSymbolAddress(tokens[0], true, sym.address))
+			sym.name = tokens[1];
+		else
+			continue;
+		m_symbols.push_back(sym);
+	}
+	// The first symbol of an address wins
+	std::stable_sort(m_symbols.begin(), m_symbols.end(),
+		[](const Symbol& a, const Symbol& b) { return a.address < b.address; });
+	m_symbols.erase(std::unique(m_symbols.begin(), m_symbols.end(),
+		[](const Symbol& a, const Symbol& b) { return a.address == b.address; }), m_symbols.end());
+	if (m_symbols.empty())
+	{
+		error = "no symbols in " + path.string();
+		return false;
+	}
+	return true;
+}
+
+int SymbolTable::Find(UINT16 address) const
+{
+	auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), address,
+		[](UINT16 a, const Symbol& s) { return a < s.address; });
+	int index = static_cast<int>(it - m_symbols.begin()) - 1;
+	if ((index >= 0) && (address > GetEnd(index)))
+		return -1;
+	return index;
+}
+
+UINT16 SymbolTable::GetEnd(size_t index) const
+{
+	UINT16 end = GetRegionEnd(m_symbols[index].address);
+	if ((index + 1 < m_symbols.size()) && (m_symbols[index + 1].address <= end))
+		return m_symbols[index + 1].address - 1;
+	return end;
+}
+
+UINT32 SymbolTable::GetNextAddress(UINT16 address) const
+{
+	auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), address,
+		[](UINT16 a, const Symbol& s) { return a < s.address; });
+	return (it != m_symbols.end()) ? it->address : 0x10000;
+}
+
+const char* SymbolTable::GetRegionName(UINT16 address)
+{
+	return (address < 0xC000) ? "RAM" : ((address < 0xD000) ? "IO" : "ROM");
+}
+
+UINT16 SymbolTable::GetRegionEnd(UINT16 address)
+{
+	return (address < 0xC000) ? 0xBFFF : ((address < 0xD000) ? 0xCFFF : 0xFFFF);
+}
+
+const Symbol* SymbolTable::GetAt(UINT16 address) const
+{
+	int i = Find(address);
+	if ((i >= 0) && (m_symbols[i].address == address))
+		return &m_symbols[i];
+	return nullptr;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <filesystem>
+
+/// <summary>
+/// SymbolTable holds the 6502 symbols of a program, loaded from a symbol file.
+/// A symbol covers the addresses from its own up to the next symbol, which is how the
+/// profiler attributes samples to routines. It never covers more than its memory region,
+/// RAM up to $BFFF, the I/O space up to $CFFF and the ROM, so the last routine of a program
+/// doesn't take in the firmware.
+///
+/// The usual assembler and debugger listings are accepted, one symbol per line:
+///		FDED COUT
+///		$FDED COUT
+///		COUT = $FDED
+///		COUT EQU $FDED
+/// Anything after ; or // is a comment. Hex addresses need a $ or 0x prefix, unless the line
+/// starts with them.
+/// </summary>
+
+struct Symbol
+{
+	UINT16 address = 0;
+	std::string name;
+};
+
+class SymbolTable
+{
+public:
+	// Replaces the symbols with the ones of the file. Returns false if the file can't be read.
+	bool Load(const std::filesystem::path& path, std::string& error);
+	void Clear() { m_symbols.clear(); }
+
+	bool IsEmpty() const { return m_symbols.empty(); }
+	size_t GetCount() const { return m_symbols.size(); }
+	// Symbols sorted by address
+	const Symbol& Get(size_t index) const { return m_symbols[index]; }
+	// Index of the symbol covering the address, -1 if no symbol does
+	int Find(UINT16 address) const;
+	// Last address covered by the symbol
+	UINT16 GetEnd(size_t index) const;
+	// Address of the first symbol after address, 0x10000 if there is none
+	UINT32 GetNextAddress(UINT16 address) const;
+
+	// RAM, IO or ROM
+	static const char* GetRegionName(UINT16 address);
+	static UINT16 GetRegionEnd(UINT16 address);
+	// The symbol exactly at the address, or nullptr
+	const Symbol* GetAt(UINT16 address) const;
+
+private:
+	std::vector<Symbol> m_symbols;
+};
@@ -0,0 +1,176 @@
+#include "pch.h"
+#include "Tracer.h"
+#include "Metrics.h"
+#include <mutex>
+#include <thread>
+#include <map>
+#include <fstream>
+
+std::atomic<bool> Tracer::s_enabled = true;
+std::atomic<UINT64> Tracer::s_next = 0;
+Tracer::Slot Tracer::s_slots[TRACER_EVENT_COUNT] = {};
+
+static std::mutex s_threadNamesMutex;
+static std::vector<std::pair<UINT32, std::string>> s_threadNames;
+
+// The dump being written
+static std::mutex s_dumpMutex;
+static std::thread s_dumpThread;
+static std::atomic<bool> s_dumping = false;
+
+UINT32 Tracer::GetThreadId()
+{
+	thread_local UINT32 threadId = static_cast<UINT32>(GetCurrentThreadId());
+	return threadId;
+}
+
+void Tracer::SetThreadName(const char* name)
+{
+	UINT32 threadId = GetThreadId();
+	std::lock_guard<std::mutex> lock(s_threadNamesMutex);
+	for (auto& tn : s_threadNames)
+	{
+		if (tn.first == threadId)
+		{
+			tn.second = name;
+			return;
+		}
+	}
+	s_threadNames.emplace_back(threadId, name);
+}
+
+void Tracer::Record(const char* name, char phase)
+{
+	UINT64 index = s_next.fetch_add(1, std::memory_order_relaxed);
+	Slot& slot = s_slots[index & (TRACER_EVENT_COUNT - 1)];
+	// Seqlock: the index is cleared before the fields change, and set once they are written
+	slot.index.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.ticks.store(Metrics::GetTicks(), std::memory_order_relaxed);
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.threadId.store(GetThreadId(), std::memory_order_relaxed);
+	slot.phase.store(phase, std::memory_order_relaxed);
+	slot.index.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::Copy(std::vector<TraceEvent>& events)
+{
+	events.clear();
+	UINT64 end = s_next.load(std::memory_order_acquire);
+	UINT64 start = (end > TRACER_EVENT_COUNT) ? end - TRACER_EVENT_COUNT : 0;
+	events.reserve(static_cast<size_t>(end - start));
+	for (UINT64 i = start; i < end; i++)
+	{
+		const Slot& slot = s_slots[i & (TRACER_EVENT_COUNT - 1)];
+		if (slot.index.load(std::memory_order_acquire) != i + 1)
+			continue;		// being written, or already overwritten by a newer event
+		TraceEvent e;
+		e.ticks = slot.ticks.load(std::memory_order_relaxed);
+		e.name = slot.name.load(std::memory_order_relaxed);
+		e.threadId = slot.threadId.load(std::memory_order_relaxed);
+		e.phase = slot.phase.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.index.load(std::memory_order_relaxed) != i + 1)
+			continue;
+		events.push_back(e);
+	}
+	// Threads record in index order but can be preempted between taking the index and reading the clock
+	std::stable_sort(events.begin(), events.end(),
+		[](const TraceEvent& a, const TraceEvent& b) { return a.ticks < b.ticks; });
+}
+
+bool Tracer::Dump(const std::filesystem::path& path)
+{
+	if (s_dumping)
+		return false;
+	// The copy happens now, on the calling thread, so the trace ends here
+	auto events = std::make_shared<std::vector<TraceEvent>>();
+	Copy(*events);
+	std::vector<std::pair<UINT32, std::string>> threadNames;
+	{
+		std::lock_guard<std::mutex> lock(s_threadNamesMutex);
+		threadNames = s_threadNames;
+	}
+	std::lock_guard<std::mutex> lock(s_dumpMutex);
+	if (s_dumpThread.joinable())
+		s_dumpThread.join();
+	s_dumping = true;
+	s_dumpThread = std::thread([path, events, threadNames]
+	{
+		std::string error;
+		if (!WriteJson(path, *events, threadNames, error))
+		{
+			char buf[500];
+			snprintf(buf, 500, "Tracer: couldn't write %s: %s\n", path.string().c_str(), error.c_str());
+			OutputDebugStringA(buf);
+		}
+		s_dumping = false;
+	});
+	return true;
+}
+
+void Tracer::WaitForDump()
+{
+	std::lock_guard<std::mutex> lock(s_dumpMutex);
+	if (s_dumpThread.joinable())
+		s_dumpThread.join();
+}
+
+// {"traceEvents":[{"name":"Render","ph":"B","ts":12.345,"pid":1,"tid":2},{"ph":"E","ts":13.5,"pid":1,"tid":2},...]}
+// Timestamps are in microseconds from the oldest event.
+bool Tracer::WriteJson(const std::filesystem::path& path, const std::vector<TraceEvent>& events,
+	const std::vector<std::pair<UINT32, std::string>>& threadNames, std::string& error)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+	std::ofstream file(path, std::ios::trunc);
+	if (!file)
+	{
+		error = "can't create the file";
+		return false;
+	}
+	const UINT32 pid = static_cast<UINT32>(GetCurrentProcessId());
+	const UINT64 firstTicks = events.empty() ? 0 : events.front().ticks;
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	char buf[300];
+	bool first = true;
+	for (auto& tn : threadNames)
+	{
+		// Names are set by the code, they don't need escaping
+		snprintf(buf, sizeof(buf), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",\n", pid, tn.first, tn.second.c_str());
+		file << buf;
+		first = false;
+	}
+	std::map<UINT32, UINT32> depths;
+	for (auto& e : events)
+	{
+		UINT32& depth = depths[e.threadId];
+		if (e.phase == 'E')
+		{
+			if (depth == 0)
+				continue;
+			depth--;
+		}
+		else
+		{
+			depth++;
+		}
+		double us = Metrics::TicksToNs(e.ticks - firstTicks) / 1000.;
+		if (e.phase == 'B')
+			snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u}",
+				first ? "" : ",\n", e.name ? e.name : "?", us, pid, e.threadId);
+		else
+			snprintf(buf, sizeof(buf), "%s{\"ph\":\"E\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u}",
+				first ? "" : ",\n", us, pid, e.threadId);
+		file << buf;
+		first = false;
+	}
+	file << "\n]}\n";
+	if (!file)
+	{
+		error = "write failed";
+		return false;
+	}
+	return true;
+}
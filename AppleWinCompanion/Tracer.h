@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <string>
+#include <filesystem>
+
+/// <summary>
+/// Tracer records the begin and end of scopes, with their thread, into a ring of the last
+/// TRACER_EVENT_COUNT events, to see after the fact where a hitch came from without a debugger.
+/// Dump() writes the ring in the Chrome trace event format, which chrome://tracing and
+/// ui.perfetto.dev open.
+///
+/// The render loop has a scope at each of its PIX events, and the worker threads one per job,
+/// named with SetThreadName(). Recording takes a slot with one atomic increment and fills it,
+/// without locking, from any thread. Each slot carries the index of its event, written last, so
+/// that Dump() skips the slots that were being overwritten while it copied the ring.
+///
+/// Names must be string literals, or anything else that lives until the program ends:
+/// only the pointer is recorded. The JSON is written by a background thread.
+/// </summary>
+
+constexpr UINT32 TRACER_EVENT_COUNT = 1 << 16;		// power of 2, 32 bytes each
+constexpr char TRACER_DIRECTORY[] = "Traces";
+constexpr UINT32 TRACER_SLOW_FRAME_MS = 100;		// frames longer than this save a trace, when enabled
+constexpr UINT32 TRACER_SLOW_FRAME_INTERVAL_MS = 10000;	// at most one slow frame trace in this time
+
+struct TraceEvent
+{
+	UINT64 ticks = 0;				// Metrics::GetTicks()
+	const char* name = nullptr;		// null for the end of a scope
+	UINT32 threadId = 0;
+	char phase = 0;					// 'B' or 'E', as in the Chrome format
+};
+
+class Tracer
+{
+public:
+	// On by default
+	static void SetEnabled(bool enabled) { s_enabled.store(enabled, std::memory_order_relaxed); }
+	static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+	// Names the calling thread in the traces
+	static void SetThreadName(const char* name);
+
+	static void Begin(const char* name) { if (IsEnabled()) Record(name, 'B'); }
+	static void End() { if (IsEnabled()) Record(nullptr, 'E'); }
+
+	// Copies the ring and writes it to path in the background.
+	// Returns false if the previous dump is still being written.
+	static bool Dump(const std::filesystem::path& path);
+	// Waits for the dump being written, if any
+	static void WaitForDump();
+
+	// The complete events of the ring, oldest first
+	static void Copy(std::vector<TraceEvent>& events);
+	// Ends without a begin, from scopes that started before the oldest event, are left out
+	static bool WriteJson(const std::filesystem::path& path, const std::vector<TraceEvent>& events,
+		const std::vector<std::pair<UINT32, std::string>>& threadNames, std::string& error);
+
+private:
+	struct Slot
+	{
+		std::atomic<UINT64> index;		// of the event + 1, 0 while it is written
+		std::atomic<UINT64> ticks;
+		std::atomic<const char*> name;
+		std::atomic<UINT32> threadId;
+		std::atomic<char> phase;
+	};
+
+	static void Record(const char* name, char phase);
+	static UINT32 GetThreadId();
+
+	static std::atomic<bool> s_enabled;
+	static std::atomic<UINT64> s_next;
+	static Slot s_slots[TRACER_EVENT_COUNT];
+};
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name) { Tracer::Begin(name); }
+	~TraceScope() { Tracer::End(); }
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+};
@@ -0,0 +1,237 @@
+#include "pch.h"
+#include "TriggerEngine.h"
+#include "FrameCapture.h"
+#include "Tracer.h"
+#include <map>
+#include <fstream>
+#include <ctime>
+
+TriggerEngine::TriggerEngine()
+{
+	m_profile = nullptr;
+	m_started = false;
+	m_seq = 0;
+	m_evaluations = 0;
+	m_stopping = false;
+	m_actionsRun = 0;
+	m_actionsDropped = 0;
+}
+
+TriggerEngine::~TriggerEngine()
+{
+	Clear();
+}
+
+void TriggerEngine::Load(const CompiledProfile* profile)
+{
+	Clear();
+	if ((profile == nullptr) || profile->triggers.empty())
+		return;
+	m_profile = profile;
+	m_states.resize(profile->triggers.size());
+	m_dirty.assign(profile->triggers.size(), 0);
+
+	// Index the triggers by the pages their condition reads
+	std::map<UINT32, std::vector<UINT16>> pageTriggers;
+	std::vector<std::pair<UINT32, UINT16>> reads;
+	for (UINT16 i = 0; i < profile->triggers.size(); i++)
+	{
+		reads.clear();
+		const ProfileExpression& expr = profile->expressions[profile->triggers[i].conditionExprId];
+		if (!expr.GetFixedReads(reads))
+		{
+			m_alwaysIds.push_back(i);
+			continue;
+		}
+		for (auto& [address, length] : reads)
+		{
+			UINT32 lastPage = (address + std::max<UINT16>(length, 1) - 1) >> 8;
+			for (UINT32 page = address >> 8; page <= lastPage; page++)
+			{
+				auto& ids = pageTriggers[page];
+				if (ids.empty() || (ids.back() != i))
+					ids.push_back(i);
+			}
+		}
+	}
+	for (auto& [page, ids] : pageTriggers)
+	{
+		WatchedPage wp;
+		wp.page = page;
+		wp.triggerIds = std::move(ids);
+		m_pages.push_back(std::move(wp));
+	}
+	m_snapshots.assign(m_pages.size() * 256, 0);
+
+	m_stopping = false;
+	m_worker = std::thread(&TriggerEngine::WorkerThread, this);
+}
+
+void TriggerEngine::Clear()
+{
+	if (m_worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_cv.notify_all();
+		m_worker.join();
+	}
+	m_pending.clear();
+	m_profile = nullptr;
+	m_states.clear();
+	m_pages.clear();
+	m_snapshots.clear();
+	m_alwaysIds.clear();
+	m_dirty.clear();
+	m_started = false;
+	m_seq = 0;
+	m_evaluations = 0;
+}
+
+void TriggerEngine::Update(UINT16 seq, const UINT8* mem, int memsize)
+{
+	if ((m_profile == nullptr) || (mem == nullptr))
+		return;
+	if (m_started && (seq == m_seq))
+		return;
+	bool first = !m_started;
+	m_started = true;
+	m_seq = seq;
+
+	if (first)
+		std::fill(m_dirty.begin(), m_dirty.end(), 1);
+	for (size_t i = 0; i < m_pages.size(); i++)
+	{
+		UINT32 base = m_pages[i].page << 8;
+		if (base + 256 > static_cast<UINT32>(memsize))
+			continue;
+		UINT8* snapshot = &m_snapshots[i * 256];
+		if (!first && (memcmp(snapshot, mem + base, 256) == 0))
+			continue;
+		memcpy(snapshot, mem + base, 256);
+		for (UINT16 id : m_pages[i].triggerIds)
+			m_dirty[id] = 1;
+	}
+	for (UINT16 id : m_alwaysIds)
+		m_dirty[id] = 1;
+
+	m_evaluations = 0;
+	for (UINT16 i = 0; i < m_states.size(); i++)
+	{
+		const CompiledTrigger& trigger = m_profile->triggers[i];
+		TriggerState& st = m_states[i];
+		if (m_dirty[i])
+		{
+			m_dirty[i] = 0;
+			m_evaluations++;
+			bool condition = m_profile->IsConditionTrue(trigger.conditionExprId, mem, memsize);
+			if (condition != st.condition)
+			{
+				st.condition = condition;
+				st.heldFrames = 0;
+				// What is already true when the profile loads isn't an edge
+				st.fired = first && (trigger.mode == TriggerMode::Edge);
+			}
+		}
+		if (!st.condition)
+			continue;
+		st.heldFrames++;
+		st.sinceFired++;
+		if (st.heldFrames < trigger.debounce)
+			continue;
+		if (!st.fired || ((trigger.mode == TriggerMode::Level) && (st.sinceFired >= trigger.interval)))
+		{
+			Fire(i);
+			st.fired = true;
+			st.sinceFired = 0;
+		}
+	}
+}
+
+TriggerEngineStats TriggerEngine::GetStats() const
+{
+	TriggerEngineStats stats;
+	stats.evaluations = m_evaluations;
+	stats.actionsRun = m_actionsRun;
+	stats.actionsDropped = m_actionsDropped;
+	return stats;
+}
+
+void TriggerEngine::Fire(UINT16 triggerId)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_pending.size() >= TRIGGER_MAX_PENDING)
+		{
+			m_actionsDropped++;
+			return;
+		}
+		m_pending.push_back(triggerId);
+	}
+	m_cv.notify_one();
+}
+
+#pragma region Worker thread
+
+void TriggerEngine::WorkerThread()
+{
+	Tracer::SetThreadName("Triggers");
+	for (;;)
+	{
+		UINT16 triggerId;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this] { return m_stopping || !m_pending.empty(); });
+			if (m_stopping)
+				return;
+			triggerId = m_pending.front();
+			m_pending.pop_front();
+		}
+		// The profile can't change while the worker runs, Clear() stops it first
+		TraceScope trace("Trigger action");
+		RunAction(m_profile->triggers[triggerId]);
+		m_actionsRun++;
+	}
+}
+
+void TriggerEngine::RunAction(const CompiledTrigger& trigger)
+{
+	switch (trigger.action)
+	{
+	case TriggerActionType::Beep:
+		Beep(trigger.frequency, trigger.duration);
+		break;
+	case TriggerActionType::Log:
+	{
+		std::ofstream file(trigger.file, std::ios::app);
+		if (!file)
+		{
+			char buf[500];
+			snprintf(buf, 500, "Trigger %s can't open %s\n", trigger.name.c_str(), trigger.file.c_str());
+			OutputDebugStringA(buf);
+			break;
+		}
+		char timebuf[30];
+		time_t now = time(nullptr);
+		tm local;
+		localtime_s(&local, &now);
+		strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &local);
+		file << timebuf << "  " << trigger.message << '\n';
+		break;
+	}
+	case TriggerActionType::Screenshot:
+		// Taken by the render loop, at its next frame
+		FrameCapture::Request(trigger.videoOnly ? CaptureRequest::Video : CaptureRequest::Window);
+		break;
+	case TriggerActionType::Replay:
+		// Only saved if Tools > Instant Replay is on
+		FrameCapture::Request(CaptureRequest::Replay);
+		break;
+	default:
+		break;
+	}
+}
+
+#pragma endregion
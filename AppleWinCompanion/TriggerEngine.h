@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "CompiledProfile.h"
+
+/// <summary>
+/// TriggerEngine evaluates the triggers of a compiled profile once per GameLink frame,
+/// and runs their actions.
+///
+/// Most conditions only read fixed addresses, which are known when the profile is loaded.
+/// The engine keeps a copy of each 256 byte page such a condition reads, and only evaluates the
+/// triggers of the pages that changed since the previous frame. The others keep their last result.
+/// Conditions that read through pointers or at computed addresses are evaluated every frame.
+///
+/// The actions run on a worker thread, since beeping or writing a file can take a while.
+/// Update() only queues them, and drops them if the worker is more than TRIGGER_MAX_PENDING behind.
+/// </summary>
+
+constexpr size_t TRIGGER_MAX_PENDING = 64;
+
+struct TriggerEngineStats
+{
+	UINT32 evaluations = 0;		// in the last Update()
+	UINT32 actionsRun = 0;
+	UINT32 actionsDropped = 0;
+};
+
+class TriggerEngine
+{
+public:
+	TriggerEngine();
+	~TriggerEngine();
+
+	// Indexes the triggers of the profile, which must outlive the engine or the next Load()/Clear()
+	void Load(const CompiledProfile* profile);
+	void Clear();
+
+	// Evaluates the triggers whose input changed and queues the actions that fire.
+	// Calls with the same seq are ignored. The profile pointers must be resolved for this frame.
+	void Update(UINT16 seq, const UINT8* mem, int memsize);
+
+	TriggerEngineStats GetStats() const;
+
+private:
+	struct TriggerState
+	{
+		bool condition = false;
+		bool fired = false;			// the action ran since the condition became true
+		UINT32 heldFrames = 0;		// frames the condition has been true
+		UINT32 sinceFired = 0;		// frames since the action last ran
+	};
+	struct WatchedPage
+	{
+		UINT32 page = 0;
+		std::vector<UINT16> triggerIds;
+	};
+
+	void Fire(UINT16 triggerId);
+	void WorkerThread();
+	void RunAction(const CompiledTrigger& trigger);
+
+	const CompiledProfile* m_profile;
+	std::vector<TriggerState> m_states;
+	std::vector<WatchedPage> m_pages;
+	std::vector<UINT8> m_snapshots;			// 256 bytes per watched page
+	std::vector<UINT16> m_alwaysIds;		// triggers to evaluate every frame
+	std::vector<UINT8> m_dirty;				// per trigger, its input changed this frame
+	bool m_started;
+	UINT16 m_seq;
+	UINT32 m_evaluations;
+
+	// Triggers whose action is pending, for the worker
+	std::deque<UINT16> m_pending;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stopping;
+	std::thread m_worker;
+	std::atomic<UINT32> m_actionsRun;
+	std::atomic<UINT32> m_actionsDropped;
+};
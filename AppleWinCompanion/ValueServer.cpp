@@ -0,0 +1,515 @@
+#include "pch.h"
+#include "ValueServer.h"
+#include "Tracer.h"
+#include <ws2tcpip.h>
+
+ValueServer::ValueServer()
+{
+	m_profile = nullptr;
+	m_started = false;
+	m_seq = 0;
+	m_running = false;
+	m_wsaStarted = false;
+	m_stopping = false;
+	m_generation = 0;
+	m_sharedSeq = 0;
+	m_listen = INVALID_SOCKET;
+	m_wake = INVALID_SOCKET;
+	m_loopGeneration = 0;
+	m_loopSeq = 0;
+	m_clientCount = 0;
+	m_batchesSent = 0;
+	m_batchesDeferred = 0;
+	m_bytesSent = 0;
+}
+
+ValueServer::~ValueServer()
+{
+	Stop();
+}
+
+bool ValueServer::Start(UINT16 port, std::string& error)
+{
+	if (m_running)
+		return true;
+	// Cleans up after an event loop that stopped on an error
+	Stop();
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		error = "Winsock isn't available";
+		return false;
+	}
+	m_wsaStarted = true;
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	m_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if ((m_listen == INVALID_SOCKET)
+		|| (bind(m_listen, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR)
+		|| (listen(m_listen, SOMAXCONN) == SOCKET_ERROR))
+	{
+		error = "can't listen on port " + std::to_string(port);
+		Stop();
+		return false;
+	}
+
+	// Update() wakes the event loop with a datagram to itself
+	sockaddr_in wakeAddr = {};
+	wakeAddr.sin_family = AF_INET;
+	inet_pton(AF_INET, "127.0.0.1", &wakeAddr.sin_addr);
+	int wakeAddrLen = sizeof(wakeAddr);
+	m_wake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if ((m_wake == INVALID_SOCKET)
+		|| (bind(m_wake, reinterpret_cast<sockaddr*>(&wakeAddr), sizeof(wakeAddr)) == SOCKET_ERROR)
+		|| (getsockname(m_wake, reinterpret_cast<sockaddr*>(&wakeAddr), &wakeAddrLen) == SOCKET_ERROR)
+		|| (connect(m_wake, reinterpret_cast<sockaddr*>(&wakeAddr), sizeof(wakeAddr)) == SOCKET_ERROR))
+	{
+		error = "can't create the wake up socket";
+		Stop();
+		return false;
+	}
+	u_long nonBlocking = 1;
+	ioctlsocket(m_listen, FIONBIO, &nonBlocking);
+	ioctlsocket(m_wake, FIONBIO, &nonBlocking);
+
+	m_running = true;
+	// The values are stale, until the next Update() sends them all
+	m_started = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = false;
+		std::fill(m_sharedValues.begin(), m_sharedValues.end(), std::string());
+		std::fill(m_sharedNumbers.begin(), m_sharedNumbers.end(), 0);
+		std::fill(m_sharedValid.begin(), m_sharedValid.end(), 0);
+	}
+	m_thread = std::thread(&ValueServer::EventLoop, this);
+	return true;
+}
+
+void ValueServer::Stop()
+{
+	if (m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		Wake();
+		m_thread.join();
+	}
+	for (auto& client : m_clients)
+		closesocket(client.socket);
+	m_clients.clear();
+	m_clientCount = 0;
+	if (m_listen != INVALID_SOCKET)
+		closesocket(m_listen);
+	if (m_wake != INVALID_SOCKET)
+		closesocket(m_wake);
+	m_listen = INVALID_SOCKET;
+	m_wake = INVALID_SOCKET;
+	if (m_wsaStarted)
+		WSACleanup();
+	m_wsaStarted = false;
+	m_running = false;
+}
+
+void ValueServer::Load(const CompiledProfile* profile)
+{
+	m_profile = ((profile != nullptr) && !profile->published.empty()) ? profile : nullptr;
+	size_t count = (m_profile != nullptr) ? m_profile->published.size() : 0;
+	m_lastValues.assign(count, std::string());
+	m_lastNumbers.assign(count, 0);
+	m_lastValid.assign(count, 0);
+	m_started = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_generation++;
+		m_sharedProfileName = (m_profile != nullptr) ? m_profile->name : "";
+		m_sharedNames.clear();
+		m_sharedIsString.clear();
+		for (size_t i = 0; i < count; i++)
+		{
+			const CompiledPublished& value = m_profile->published[i];
+			m_sharedNames.push_back(value.name);
+			m_sharedIsString.push_back(value.isString);
+		}
+		m_sharedValues.assign(count, std::string());
+		m_sharedNumbers.assign(count, 0);
+		m_sharedValid.assign(count, 0);
+		m_sharedChanged.assign(count, 0);
+		m_sharedChangedIds.clear();
+	}
+	if (m_running)
+		Wake();
+}
+
+void ValueServer::Update(UINT16 seq, const UINT8* mem, int memsize)
+{
+	if (!m_running || (m_profile == nullptr) || (mem == nullptr))
+		return;
+	if (m_started && (seq == m_seq))
+		return;
+	// The first frame of a profile sends every value
+	bool first = !m_started;
+	m_started = true;
+	m_seq = seq;
+
+	m_changedIds.clear();
+	std::string value;
+	for (UINT16 i = 0; i < m_profile->published.size(); i++)
+	{
+		const CompiledPublished& published = m_profile->published[i];
+		INT32 number = 0;
+		bool valid;
+		if (published.isString)
+		{
+			valid = m_profile->EvaluatePublished(published, mem, memsize, value);
+		}
+		else
+		{
+			valid = m_profile->EvaluatePublished(published, mem, memsize, number);
+			value.clear();
+			if (!valid)
+				number = 0;
+		}
+		if (!first && (valid == (m_lastValid[i] != 0)) && (value == m_lastValues[i]) && (number == m_lastNumbers[i]))
+			continue;
+		m_lastValid[i] = valid;
+		m_lastValues[i] = value;
+		m_lastNumbers[i] = number;
+		m_changedIds.push_back(i);
+	}
+	if (m_changedIds.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (UINT16 id : m_changedIds)
+		{
+			m_sharedValues[id] = m_lastValues[id];
+			m_sharedNumbers[id] = m_lastNumbers[id];
+			m_sharedValid[id] = m_lastValid[id];
+			if (!m_sharedChanged[id])
+			{
+				m_sharedChanged[id] = 1;
+				m_sharedChangedIds.push_back(id);
+			}
+		}
+		m_sharedSeq = seq;
+	}
+	Wake();
+}
+
+ValueServerStats ValueServer::GetStats() const
+{
+	ValueServerStats stats;
+	stats.clients = m_clientCount;
+	stats.batchesSent = m_batchesSent;
+	stats.batchesDeferred = m_batchesDeferred;
+	stats.bytesSent = m_bytesSent;
+	return stats;
+}
+
+void ValueServer::Wake()
+{
+	char b = 0;
+	send(m_wake, &b, 1, 0);
+}
+
+#pragma region Event loop
+
+void ValueServer::EventLoop()
+{
+	Tracer::SetThreadName("Value server");
+	// Start with a full copy of the values
+	m_loopGeneration = m_generation - 1;
+	std::vector<WSAPOLLFD> fds;
+	for (;;)
+	{
+		// The wake up socket, the listening socket while there's room, then the clients
+		fds.clear();
+		fds.push_back({ m_wake, POLLRDNORM, 0 });
+		fds.push_back({ m_listen, static_cast<SHORT>((m_clients.size() < VALUESERVER_MAX_CLIENTS) ? POLLRDNORM : 0), 0 });
+		for (auto& client : m_clients)
+		{
+			SHORT events = POLLRDNORM;
+			if (client.outSent < client.out.size())
+				events |= POLLWRNORM;
+			fds.push_back({ client.socket, events, 0 });
+		}
+		if (WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), -1) == SOCKET_ERROR)
+		{
+			char buf[500];
+			snprintf(buf, 500, "Value server stopped, WSAPoll error %d\n", WSAGetLastError());
+			OutputDebugStringA(buf);
+			// Stop() closes the sockets
+			m_running = false;
+			return;
+		}
+		TraceScope trace("Value server");
+
+		if (fds[0].revents & POLLRDNORM)
+		{
+			char buf[64];
+			while (recv(m_wake, buf, sizeof(buf), 0) > 0)
+				;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_stopping)
+				return;
+		}
+		TakeChanges();
+
+		for (size_t i = 0; i < m_clients.size(); i++)
+		{
+			Client& client = m_clients[i];
+			SHORT revents = fds[i + 2].revents;
+			if (revents & (POLLERR | POLLHUP | POLLNVAL))
+				client.closing = true;
+			else if ((revents & POLLRDNORM) && !Receive(client))
+				client.closing = true;
+		}
+		// New clients after the others, their fds weren't polled
+		if (fds[1].revents & POLLRDNORM)
+			Accept();
+
+		for (auto& client : m_clients)
+		{
+			if (client.closing)
+				continue;
+			QueueBatch(client);
+			if (!Send(client))
+				client.closing = true;
+		}
+		for (auto it = m_clients.begin(); it != m_clients.end();)
+		{
+			if (it->closing)
+			{
+				closesocket(it->socket);
+				it = m_clients.erase(it);
+			}
+			else
+				++it;
+		}
+		m_clientCount = static_cast<UINT32>(m_clients.size());
+	}
+}
+
+// Copies what Update() and Load() left for the event loop, and marks the changed values as dirty
+void ValueServer::TakeChanges()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_loopGeneration != m_generation)
+	{
+		m_loopGeneration = m_generation;
+		m_profileName = m_sharedProfileName;
+		m_names = m_sharedNames;
+		m_isString = m_sharedIsString;
+		m_values = m_sharedValues;
+		m_numbers = m_sharedNumbers;
+		m_valid = m_sharedValid;
+		m_loopSeq = m_sharedSeq;
+		// Only the values of this profile that Update() already evaluated are sent
+		for (auto& client : m_clients)
+		{
+			SendHello(client);
+			client.subscribed.assign(m_names.size(), 0);
+			ResolveSubscriptions(client);
+			for (size_t i = 0; i < m_names.size(); i++)
+				client.dirty[i] = client.subscribed[i] & m_sharedChanged[i];
+		}
+		std::fill(m_sharedChanged.begin(), m_sharedChanged.end(), 0);
+		m_sharedChangedIds.clear();
+		return;
+	}
+	if (m_sharedChangedIds.empty())
+		return;
+	for (UINT16 id : m_sharedChangedIds)
+	{
+		m_values[id] = m_sharedValues[id];
+		m_numbers[id] = m_sharedNumbers[id];
+		m_valid[id] = m_sharedValid[id];
+		m_sharedChanged[id] = 0;
+		for (auto& client : m_clients)
+			client.dirty[id] |= client.subscribed[id];
+	}
+	m_sharedChangedIds.clear();
+	m_loopSeq = m_sharedSeq;
+}
+
+void ValueServer::Accept()
+{
+	while (m_clients.size() < VALUESERVER_MAX_CLIENTS)
+	{
+		SOCKET s = accept(m_listen, nullptr, nullptr);
+		if (s == INVALID_SOCKET)
+			return;
+		u_long nonBlocking = 1;
+		ioctlsocket(s, FIONBIO, &nonBlocking);
+		m_clients.emplace_back();
+		Client& client = m_clients.back();
+		client.socket = s;
+		SendHello(client);
+		ResolveSubscriptions(client);
+	}
+}
+
+bool ValueServer::Receive(Client& client)
+{
+	char buf[1024];
+	for (;;)
+	{
+		int n = recv(client.socket, buf, sizeof(buf), 0);
+		if (n == 0)
+			return false;
+		if (n == SOCKET_ERROR)
+			return (WSAGetLastError() == WSAEWOULDBLOCK);
+		client.in.append(buf, n);
+		size_t start = 0;
+		size_t eol;
+		while ((eol = client.in.find('\n', start)) != std::string::npos)
+		{
+			HandleRequest(client, client.in.substr(start, eol - start));
+			start = eol + 1;
+		}
+		client.in.erase(0, start);
+		if (client.in.size() > VALUESERVER_MAX_REQUEST)
+			return false;
+	}
+}
+
+void ValueServer::HandleRequest(Client& client, const std::string& line)
+{
+	if (line.find_first_not_of(" \t\r") == std::string::npos)
+		return;
+	try
+	{
+		auto j = nlohmann::json::parse(line);
+		bool subscribe = j.contains("subscribe");
+		if (!subscribe && !j.contains("unsubscribe"))
+		{
+			QueueLine(client, "{\"error\":\"expected subscribe or unsubscribe\"}");
+			return;
+		}
+		auto& names = subscribe ? j["subscribe"] : j["unsubscribe"];
+		std::vector<std::string> list;
+		if (names.is_string())
+			list.push_back(names.get<std::string>());
+		else
+			list = names.get<std::vector<std::string>>();
+		for (auto& name : list)
+		{
+			if (subscribe)
+				client.names.insert(name);
+			else if (name == "*")
+				client.names.clear();
+			else
+				client.names.erase(name);
+		}
+		ResolveSubscriptions(client);
+	}
+	catch (std::exception& e)
+	{
+		nlohmann::json error = { { "error", e.what() } };
+		QueueLine(client, error.dump());
+	}
+}
+
+void ValueServer::SendHello(Client& client)
+{
+	nlohmann::json hello = { { "profile", m_profileName }, { "values", m_names } };
+	QueueLine(client, hello.dump());
+}
+
+// Subscriptions are by name, and survive profile changes. The values that a client
+// just subscribed to are sent with the next batch.
+void ValueServer::ResolveSubscriptions(Client& client)
+{
+	bool all = (client.names.count("*") != 0);
+	client.subscribed.resize(m_names.size(), 0);
+	client.dirty.resize(m_names.size(), 0);
+	for (size_t i = 0; i < m_names.size(); i++)
+	{
+		bool subscribed = all || (client.names.count(m_names[i]) != 0);
+		if (subscribed && !client.subscribed[i])
+			client.dirty[i] = 1;
+		else if (!subscribed)
+			client.dirty[i] = 0;
+		client.subscribed[i] = subscribed;
+	}
+}
+
+void ValueServer::QueueBatch(Client& client)
+{
+	if (std::find(client.dirty.begin(), client.dirty.end(), 1) == client.dirty.end())
+		return;
+	if (client.out.size() - client.outSent >= VALUESERVER_MAX_QUEUED)
+	{
+		// The dirty values stay dirty, and will be sent with their latest value
+		m_batchesDeferred++;
+		return;
+	}
+	nlohmann::json values = nlohmann::json::object();
+	for (size_t i = 0; i < client.dirty.size(); i++)
+	{
+		if (!client.dirty[i])
+			continue;
+		client.dirty[i] = 0;
+		if (!m_valid[i])
+			values[m_names[i]] = nullptr;
+		else if (m_isString[i])
+			values[m_names[i]] = m_values[i];
+		else
+			values[m_names[i]] = m_numbers[i];
+	}
+	nlohmann::json batch = { { "seq", m_loopSeq }, { "values", values } };
+	QueueLine(client, batch.dump());
+	m_batchesSent++;
+}
+
+// Batches are bounded by QueueBatch(), this only guards against clients that flood requests without reading
+void ValueServer::QueueLine(Client& client, const std::string& line)
+{
+	if (client.out.size() - client.outSent >= 2 * VALUESERVER_MAX_QUEUED)
+	{
+		client.closing = true;
+		return;
+	}
+	if (client.outSent == client.out.size())
+	{
+		client.out.clear();
+		client.outSent = 0;
+	}
+	client.out += line;
+	client.out += '\n';
+}
+
+bool ValueServer::Send(Client& client)
+{
+	while (client.outSent < client.out.size())
+	{
+		int n = send(client.socket, client.out.data() + client.outSent,
+			static_cast<int>(std::min<size_t>(client.out.size() - client.outSent, INT_MAX)), 0);
+		if (n == SOCKET_ERROR)
+		{
+			if (WSAGetLastError() != WSAEWOULDBLOCK)
+				return false;
+			// Drop the bytes already sent, or a client that always lags a little would grow the buffer forever
+			if (client.outSent > client.out.size() / 2)
+			{
+				client.out.erase(0, client.outSent);
+				client.outSent = 0;
+			}
+			return true;
+		}
+		client.outSent += n;
+		m_bytesSent += n;
+	}
+	client.out.clear();
+	client.outSent = 0;
+	return true;
+}
+
+#pragma endregion
@@ -0,0 +1,134 @@
+#pragma once
+#include <winsock2.h>
+#include <vector>
+#include <string>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "CompiledProfile.h"
+
+/// <summary>
+/// ValueServer streams the published values of the profile to local programs over TCP,
+/// so that overlays and bots get the decoded values instead of the pixels.
+///
+/// The protocol is one json object per line. On connection, and whenever the profile changes,
+/// the server sends the names of the values:
+///		{"profile":"Nox Archaist","values":["hp","gold"]}
+/// A client subscribes to some of them, or to all of them with "*", and unsubscribes the same way:
+///		{"subscribe":["hp","gold"]}		{"unsubscribe":"*"}
+/// It then receives the current values, and afterwards only the values that changed, batched per frame:
+///		{"seq":1234,"values":{"hp":12,"gold":300}}
+/// Values that can't be read are null.
+///
+/// Update() runs in the render loop. It evaluates the values once per GameLink frame, and hands the
+/// ones that changed to the event loop thread, which owns every socket. The sockets are nonblocking
+/// and each client has at most VALUESERVER_MAX_QUEUED bytes waiting to be sent. When a client reads
+/// too slowly, its changes accumulate as a set of dirty values and go out as a single batch with the
+/// latest values once it catches up, so a slow client never stalls the companion or the other clients.
+///
+/// The server only listens on the loopback interface.
+/// </summary>
+
+constexpr UINT16 VALUESERVER_DEFAULT_PORT = 6502;
+constexpr size_t VALUESERVER_MAX_CLIENTS = 16;
+constexpr size_t VALUESERVER_MAX_QUEUED = 64 * 1024;	// bytes waiting to be sent to a client
+constexpr size_t VALUESERVER_MAX_REQUEST = 4096;		// longest request line
+
+struct ValueServerStats
+{
+	UINT32 clients = 0;
+	UINT64 batchesSent = 0;
+	UINT64 batchesDeferred = 0;		// a client had too many bytes queued, its changes were merged
+	UINT64 bytesSent = 0;
+};
+
+class ValueServer
+{
+public:
+	ValueServer();
+	~ValueServer();
+
+	bool Start(UINT16 port, std::string& error);
+	void Stop();
+	// False again if the event loop stopped on a socket error
+	bool IsRunning() const { return m_running; }
+
+	// Uses the published values of the profile, which must outlive the server or the next Load().
+	// Can be called whether the server runs or not.
+	void Load(const CompiledProfile* profile);
+
+	// Evaluates the values and sends the ones that changed. Calls with the same seq are ignored.
+	// The profile pointers must be resolved for this frame.
+	void Update(UINT16 seq, const UINT8* mem, int memsize);
+
+	ValueServerStats GetStats() const;
+
+private:
+	struct Client
+	{
+		SOCKET socket = INVALID_SOCKET;
+		std::string in;						// the incomplete request line
+		std::string out;					// bytes to send, from outSent
+		size_t outSent = 0;
+		std::set<std::string> names;		// subscribed names, "*" for all
+		std::vector<UINT8> subscribed;		// per value
+		std::vector<UINT8> dirty;			// per value, changed since last sent
+		bool closing = false;
+	};
+
+	void EventLoop();
+	void Wake();
+	void TakeChanges();
+	void Accept();
+	bool Receive(Client& client);
+	void HandleRequest(Client& client, const std::string& line);
+	void SendHello(Client& client);
+	void ResolveSubscriptions(Client& client);
+	void QueueBatch(Client& client);
+	bool Send(Client& client);
+	void QueueLine(Client& client, const std::string& line);
+
+	// Render thread
+	const CompiledProfile* m_profile;
+	std::vector<std::string> m_lastValues;	// of the string values
+	std::vector<INT32> m_lastNumbers;		// of the numeric values
+	std::vector<UINT8> m_lastValid;
+	std::vector<UINT16> m_changedIds;
+	bool m_started;
+	UINT16 m_seq;
+	std::atomic<bool> m_running;
+	bool m_wsaStarted;
+
+	// Shared with the event loop
+	std::mutex m_mutex;
+	bool m_stopping;
+	UINT32 m_generation;				// bumped when the values change names
+	std::string m_sharedProfileName;
+	std::vector<std::string> m_sharedNames;
+	std::vector<UINT8> m_sharedIsString;
+	std::vector<std::string> m_sharedValues;
+	std::vector<INT32> m_sharedNumbers;
+	std::vector<UINT8> m_sharedValid;
+	std::vector<UINT8> m_sharedChanged;
+	std::vector<UINT16> m_sharedChangedIds;
+	UINT16 m_sharedSeq;
+
+	// Event loop thread
+	std::thread m_thread;
+	SOCKET m_listen;
+	SOCKET m_wake;						// loopback UDP socket connected to itself
+	std::vector<Client> m_clients;
+	UINT32 m_loopGeneration;
+	std::string m_profileName;
+	std::vector<std::string> m_names;
+	std::vector<UINT8> m_isString;
+	std::vector<std::string> m_values;
+	std::vector<INT32> m_numbers;
+	std::vector<UINT8> m_valid;
+	UINT16 m_loopSeq;
+	std::atomic<UINT32> m_clientCount;
+	std::atomic<UINT64> m_batchesSent;
+	std::atomic<UINT64> m_batchesDeferred;
+	std::atomic<UINT64> m_bytesSent;
+};
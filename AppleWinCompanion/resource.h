@@ -12,6 +12,28 @@
 #define IDI_SMALL                       108
 #define IDC_APPLEWINCOMPANION           109
 #define IDR_MAINFRAME                   128
+#define IDD_MEMORYSEARCH                129
+#define IDC_SEARCH_TYPE                 1000
+#define IDC_SEARCH_VALUE                1001
+#define IDC_SEARCH_NEW                  1002
+#define IDC_SEARCH_EQUAL                1003
+#define IDC_SEARCH_CHANGED              1004
+#define IDC_SEARCH_UNCHANGED            1005
+#define IDC_SEARCH_INCREASED            1006
+#define IDC_SEARCH_DECREASED            1007
+#define IDC_SEARCH_STATUS               1008
+#define IDC_SEARCH_RESULTS              1009
+#define IDD_PROFILER                    130
+#define IDC_PROFILER_RUN                1010
+#define IDC_PROFILER_RESET              1011
+#define IDC_PROFILER_SYMBOLS            1012
+#define IDC_PROFILER_EXPORT             1013
+#define IDC_PROFILER_STATUS             1014
+#define IDC_PROFILER_RESULTS            1015
+#define IDD_DISASSEMBLY                 131
+#define IDC_DISASM_CMOS                 1016
+#define IDC_DISASM_STATUS               1017
+#define IDC_DISASM_LINES                1018
 #define ID_FILE_ACTIVATEPROFILE         32771
 #define ID_EMULATOR_PAUSE               32772
 #define ID_EMULATOR_RESET               32773
@@ -25,6 +47,23 @@
 #define ID_FILE_DEACTIVATEPROFILE       32781
 #define ID_VIDEO_NOSDHR                 32785
 #define ID_VIDEO_SDHR                   32786
+#define ID_TOOLS_BENCHMARKEXPRESSIONS   32787
+#define ID_TOOLS_RECORDSESSION          32788
+#define ID_TOOLS_RECORDSESSIONVIDEO     32789
+#define ID_TOOLS_MEMORYSEARCH           32790
+#define ID_TOOLS_MEMORYHEATMAP          32791
+#define ID_TOOLS_PROFILER               32792
+#define ID_TOOLS_DISASSEMBLY            32793
+#define ID_TOOLS_VALUESERVER            32794
+#define ID_TOOLS_SIDEBARSTREAM          32795
+#define ID_TOOLS_SIDEBARSTREAMTRANSPARENT 32796
+#define ID_TOOLS_SCREENSHOT             32797
+#define ID_TOOLS_SCREENSHOTVIDEO        32798
+#define ID_TOOLS_INSTANTREPLAY          32799
+#define ID_TOOLS_SAVEREPLAY             32800
+#define ID_TOOLS_FRAMETIMING            32801
+#define ID_TOOLS_SAVETRACE              32802
+#define ID_TOOLS_TRACESLOWFRAMES        32803
 #define IDC_STATIC                      -1
 
 // Next default values for new objects
@@ -32,9 +71,9 @@
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
-#define _APS_NEXT_RESOURCE_VALUE        129
-#define _APS_NEXT_COMMAND_VALUE         32787
-#define _APS_NEXT_CONTROL_VALUE         1000
+#define _APS_NEXT_RESOURCE_VALUE        132
+#define _APS_NEXT_COMMAND_VALUE         32804
+#define _APS_NEXT_CONTROL_VALUE         1019
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
 #endif
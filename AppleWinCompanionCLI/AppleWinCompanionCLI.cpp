@@ -0,0 +1,595 @@
+//
+// AppleWinCompanionCLI.cpp
+// Evaluates a profile against Apple 2 memory dumps, without AppleWin or a GPU.
+//
+
+#include "pch.h"
+#include "CompiledProfile.h"
+#include "AWSaveState.h"
+#include "SessionPlayer.h"
+#include "ValueServer.h"
+#include "SharedValues.h"
+#include "SidebarStream.h"
+#include <ws2tcpip.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/// <summary>
+/// The CLI runs the same CompiledProfile engine as the sidebars over raw memory dumps,
+/// and prints the text of every visible block of each dump, followed by timing stats.
+///
+/// A dump is the AppleWin memory as GameLink maps it: main memory, then the aux bank at 0x10000.
+/// Shorter dumps are fine, anything read past their end is treated as if GameLink was down.
+/// AppleWin save states (.aws.yaml) can be given as well, their memory is extracted by AWSaveState.
+///
+/// The dumps are spread over a pool of worker threads pulling the next dump from a shared counter.
+/// Evaluation caches per frame state (pointers, text screen), so each worker evaluates with its
+/// own copy of the compiled profile. Results are printed in the order the dumps were given.
+///
+/// With --replay, the CLI stands in for AppleWin instead and plays a recorded session into the
+/// GameLink shared memory (see SessionPlayer), for the companion to run against.
+///
+/// With --subscribe, the CLI is a client of the companion's value server (see ValueServer),
+/// and prints the values as they change. --read-values does the same from the shared memory
+/// (see SharedValues), and --bench-values measures how fast the shared memory can be written and read.
+/// --read-sidebars follows the images of the sidebar stream (see SidebarStream), and saves them as a TGA.
+/// </summary>
+
+static const char* s_usage =
+	"Usage: AppleWinCompanionCLI [options] profile.json dump|savestate|directory...\n"
+	"  -j <n>   worker threads (default: one per core)\n"
+	"  -r <n>   evaluate each dump n times, for more stable timings\n"
+	"  -q       only print the errors and the stats\n"
+	"       AppleWinCompanionCLI --replay session.awcsession [-s speed] [-f frame] [--loop]\n"
+	"  -s <x>   replay speed as a multiple of real time, 0 for as fast as possible (default: 1)\n"
+	"  -f <n>   start the replay at frame n\n"
+	"  --loop   restart at the beginning when the session ends\n"
+	"       AppleWinCompanionCLI --subscribe [-p port] [name...]\n"
+	"  -p <n>   value server port (default: 6502)\n"
+	"  name     published values to print, all of them if none\n"
+	"       AppleWinCompanionCLI --read-values [-i ms]\n"
+	"  -i <n>   polling interval of the shared memory (default: 16)\n"
+	"       AppleWinCompanionCLI --bench-values [-n values] [-t ms]\n"
+	"  -n <n>   values written every frame (default: 64)\n"
+	"  -t <n>   duration of the benchmark (default: 2000)\n"
+	"       AppleWinCompanionCLI --read-sidebars [-i ms] [-o image.tga]\n"
+	"  -i <n>   polling interval of the shared memory (default: 16)\n"
+	"  -o <f>   file the last image is saved to, whenever it changes\n";
+
+static SessionPlayer* s_player = nullptr;
+
+static BOOL WINAPI ConsoleCtrlHandler(DWORD ctrlType)
+{
+	if ((ctrlType == CTRL_C_EVENT) && s_player)
+	{
+		s_player->Stop();
+		return TRUE;
+	}
+	return FALSE;
+}
+
+struct DumpResult
+{
+	bool ok = false;
+	std::string text;		// the sidebars' text, or the error
+	double loadUs = 0.;		// reading the file
+	double evalUs = 0.;		// one evaluation of the whole profile
+};
+
+static bool ReadDump(const fs::path& path, std::vector<UINT8>& mem, std::string& error)
+{
+	if (AWSaveState::IsSaveStateFile(path))
+		return AWSaveState::LoadMemory(path, mem, error);
+	std::ifstream f(path, std::ios::binary | std::ios::ate);
+	if (!f)
+	{
+		error = "can't open the file";
+		return false;
+	}
+	std::streamoff size = f.tellg();
+	if ((size <= 0) || (size > INT32_MAX))
+	{
+		error = "empty or too large";
+		return false;
+	}
+	mem.resize(static_cast<size_t>(size));
+	f.seekg(0);
+	if (!f.read(reinterpret_cast<char*>(mem.data()), size))
+	{
+		error = "read error";
+		return false;
+	}
+	return true;
+}
+
+// Same order of operations as SidebarContent::UpdateAllSidebarText()
+static void EvaluateDump(CompiledProfile& cp, const UINT8* mem, int memsize, std::string* out)
+{
+	cp.ResolvePointers(mem, memsize);
+	cp.UpdateTextScreen(mem, memsize);
+	for (size_t i = 0; i < cp.sidebars.size(); i++)
+	{
+		const CompiledSidebar& cs = cp.sidebars[i];
+		if (out)
+		{
+			out->append(cs.type == SidebarTypes::Right ? "[right sidebar " : "[bottom sidebar ");
+			out->append(std::to_string(i));
+			out->append("]\n");
+		}
+		for (UINT8 k = 0; k < cs.blockCount; k++)
+		{
+			const CompiledBlock& cb = cp.blocks[cs.firstBlock + k];
+			if ((cb.type == BlockType::Empty) || !cp.IsBlockVisible(cb, mem, memsize))
+				continue;
+			std::string s = cp.FormatBlockText(cb, mem, memsize);
+			if (out)
+			{
+				out->append(s);
+				out->append(1, '\n');
+			}
+		}
+	}
+}
+
+static void EvaluateDumps(const CompiledProfile& compiled, const std::vector<fs::path>& dumps,
+	std::vector<DumpResult>& results, UINT32 repeat, std::atomic<size_t>& next)
+{
+	CompiledProfile cp = compiled;
+	std::vector<UINT8> mem;
+	size_t i;
+	while ((i = next.fetch_add(1)) < dumps.size())
+	{
+		DumpResult& r = results[i];
+		auto tStart = std::chrono::steady_clock::now();
+		if (!ReadDump(dumps[i], mem, r.text))
+			continue;
+		auto tLoaded = std::chrono::steady_clock::now();
+		int memsize = static_cast<int>(mem.size());
+		EvaluateDump(cp, mem.data(), memsize, &r.text);
+		for (UINT32 n = 1; n < repeat; n++)
+			EvaluateDump(cp, mem.data(), memsize, nullptr);
+		auto tEnd = std::chrono::steady_clock::now();
+		r.loadUs = std::chrono::duration<double, std::micro>(tLoaded - tStart).count();
+		r.evalUs = std::chrono::duration<double, std::micro>(tEnd - tLoaded).count() / repeat;
+		r.ok = true;
+	}
+}
+
+// Expands the directories into their files, sorted by name
+static void AddDumpPaths(const char* arg, std::vector<fs::path>& dumps)
+{
+	fs::path p(arg);
+	std::error_code ec;
+	if (!fs::is_directory(p, ec))
+	{
+		dumps.push_back(p);
+		return;
+	}
+	std::vector<fs::path> files;
+	for (const auto& entry : fs::directory_iterator(p, ec))
+	{
+		if (entry.is_regular_file())
+			files.push_back(entry.path());
+	}
+	std::sort(files.begin(), files.end());
+	dumps.insert(dumps.end(), files.begin(), files.end());
+}
+
+static double Percentile(const std::vector<double>& sorted, double pct)
+{
+	if (sorted.empty())
+		return 0.;
+	size_t i = static_cast<size_t>(pct / 100. * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(i, sorted.size() - 1)];
+}
+
+static int ReplayMain(int argc, char* argv[])
+{
+	double speed = 1.;
+	UINT32 startFrame = 0;
+	bool loop = false;
+	const char* sessionPath = nullptr;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if ((arg == "-s") && (i + 1 < argc))
+			speed = std::max(0., atof(argv[++i]));
+		else if ((arg == "-f") && (i + 1 < argc))
+			startFrame = static_cast<UINT32>(std::max(0, atoi(argv[++i])));
+		else if (arg == "--loop")
+			loop = true;
+		else if ((arg[0] != '-') && (sessionPath == nullptr))
+			sessionPath = argv[i];
+		else
+		{
+			std::cerr << s_usage;
+			return 1;
+		}
+	}
+	if (sessionPath == nullptr)
+	{
+		std::cerr << s_usage;
+		return 1;
+	}
+
+	SessionPlayer player;
+	std::string error;
+	if (!player.Open(sessionPath, error))
+	{
+		std::cerr << sessionPath << ": " << error << std::endl;
+		return 1;
+	}
+	SessionReader& reader = player.GetReader();
+	if (startFrame > 0)
+	{
+		if (!reader.Seek(startFrame))
+		{
+			std::cerr << sessionPath << ": corrupt session" << std::endl;
+			return 1;
+		}
+		player.Publish();
+	}
+	std::cout << "Replaying frames " << reader.GetFirstFrame() << " to " << reader.GetLastFrame()
+		<< (reader.HasVideo() ? " with video" : " (tracking only)") << ". Ctrl+C to stop." << std::endl;
+
+	s_player = &player;
+	SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+	SessionPlayerStats stats = player.Play(speed, loop);
+	SetConsoleCtrlHandler(ConsoleCtrlHandler, FALSE);
+	s_player = nullptr;
+
+	char buf[200];
+	snprintf(buf, sizeof(buf), "%u frames in %.2f s, %.1f frames/s\n", stats.framesPlayed, stats.seconds, stats.fps);
+	std::cout << buf;
+	return 0;
+}
+
+static int SubscribeMain(int argc, char* argv[])
+{
+	UINT16 port = VALUESERVER_DEFAULT_PORT;
+	std::vector<std::string> names;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if ((arg == "-p") && (i + 1 < argc))
+			port = static_cast<UINT16>(atoi(argv[++i]));
+		else if (arg[0] != '-')
+			names.push_back(arg);
+		else
+		{
+			std::cerr << s_usage;
+			return 1;
+		}
+	}
+
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		std::cerr << "Winsock isn't available" << std::endl;
+		return 1;
+	}
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if ((s == INVALID_SOCKET) || (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR))
+	{
+		std::cerr << "Can't connect to the value server on port " << port
+			<< ", enable it with Tools > Value Server" << std::endl;
+		WSACleanup();
+		return 1;
+	}
+	nlohmann::json request;
+	if (names.empty())
+		request["subscribe"] = "*";
+	else
+		request["subscribe"] = names;
+	std::string line = request.dump() + "\n";
+	send(s, line.data(), static_cast<int>(line.size()), 0);
+
+	// The server sends whole lines, print them as they come until it closes
+	char buf[4096];
+	int n;
+	while ((n = recv(s, buf, sizeof(buf), 0)) > 0)
+		std::cout.write(buf, n).flush();
+	closesocket(s);
+	WSACleanup();
+	return 0;
+}
+
+static void PrintSharedValue(const SharedValue& v)
+{
+	std::cout << ' ' << v.name << '=';
+	if (v.type == SharedValueType::Int)
+		std::cout << v.intValue;
+	else if (v.type == SharedValueType::String)
+		std::cout << '"' << v.stringValue << '"';
+	else
+		std::cout << '-';
+}
+
+// The reference reader: polls the shared memory and prints the values that changed
+static int ReadValuesMain(int argc, char* argv[])
+{
+	UINT32 intervalMs = 16;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if ((arg == "-i") && (i + 1 < argc))
+			intervalMs = static_cast<UINT32>(std::max(0, atoi(argv[++i])));
+		else
+		{
+			std::cerr << s_usage;
+			return 1;
+		}
+	}
+	SharedValuesReader reader;
+	std::string error;
+	if (!reader.Open(error))
+	{
+		std::cerr << "Can't read the shared values: " << error << std::endl;
+		return 1;
+	}
+	SharedValuesSnapshot snapshot;
+	UINT32 schema = 0;
+	UINT32 updates = 0;
+	for (;;)
+	{
+		if (reader.Read(snapshot))
+		{
+			bool newSchema = (snapshot.schema != schema);
+			if (newSchema)
+			{
+				std::cout << "[" << (snapshot.profileName.empty() ? "no profile" : snapshot.profileName) << "]\n";
+				schema = snapshot.schema;
+				updates = 0;
+			}
+			if (newSchema || (snapshot.updates != updates))
+			{
+				std::cout << snapshot.frameSeq << ':';
+				for (auto& v : snapshot.values)
+				{
+					if (newSchema || (v.changed > updates))
+						PrintSharedValue(v);
+				}
+				std::cout << std::endl;
+				updates = snapshot.updates;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+	}
+}
+
+// Uncompressed 32 bit TGA with its origin at the top left. TGA alpha isn't premultiplied.
+static bool WriteTga(const std::string& path, const SidebarStreamImage& image, const std::vector<UINT8>& pixels)
+{
+	UINT8 header[18] = {};
+	header[2] = 2;
+	header[12] = static_cast<UINT8>(image.width & 0xFF);
+	header[13] = static_cast<UINT8>(image.width >> 8);
+	header[14] = static_cast<UINT8>(image.height & 0xFF);
+	header[15] = static_cast<UINT8>(image.height >> 8);
+	header[16] = 32;
+	header[17] = 0x28;
+	std::vector<UINT8> straight(pixels);
+	for (size_t i = 0; i + 3 < straight.size(); i += 4)
+	{
+		UINT8 a = straight[i + 3];
+		if ((a == 0) || (a == 255))
+			continue;
+		for (size_t c = 0; c < 3; c++)
+			straight[i + c] = static_cast<UINT8>(std::min(255, (straight[i + c] * 255 + a / 2) / a));
+	}
+	std::ofstream f(path, std::ios::binary | std::ios::trunc);
+	f.write(reinterpret_cast<const char*>(header), sizeof(header));
+	f.write(reinterpret_cast<const char*>(straight.data()), straight.size());
+	return f.good();
+}
+
+static int ReadSidebarsMain(int argc, char* argv[])
+{
+	UINT32 intervalMs = 16;
+	std::string outPath;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if ((arg == "-i") && (i + 1 < argc))
+			intervalMs = static_cast<UINT32>(std::max(0, atoi(argv[++i])));
+		else if ((arg == "-o") && (i + 1 < argc))
+			outPath = argv[++i];
+		else
+		{
+			std::cerr << s_usage;
+			return 1;
+		}
+	}
+	SidebarStreamReader reader;
+	std::string error;
+	if (!reader.Open(error))
+	{
+		std::cerr << "Can't read the sidebar stream: " << error << std::endl;
+		return 1;
+	}
+	SidebarStreamImage image;
+	std::vector<UINT8> pixels;
+	UINT32 lastFrame = 0;
+	for (;;)
+	{
+		UINT32 frame = 0;
+		if ((reader.GetFrame() != lastFrame) && reader.Read(image, pixels, frame) && (frame != lastFrame))
+		{
+			lastFrame = frame;
+			std::cout << "frame " << frame << ": ";
+			if (image.width == 0)
+				std::cout << "no sidebars" << std::endl;
+			else
+			{
+				std::cout << image.width << 'x' << image.height << " at " << image.originX << ',' << image.originY
+					<< ((image.flags & static_cast<UINT32>(SidebarStreamFlags::Transparent)) ? ", transparent" : "")
+					<< ", seq " << image.frameSeq << std::endl;
+				if (!outPath.empty() && !WriteTga(outPath, image, pixels))
+					std::cerr << "Can't write " << outPath << std::endl;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+	}
+}
+
+static int BenchValuesMain(int argc, char* argv[])
+{
+	UINT32 values = 64;
+	UINT32 durationMs = 2000;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (((arg == "-n") || (arg == "-t")) && (i + 1 < argc))
+		{
+			UINT32 v = static_cast<UINT32>(std::max(1, atoi(argv[++i])));
+			(arg == "-n" ? values : durationMs) = v;
+		}
+		else
+		{
+			std::cerr << s_usage;
+			return 1;
+		}
+	}
+	SharedValuesBenchmarkResult res = SharedValues::RunBenchmark(values, durationMs);
+	char buf[500];
+	snprintf(buf, sizeof(buf),
+		"%u values, one in four a string, all changing every frame, for %.2f s\n"
+		"Writer: %llu frames, %.0f frames/s, %.0f ns per frame\n"
+		"Reader: %llu snapshots, %.0f snapshots/s, %.0f ns per snapshot, %llu retries\n",
+		res.values, res.seconds, res.writes, res.writes / std::max(res.seconds, 0.001), res.nsPerWrite,
+		res.reads, res.reads / std::max(res.seconds, 0.001), res.nsPerRead, res.retries);
+	std::cout << buf;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if ((argc > 1) && (strcmp(argv[1], "--replay") == 0))
+		return ReplayMain(argc, argv);
+	if ((argc > 1) && (strcmp(argv[1], "--subscribe") == 0))
+		return SubscribeMain(argc, argv);
+	if ((argc > 1) && (strcmp(argv[1], "--read-values") == 0))
+		return ReadValuesMain(argc, argv);
+	if ((argc > 1) && (strcmp(argv[1], "--bench-values") == 0))
+		return BenchValuesMain(argc, argv);
+	if ((argc > 1) && (strcmp(argv[1], "--read-sidebars") == 0))
+		return ReadSidebarsMain(argc, argv);
+
+	UINT32 threadCount = std::max(1u, std::thread::hardware_concurrency());
+	UINT32 repeat = 1;
+	bool quiet = false;
+	const char* profilePath = nullptr;
+	std::vector<fs::path> dumps;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (((arg == "-j") || (arg == "-r")) && (i + 1 < argc))
+		{
+			UINT32 v = static_cast<UINT32>(std::max(1, atoi(argv[++i])));
+			(arg == "-j" ? threadCount : repeat) = v;
+		}
+		else if (arg == "-q")
+			quiet = true;
+		else if ((arg[0] == '-') && (arg.size() > 1))
+		{
+			std::cerr << s_usage;
+			return 1;
+		}
+		else if (profilePath == nullptr)
+			profilePath = argv[i];
+		else
+			AddDumpPaths(argv[i], dumps);
+	}
+	if ((profilePath == nullptr) || dumps.empty())
+	{
+		std::cerr << s_usage;
+		return 1;
+	}
+
+	nlohmann::json profile;
+	try
+	{
+		std::ifstream f(profilePath);
+		f >> profile;
+	}
+	catch (nlohmann::detail::exception& e)
+	{
+		std::cerr << "Error parsing profile " << profilePath << ": " << e.what() << std::endl;
+		return 1;
+	}
+
+	CompiledProfile compiled;
+	auto tCompile = std::chrono::steady_clock::now();
+	std::string compileError;
+	if (!compiled.Compile(profile, compileError))
+	{
+		std::cerr << "Profile " << profilePath << " couldn't be compiled:\n" << compileError << std::flush;
+		return 1;
+	}
+	// The warnings, such as sidebars with too many blocks
+	if (!compileError.empty())
+		std::cerr << "Profile " << profilePath << " compiled with warnings:\n" << compileError << std::flush;
+	double compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tCompile).count();
+
+	std::vector<DumpResult> results(dumps.size());
+	std::atomic<size_t> next = 0;
+	threadCount = static_cast<UINT32>(std::min<size_t>(threadCount, dumps.size()));
+	auto tStart = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (UINT32 t = 0; t < threadCount; t++)
+		workers.emplace_back(EvaluateDumps, std::cref(compiled), std::cref(dumps), std::ref(results), repeat, std::ref(next));
+	for (auto& w : workers)
+		w.join();
+	double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+	std::vector<double> evalUs;
+	double loadUs = 0.;
+	size_t failed = 0;
+	std::ostringstream out;
+	for (size_t i = 0; i < dumps.size(); i++)
+	{
+		const DumpResult& r = results[i];
+		if (!r.ok)
+		{
+			failed++;
+			std::cerr << dumps[i].string() << ": " << r.text << std::endl;
+			continue;
+		}
+		evalUs.push_back(r.evalUs);
+		loadUs += r.loadUs;
+		if (!quiet)
+			out << "== " << dumps[i].string() << " ==\n" << r.text << "\n";
+	}
+	std::cout << out.str();
+
+	std::sort(evalUs.begin(), evalUs.end());
+	double evalTotal = 0.;
+	for (double v : evalUs)
+		evalTotal += v;
+	size_t n = std::max<size_t>(1, evalUs.size());
+	char buf[500];
+	snprintf(buf, sizeof(buf),
+		"Profile compiled in %.3f ms: %zu blocks, %zu vars, %zu expressions\n"
+		"%zu dumps (%zu failed) on %u threads in %.1f ms, %.0f dumps/s\n"
+		"Load (us):       mean %.1f\n"
+		"Evaluation (us): mean %.2f  min %.2f  p50 %.2f  p95 %.2f  p99 %.2f  max %.2f\n",
+		compileMs, compiled.blocks.size(), compiled.vars.size(), compiled.expressions.size(),
+		dumps.size(), failed, threadCount, wallMs, dumps.size() * 1000. / std::max(wallMs, 0.001),
+		loadUs / n,
+		evalTotal / n, Percentile(evalUs, 0.), Percentile(evalUs, 50.), Percentile(evalUs, 95.),
+		Percentile(evalUs, 99.), Percentile(evalUs, 100.));
+	std::cout << buf;
+	return (failed > 0 ? 2 : 0);
+}